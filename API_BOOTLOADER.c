@@ -13,23 +13,57 @@
 
 /* Typedefs ------------------------------------------------------------------*/
 bootloaderVariables_t  xBootloaderVariables;
+uartRing_t             xGSMRxRing, xWifiRxRing;
+uartTxQueue_t          xTxQueue[LINK_COUNT] = {[LINK_WIFI] = {.huart = &WIFI_UART, .frame = {"+IPD,", ':'}}, [LINK_GSM] = {.huart = &GSM_UART, .frame = {"+QIURC: \"recv\",", '\n'}}};
+traceLog_t             xTraceLog BOOTLOADER_NOINIT;
+linkQualityLog_t       xLinkQuality BOOTLOADER_NOINIT;
+
+/* Flash regions written by the bootloader must stay above its code ---------*/
+_Static_assert(METADATA_SECTOR_A_ADDRESS >= BOOTLOADER_ROM_LIMIT && METADATA_SECTOR_B_ADDRESS + METADATA_SECTOR_SIZE <= APPLICATION_ADDRESS, "metadata log overlaps the bootloader or the application");
+_Static_assert(FIRMWARE_KEY_ADDRESS >= BOOTLOADER_ROM_LIMIT && FIRMWARE_KEY_ADDRESS + 16 <= APPLICATION_ADDRESS && (FIRMWARE_KEY_ADDRESS >= METADATA_SECTOR_B_ADDRESS + METADATA_SECTOR_SIZE || FIRMWARE_KEY_ADDRESS + 16 <= METADATA_SECTOR_A_ADDRESS), "firmware key overlaps the bootloader, the metadata log or the application");
+_Static_assert(BUNDLE_CONFIG_ADDRESS >= METADATA_SECTOR_B_ADDRESS + METADATA_SECTOR_SIZE && BUNDLE_CONFIG_ADDRESS + BUNDLE_CONFIG_SIZE <= APPLICATION_ADDRESS && (FIRMWARE_KEY_ADDRESS >= BUNDLE_CONFIG_ADDRESS + BUNDLE_CONFIG_SIZE || FIRMWARE_KEY_ADDRESS + 16 <= BUNDLE_CONFIG_ADDRESS), "bundle configuration region overlaps the bootloader, the metadata log, the firmware key or the application");
+
+/* SRAM words kept over a reset must not overlap -----------------------------*/
+_Static_assert(TIMING_SUMMARY_SRAM_ADDRESS + sizeof(updateTimingSummary_t) <= BOOT_VERIFY_SRAM_ADDRESS, "timing summary overlaps the boot verification marker");
+_Static_assert(BOOT_VERIFY_SRAM_ADDRESS + sizeof(bootVerifyMarker_t) <= CONTROL_VALUE_SRAM_ADDRESS, "boot verification marker overlaps the built in bootloader trigger");
 
 /**
 * @brief This function copies the data on the storage space to the application space if its checksum bit at the end of the space is 1,
 *				 otherwise, jumps at application space if there is data on that space and its checksum bit at the end of the space is 1, showing firmware is verified
 *				 else starts normally from the boot space.
 * @note  This function should be called at very beginning of the program, such as, insert it as the first line of the function systemInit() as told in API_BOOTLOADER.h
+*				 Slot states are read from the metadata log once it has a record, the trailer approval words are the fallback.
 */
 void vBootloader(void)
 {
+	bootMetadata_t metadata;
+	
+	if (BOOTLOADER_IMAGE_END() > BOOTLOADER_ROM_LIMIT)																														/*If the bootloader grew into the sectors it writes, erasing them would erase itself*/
+	{
+		while (1);
+	}
+	
 	HAL_FLASH_Unlock();
 	
-	if((int)*(__IO uint32_t *)STORAGE_ADDRESS != -1)																										/*If there is data on the start address of the storage space*/
+	vMetadataScan(&metadata);
+	
+	if (metadata.sequence != 0)																																					/*If the metadata log is in use, it decides*/
 	{
-		if(*(__IO uint32_t *)(STORAGE_ADDRESS + MAX_APPICATION_SIZE - 4) == 1)														/*If checksum calculation bit is set*/
+		vBootFromMetadata(&metadata);
+	}
+	else if((int)BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS) != -1)																										/*If there is data on the start address of the storage space*/
+	{
+		if(BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS + MAX_APPICATION_SIZE - 4) == 1 && !bBootloaderInstallAttemptsLeft())				/*If the image failed to install BOOT_INSTALL_ATTEMPTS times since power on*/
+		{
+			return;																																													/*Storage is kept, start working as a bootloader application*/
+		}
+		else if(BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS + MAX_APPICATION_SIZE - 4) == 1 && bBootloaderVerifyImage(STORAGE_ADDRESS))	/*If checksum calculation bit is set and the image is intact*/
 		{
-			vEraseApplicationSpace();																																				/*Erase application space*/
-			vCopyStorageSpaceToApplicationSpace(APPLICATION_ADDRESS, STORAGE_ADDRESS, MAX_APPICATION_SIZE);	/*Copy storage space to app space*/
+			if (!bBootloaderInstallStorage(NULL))																																/*If the copy is broken, storage is kept to copy it again*/
+			{
+				NVIC_SystemReset();
+			}
+			
 			vEraseStorageSpace();																																						/*Erase the storage sector*/
 			vBootloaderJumpToApplication(APPLICATION_ADDRESS);																							/*Jump to the application*/
 		}
@@ -41,13 +75,13 @@ void vBootloader(void)
 	}
 	else
 	{
-		if((int)*(__IO uint32_t *)APPLICATION_ADDRESS != -1)																							/*If there is data on the start address of the application space*/
+		if((int)BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS) != -1)																							/*If there is data on the start address of the application space*/
 		{
-			if(*(__IO uint32_t*)(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4) == 1)												/*If checksum calculation bit is set*/
+			if(BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4) == 1 && bBootloaderVerifyImage(APPLICATION_ADDRESS))	/*If checksum calculation bit is set and the image is intact*/
 			{	
 				vBootloaderJumpToApplication(APPLICATION_ADDRESS);																						/*Jump to the approved application space*/
 			}
-			else																																														/*If program stopped before checksum calculation, electric cut etc.*/
+			else																																														/*If program stopped before checksum calculation, electric cut, bit rot etc.*/
 			{																																		
 				vEraseApplicationSpace();																																			/*Erase unapproved application space*/
 				NVIC_SystemReset();																																						/*Reset the system*/
@@ -83,27 +117,18 @@ void vBuiltInBootloader(void)
 */
 void vAskFirmwareVersionRequestWifi(void)
 {
-	if (WIFI_EXTERNAL_IP[0] != 0 && WIFI_STATE == WIFI_STEADY_STATE)
+	if (bBootloaderLinkUp(LINK_WIFI) && !xBootloaderVariables.wifiBootloading && !xBootloaderVariables.gsmBootloading && !xBootloaderVariables.firmwareReady)
 	{
-		if (xBootloaderVariables.triggerUpdateAtStartWifi || xBootloaderVariables.askForUpdateCounter >= PERIODIC_FW_UPDATE_TIME)
+		if (bBootloaderUpdateCheckDue(&xBootloaderVariables.triggerUpdateAtStartWifi))
 		{
-			/*Update should be requested at device start or because of the periodic update timer*/
-			if (xBootloaderVariables.triggerUpdateAtStartWifi)
-			{
-				xBootloaderVariables.triggerUpdateAtStartWifi = false;
-			} 
-			else if(xBootloaderVariables.askForUpdateCounter >= PERIODIC_FW_UPDATE_TIME)/*global timer triggers bootloader request*/
-			{
-				xBootloaderVariables.askForUpdateCounter = 250000;
-			}
-			
 			#if TFTP_BOOTLOADER_DEBUG
 			printf("Wifi is asking for update..\r\n");
 			#endif
 			
 			
-			char remoteIP[20], remoteFixedPort[20], fileName[50], connectToTCPServer[100];
-						
+			char connectToTCPServer[100];
+			uint32_t connectStart = BOOTLOADER_GET_TICK();
+			
 			HAL_FLASH_Unlock();
 			
 			clearWifiBufferAndResetItsIndex();
@@ -111,46 +136,49 @@ void vAskFirmwareVersionRequestWifi(void)
 			sprintf(connectToTCPServer, "AT+CIPSTART=%i,\"TCP\",%s,%i\r\n", WIFI_TCP_SOCKET_NO, FIRMWARE_VERSION_WEB_SERVER_ADDRESS, FIRMWARE_VERSION_WEB_SERVER_PORT);
 			
 			/*connect to the TCP - Web server*/
-			HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)connectToTCPServer, strlen(connectToTCPServer));
+			vBootloaderTxSend(LINK_WIFI, connectToTCPServer);
 						
 			if (bCheckIfResponseReceivedOnTime("CONNECT\r\n\r\nOK\r\n", WIFI_BUFFER, 15000))/*if connected*/
 			{
-				char deviceVersionNumber[5], askFirmwareURLPath[150], sendQuantity[150], closeSocket[50];
+				char deviceVersionNumber[6] = {0}, timingQuery[150] = {0}, askFirmwareURLPath[300], sendQuantity[150], closeSocket[50];
+				uint32_t rttMs = BOOTLOADER_GET_TICK() - connectStart, exchangeStart;
 				
 				clearWifiBufferAndResetItsIndex();
 				
 				
 				vGetDeviceFirmwareVersion(deviceVersionNumber);
 				
-								
+				
 				/*prepare the HTTP request to ask for update, send your version number to get if a new one*/
-				sprintf(askFirmwareURLPath, "%s%s%s", FIRMWARE_VERSION_WEB_SERVER_PATH_FIRST_PART, deviceVersionNumber, FIRMWARE_VERSION_WEB_SERVER_PATH_SECOND_PART);
+				vBootloaderTimingQuery(timingQuery);
+				
+				vPrepareFirmwareVersionRequest(askFirmwareURLPath, deviceVersionNumber, timingQuery);
 				
 				sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_TCP_SOCKET_NO, strlen(askFirmwareURLPath));
-								
 				
-				HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)sendQuantity, strlen(sendQuantity));
-				bCheckIfResponseReceivedOnTime("> ", WIFI_BUFFER, 5000);
-				clearWifiBufferAndResetItsIndex();
+				exchangeStart = BOOTLOADER_GET_TICK();
 				
+				bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, askFirmwareURLPath, strlen(askFirmwareURLPath), NULL, 0);
 				
-				HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)askFirmwareURLPath, strlen(askFirmwareURLPath));
-				bCheckIfResponseReceivedOnTime("}}", WIFI_BUFFER, 15000);
-								
+				if (bCheckIfResponseReceivedOnTime(FIRMWARE_VERSION_RESPONSE_END, WIFI_BUFFER, 15000))
+				{
+					vBootloaderLinkSample(LINK_WIFI, rttMs, strlen(askFirmwareURLPath) + WIFI_BUFFER_RECEIVE_INDEX, BOOTLOADER_GET_TICK() - exchangeStart);
+				}
+				
+				
+				/*parse the response, an empty answer on one link must not drop the offer of the other*/
+				vParseFirmwareVersionResponse(WIFI_BUFFER, &xBootloaderVariables.offers[LINK_WIFI]);
 				
-				/*parse the response*/
-				vGetSubstringBetweenTwoStrings(WIFI_BUFFER, "\"ip\":\"", "\"",   remoteIP);
-				vGetSubstringBetweenTwoStrings(WIFI_BUFFER, "\"port\":\"", "\"", remoteFixedPort);
-				vGetSubstringBetweenTwoStrings(WIFI_BUFFER, "\"file\":\"", "\"", fileName);
-								
-				if (strlen(fileName) > 0)/*if a new firmware found*/
+				xLinkQuality.links[LINK_WIFI].fileOffered = (xBootloaderVariables.offers[LINK_WIFI].fileName[0] != 0);
+				
+				if (xLinkQuality.links[LINK_WIFI].fileOffered)
 				{
-					vGetSubstringBetweenTwoStrings(WIFI_BUFFER, "rx-", "bin", xBootloaderVariables.newVersionNumber);
+					vBootloaderGetField(WIFI_BUFFER, "\"seed\":\"", "\"", xBootloaderVariables.offers[LINK_WIFI].seedIP, sizeof(xBootloaderVariables.offers[LINK_WIFI].seedIP));/*only reachable over the LAN*/
 				}
 				
 				
 				sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", WIFI_TCP_SOCKET_NO);
-				HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)closeSocket, strlen(closeSocket));/*close the socket*/
+				vBootloaderTxSend(LINK_WIFI, closeSocket);/*close the socket*/
 				bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 750);
 				clearWifiBufferAndResetItsIndex();
 				
@@ -158,9 +186,6 @@ void vAskFirmwareVersionRequestWifi(void)
 				#if TFTP_BOOTLOADER_DEBUG
 				printf("Wifi update ask request completed..\r\n");
 				#endif
-				
-				
-				vTFTPReadRequestWifi(remoteIP, remoteFixedPort, fileName);
 			}
 			else
 			{
@@ -173,896 +198,5026 @@ void vAskFirmwareVersionRequestWifi(void)
 }
 
 /**
-* @brief this function connects to the tftp server and sends a read request to the server over Wifi
-* @params char remoteIP[] 			 -> TFTP Server IP
-*					char remoteFixedPort[] -> TFTP Server Port
-*					char fileName[]				 -> name of the new firmware
+* @brief This function prepares the HTTP request asking the web server for a firmware newer than the given version
+* @param char request[]				-> the request to be sent over the web server socket
+*				 char versionNumber[] -> firmware version of the device
+*				 char query[]					-> extra query parameters starting with '&', may be empty
+* @note  Protocol builders and parsers don't touch the modems, so host tools can reuse them
 */
-void vTFTPReadRequestWifi(char remoteIP[], char remoteFixedPort[], char fileName[])
+void vPrepareFirmwareVersionRequest(char request[], char versionNumber[], char query[])
 {
-	if(remoteIP[0] != 0x00 	&& remoteFixedPort[0] != 0x00 && fileName[0] != 0x00) /*if there is a file to be requested*/
+	sprintf(request, "%s%s%s%s", FIRMWARE_VERSION_WEB_SERVER_PATH_FIRST_PART, versionNumber, query, FIRMWARE_VERSION_WEB_SERVER_PATH_SECOND_PART);
+}
+
+/**
+* @brief  This function parses a checkFirmware response into the offer of a link, the file name is left empty if nothing should be downloaded
+* @params char response[]			-> buffer holding the whole HTTP response
+*					linkOffer_t *offer	-> offer of the link the response came from, TFTP server, file name and manifest
+*/
+void vParseFirmwareVersionResponse(char response[], linkOffer_t *offer)
+{
+	memset(offer, 0, sizeof(linkOffer_t));
+	
+	vBootloaderGetField(response, "\"ip\":\"",   "\"", offer->remoteIP, sizeof(offer->remoteIP));
+	vBootloaderGetField(response, "\"port\":\"", "\"", offer->remoteFixedPort, sizeof(offer->remoteFixedPort));
+	vBootloaderGetField(response, "\"file\":\"", "\"", offer->fileName, sizeof(offer->fileName));
+	
+	if (!bBootloaderApplySchedulingHints(response) || !bBootloaderParseManifest(response, &offer->manifest))/*not in the staged rollout yet or unusable manifest*/
 	{
-		char connectToUDPServer[100];
-		
-		HAL_FLASH_Unlock();
-		
-		vEraseStorageSpace();
-		
-		vReduceWifiBaudRateTo19200();
-		
-		clearWifiBufferAndResetItsIndex();
-		
-		sprintf(connectToUDPServer, "AT+CIPSTART=%i,\"UDP\",\"%s\",%s,69,2\r\n", WIFI_UDP_SOCKET_NO, remoteIP, remoteFixedPort);
+		offer->fileName[0] = 0;
+	}
+}
+
+/**
+* @brief This function makes the offer of a link the download in progress, its TFTP server, file name, seed and manifest
+* @param bootloaderLink_t link -> link the download is started on
+*/
+void vBootloaderTakeOffer(bootloaderLink_t link)
+{
+	linkOffer_t *offer = &xBootloaderVariables.offers[link];
+	
+	strcpy(xBootloaderVariables.remoteIP, offer->remoteIP);
+	strcpy(xBootloaderVariables.remoteFixedPort, offer->remoteFixedPort);
+	strcpy(xBootloaderVariables.fileName, offer->fileName);
+	strcpy(xBootloaderVariables.seedIP, offer->seedIP);
+	
+	xBootloaderVariables.manifest = offer->manifest;
+	
+	/*if a recent update exists, web will return it as a filename*/
+	if (strlen(xBootloaderVariables.fileName) > 0)
+	{
+		vGetSubstringBetweenTwoStrings(xBootloaderVariables.fileName, "rx-", "bin", xBootloaderVariables.newVersionNumber);
+	}
+}
+
+/**
+* @brief  This function decides if a firmware version check is due and schedules the next periodic one
+* @param  bool *triggerUpdateAtStart -> pending check flag of the asking transport, cleared once served
+* @retval true if the version check should be made now
+* @note   A start-up request waits for the per device offset, so devices powered on together don't ask in the same minute.
+*					The periodic check is made on every link that is up, so each one is measured before the download link is chosen.
+*/
+bool bBootloaderUpdateCheckDue(bool *triggerUpdateAtStart)
+{
+	if (bBootloaderTimerExpired(ASK_FOR_UPDATE_TIMER))
+	{
+		vBootloaderScheduleNextCheck(PERIODIC_FW_UPDATE_RETRY_TIME, true);/*the response may override it with a backoff hint*/
 		
-		/*connect to the tftp server*/ 
-		HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)connectToUDPServer, strlen(connectToUDPServer));
+		xBootloaderVariables.triggerUpdateAtStartWifi = true;
+		xBootloaderVariables.triggerUpdateAtStartGSM  = true;
+	}
+	
+	if (*triggerUpdateAtStart && bBootloaderTimerExpired(STARTUP_CHECK_TIMER))
+	{
+		*triggerUpdateAtStart = false;
 		
-		if(bCheckIfResponseReceivedOnTime("CONNECT\r\n\r\nOK\r\n", WIFI_BUFFER, 15000))/*if connected to the tftp server*/
-		{
-			uint32_t length;
-			char tftpReadRequest[50], sendQuantity[50];
-			
-			xBootloaderVariables.wifiBootloading = true;
-			
-			clearWifiBufferAndResetItsIndex();
-			
-			/*turn access point off*/
-			HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)"AT+CWMODE=1\r\n", 	strlen("AT+CWMODE=1\r\n"));
-			bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 2500);
-			clearWifiBufferAndResetItsIndex();
-			
-			vPrepareTFTPReadRequest(tftpReadRequest, fileName, &length);
-			
-			sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_UDP_SOCKET_NO, length);
-			HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)sendQuantity, sizeof(sendQuantity));
-			bCheckIfResponseReceivedOnTime("> ", WIFI_BUFFER, 5000);
-			
-			
-			/*Send read request to the server to read the firmware*/
-			clearWifiBufferAndResetItsIndex();
-			
-			HAL_UART_Transmit_IT(&WIFI_UART, (unsigned char *)tftpReadRequest, length);
-		}
-		else/*if not connected to the tftp server*/
-		{
-			#if TFTP_BOOTLOADER_DEBUG			
-			printf("couldn't connect to TFTP server on Wifi\r\n");
-			#endif
-			
-			char closeSocket[50];
-			sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", WIFI_UDP_SOCKET_NO);
-			HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t*)closeSocket, strlen(closeSocket));
-		}
-	}	
+		return true;
+	}
+	
+	return false;
 }
 
 /**
-* @brief This function sends device firmware version to a web server using GSM. 
-*				 Web server returns a file name if the device firmware version is NOT the most recent.
+* @brief  This function tells if a link can reach the web server
+* @param  bootloaderLink_t link -> LINK_WIFI or LINK_GSM
+* @retval true if the link has an IP and its modem is steady
 */
-void vAskFirmwareVersionRequestGSM(void)
-{	
-	if (WIFI_EXTERNAL_IP[0] == 0 && GSM_EXTERNAL_IP[0] != 0 && GSM_MODULE_STATE == GSM_STEADY_STATE)
+bool bBootloaderLinkUp(bootloaderLink_t link)
+{
+	if (link == LINK_WIFI)
 	{
-		if ((xBootloaderVariables.triggerUpdateAtStartGSM || xBootloaderVariables.askForUpdateCounter >= PERIODIC_FW_UPDATE_TIME))
-		{
-			/*Update should be requested at device start or because of the periodic update timer*/
-			if (xBootloaderVariables.triggerUpdateAtStartGSM)
-			{
-				xBootloaderVariables.triggerUpdateAtStartGSM = false;
-			} 
-			else if(xBootloaderVariables.askForUpdateCounter >= PERIODIC_FW_UPDATE_TIME)/*reset the periodic requestor*/
-			{
-				xBootloaderVariables.askForUpdateCounter = 250000;
-			}
-			
-			#if TFTP_BOOTLOADER_DEBUG
-			printf("GSM is asking for update..\r\n");
-			#endif
-			
-			
-			char connectToTCPServer[100], connected[100];	
-			
-			HAL_FLASH_Unlock();
-			
-			clearGSMBufferAndResetItsIndex();
-			
-			sprintf(connectToTCPServer, "AT+QIOPEN=%i,%i,\"TCP\",%s,%i,%i,1\r\n", GSM_TCP_SOCKET_CONTEXT_ID, GSM_TCP_SOCKET_CONNECT_ID, FIRMWARE_VERSION_WEB_SERVER_ADDRESS, FIRMWARE_VERSION_WEB_SERVER_PORT, FIRMWARE_VERSION_WEB_SERVER_PORT);
-			
-			sprintf(connected, "+QIOPEN: %i,0\r\n", GSM_TCP_SOCKET_CONNECT_ID);
-			
-			/*connect to the TCP - Web server*/
-			HAL_UART_Transmit_IT(&GSM_UART, (uint8_t*)connectToTCPServer, strlen(connectToTCPServer));
-			
-			if (bCheckIfResponseReceivedOnTime(connected, GSM_BUFFER, 15000))
-			{
-				char deviceVersionNumber[5], askFirmwareVersionURLPath[150], sendQuantity[150], closeSocket[50];
-				
-				clearGSMBufferAndResetItsIndex();
-				
-				
-				vGetDeviceFirmwareVersion(deviceVersionNumber);		
-				
-				
-				/*prepare the HTTP request to ask for update, send your version number to get if a new one*/
-				sprintf(askFirmwareVersionURLPath, "%s%s%s", FIRMWARE_VERSION_WEB_SERVER_PATH_FIRST_PART, deviceVersionNumber, FIRMWARE_VERSION_WEB_SERVER_PATH_SECOND_PART);
+		return WIFI_EXTERNAL_IP[0] != 0 && WIFI_STATE == WIFI_STEADY_STATE;
+	}
+	
+	return GSM_EXTERNAL_IP[0] != 0 && GSM_MODULE_STATE == GSM_STEADY_STATE;
+}
 
-				sprintf(sendQuantity, "AT+QISEND=%i,%i\r\n", GSM_TCP_SOCKET_CONNECT_ID, strlen(askFirmwareVersionURLPath));				
-				
-				
-				HAL_UART_Transmit_IT(&GSM_UART, (uint8_t*)sendQuantity, strlen(sendQuantity));
-				bCheckIfResponseReceivedOnTime("> ", GSM_BUFFER, 5000);
-				clearGSMBufferAndResetItsIndex();
-				
-				
-				HAL_UART_Transmit_IT(&GSM_UART, (uint8_t*)askFirmwareVersionURLPath, strlen(askFirmwareVersionURLPath));
-				bCheckIfResponseReceivedOnTime("}}", GSM_BUFFER, 15000);
-				
-				
-				/*parse the response*/
-				vGetSubstringBetweenTwoStrings(GSM_BUFFER, "\"ip\":\"",   "\"", xBootloaderVariables.remoteIP);
-				vGetSubstringBetweenTwoStrings(GSM_BUFFER, "\"port\":\"", "\"", xBootloaderVariables.remoteFixedPort);
-				vGetSubstringBetweenTwoStrings(GSM_BUFFER, "\"file\":\"", "\"", xBootloaderVariables.fileName);
-				
-				/*if a recent update exists, web will return it as a filename*/
-				if (strlen(xBootloaderVariables.fileName) > 0)
-				{
-					vGetSubstringBetweenTwoStrings(GSM_BUFFER, "rx-", "bin", xBootloaderVariables.newVersionNumber);
-				}
-				
-				
-				sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_TCP_SOCKET_CONNECT_ID);
-				clearGSMBufferAndResetItsIndex();
-				HAL_UART_Transmit_IT(&GSM_UART, (uint8_t*)closeSocket, strlen(closeSocket));
-				bCheckIfResponseReceivedOnTime("OK\r\n", GSM_BUFFER, 5000);				
-				
-				
-				#if TFTP_BOOTLOADER_DEBUG
-				printf("GSM update ask request completed..\r\n");
-				#endif
+/**
+* @brief  This function folds a checkFirmware exchange into the moving averages of its link
+* @params bootloaderLink_t link	-> link the exchange was made on
+*					uint32_t rttMs				-> web server connect time
+*					uint32_t bytes				-> request and response bytes
+*					uint32_t elapsedMs		-> from sending the request to the end of the response
+*/
+void vBootloaderLinkSample(bootloaderLink_t link, uint32_t rttMs, uint32_t bytes, uint32_t elapsedMs)
+{
+	linkQuality_t *quality = &xLinkQuality.links[link];
+	uint32_t bytesPerSecond = (uint32_t)((uint64_t)bytes * 1000 / (elapsedMs ? elapsedMs : 1));
 	
-				
-				vTFTPReadRequestQuectel(xBootloaderVariables.remoteIP, xBootloaderVariables.remoteFixedPort, xBootloaderVariables.fileName);
-			}
-			else
-			{
-				#if TFTP_BOOTLOADER_DEBUG
-				printf("GSM could not connect to Web server to ask for firmware version..\r\n");
-				#endif
-			}
-		}
+	if (quality->bytesPerSecond == 0)/*first measurement*/
+	{
+		quality->rttMs          = rttMs;
+		quality->bytesPerSecond = bytesPerSecond;
 	}
+	else
+	{
+		quality->rttMs          = quality->rttMs + ((int32_t)(rttMs - quality->rttMs) >> LINK_EWMA_SHIFT);
+		quality->bytesPerSecond = quality->bytesPerSecond + ((int32_t)(bytesPerSecond - quality->bytesPerSecond) >> LINK_EWMA_SHIFT);
+	}
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Link %d: rtt %u ms, %u bytes/s\r\n", link, quality->rttMs, quality->bytesPerSecond);
+	#endif
 }
 
 /**
-* @brief  This function connects to the tftp server and sends a read request to the server over GSM
-* @params char remoteIP[] 			 -> TFTP Server IP
-*					char remoteFixedPort[] -> TFTP Server Port
-*					char fileName[]				 -> name of the new firmware
+* @brief This function folds the goodput of the ending TFTP transfer into its link, called before the reset that ends a transfer
 */
-void vTFTPReadRequestQuectel(char remoteIP[], char remoteFixedPort[], char fileName[])
+void vBootloaderLinkTransferSample(void)
 {
-	if(remoteIP[0] != 0x00 && remoteFixedPort[0] != 0x00 && fileName[0] != 0x00)
+	uint32_t bytes = xBootloaderVariables.manifest.present ? xBootloaderVariables.receivedImageLength : xBootloaderVariables.applicationStoredAddressEnd - xBootloaderVariables.applicationStoredAddressStart;
+	
+	if ((!xBootloaderVariables.wifiBootloading && !xBootloaderVariables.gsmBootloading) || xBootloaderVariables.seedIP[0] != 0)/*a multipath download samples each link itself, LAN goodput says nothing of the link*/
 	{
-		char connectToUDPServer[100], connected[50];
-		
-		HAL_FLASH_Unlock();
-		
-		vEraseStorageSpace();
-				
-		clearGSMBufferAndResetItsIndex();
-				
-		sprintf(connectToUDPServer, "AT+QIOPEN=%i,%i,\"UDP SERVICE\",\"%s\",%s,69,1\r\n", GSM_UDP_SOCKET_CONTEXT_ID, GSM_UDP_SOCKET_CONNECT_ID, remoteIP, remoteFixedPort);
-		
-		/*connect to the UDP - TFTP server*/
-		HAL_UART_Transmit_IT(&GSM_UART, (uint8_t *)connectToUDPServer, strlen(connectToUDPServer));
-		
-		sprintf(connected, "+QIOPEN: %i,0\r\n", GSM_UDP_SOCKET_CONNECT_ID);
-		
-		if (bCheckIfResponseReceivedOnTime(connected, GSM_BUFFER, 15000))
-		{
-			uint32_t length;
-			
-			char tftpReadRequest[50], sendQuantity[50];
-			
-			xBootloaderVariables.gsmBootloading = true;
-			
-			
-			/*turn the access point off*/
-			HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)"AT+CWMODE=1\r\n", 	strlen("AT+CWMODE=1\r\n"));
-			bCheckIfResponseReceivedOnTime("OK\r\n", GSM_BUFFER, 2500);
-			clearWifiBufferAndResetItsIndex();	
-			
-			
-			vPrepareTFTPReadRequest(tftpReadRequest, fileName, &length);
-			
-			
-			sprintf(sendQuantity, "AT+QISEND=%i,%i,\"%s\",%s\r\n", GSM_UDP_SOCKET_CONNECT_ID, length, remoteIP, remoteFixedPort);
-			HAL_UART_Transmit_IT(&GSM_UART, (uint8_t *)sendQuantity, strlen(sendQuantity));
-			bCheckIfResponseReceivedOnTime("> ", GSM_BUFFER, 100);
-			clearGSMBufferAndResetItsIndex();
-			
-			
-			/*send the read request to the server*/
-			HAL_UART_Transmit_IT(&GSM_UART, (unsigned char *)tftpReadRequest, length);
-						
-			xBootloaderVariables.solvePort = 1;
+		return;
+	}
+	
+	vBootloaderLinkGoodputSample(eBootloaderActiveLink(), bytes, BOOTLOADER_GET_TICK() - xBootloaderVariables.timing.transferStartTick);
+}
 
-			xBootloaderVariables.startGSMTimeout = true;
-		}
-		else /*if not able to connect to server*/
-		{
-			#if TFTP_BOOTLOADER_DEBUG
-			printf("Couldn't connect to TFTP server on GSM\r\n");
-			#endif	
-			
-			char closeSocket[50];
-			sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_TCP_SOCKET_CONNECT_ID);
-			HAL_UART_Transmit_IT(&GSM_UART, (uint8_t*)closeSocket, strlen(closeSocket));
-			clearGSMBufferAndResetItsIndex();
-		}
+/**
+* @brief  This function folds a download goodput into the moving average of a link
+* @params bootloaderLink_t link	-> link the bytes were downloaded on
+*					uint32_t bytes				-> downloaded bytes
+*					uint32_t elapsedMs		-> time the download took
+*/
+void vBootloaderLinkGoodputSample(bootloaderLink_t link, uint32_t bytes, uint32_t elapsedMs)
+{
+	linkQuality_t *quality = &xLinkQuality.links[link];
+	uint32_t bytesPerSecond;
+	
+	if (bytes == 0 || elapsedMs == 0)
+	{
+		return;
 	}
+	
+	bytesPerSecond = (uint32_t)((uint64_t)bytes * 1000 / elapsedMs);
+	
+	quality->transferBytesPerSecond = quality->transferBytesPerSecond ? quality->transferBytesPerSecond + ((int32_t)(bytesPerSecond - quality->transferBytesPerSecond) >> LINK_EWMA_SHIFT) : bytesPerSecond;
 }
 
 /**
-* @brief This function parses incoming GSM buffer as the tftp data
+* @brief  This function tells the link of the running TFTP transfer
+* @retval LINK_WIFI or LINK_GSM
 */
-void vBootloaderQuectelEngage(void)
+bootloaderLink_t eBootloaderActiveLink(void)
 {
-	/*if 10 msecs past from the last arrival data, means gsm responded*/
-	if(GSM_TIME_PASSED_FROM_LAST_BYTE_RECEIVED >= 10 && GSM_BUFFER_RECEIVE_INDEX > 0)
-	{		
-		if (xBootloaderVariables.solvePort == 1)/*this is the first state supposed to resolve the port of the incoming data*/
-		{
-			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
-			{
-				if (GSM_BUFFER[i]   == 0x72 
-				 && GSM_BUFFER[i+1] == 0x65 
-				 && GSM_BUFFER[i+2] == 0x63 
+	return xBootloaderVariables.wifiBootloading ? LINK_WIFI : LINK_GSM;
+}
+
+/**
+* @brief  This function projects the download time of an image on a link, scaled by the cost of the link
+* @params bootloaderLink_t link	 -> link to be projected
+*					uint32_t imageLength	 -> bytes to be downloaded
+* @retval weighted ms, 0xFFFFFFFF if the link was never measured
+* @note   Measured TFTP goodput is used once known, before that every 512 bytes block costs a round trip on top of the
+*					checkFirmware goodput, as TFTP waits for each acknowledge
+*/
+uint32_t ulBootloaderProjectedTime(bootloaderLink_t link, uint32_t imageLength)
+{
+	linkQuality_t *quality = &xLinkQuality.links[link];
+	uint64_t projected;
+	
+	if (quality->transferBytesPerSecond != 0)
+	{
+		projected = (uint64_t)imageLength * 1000 / quality->transferBytesPerSecond;
+	}
+	else if (quality->bytesPerSecond != 0)
+	{
+		projected = (uint64_t)(imageLength / 512 + 1) * quality->rttMs + (uint64_t)imageLength * 1000 / quality->bytesPerSecond;
+	}
+	else
+	{
+		return 0xFFFFFFFF;
+	}
+	
+	if (link == LINK_GSM)
+	{
+		projected = projected * GSM_DATA_COST_WEIGHT / 100;
+	}
+	
+	return (projected < 0xFFFFFFFF) ? (uint32_t)projected : 0xFFFFFFFE;
+}
+
+/**
+* @brief This function starts the offered download on the link projected to finish fastest and cheapest,
+*				 once every link that is up has answered its version check
+*/
+void vBootloaderStartDownloadOnBestLink(void)
+{
+	linkOffer_t *offers = xBootloaderVariables.offers;
+	uint32_t imageLength[LINK_COUNT];
+	bootloaderLink_t best = LINK_COUNT;
+	
+	if (xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading || (!xLinkQuality.links[LINK_WIFI].fileOffered && !xLinkQuality.links[LINK_GSM].fileOffered))
+	{
+		return;
+	}
+	
+	if ((xBootloaderVariables.triggerUpdateAtStartWifi && bBootloaderLinkUp(LINK_WIFI)) || (xBootloaderVariables.triggerUpdateAtStartGSM && bBootloaderLinkUp(LINK_GSM)))
+	{
+		return;/*a link is still to be measured*/
+	}
+	
+	for (int i = 0; i < LINK_COUNT; i++)
+	{
+		imageLength[i] = offers[i].manifest.present ? offers[i].manifest.imageLength : MAX_APPICATION_SIZE / 2;
+	}
+	
+	if (offers[LINK_WIFI].seedIP[0] != 0 && offers[LINK_WIFI].manifest.present && xLinkQuality.links[LINK_WIFI].fileOffered && bBootloaderLinkUp(LINK_WIFI))
+	{
+		xLinkQuality.links[LINK_WIFI].fileOffered = false;
+		xLinkQuality.links[LINK_GSM].fileOffered  = false;
+		
+		vBootloaderTakeOffer(LINK_WIFI);
+		vBootloaderSeedDownload();/*returns once the image is ready, or falls back to the TFTP server*/
+		
+		return;
+	}
+	
+	#if BOOTLOADER_MULTIPATH
+	if (offers[LINK_WIFI].manifest.present && imageLength[LINK_WIFI] >= MULTIPATH_MIN_IMAGE_SIZE && xLinkQuality.links[LINK_WIFI].fileOffered && xLinkQuality.links[LINK_GSM].fileOffered &&
+		  bBootloaderLinkUp(LINK_WIFI) && bBootloaderLinkUp(LINK_GSM) &&
+		  strcmp(offers[LINK_WIFI].fileName, offers[LINK_GSM].fileName) == 0 && offers[LINK_GSM].manifest.present && offers[LINK_WIFI].manifest.imageCRC == offers[LINK_GSM].manifest.imageCRC)/*both links offer the same image*/
+	{
+		xLinkQuality.links[LINK_WIFI].fileOffered = false;
+		xLinkQuality.links[LINK_GSM].fileOffered  = false;
+		
+		vBootloaderTakeOffer(LINK_WIFI);
+		vBootloaderMultipathDownload();/*returns once the image is ready*/
+		
+		return;
+	}
+	#endif
+	
+	for (int i = 0; i < LINK_COUNT; i++)
+	{
+		if (xLinkQuality.links[i].fileOffered && bBootloaderLinkUp((bootloaderLink_t)i) &&
+			 (best == LINK_COUNT || ulBootloaderProjectedTime((bootloaderLink_t)i, imageLength[i]) < ulBootloaderProjectedTime(best, imageLength[best])))
+		{
+			best = (bootloaderLink_t)i;
+		}
+		
+		xLinkQuality.links[i].fileOffered = false;
+	}
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Download link %d, projected Wifi %u ms, GSM %u ms\r\n", best, ulBootloaderProjectedTime(LINK_WIFI, imageLength[LINK_WIFI]), ulBootloaderProjectedTime(LINK_GSM, imageLength[LINK_GSM]));
+	#endif
+	
+	if (best != LINK_COUNT)
+	{
+		vBootloaderTakeOffer(best);
+	}
+	
+	if (best == LINK_WIFI)
+	{
+		vTFTPReadRequestWifi(xBootloaderVariables.remoteIP, xBootloaderVariables.remoteFixedPort, xBootloaderVariables.fileName);
+	}
+	else if (best == LINK_GSM)
+	{
+		vTFTPReadRequestQuectel(xBootloaderVariables.remoteIP, xBootloaderVariables.remoteFixedPort, xBootloaderVariables.fileName);
+	}
+}
+
+/**
+* @brief  This function arms the periodic version check timer
+* @params uint32_t earliest -> ms from now before which the check must not be made
+*					bool jitter				-> true to add a random delay of up to UPDATE_CHECK_JITTER on top, false to keep a server backoff exact
+*/
+void vBootloaderScheduleNextCheck(uint32_t earliest, bool jitter)
+{
+	vBootloaderTimerStart(ASK_FOR_UPDATE_TIMER, earliest + (jitter ? ulBootloaderRandom() % UPDATE_CHECK_JITTER : 0));
+}
+
+/**
+* @brief  This function copies the text between two strings of a response into a buffer of a known size
+* @params const char response[] -> buffer holding the whole HTTP response
+*					const char start[]		-> text before the field
+*					const char end[]			-> text after the field
+*					char value[]					-> buffer to be filled, left empty if the field is missing or does not fit
+*					uint32_t size					-> size of the buffer
+*/
+void vBootloaderGetField(const char response[], const char start[], const char end[], char value[], uint32_t size)
+{
+	const char *first = strstr(response, start), *last;
+	
+	value[0] = 0;
+	
+	if (first == NULL || (last = strstr(first + strlen(start), end)) == NULL)
+	{
+		return;
+	}
+	
+	first += strlen(start);
+	
+	if ((uint32_t)(last - first) < size)
+	{
+		memcpy(value, first, last - first);
+		
+		value[last - first] = 0;
+	}
+}
+
+/**
+* @brief  This function applies the backoff and staged rollout hints of a checkFirmware response
+* @param  char response[] -> buffer holding the whole HTTP response
+* @retval true if this device is inside the rollout percentage, false if it should not download yet
+* @note   Backoff is read from the "Retry-After" header or the "retryAfter" field in seconds and replaces the jittered
+*					periodic check. A value which is not a number of seconds, like an HTTP-date, keeps the default backoff.
+*					Rollout is read from the "rollout" field in percent, a missing field means 100%
+*/
+bool bBootloaderApplySchedulingHints(char response[])
+{
+	char retryAfter[12], rollout[5], *end;
+	
+	vBootloaderGetField(response, "Retry-After: ", "\r\n", retryAfter, sizeof(retryAfter));
+	
+	if (retryAfter[0] == 0)
+	{
+		vBootloaderGetField(response, "\"retryAfter\":\"", "\"", retryAfter, sizeof(retryAfter));
+	}
+	
+	if (retryAfter[0] >= '0' && retryAfter[0] <= '9')
+	{
+		uint32_t seconds = strtoul(retryAfter, &end, 10);
+		
+		if (*end == 0)
+		{
+			if (seconds > UPDATE_CHECK_MAX_RETRY_AFTER)
+			{
+				seconds = UPDATE_CHECK_MAX_RETRY_AFTER;
+			}
+			
+			vBootloaderScheduleNextCheck(seconds * 1000, false);
+			
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Server asked to retry after %u s\r\n", seconds);
+			#endif
+		}
+	}
+	
+	vBootloaderGetField(response, "\"rollout\":\"", "\"", rollout, sizeof(rollout));
+	
+	if (rollout[0] != 0 && xBootloaderVariables.rolloutBucket >= atoi(rollout))
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Device bucket %d is out of the %s%% rollout\r\n", xBootloaderVariables.rolloutBucket, rollout);
+		#endif
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function reads a number field of the firmware manifest
+* @params const char response[] -> buffer holding the whole HTTP response
+*					const char start[]		-> text before the field
+*					int base							-> 10 or 16
+*					uint32_t *value				-> number read, 0 if the field can't be read
+* @retval false if the field is missing, empty or too long for a 32 bit number
+*/
+bool bBootloaderManifestNumber(const char response[], const char start[], int base, uint32_t *value)
+{
+	char field[12];
+	
+	vBootloaderGetField(response, start, "\"", field, sizeof(field));
+	
+	*value = strtoul(field, NULL, base);
+	
+	return field[0] != 0;
+}
+
+/**
+* @brief  This function reads the firmware manifest of a checkFirmware response
+* @params char response[]							-> buffer holding the whole HTTP response
+*					firmwareManifest_t *manifest	-> offer of the link the response came from, to be filled
+* @retval false if a manifest is given but can not be used, true otherwise
+* @note   Fields are "length" in bytes, "crc" as the CRC32 of the whole image, "chunkSize", "chunks" as comma separated
+*					hexadecimal CRC32s of every FIRMWARE_CHUNK_SIZE bytes and "format" flags. Without "length" the CRC32 is expected
+*					at the end of the last TFTP block as before. "signature" and "iv" of an encrypted image are read with or without the other fields.
+*					With "length", a missing "crc" or "chunkSize" or a field too long for its number rejects the manifest, a missing
+*					"format" means no flags.
+*/
+bool bBootloaderParseManifest(char response[], firmwareManifest_t *manifest)
+{
+	uint32_t chunkSize;
+	char *chunks;
+	
+	manifest->present = false;
+	
+	char *signature = strstr(response, "\"signature\":\"");
+	
+	manifest->signaturePresent = (signature != NULL && bBootloaderHexToBytes(signature + strlen("\"signature\":\""), manifest->signature, FIRMWARE_SIGNATURE_SIZE));
+	
+	char *iv = strstr(response, "\"iv\":\"");
+	
+	manifest->encrypted = (iv != NULL);
+	
+	if (manifest->encrypted && (!BOOTLOADER_DECRYPTION || !bBootloaderHexToBytes(iv + strlen("\"iv\":\""), manifest->iv, sizeof(manifest->iv))))
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Manifest rejected: image is encrypted\r\n");
+		#endif
+		
+		return false;
+	}
+	
+	if (strstr(response, "\"length\":\"") == NULL)
+	{
+		return true;
+	}
+	
+	manifest->formatFlags = 0;
+	
+	if (!bBootloaderManifestNumber(response, "\"length\":\"", 10, &manifest->imageLength) || !bBootloaderManifestNumber(response, "\"crc\":\"", 16, &manifest->imageCRC) ||
+			!bBootloaderManifestNumber(response, "\"chunkSize\":\"", 10, &chunkSize) || (strstr(response, "\"format\":\"") != NULL && !bBootloaderManifestNumber(response, "\"format\":\"", 16, &manifest->formatFlags)))
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Manifest rejected: a field is missing or too long\r\n");
+		#endif
+		
+		return false;
+	}
+	
+	manifest->chunkCount = (manifest->imageLength + FIRMWARE_CHUNK_SIZE - 1) / FIRMWARE_CHUNK_SIZE;
+	
+	if (manifest->imageLength == 0 || manifest->imageLength > MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE)/*would not fit in the slot, don't erase for it*/
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Manifest rejected: image length %u\r\n", manifest->imageLength);
+		#endif
+		
+		return false;
+	}
+	
+	if (chunkSize != FIRMWARE_CHUNK_SIZE || (manifest->formatFlags & ~FIRMWARE_FORMAT_SUPPORTED) != 0)
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Manifest rejected: chunk size %u, format 0x%x\r\n", chunkSize, manifest->formatFlags);
+		#endif
+		
+		return false;
+	}
+	
+	chunks = strstr(response, "\"chunks\":\"");
+	
+	if (chunks == NULL)
+	{
+		return false;
+	}
+	
+	chunks += strlen("\"chunks\":\"");
+	
+	for (uint32_t i = 0; i < manifest->chunkCount; i++)
+	{
+		char *end;
+		
+		manifest->chunkCRC[i] = strtoul(chunks, &end, 16);
+		
+		if (end == chunks || (*end != ',' && i + 1 < manifest->chunkCount))/*less checksums than chunks*/
+		{
+			return false;
+		}
+		
+		chunks = end + 1;
+	}
+	
+	manifest->present = true;
+	
+	return true;
+}
+
+/**
+* @brief  This function hashes the 96 bit unique device ID (FNV-1a), giving a stable per device phase and rollout bucket
+* @retval hash of the unique device ID
+*/
+uint32_t ulBootloaderDeviceHash(void)
+{
+	uint32_t uid[3] = {HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2()}, hash = 2166136261U;
+	
+	for (int i = 0; i < 12; i++)
+	{
+		hash ^= (uid[i / 4] >> (8 * (i % 4))) & 0xFF;
+		hash *= 16777619U;
+	}
+	
+	return hash;
+}
+
+/**
+* @brief  This function returns the next value of a xorshift32 generator seeded at init
+* @retval pseudo random number
+*/
+uint32_t ulBootloaderRandom(void)
+{
+	uint32_t x = xBootloaderVariables.randomState;
+	
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	
+	xBootloaderVariables.randomState = x;
+	
+	return x;
+}
+
+/**
+* @brief this function connects to the tftp server and sends a read request to the server over Wifi
+* @params char remoteIP[] 			 -> TFTP Server IP
+*					char remoteFixedPort[] -> TFTP Server Port
+*					char fileName[]				 -> name of the new firmware
+*/
+void vTFTPReadRequestWifi(char remoteIP[], char remoteFixedPort[], char fileName[])
+{
+	if(remoteIP[0] != 0x00 	&& remoteFixedPort[0] != 0x00 && fileName[0] != 0x00) /*if there is a file to be requested*/
+	{
+		char connectToUDPServer[100];
+		
+		HAL_FLASH_Unlock();
+		
+		vEraseStorageSpace();
+		
+		vReduceWifiBaudRateTo19200();
+		
+		clearWifiBufferAndResetItsIndex();
+		
+		sprintf(connectToUDPServer, "AT+CIPSTART=%i,\"UDP\",\"%s\",%s,69,2\r\n", WIFI_UDP_SOCKET_NO, remoteIP, remoteFixedPort);
+		
+		/*turn access point off, the socket open is queued behind its "OK"*/
+		bBootloaderTxQueue(LINK_WIFI, "AT+CWMODE=1\r\n", strlen("AT+CWMODE=1\r\n"), "OK\r\n", NULL, 0);
+		
+		/*connect to the tftp server*/ 
+		vBootloaderTxSend(LINK_WIFI, connectToUDPServer);
+		
+		if(bCheckIfResponseReceivedOnTime("CONNECT\r\n\r\nOK\r\n", WIFI_BUFFER, 15000))/*if connected to the tftp server*/
+		{
+			uint32_t length;
+			char tftpReadRequest[80], sendQuantity[50];
+			
+			xBootloaderVariables.wifiBootloading = true;
+			
+			vBootloaderTransferStart();
+			
+			if (fileName != xBootloaderVariables.fileName)/*kept for HTTP Range downloads of corrupted chunks*/
+			{
+				strcpy(xBootloaderVariables.fileName, fileName);
+			}
+			
+			vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+			vBootloaderTimerStart(CONNECTION_TIMER, TFTP_CONNECTION_TIME);
+			
+			clearWifiBufferAndResetItsIndex();
+			
+			vPrepareTFTPReadRequest(tftpReadRequest, fileName, &length);
+			
+			sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_UDP_SOCKET_NO, length);
+			
+			/*Send read request to the server to read the firmware*/
+			bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, tftpReadRequest, length, NULL, 0);
+		}
+		else/*if not connected to the tftp server*/
+		{
+			#if TFTP_BOOTLOADER_DEBUG			
+			printf("couldn't connect to TFTP server on Wifi\r\n");
+			#endif
+			
+			char closeSocket[50];
+			sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", WIFI_UDP_SOCKET_NO);
+			vBootloaderTxSend(LINK_WIFI, closeSocket);
+		}
+	}	
+}
+
+/**
+* @brief This function sends device firmware version to a web server using GSM. 
+*				 Web server returns a file name if the device firmware version is NOT the most recent.
+*/
+void vAskFirmwareVersionRequestGSM(void)
+{	
+	if (bBootloaderLinkUp(LINK_GSM) && !xBootloaderVariables.wifiBootloading && !xBootloaderVariables.gsmBootloading && !xBootloaderVariables.firmwareReady)
+	{
+		if (bBootloaderUpdateCheckDue(&xBootloaderVariables.triggerUpdateAtStartGSM))
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("GSM is asking for update..\r\n");
+			#endif
+			
+			
+			char connectToTCPServer[100];	
+			uint32_t connectStart = BOOTLOADER_GET_TICK();
+			
+			HAL_FLASH_Unlock();
+			
+			clearGSMBufferAndResetItsIndex();
+			
+			sprintf(connectToTCPServer, "AT+QIOPEN=%i,%i,\"TCP\",%s,%i,%i,1\r\n", GSM_TCP_SOCKET_CONTEXT_ID, GSM_TCP_SOCKET_CONNECT_ID, FIRMWARE_VERSION_WEB_SERVER_ADDRESS, FIRMWARE_VERSION_WEB_SERVER_PORT, FIRMWARE_VERSION_WEB_SERVER_PORT);
+			
+			/*connect to the TCP - Web server*/
+			vBootloaderTxSend(LINK_GSM, connectToTCPServer);
+			
+			if (bCheckIfResponseReceivedOnTime(GSM_TCP_SOCKET_OPENED, GSM_BUFFER, 15000))
+			{
+				char deviceVersionNumber[6] = {0}, timingQuery[150] = {0}, askFirmwareVersionURLPath[300], sendQuantity[150], closeSocket[50];
+				uint32_t rttMs = BOOTLOADER_GET_TICK() - connectStart, exchangeStart;
+				
+				clearGSMBufferAndResetItsIndex();
+				
+				
+				vGetDeviceFirmwareVersion(deviceVersionNumber);		
+				
+				
+				/*prepare the HTTP request to ask for update, send your version number to get if a new one*/
+				vBootloaderTimingQuery(timingQuery);
+				
+				vPrepareFirmwareVersionRequest(askFirmwareVersionURLPath, deviceVersionNumber, timingQuery);
+
+				sprintf(sendQuantity, "AT+QISEND=%i,%i\r\n", GSM_TCP_SOCKET_CONNECT_ID, strlen(askFirmwareVersionURLPath));				
+				
+				exchangeStart = BOOTLOADER_GET_TICK();
+				
+				bBootloaderTxSendPayload(LINK_GSM, sendQuantity, askFirmwareVersionURLPath, strlen(askFirmwareVersionURLPath), NULL, 0);
+				
+				if (bCheckIfResponseReceivedOnTime(FIRMWARE_VERSION_RESPONSE_END, GSM_BUFFER, 15000))
+				{
+					vBootloaderLinkSample(LINK_GSM, rttMs, strlen(askFirmwareVersionURLPath) + GSM_BUFFER_RECEIVE_INDEX, BOOTLOADER_GET_TICK() - exchangeStart);
+				}
+				
+				
+				/*parse the response, an empty answer on one link must not drop the offer of the other*/
+				vParseFirmwareVersionResponse(GSM_BUFFER, &xBootloaderVariables.offers[LINK_GSM]);
+				
+				xLinkQuality.links[LINK_GSM].fileOffered = (xBootloaderVariables.offers[LINK_GSM].fileName[0] != 0);
+				
+				
+				sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_TCP_SOCKET_CONNECT_ID);
+				clearGSMBufferAndResetItsIndex();
+				vBootloaderTxSend(LINK_GSM, closeSocket);
+				bCheckIfResponseReceivedOnTime("OK\r\n", GSM_BUFFER, 5000);				
+				
+				
+				#if TFTP_BOOTLOADER_DEBUG
+				printf("GSM update ask request completed..\r\n");
+				#endif
+			}
+			else
+			{
+				#if TFTP_BOOTLOADER_DEBUG
+				printf("GSM could not connect to Web server to ask for firmware version..\r\n");
+				#endif
+			}
+		}
+	}
+}
+
+/**
+* @brief  This function connects to the tftp server and sends a read request to the server over GSM
+* @params char remoteIP[] 			 -> TFTP Server IP
+*					char remoteFixedPort[] -> TFTP Server Port
+*					char fileName[]				 -> name of the new firmware
+*/
+void vTFTPReadRequestQuectel(char remoteIP[], char remoteFixedPort[], char fileName[])
+{
+	if(remoteIP[0] != 0x00 && remoteFixedPort[0] != 0x00 && fileName[0] != 0x00)
+	{
+		char connectToUDPServer[100];
+		
+		HAL_FLASH_Unlock();
+		
+		vEraseStorageSpace();
+				
+		clearGSMBufferAndResetItsIndex();
+				
+		sprintf(connectToUDPServer, "AT+QIOPEN=%i,%i,\"UDP SERVICE\",\"%s\",%s,69,1\r\n", GSM_UDP_SOCKET_CONTEXT_ID, GSM_UDP_SOCKET_CONNECT_ID, remoteIP, remoteFixedPort);
+		
+		/*connect to the UDP - TFTP server*/
+		vBootloaderTxSend(LINK_GSM, connectToUDPServer);
+		
+		if (bCheckIfResponseReceivedOnTime(GSM_UDP_SOCKET_OPENED, GSM_BUFFER, 15000))
+		{
+			uint32_t length;
+			
+			char tftpReadRequest[50], sendQuantity[50];
+			
+			xBootloaderVariables.gsmBootloading = true;
+			
+			vBootloaderTransferStart();
+			
+			vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+			vBootloaderTimerStart(CONNECTION_TIMER, TFTP_CONNECTION_TIME);
+			
+			
+			/*turn the access point off, the Wifi modem answers on its own UART so nothing waits for it*/
+			vBootloaderTxSend(LINK_WIFI, "AT+CWMODE=1\r\n");
+			
+			
+			vPrepareTFTPReadRequest(tftpReadRequest, fileName, &length);
+			
+			
+			sprintf(sendQuantity, "AT+QISEND=%i,%i,\"%s\",%s\r\n", GSM_UDP_SOCKET_CONNECT_ID, length, remoteIP, remoteFixedPort);
+			
+			clearGSMBufferAndResetItsIndex();
+			
+			/*send the read request to the server*/
+			bBootloaderTxSendPayload(LINK_GSM, sendQuantity, tftpReadRequest, length, NULL, 0);
+						
+			xBootloaderVariables.solvePort = 1;
+		}
+		else /*if not able to connect to server*/
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Couldn't connect to TFTP server on GSM\r\n");
+			#endif	
+			
+			char closeSocket[50];
+			sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_TCP_SOCKET_CONNECT_ID);
+			vBootloaderTxSend(LINK_GSM, closeSocket);
+			clearGSMBufferAndResetItsIndex();
+		}
+	}
+}
+
+/**
+* @brief This function parses incoming GSM buffer as the tftp data
+*/
+void vBootloaderQuectelEngage(void)
+{
+	/*if GSM_IDLE_TIME msecs past from the last arrival data, means gsm responded*/
+	if(bBootloaderTimerExpired(GSM_IDLE_TIMER) && GSM_BUFFER_RECEIVE_INDEX > 0)
+	{		
+		if (xBootloaderVariables.solvePort == 1)/*this is the first state supposed to resolve the port of the incoming data*/
+		{
+			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
+			{
+				if (GSM_BUFFER[i]   == 0x72 
+				 && GSM_BUFFER[i+1] == 0x65 
+				 && GSM_BUFFER[i+2] == 0x63 
+				 && GSM_BUFFER[i+3] == 0x76) /*if gsm buffer includes "recv" meaning that module arrived data*/
+				{
+					while (GSM_BUFFER[i] != 0x0D)/*place forward the buffer index until you see '\r'*/
+					{
+						i++;
+					}
+					i--;
+					
+					while (GSM_BUFFER[i] != 0x2C)/*place back the buffer index until you see ','*/
+					{
+						i--;
+					}
+					i++;
+					
+					while (GSM_BUFFER[i] != 0x0D)/*from ',' to '\r' resolve the characters as the port*/
+					{
+						char digit = GSM_BUFFER[i];
+						xBootloaderVariables.remotePort = xBootloaderVariables.remotePort * 10 + (digit - '0');
+						i++;
+					}
+					xBootloaderVariables.solvePort = 2;/*once port is resolved, process continues over the second state where "xBootloaderVariables.solvePort == 2"*/
+					i = sizeof(GSM_BUFFER);
+				}
+			}
+		}
+		
+		if(xBootloaderVariables.solvePort == 2)
+		{
+			uint32_t dataIndex = 0;
+			
+			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
+			{
+				if (GSM_BUFFER[i]   == 0x72 
+				 && GSM_BUFFER[i+1] == 0x65 
+				 && GSM_BUFFER[i+2] == 0x63 
+				 && GSM_BUFFER[i+3] == 0x76) /*if gsm buffer includes "recv" meaning that module arrived data*/
+				{
+					while (GSM_BUFFER[i] != 0x2C)/*place the buffer index until you see ","*/
+					{
+						i++;
+					}
+					i++;
+					
+					while (GSM_BUFFER[i] != 0x2C)/*place the buffer index until you see the second ","*/
+					{
+						i++;
+					}
+					i++;
+					
+					while (GSM_BUFFER[i] != 0x2C)/*resolve the incoming data quantity*/
+					{
+						char digit = GSM_BUFFER[i];
+						dataIndex = dataIndex * 10 + (digit - '0');
+						i++;
+					}
+											
+					i = sizeof(GSM_BUFFER);/*conclude the loop*/
+				}
+			}
+							
+			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
+			{
+				if (GSM_BUFFER[i]   == 0x72 
+				 && GSM_BUFFER[i+1] == 0x65 
+				 && GSM_BUFFER[i+2] == 0x63 
 				 && GSM_BUFFER[i+3] == 0x76) /*if gsm buffer includes "recv" meaning that module arrived data*/
 				{
-					while (GSM_BUFFER[i] != 0x0D)/*place forward the buffer index until you see '\r'*/
-					{
-						i++;
-					}
-					i--;
-					
-					while (GSM_BUFFER[i] != 0x2C)/*place back the buffer index until you see ','*/
-					{
-						i--;
-					}
-					i++;
-					
-					while (GSM_BUFFER[i] != 0x0D)/*from ',' to '\r' resolve the characters as the port*/
-					{
-						char digit = GSM_BUFFER[i];
-						xBootloaderVariables.remotePort = xBootloaderVariables.remotePort * 10 + atoi(&digit);
-						i++;
-					}
-					xBootloaderVariables.solvePort = 2;/*once port is resolved, process continues over the second state where "xBootloaderVariables.solvePort == 2"*/
-					i = sizeof(GSM_BUFFER);
+					
+					while (GSM_BUFFER[i] != 0x0A)/*place the buffer index until you see "\n"*/
+					{
+						i++;
+					}
+					i++;
+					
+					/*fulfil the tftp buffer from gsm buffer*/
+					for (int k = 0; k < 516; k++)
+					{
+						xBootloaderVariables.currentTftpBuffer[k] = GSM_BUFFER[i];
+						i++;
+					}
+					i = sizeof(GSM_BUFFER);/*conclude the loop*/
+					
+					vBootloaderCRC32ToFlash(dataIndex);
+				}
+			}
+		}
+	}
+}
+
+/**
+* @brief This function parses incoming wifi buffer as the tftp data 
+*/
+void vBootloaderWifiEngage(void)
+{
+	for(int k = 0; k < sizeof(WIFI_BUFFER); k++)
+	{
+		if (WIFI_BUFFER[k]   == 0x49 &&
+				WIFI_BUFFER[k+1] == 0x50 &&
+				WIFI_BUFFER[k+2] == 0x44 &&
+				WIFI_BUFFER[k+3] == 0x2C &&
+				(WIFI_BUFFER[k+4] == (0x30 + WIFI_UDP_SOCKET_NO) ||
+				(xBootloaderVariables.multicast.active && WIFI_BUFFER[k+4] == (0x30 + MULTICAST_UDP_SOCKET_NO))))/*if "IPD, X" arrives at the wifi buffer, meaning that Xth socket arrived data, which is the udp socket or the multicast group*/
+		{			
+			
+			uint32_t dataIndex = 0;
+			
+			for (int i = 0; i < sizeof(WIFI_BUFFER); i++)
+			{
+				if (WIFI_BUFFER[i] == 0x3A)/*:*/
+				{
+					if (WIFI_BUFFER[i-1] == 0x36 &&
+							WIFI_BUFFER[i-2] == 0x31 &&
+							WIFI_BUFFER[i-3] == 0x35)/*if arrival data includes "516:" meaning that 516 bytes of tftp package arrived*/
+					{
+						i++;
+						
+						for (int j = 0; j < 516; j++)
+						{
+							xBootloaderVariables.currentTftpBuffer[j] = WIFI_BUFFER[i];/*transfer the tftp package from the wifi buffer to the tftp buffer*/
+							i++;
+						}
+						
+						i = sizeof(WIFI_BUFFER);
+						
+						dataIndex = 516;
+						
+						vBootloaderCRC32ToFlash(dataIndex);
+					}
+					else/* if the last package; namely, package arrival quantity is NOT 516 but different*/
+					{
+						/*resolve how many data arrived*/
+						if(WIFI_BUFFER[i-2] == 0x2C || WIFI_BUFFER[i-3] == 0x2C || WIFI_BUFFER[i-4] == 0x2C)/*arrival quantity differ from 1 to 3 digits in the context of TFTP nax buf size 512*/
+						{
+							if(WIFI_BUFFER[i-1] != 0x2C)
+							{
+								char digit = WIFI_BUFFER[i-1];
+								dataIndex = (digit - '0');
+								if(WIFI_BUFFER[i-2] != 0x2C)
+								{
+									char digit = WIFI_BUFFER[i-2];
+									dataIndex += (digit - '0')*10;
+									if(WIFI_BUFFER[i-3] != 0x2C)
+									{
+										char digit = WIFI_BUFFER[i-3];
+										dataIndex += (digit - '0')*100;
+									}
+								}
+							}
+							
+							i++;
+														
+							for(int j = 0; j < dataIndex; j++)/*transfer the data into tftp buffer*/
+							{
+								xBootloaderVariables.currentTftpBuffer[j] = WIFI_BUFFER[i];
+								i++;
+							}
+							
+							i = sizeof(WIFI_BUFFER);
+							
+							vBootloaderCRC32ToFlash(dataIndex);
+						}
+					}
+				}
+			}			
+			k = sizeof(WIFI_BUFFER);/*conclude the loop*/
+		}
+	}
+}
+
+/**
+* @brief This function puts tftp buffer to crc calculation buffer, calculates its checksum and writes it to the flash
+* @param uint32_t tftpBufferIndex -> telling how full the current tftp buffer is
+*/
+void vBootloaderCRC32ToFlash(uint32_t tftpBufferIndex)
+{		
+	BOOTLOADER_TIMING_START(processStart);
+	
+	xBootloaderVariables.incomingBlockNumber = xBootloaderVariables.currentTftpBuffer[2]*(0x100) + xBootloaderVariables.currentTftpBuffer[3];
+	
+	#if BOOTLOADER_TIMING
+	if (xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1)
+	{
+		if (xBootloaderVariables.timing.lastBlockTimestamp != 0)
+		{
+			vBootloaderTimingRecord(TIMING_BLOCK_INTERVAL, xBootloaderVariables.timing.lastBlockTimestamp);
+		}
+		
+		xBootloaderVariables.timing.lastBlockTimestamp = processStart;
+		xBootloaderVariables.timing.bytesReceived += tftpBufferIndex - 4;
+	}
+	else
+	{
+		xBootloaderVariables.timing.retransmits++;
+	}
+	#endif
+	
+	#if BOOTLOADER_MULTICAST
+	if (xBootloaderVariables.currentTftpBuffer[1] == TFTP_OPCODE_OACK || xBootloaderVariables.multicast.active)
+	{
+		if (xBootloaderVariables.currentTftpBuffer[1] == TFTP_OPCODE_OACK)
+		{
+			vBootloaderMulticastOption(tftpBufferIndex);
+		}
+		else
+		{
+			vBootloaderMulticastBlockToFlash(tftpBufferIndex);
+		}
+		
+		BOOTLOADER_TIMING_RECORD(TIMING_BLOCK_PROCESS, processStart);
+		
+		return;
+	}
+	#endif
+	
+	#if BOOTLOADER_DECRYPTION
+	if (xBootloaderVariables.manifest.encrypted && xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1)/*in place, once per block*/
+	{
+		vBootloaderDecrypt((uint8_t *)&xBootloaderVariables.currentTftpBuffer[4], tftpBufferIndex - 4, (xBootloaderVariables.incomingBlockNumber - 1) * 512);
+	}
+	#endif
+	
+	if ((xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1) && xBootloaderVariables.manifest.present)
+	{
+		vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+		
+		xBootloaderVariables.incomingBlockNumberOld = xBootloaderVariables.incomingBlockNumber;
+		
+		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, true);
+		
+		vBootloaderManifestBlockToFlash(tftpBufferIndex);
+	}
+	else if ((xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1) && xBootloaderVariables.incomingBlockNumber > 1)
+	{	
+		vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+		
+		xBootloaderVariables.incomingBlockNumberOld = xBootloaderVariables.incomingBlockNumber;
+		
+		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, true);
+		
+		if(!bIsTheLastTFTPPackage(tftpBufferIndex))
+		{
+			vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, tftpBufferIndex);
+			
+			vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
+			
+			memcpy(xBootloaderVariables.previousTftpBuffer, xBootloaderVariables.currentTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
+			
+			vTFTPIncrementACK(xBootloaderVariables.ACK);
+			
+			vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+		}
+		else
+		{
+			uint32_t crcIndex = 0;
+			
+			if (tftpBufferIndex == 4)/*if last package does not contain data*/
+			{
+				vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
+				
+				vExtractCRCFromTheLastTFTPPackage(&xBootloaderVariables.checkSumOnTheLastTFTPPackage, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer), &crcIndex);
+
+				vTFTPIncrementACK(xBootloaderVariables.ACK);
+				
+				vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+				
+				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, crcIndex + 1);
+				
+				vEvaluateCRC32(xBootloaderVariables.checkSumCalculated, xBootloaderVariables.checkSumOnTheLastTFTPPackage);
+			}
+			else
+			{				
+				vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
+				
+				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
+																
+				vFlashTFTPBuffer(xBootloaderVariables.currentTftpBuffer, tftpBufferIndex - 4);
+				
+				vExtractCRCFromTheLastTFTPPackage(&xBootloaderVariables.checkSumOnTheLastTFTPPackage, xBootloaderVariables.currentTftpBuffer, tftpBufferIndex, &crcIndex);
+				
+				vTFTPIncrementACK(xBootloaderVariables.ACK);
+				
+				vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+				
+				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.currentTftpBuffer, crcIndex + 1);
+				
+				vEvaluateCRC32(xBootloaderVariables.checkSumCalculated, xBootloaderVariables.checkSumOnTheLastTFTPPackage);
+			}
+		}
+	}
+	else if((xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1) && xBootloaderVariables.incomingBlockNumber == 1)
+	{
+		vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+		
+		xBootloaderVariables.incomingBlockNumberOld = xBootloaderVariables.incomingBlockNumber;
+		
+		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, true);
+		
+		memcpy(xBootloaderVariables.previousTftpBuffer, xBootloaderVariables.currentTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
+		
+		vTFTPIncrementACK(xBootloaderVariables.ACK);
+		
+		vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+	}
+	else
+	{				
+		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, false);
+		
+		xBootloaderVariables.incomingBlockNumber = xBootloaderVariables.incomingBlockNumberOld ;
+		
+		vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+	}
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_BLOCK_PROCESS, processStart);
+}
+
+/**
+* @brief This function reads the RFC 2090 option acknowledgement, joining the group on the first one and taking the
+*				 master client role whenever the server hands it over
+* @param uint32_t tftpBufferIndex -> telling how full the current tftp buffer is
+* @note  The options are name and value pairs ending with a NUL, only the ones inside tftpBufferIndex are read. The
+*				 value is "addr,port,mc", later acknowledgements may leave addr and port empty to change the role only. An
+*				 acknowledgement without the multicast option is answered with block 0 and the transfer goes on unicast.
+*/
+void vBootloaderMulticastOption(uint32_t tftpBufferIndex)
+{
+	#if BOOTLOADER_MULTICAST
+	multicastState_t *multicast = &xBootloaderVariables.multicast;
+	char *option = &xBootloaderVariables.currentTftpBuffer[2], *value = NULL, *comma, *end;
+	
+	end = &xBootloaderVariables.currentTftpBuffer[(tftpBufferIndex < sizeof(xBootloaderVariables.currentTftpBuffer)) ? tftpBufferIndex : sizeof(xBootloaderVariables.currentTftpBuffer)];
+	
+	while (option < end && value == NULL)
+	{
+		char *nameEnd = memchr(option, 0, end - option), *valueEnd;
+		
+		if (nameEnd == NULL || (valueEnd = memchr(nameEnd + 1, 0, end - nameEnd - 1)) == NULL)
+		{
+			break;/*an option cut by the end of the datagram*/
+		}
+		
+		if (strcmp(option, "multicast") == 0)
+		{
+			value = nameEnd + 1;
+		}
+		
+		option = valueEnd + 1;
+	}
+	
+	if (value == NULL || !xBootloaderVariables.manifest.present)
+	{
+		vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+		
+		return;
+	}
+	
+	if (!multicast->active && value[0] != ',')
+	{
+		char joinGroup[100];
+		
+		comma = strchr(value, ',');
+		
+		if (comma == NULL || comma <= value || (size_t)(comma - value) >= sizeof(multicast->groupIP))
+		{
+			vBootloaderDiscardDownload();
+		}
+		
+		memcpy(multicast->groupIP, value, comma - value);
+		
+		multicast->groupIP[comma - value] = 0;
+		
+		sprintf(multicast->groupPort, "%u", (unsigned)strtoul(comma + 1, NULL, 10));
+		
+		multicast->blockCount = xBootloaderVariables.manifest.imageLength / 512 + 1;
+		
+		sprintf(joinGroup, "AT+CIPSTART=%i,\"UDP\",\"%s\",%s,%s,0\r\n", MULTICAST_UDP_SOCKET_NO, multicast->groupIP, multicast->groupPort, multicast->groupPort);
+		
+		clearWifiBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_WIFI, joinGroup);
+		
+		if (!bCheckIfResponseReceivedOnTime("CONNECT\r\n\r\nOK\r\n", WIFI_BUFFER, 5000))
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Could not join multicast group %s\r\n", multicast->groupIP);
+			#endif
+			
+			vBootloaderDiscardDownload();
+		}
+		
+		clearWifiBufferAndResetItsIndex();
+		
+		multicast->active = true;
+	}
+	
+	comma = strrchr(value, ',');
+	
+	multicast->master = (comma != NULL && comma[1] == '1');
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Multicast group %s:%s, %s client\r\n", multicast->groupIP, multicast->groupPort, multicast->master ? "master" : "listening");
+	#endif
+	
+	vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+	vBootloaderTimerStart(MULTICAST_REASK_TIMER, MULTICAST_REASK_TIME);
+	
+	if (multicast->master)
+	{
+		vBootloaderMulticastAcknowledge();
+	}
+	else
+	{
+		clearWifiBufferAndResetItsIndex();
+	}
+	#endif
+}
+
+/**
+* @brief This function programs a multicast TFTP block straight to its offset in the storage space, blocks may come
+*				 in any order and more than once. A chunk is checked against the manifest from the flash once all of its
+*				 blocks are in, the whole image when the last missing block arrives.
+* @param uint32_t tftpBufferIndex -> telling how full the current tftp buffer is
+*/
+void vBootloaderMulticastBlockToFlash(uint32_t tftpBufferIndex)
+{
+	#if BOOTLOADER_MULTICAST
+	multicastState_t *multicast = &xBootloaderVariables.multicast;
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	uint32_t block = xBootloaderVariables.incomingBlockNumber, dataLength, offset = (block - 1) * 512, chunk;
+	
+	if (tftpBufferIndex < 4 || tftpBufferIndex > sizeof(xBootloaderVariables.currentTftpBuffer) || xBootloaderVariables.currentTftpBuffer[1] != 3 || block == 0 || block > multicast->blockCount)
+	{
+		vPrintTFTPBlockNumber(block, false);
+		clearWifiBufferAndResetItsIndex();
+		
+		return;/*not a data block of the image*/
+	}
+	
+	if (multicast->receivedMap[(block - 1) / 32] & (1U << ((block - 1) % 32)))
+	{
+		multicast->duplicateBlocks++;
+		
+		vPrintTFTPBlockNumber(block, false);
+		clearWifiBufferAndResetItsIndex();
+		
+		return;/*a block this client already has, sent again for another client*/
+	}
+	
+	dataLength = tftpBufferIndex - 4;
+	
+	if (dataLength != ((block < multicast->blockCount) ? 512 : manifest->imageLength % 512))
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Block %u does not match the manifest\r\n", block);
+		#endif
+		
+		vBootloaderDiscardDownload();
+	}
+	
+	vPrintTFTPBlockNumber(block, true);
+	
+	vBootloaderTimerStart(TFTP_TIMEOUT_TIMER, TFTP_TIMEOUT_TIME);
+	vBootloaderTimerStart(MULTICAST_REASK_TIMER, MULTICAST_REASK_TIME);
+	
+	if (dataLength > 0)
+	{
+		#if BOOTLOADER_DECRYPTION
+		if (manifest->encrypted)
+		{
+			vBootloaderDecrypt((uint8_t *)&xBootloaderVariables.currentTftpBuffer[4], dataLength, offset);
+		}
+		#endif
+		
+		vBootloaderProgramFlash(xBootloaderVariables.applicationStoredAddressStart + offset, (uint8_t *)&xBootloaderVariables.currentTftpBuffer[4], dataLength);
+		
+		#if BOOTLOADER_SIGNATURE
+		if (xBootloaderVariables.imageHash.length == offset)/*in order, the rest is hashed from the flash at the end*/
+		{
+			vSHA256Update(&xBootloaderVariables.imageHash, (const uint8_t *)&xBootloaderVariables.currentTftpBuffer[4], dataLength);
+		}
+		#endif
+	}
+	
+	multicast->receivedMap[(block - 1) / 32] |= 1U << ((block - 1) % 32);
+	multicast->receivedBlocks++;
+	
+	while (multicast->contiguousBlocks < multicast->blockCount && (multicast->receivedMap[multicast->contiguousBlocks / 32] & (1U << (multicast->contiguousBlocks % 32))))
+	{
+		multicast->contiguousBlocks++;
+	}
+	
+	chunk = offset / FIRMWARE_CHUNK_SIZE;
+	
+	if (chunk < manifest->chunkCount)
+	{
+		uint32_t firstBlock = chunk * (FIRMWARE_CHUNK_SIZE / 512), lastBlock = firstBlock + (ulBootloaderChunkLength(chunk) + 511) / 512 - 1;
+		bool complete = true;
+		
+		for (uint32_t i = firstBlock; i <= lastBlock && complete; i++)
+		{
+			complete = (multicast->receivedMap[i / 32] & (1U << (i % 32))) != 0;
+		}
+		
+		if (complete && ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart + chunk * FIRMWARE_CHUNK_SIZE), ulBootloaderChunkLength(chunk), 0) != manifest->chunkCRC[chunk])
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Chunk %u CRC32 FAILED, programmed blocks can not be received again\r\n", chunk);
+			#endif
+			
+			vBootloaderDiscardDownload();
+		}
+	}
+	
+	if (multicast->master)
+	{
+		vBootloaderMulticastAcknowledge();
+	}
+	else
+	{
+		clearWifiBufferAndResetItsIndex();/*a listening client doesn't acknowledge, the acknowledge is what clears the buffer*/
+	}
+	
+	if (multicast->receivedBlocks == multicast->blockCount)
+	{
+		vBootloaderTimerStop(TFTP_TIMEOUT_TIMER);
+		vBootloaderTimerStop(MULTICAST_REASK_TIMER);
+		
+		vBootloaderMulticastLeave();
+		
+		xBootloaderVariables.receivedImageLength				 = manifest->imageLength;
+		xBootloaderVariables.applicationStoredAddressEnd = xBootloaderVariables.applicationStoredAddressStart + manifest->imageLength;
+		
+		vEvaluateCRC32(ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart), manifest->imageLength, 0), manifest->imageCRC);
+	}
+	#endif
+}
+
+/**
+* @brief This function acknowledges the blocks received without a gap, the server goes on with the block after it
+*/
+void vBootloaderMulticastAcknowledge(void)
+{
+	xBootloaderVariables.ACK[0] = 0;
+	xBootloaderVariables.ACK[1] = 4;
+	xBootloaderVariables.ACK[2] = (xBootloaderVariables.multicast.contiguousBlocks >> 8) & 0xFF;
+	xBootloaderVariables.ACK[3] = xBootloaderVariables.multicast.contiguousBlocks & 0xFF;
+	
+	vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+}
+
+/**
+* @brief This function runs when no new multicast block came for MULTICAST_REASK_TIME, the master acknowledges again
+*				 and a listening client sends its read request again to be made master for the blocks it misses
+*/
+void vBootloaderMulticastReask(void)
+{
+	#if BOOTLOADER_MULTICAST
+	char readRequest[80], sendQuantity[80];
+	uint32_t length;
+	
+	vBootloaderTimerStart(MULTICAST_REASK_TIMER, MULTICAST_REASK_TIME);
+	
+	if (xBootloaderVariables.multicast.master)
+	{
+		vBootloaderMulticastAcknowledge();
+		
+		return;
+	}
+	
+	vPrepareTFTPReadRequest(readRequest, xBootloaderVariables.fileName, &length);
+	
+	sprintf(sendQuantity, "AT+CIPSEND=%i,%u,\"%s\",69\r\n", WIFI_UDP_SOCKET_NO, length, xBootloaderVariables.remoteIP);/*the socket follows the transfer port, a request goes to port 69*/
+	
+	clearWifiBufferAndResetItsIndex();
+	bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, readRequest, length, NULL, 0);
+	#endif
+}
+
+/**
+* @brief This function closes the multicast group socket, the ESP8266 keeps it open over a reset of the MCU
+*/
+void vBootloaderMulticastLeave(void)
+{
+	char closeSocket[50];
+	
+	sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", MULTICAST_UDP_SOCKET_NO);
+	
+	clearWifiBufferAndResetItsIndex();
+	vBootloaderTxSend(LINK_WIFI, closeSocket);
+	bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 750);
+	clearWifiBufferAndResetItsIndex();
+	
+	xBootloaderVariables.multicast.active = false;
+}
+
+/**
+* @brief This function collects in order TFTP blocks of an image described by a manifest into the chunk buffer.
+*				 A completed chunk is programmed if its CRC32 matches the manifest, otherwise it is left erased and marked
+*				 to be downloaded again by HTTP Range once the TFTP transfer ends.
+* @param uint32_t tftpBufferIndex -> telling how full the current tftp buffer is
+*/
+void vBootloaderManifestBlockToFlash(uint32_t tftpBufferIndex)
+{
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	uint32_t dataLength = tftpBufferIndex - 4;
+	
+	if (xBootloaderVariables.receivedImageLength + dataLength > manifest->imageLength)
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Image is longer than its manifest\r\n");
+		#endif
+		
+		vBootloaderDiscardDownload();
+	}
+	
+	if (dataLength > 0)
+	{
+		memcpy(&xBootloaderVariables.chunkBuffer[xBootloaderVariables.receivedImageLength % FIRMWARE_CHUNK_SIZE], &xBootloaderVariables.currentTftpBuffer[4], dataLength);
+		
+		xBootloaderVariables.receivedImageLength += dataLength;
+		
+		if (xBootloaderVariables.receivedImageLength % FIRMWARE_CHUNK_SIZE == 0 || xBootloaderVariables.receivedImageLength == manifest->imageLength)
+		{
+			uint32_t chunk = (xBootloaderVariables.receivedImageLength - 1) / FIRMWARE_CHUNK_SIZE;
+			
+			vBootloaderStoreChunk(chunk, xBootloaderVariables.chunkBuffer, xBootloaderVariables.receivedImageLength - chunk * FIRMWARE_CHUNK_SIZE);
+		}
+	}
+	
+	vTFTPIncrementACK(xBootloaderVariables.ACK);
+	
+	vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+	
+	if (bIsTheLastTFTPPackage(tftpBufferIndex))
+	{
+		if (xBootloaderVariables.receivedImageLength != manifest->imageLength)
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Image is shorter than its manifest\r\n");
+			#endif
+			
+			vBootloaderDiscardDownload();
+		}
+		
+		vBootloaderTimerStop(TFTP_TIMEOUT_TIMER);
+		
+		if (!bBootloaderRefetchFailedChunks())
+		{
+			vBootloaderDiscardDownload();
+		}
+		
+		xBootloaderVariables.applicationStoredAddressEnd = xBootloaderVariables.applicationStoredAddressStart + manifest->imageLength;
+		
+		/*whole image is checked once more on the flash, after the chunks downloaded again are in place*/
+		vEvaluateCRC32(ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart), manifest->imageLength, 0), manifest->imageCRC);
+	}
+}
+
+/**
+* @brief  This function programs a chunk to its place in the storage space if its CRC32 matches the manifest
+* @params uint32_t chunk	-> chunk number
+*					uint8_t data[]	-> chunk buffer
+*					uint32_t length -> bytes held in the chunk buffer
+*/
+void vBootloaderStoreChunk(uint32_t chunk, uint8_t data[], uint32_t length)
+{
+	if (ulCRC32Region(data, length, 0) == xBootloaderVariables.manifest.chunkCRC[chunk])
+	{
+		vBootloaderProgramFlash(xBootloaderVariables.applicationStoredAddressStart + chunk * FIRMWARE_CHUNK_SIZE, data, length);
+		
+		#if BOOTLOADER_SIGNATURE
+		if (xBootloaderVariables.imageHash.length == (uint64_t)chunk * FIRMWARE_CHUNK_SIZE)/*in order, the rest is hashed from the flash at the end*/
+		{
+			vSHA256Update(&xBootloaderVariables.imageHash, data, length);
+		}
+		#endif
+		
+		xBootloaderVariables.failedChunks[chunk / 32] &= ~(1U << (chunk % 32));
+	}
+	else
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Chunk %u CRC32 FAILED, it will be downloaded again\r\n", chunk);
+		#endif
+		
+		xBootloaderVariables.failedChunks[chunk / 32] |= 1U << (chunk % 32);
+	}
+}
+
+/**
+* @brief  This function downloads the chunks marked in failedChunks again by HTTP Range requests over the transport of the transfer
+* @retval true if every chunk is now programmed, false if one still fails after FIRMWARE_REFETCH_RETRIES
+*/
+bool bBootloaderRefetchFailedChunks(void)
+{
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	bootloaderLink_t link = eBootloaderActiveLink();
+	bool socketOpen = false, result = true;
+	
+	for (uint32_t chunk = 0; chunk < manifest->chunkCount && result; chunk++)
+	{
+		uint32_t offset = chunk * FIRMWARE_CHUNK_SIZE;
+		uint32_t length = ulBootloaderChunkLength(chunk);
+		
+		for (int retry = 0; retry < FIRMWARE_REFETCH_RETRIES && (xBootloaderVariables.failedChunks[chunk / 32] & (1U << (chunk % 32))); retry++)
+		{
+			if (!socketOpen)
+			{
+				socketOpen = bBootloaderWebSocketOpen(link);
+			}
+			
+			if (socketOpen && bBootloaderRangeFetch(link, offset, length, xBootloaderVariables.chunkBuffer))
+			{
+				#if BOOTLOADER_DECRYPTION
+				if (manifest->encrypted)/*counter follows the file offset, a range decrypts like the TFTP blocks*/
+				{
+					vBootloaderDecrypt(xBootloaderVariables.chunkBuffer, length, offset);
+				}
+				#endif
+				
+				vBootloaderStoreChunk(chunk, xBootloaderVariables.chunkBuffer, length);
+			}
+		}
+		
+		result = !(xBootloaderVariables.failedChunks[chunk / 32] & (1U << (chunk % 32)));
+	}
+	
+	if (socketOpen)
+	{
+		vBootloaderWebSocketClose(link);
+	}
+	
+	return result;
+}
+
+/**
+* @brief  This function tells the length of a manifest chunk, only the last one may be short
+* @param  uint32_t chunk -> chunk number
+* @retval bytes of the chunk
+*/
+uint32_t ulBootloaderChunkLength(uint32_t chunk)
+{
+	uint32_t offset = chunk * FIRMWARE_CHUNK_SIZE;
+	
+	return (xBootloaderVariables.manifest.imageLength - offset < FIRMWARE_CHUNK_SIZE) ? xBootloaderVariables.manifest.imageLength - offset : FIRMWARE_CHUNK_SIZE;
+}
+
+/**
+* @brief This function downloads a manifest image over Wifi and GSM at the same time by HTTP Range requests
+* @note  Each link takes the next chunk nobody holds as soon as it is idle, so the faster link ends up with more of
+*				 the image. When no chunk is left, an idle link downloads the chunk the other link is still busy with and the
+*				 first copy to pass its CRC32 is kept. Chunks are written to their own offsets, the whole image is then
+*				 checked like a TFTP download.
+*/
+void vBootloaderMultipathDownload(void)
+{
+	#if BOOTLOADER_MULTIPATH
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	multipathLink_t paths[LINK_COUNT] = {0};
+	uint8_t attempts[FIRMWARE_MAX_CHUNKS] = {0};
+	uint32_t pending = manifest->chunkCount;
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Multipath download of %u chunks\r\n", manifest->chunkCount);
+	#endif
+	
+	vBootloaderSetTaskPriority(true);
+	
+	HAL_FLASH_Unlock();
+	
+	vEraseStorageSpace();
+	
+	vBootloaderTransferStart();
+	
+	memset(xBootloaderVariables.failedChunks, 0, sizeof(xBootloaderVariables.failedChunks));
+	
+	for (uint32_t chunk = 0; chunk < manifest->chunkCount; chunk++)/*every chunk waits to be stored*/
+	{
+		xBootloaderVariables.failedChunks[chunk / 32] |= 1U << (chunk % 32);
+	}
+	
+	paths[LINK_WIFI].buffer = xBootloaderVariables.chunkBuffer;
+	paths[LINK_GSM].buffer  = xBootloaderVariables.multipathBuffer;
+	
+	for (int i = 0; i < LINK_COUNT; i++)
+	{
+		paths[i].up    = true;
+		paths[i].chunk = MULTIPATH_NO_CHUNK;
+	}
+	
+	while (pending > 0)
+	{
+		if (!paths[LINK_WIFI].up && !paths[LINK_GSM].up)
+		{
+			vBootloaderDiscardDownload();
+		}
+		
+		for (int i = 0; i < LINK_COUNT; i++)
+		{
+			multipathLink_t *path = &paths[i];
+			bootloaderLink_t link = (bootloaderLink_t)i;
+			int32_t received;
+			
+			if (!path->up)
+			{
+				continue;
+			}
+			
+			if (path->chunk == MULTIPATH_NO_CHUNK)
+			{
+				if (!path->socketOpen && !(path->socketOpen = bBootloaderWebSocketOpen(link)))
+				{
+					vBootloaderMultipathFailed(path, link, attempts);
+					
+					continue;
+				}
+				
+				if ((path->chunk = ulBootloaderMultipathNextChunk(paths, link)) != MULTIPATH_NO_CHUNK)
+				{
+					path->done = 0;
+					
+					vBootloaderMultipathAsk(path, link);
+				}
+				
+				continue;
+			}
+			
+			received = lBootloaderPollHTTPBody(link, &path->buffer[path->done], ulBootloaderChunkLength(path->chunk) - path->done < FIRMWARE_REFETCH_PIECE_SIZE ? ulBootloaderChunkLength(path->chunk) - path->done : FIRMWARE_REFETCH_PIECE_SIZE);
+			
+			if (received < 0 || (received == 0 && BOOTLOADER_GET_TICK() - path->requestTick > FIRMWARE_REFETCH_TIMEOUT))
+			{
+				vBootloaderMultipathFailed(path, link, attempts);
+			}
+			else if (received > 0)
+			{
+				path->done    += received;
+				path->failures = 0;
+				
+				if (!(xBootloaderVariables.failedChunks[path->chunk / 32] & (1U << (path->chunk % 32))))/*the other link stored it first*/
+				{
+					path->chunk = MULTIPATH_NO_CHUNK;
+				}
+				else if (path->done < ulBootloaderChunkLength(path->chunk))
+				{
+					vBootloaderMultipathAsk(path, link);
+				}
+				else
+				{
+					#if BOOTLOADER_DECRYPTION
+					if (manifest->encrypted)
+					{
+						vBootloaderDecrypt(path->buffer, path->done, path->chunk * FIRMWARE_CHUNK_SIZE);
+					}
+					#endif
+					
+					vBootloaderStoreChunk(path->chunk, path->buffer, path->done);
+					
+					if (xBootloaderVariables.failedChunks[path->chunk / 32] & (1U << (path->chunk % 32)))
+					{
+						if (++attempts[path->chunk] >= FIRMWARE_REFETCH_RETRIES)
+						{
+							vBootloaderDiscardDownload();
+						}
+					}
+					else
+					{
+						path->storedBytes += path->done;
+						
+						pending--;
+					}
+					
+					path->chunk = MULTIPATH_NO_CHUNK;
+				}
+			}
+		}
+		
+		WATCHDOG_RESET();
+	}
+	
+	for (int i = 0; i < LINK_COUNT; i++)
+	{
+		if (paths[i].socketOpen)
+		{
+			vBootloaderWebSocketClose((bootloaderLink_t)i);
+		}
+		
+		vBootloaderLinkGoodputSample((bootloaderLink_t)i, paths[i].storedBytes, BOOTLOADER_GET_TICK() - xBootloaderVariables.timing.transferStartTick);
+		
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Link %d stored %u bytes\r\n", i, paths[i].storedBytes);
+		#endif
+	}
+	
+	xBootloaderVariables.receivedImageLength				 = manifest->imageLength;
+	xBootloaderVariables.applicationStoredAddressEnd = xBootloaderVariables.applicationStoredAddressStart + manifest->imageLength;
+	
+	vEvaluateCRC32(ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart), manifest->imageLength, 0), manifest->imageCRC);
+	#endif
+}
+
+/**
+* @brief This function downloads a manifest image by HTTP Range from the LAN seed given in the checkFirmware response
+* @note  Every chunk is marked for downloading and fetched by bBootloaderRefetchFailedChunks, the chunk CRC32s of the
+*				 manifest and the whole image check keep a wrong image of a seed out. The chunks left are asked again
+*				 SEED_ATTEMPTS times, then the image is asked from the TFTP server.
+*/
+void vBootloaderSeedDownload(void)
+{
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Downloading from the seed %s\r\n", xBootloaderVariables.seedIP);
+	#endif
+	
+	HAL_FLASH_Unlock();
+	
+	vEraseStorageSpace();
+	
+	xBootloaderVariables.wifiBootloading = true;
+	
+	vBootloaderTransferStart();
+	
+	memset(xBootloaderVariables.failedChunks, 0, sizeof(xBootloaderVariables.failedChunks));
+	
+	for (uint32_t chunk = 0; chunk < manifest->chunkCount; chunk++)
+	{
+		xBootloaderVariables.failedChunks[chunk / 32] |= 1U << (chunk % 32);
+	}
+	
+	for (uint32_t attempt = 0; attempt < SEED_ATTEMPTS; attempt++)/*a busy seed refuses the connection, the chunks stored are kept*/
+	{
+		if (bBootloaderRefetchFailedChunks())
+		{
+			xBootloaderVariables.receivedImageLength				 = manifest->imageLength;
+			xBootloaderVariables.applicationStoredAddressEnd = xBootloaderVariables.applicationStoredAddressStart + manifest->imageLength;
+			
+			vEvaluateCRC32(ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart), manifest->imageLength, 0), manifest->imageCRC);
+			
+			return;
+		}
+	}
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Seed failed, downloading from the TFTP server\r\n");
+	#endif
+	
+	xBootloaderVariables.wifiBootloading = false;
+	xBootloaderVariables.seedIP[0]			 = 0;
+	
+	vTFTPReadRequestWifi(xBootloaderVariables.remoteIP, xBootloaderVariables.remoteFixedPort, xBootloaderVariables.fileName);
+}
+
+/**
+* @brief This function serves the installed image to peers on the Wi-Fi network, call it periodically while no transfer runs
+* @note  The image is checked against its trailer CRC32 once, then an AT+CIPSERVER listener is opened for SEED_MAX_PEERS
+*				 connections, so peers never get the links of the client sockets, a peer over it retries later. A GET with a
+*				 "Range: bytes=first-last" header of up to FIRMWARE_REFETCH_PIECE_SIZE bytes is answered with a 206 Partial
+*				 Content, anything else with a 416. Requests are served one at a time, the ones of other peers received
+*				 meanwhile are kept for the next calls, a peer asks again after its timeout if its request was lost.
+*				 Nothing is served by a build accepting encrypted images, the flash holds them decrypted, nor for an image
+*				 which was not installed as a single image by the metadata log, a bundle leaves only its application
+*				 component in place and peers would be served other bytes than the file they download.
+*/
+void vBootloaderSeedServe(void)
+{
+	#if BOOTLOADER_SEED
+	if (!bBootloaderLinkUp(LINK_WIFI) || xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading || xBootloaderVariables.seedImageLength == SEED_NOT_SERVABLE)
+	{
+		return;
+	}
+	
+	if (!xBootloaderVariables.seedListening)
+	{
+		const metadataRecord_t *installed = &xBootloaderVariables.metadata.slots[METADATA_APPLICATION_SLOT];
+		uint32_t imageLength = BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS + IMAGE_LENGTH_OFFSET);
+		char serverStart[50];
+		
+		if (BOOTLOADER_DECRYPTION || xBootloaderVariables.manifest.encrypted || installed->state != METADATA_SLOT_INSTALLED || installed->imageLength != imageLength ||
+				installed->imageCRC != BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET) || BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS) == BUNDLE_MAGIC ||
+				imageLength > MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE || ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), imageLength, 0) != BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET))
+		{
+			xBootloaderVariables.seedImageLength = SEED_NOT_SERVABLE;
+			
+			return;
+		}
+		
+		sprintf(serverStart, "AT+CIPSERVERMAXCONN=%i\r\n", SEED_MAX_PEERS);
+		
+		clearWifiBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_WIFI, serverStart);
+		
+		xBootloaderVariables.seedListening = bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 2500);
+		
+		sprintf(serverStart, "AT+CIPSERVER=1,%i\r\n", SEED_HTTP_PORT);
+		
+		clearWifiBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_WIFI, serverStart);
+		
+		xBootloaderVariables.seedListening	 = xBootloaderVariables.seedListening && bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 2500);
+		xBootloaderVariables.seedImageLength = xBootloaderVariables.seedListening ? imageLength : SEED_NOT_SERVABLE;
+		
+		clearWifiBufferAndResetItsIndex();
+		
+		return;
+	}
+	
+	while (bBootloaderSeedAnswer())/*requests of other peers were received meanwhile*/
+	{
+	}
+	#endif
+}
+
+/**
+* @brief  This function answers the first complete request of a peer in the Wifi buffer
+* @retval true if requests received while it was answered are waiting in the Wifi buffer
+*/
+bool bBootloaderSeedAnswer(void)
+{
+	char response[FIRMWARE_REFETCH_PIECE_SIZE + 100], sendQuantity[50], pending[SEED_PENDING_SIZE], *end;
+	uint32_t id, length, first = 0, last = 0, bodyLength = 0, responseLength, pendingLength, served;
+	int32_t frame = 0, range;
+	
+	vBootloaderDrainUartRings();
+	
+	while ((frame = lBootloaderFindPattern(WIFI_BUFFER, WIFI_BUFFER_RECEIVE_INDEX, "+IPD,", frame)) >= 0)/*"+IPD,<id>,<len>:<data>"*/
+	{
+		id = strtoul(&WIFI_BUFFER[frame + 5], &end, 10);
+		
+		frame++;
+		
+		if (*end == ',' && id != WIFI_TCP_SOCKET_NO && id != WIFI_UDP_SOCKET_NO)/*not one of our own client sockets*/
+		{
+			break;
+		}
+	}
+	
+	if (frame < 0)
+	{
+		return false;
+	}
+	
+	length = strtoul(end + 1, &end, 10);
+	
+	if (*end != ':' || (end + 1 - WIFI_BUFFER) + length > WIFI_BUFFER_RECEIVE_INDEX)/*request is still arriving*/
+	{
+		return false;
+	}
+	
+	served = (end + 1 - WIFI_BUFFER) + length;
+	range  = lBootloaderFindPattern(end + 1, length, "Range: bytes=", 0);
+	
+	if (range >= 0)
+	{
+		first = strtoul(end + 1 + range + strlen("Range: bytes="), &end, 10);
+		last  = (*end == '-') ? strtoul(end + 1, NULL, 10) : 0;
+	}
+	
+	if (range < 0 || last < first || last >= xBootloaderVariables.seedImageLength || last - first + 1 > FIRMWARE_REFETCH_PIECE_SIZE)
+	{
+		responseLength = sprintf(response, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n");
+	}
+	else
+	{
+		bodyLength		 = last - first + 1;
+		responseLength = sprintf(response, "HTTP/1.1 206 Partial Content\r\nContent-Length: %u\r\n\r\n", bodyLength);
+		
+		memcpy(&response[responseLength], (const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS + first), bodyLength);
+	}
+	
+	responseLength += bodyLength;
+	
+	sprintf(sendQuantity, "AT+CIPSEND=%u,%u\r\n", id, responseLength);
+	
+	pendingLength = ulBootloaderSeedKeepRequests(pending, 0, frame - 1, served);
+	
+	clearWifiBufferAndResetItsIndex();
+	bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, response, responseLength, NULL, 0);
+	bCheckIfResponseReceivedOnTime("SEND OK\r\n", WIFI_BUFFER, 5000);
+	
+	pendingLength = ulBootloaderSeedKeepRequests(pending, pendingLength, 0, 0);/*arrived while this one was answered*/
+	
+	clearWifiBufferAndResetItsIndex();
+	
+	memcpy(WIFI_BUFFER, pending, pendingLength);
+	
+	WIFI_BUFFER_RECEIVE_INDEX = pendingLength;
+	
+	return pendingLength != 0;
+}
+
+/**
+* @brief  This function copies the complete requests of peers out of the Wifi buffer, so the ones received while a request
+*					is answered are served next instead of being cleared with the modem responses
+* @params char pending[]				-> requests kept so far, SEED_PENDING_SIZE bytes, appended to
+*					uint32_t pendingLength	-> bytes in pending
+*					uint32_t skipFrom				-> index of the request being answered, it is not kept
+*					uint32_t skipTo					-> index after it, equal to skipFrom for none
+* @retval bytes in pending, a request which doesn't fit is left to the retry of its peer
+*/
+uint32_t ulBootloaderSeedKeepRequests(char pending[], uint32_t pendingLength, uint32_t skipFrom, uint32_t skipTo)
+{
+	int32_t frame = 0;
+	
+	while ((frame = lBootloaderFindPattern(WIFI_BUFFER, WIFI_BUFFER_RECEIVE_INDEX, "+IPD,", frame)) >= 0)/*"+IPD,<id>,<len>:<data>"*/
+	{
+		char *end;
+		uint32_t id = strtoul(&WIFI_BUFFER[frame + 5], &end, 10), frameEnd;
+		
+		if (*end != ',' || id == WIFI_TCP_SOCKET_NO || id == WIFI_UDP_SOCKET_NO)/*one of our own client sockets*/
+		{
+			frame++;
+			
+			continue;
+		}
+		
+		frameEnd = strtoul(end + 1, &end, 10);
+		frameEnd += end + 1 - WIFI_BUFFER;
+		
+		if (*end != ':' || frameEnd > WIFI_BUFFER_RECEIVE_INDEX)/*still arriving, the flush drops it*/
+		{
+			break;
+		}
+		
+		if (((uint32_t)frame < skipFrom || (uint32_t)frame >= skipTo) && pendingLength + frameEnd - frame <= SEED_PENDING_SIZE)
+		{
+			memcpy(&pending[pendingLength], &WIFI_BUFFER[frame], frameEnd - frame);
+			
+			pendingLength += frameEnd - frame;
+		}
+		
+		frame = frameEnd;
+	}
+	
+	return pendingLength;
+}
+
+/**
+* @brief  This function chooses the chunk an idle link downloads next
+* @params multipathLink_t paths[]	-> state of both links
+*					bootloaderLink_t link		-> idle link
+* @retval first chunk not stored and not held by the other link, else the chunk the other link holds, MULTIPATH_NO_CHUNK if none
+*/
+uint32_t ulBootloaderMultipathNextChunk(multipathLink_t paths[], bootloaderLink_t link)
+{
+	uint32_t held = paths[link == LINK_WIFI ? LINK_GSM : LINK_WIFI].chunk;
+	
+	for (uint32_t chunk = 0; chunk < xBootloaderVariables.manifest.chunkCount; chunk++)
+	{
+		if ((xBootloaderVariables.failedChunks[chunk / 32] & (1U << (chunk % 32))) && chunk != held)
+		{
+			return chunk;
+		}
+	}
+	
+	return held;
+}
+
+/**
+* @brief  This function asks the next piece of the chunk of a link by an HTTP Range request
+* @params multipathLink_t *path	-> link state, its chunk and received bytes tell the range
+*					bootloaderLink_t link	-> link to ask on
+*/
+void vBootloaderMultipathAsk(multipathLink_t *path, bootloaderLink_t link)
+{
+	char rangeRequest[200];
+	uint32_t offset = path->chunk * FIRMWARE_CHUNK_SIZE + path->done;
+	uint32_t piece  = (ulBootloaderChunkLength(path->chunk) - path->done < FIRMWARE_REFETCH_PIECE_SIZE) ? ulBootloaderChunkLength(path->chunk) - path->done : FIRMWARE_REFETCH_PIECE_SIZE;
+	
+	vPrepareRangeRequest(rangeRequest, offset, offset + piece - 1);
+	
+	vBootloaderWebSocketSend(link, rangeRequest, strlen(rangeRequest));
+	
+	path->requestTick = BOOTLOADER_GET_TICK();
+}
+
+/**
+* @brief  This function gives the chunk of a failed link back and reconnects it, a link failing MULTIPATH_LINK_RETRIES times in a row is left out
+* @params multipathLink_t *path	-> state of the failed link
+*					bootloaderLink_t link	-> failed link
+*					uint8_t attempts[]		-> failed downloads per chunk
+*/
+void vBootloaderMultipathFailed(multipathLink_t *path, bootloaderLink_t link, uint8_t attempts[])
+{
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Link %d failed on chunk %u\r\n", link, path->chunk);
+	#endif
+	
+	if (path->socketOpen)
+	{
+		vBootloaderWebSocketClose(link);
+		
+		path->socketOpen = false;
+	}
+	
+	if (path->chunk != MULTIPATH_NO_CHUNK && (xBootloaderVariables.failedChunks[path->chunk / 32] & (1U << (path->chunk % 32))) && ++attempts[path->chunk] >= FIRMWARE_REFETCH_RETRIES)
+	{
+		vBootloaderDiscardDownload();
+	}
+	
+	path->chunk = MULTIPATH_NO_CHUNK;
+	
+	if (++path->failures >= MULTIPATH_LINK_RETRIES)
+	{
+		path->up = false;
+	}
+}
+
+/**
+* @brief  This function downloads a byte range of the firmware file from the web server in FIRMWARE_REFETCH_PIECE_SIZE pieces
+* @params bootloaderLink_t link		-> link of an open web server socket
+*					uint32_t offset					-> first byte of the range in the image
+*					uint32_t length					-> bytes to be downloaded
+*					uint8_t destination[]		-> buffer to be filled
+* @retval true if the whole range arrived
+*/
+bool bBootloaderRangeFetch(bootloaderLink_t link, uint32_t offset, uint32_t length, uint8_t destination[])
+{
+	char rangeRequest[200];
+	
+	for (uint32_t done = 0; done < length; )
+	{
+		uint32_t piece = (length - done < FIRMWARE_REFETCH_PIECE_SIZE) ? length - done : FIRMWARE_REFETCH_PIECE_SIZE;
+		
+		vPrepareRangeRequest(rangeRequest, offset + done, offset + done + piece - 1);
+		
+		vBootloaderWebSocketSend(link, rangeRequest, strlen(rangeRequest));
+		
+		if (ulBootloaderReceiveHTTPBody(link, &destination[done], piece, FIRMWARE_REFETCH_TIMEOUT) != piece)
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Range %u-%u could not be downloaded\r\n", offset + done, offset + done + piece - 1);
+			#endif
+			
+			return false;
+		}
+		
+		done += piece;
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function prepares the HTTP Range request for a byte range of the firmware file being downloaded
+* @params char request[]	-> the request to be sent over the web server socket
+*					uint32_t first	-> first byte of the range
+*					uint32_t last		-> last byte of the range, included
+*/
+void vPrepareRangeRequest(char request[], uint32_t first, uint32_t last)
+{
+	sprintf(request, "%s%s%s%u-%u\r\n\r\n", FIRMWARE_RANGE_WEB_SERVER_PATH_FIRST_PART, xBootloaderVariables.fileName, FIRMWARE_RANGE_WEB_SERVER_PATH_SECOND_PART, first, last);
+}
+
+/**
+* @brief  This function connects to the web server over a link
+* @param  bootloaderLink_t link -> LINK_WIFI or LINK_GSM
+* @retval true if connected
+*/
+bool bBootloaderWebSocketOpen(bootloaderLink_t link)
+{
+	char connectToTCPServer[100];
+	
+	if (link == LINK_WIFI)
+	{
+		clearWifiBufferAndResetItsIndex();
+		
+		if (xBootloaderVariables.seedIP[0] != 0)/*image is served by a device on the LAN*/
+		{
+			sprintf(connectToTCPServer, "AT+CIPSTART=%i,\"TCP\",\"%s\",%i\r\n", WIFI_TCP_SOCKET_NO, xBootloaderVariables.seedIP, SEED_HTTP_PORT);
+		}
+		else
+		{
+			sprintf(connectToTCPServer, "AT+CIPSTART=%i,\"TCP\",%s,%i\r\n", WIFI_TCP_SOCKET_NO, FIRMWARE_VERSION_WEB_SERVER_ADDRESS, FIRMWARE_VERSION_WEB_SERVER_PORT);
+		}
+		
+		vBootloaderTxSend(LINK_WIFI, connectToTCPServer);
+		
+		return bCheckIfResponseReceivedOnTime("CONNECT\r\n\r\nOK\r\n", WIFI_BUFFER, 15000);
+	}
+	else
+	{
+		clearGSMBufferAndResetItsIndex();
+		
+		sprintf(connectToTCPServer, "AT+QIOPEN=%i,%i,\"TCP\",%s,%i,%i,1\r\n", GSM_TCP_SOCKET_CONTEXT_ID, GSM_TCP_SOCKET_CONNECT_ID, FIRMWARE_VERSION_WEB_SERVER_ADDRESS, FIRMWARE_VERSION_WEB_SERVER_PORT, FIRMWARE_VERSION_WEB_SERVER_PORT);
+		
+		vBootloaderTxSend(LINK_GSM, connectToTCPServer);
+		
+		return bCheckIfResponseReceivedOnTime(GSM_TCP_SOCKET_OPENED, GSM_BUFFER, 15000);
+	}
+}
+
+/**
+* @brief This function closes the web server socket opened by bBootloaderWebSocketOpen
+* @param bootloaderLink_t link -> link of the socket
+*/
+void vBootloaderWebSocketClose(bootloaderLink_t link)
+{
+	char closeSocket[50];
+	
+	if (link == LINK_WIFI)
+	{
+		sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", WIFI_TCP_SOCKET_NO);
+		vBootloaderTxSend(LINK_WIFI, closeSocket);
+		bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 750);
+		clearWifiBufferAndResetItsIndex();
+	}
+	else
+	{
+		sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_TCP_SOCKET_CONNECT_ID);
+		clearGSMBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_GSM, closeSocket);
+		bCheckIfResponseReceivedOnTime("OK\r\n", GSM_BUFFER, 5000);
+	}
+}
+
+/**
+* @brief  This function sends data over the web server socket, the receive buffer is cleared for the response
+* @params bootloaderLink_t link -> link of the socket
+*					char data[]						-> data to be sent
+*					uint32_t length				-> length of the data
+*/
+void vBootloaderWebSocketSend(bootloaderLink_t link, char data[], uint32_t length)
+{
+	char sendQuantity[50];
+	
+	if (link == LINK_WIFI)
+	{
+		sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_TCP_SOCKET_NO, length);
+		clearWifiBufferAndResetItsIndex();
+		bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, data, length, NULL, 0);
+	}
+	else
+	{
+		sprintf(sendQuantity, "AT+QISEND=%i,%i\r\n", GSM_TCP_SOCKET_CONNECT_ID, length);
+		clearGSMBufferAndResetItsIndex();
+		bBootloaderTxSendPayload(LINK_GSM, sendQuantity, data, length, NULL, 0);
+	}
+}
+
+/**
+* @brief  This function waits for a "206 Partial Content" response on the web server socket and copies its body
+* @params bootloaderLink_t link		-> link of the socket
+*					uint8_t destination[]		-> buffer to be filled with the body
+*					uint32_t expectedLength	-> body length asked by the Range header
+*					uint32_t timeout				-> desired timeout in ms
+* @retval bytes copied, 0 if the response did not arrive on time or is not a partial content
+*/
+uint32_t ulBootloaderReceiveHTTPBody(bootloaderLink_t link, uint8_t destination[], uint32_t expectedLength, uint32_t timeout)
+{
+	uint32_t timeCount = 0;
+	
+	while (timeCount < timeout)
+	{
+		int32_t received = lBootloaderPollHTTPBody(link, destination, expectedLength);
+		
+		if (received != 0)
+		{
+			return (received > 0) ? received : 0;
+		}
+		
+		WATCHDOG_RESET();
+		
+		HAL_Delay(1);
+		
+		timeCount++;
+	}
+	
+	return 0;
+}
+
+/**
+* @brief  This function checks once, without waiting, if a "206 Partial Content" response is complete on the web server socket
+* @params bootloaderLink_t link		-> link of the socket
+*					uint8_t destination[]		-> buffer to be filled with the body
+*					uint32_t expectedLength	-> body length asked by the Range header
+* @retval bytes copied, 0 if the response is still arriving, -1 if it is not a partial content
+*/
+int32_t lBootloaderPollHTTPBody(bootloaderLink_t link, uint8_t destination[], uint32_t expectedLength)
+{
+	char response[FIRMWARE_REFETCH_PIECE_SIZE + 512], frameMarker[30];
+	uint32_t collected;
+	int32_t body;
+	
+	vBootloaderDrainUartRings();
+	
+	if (link == LINK_WIFI)
+	{
+		sprintf(frameMarker, "+IPD,%i,", WIFI_TCP_SOCKET_NO);
+		
+		collected = ulBootloaderCollectSocketPayload(WIFI_BUFFER, WIFI_BUFFER_RECEIVE_INDEX, frameMarker, 1, response, sizeof(response));/*"+IPD,4,<len>:<data>"*/
+	}
+	else
+	{
+		sprintf(frameMarker, "+QIURC: \"recv\",%i,", GSM_TCP_SOCKET_CONNECT_ID);
+		
+		collected = ulBootloaderCollectSocketPayload(GSM_BUFFER, GSM_BUFFER_RECEIVE_INDEX, frameMarker, 2, response, sizeof(response));/*"+QIURC: "recv",0,<len>\r\n<data>"*/
+	}
+	
+	body = lBootloaderFindPattern(response, collected, "\r\n\r\n", 0);
+	
+	if (body < 0 || collected - (body + 4) < expectedLength)
+	{
+		return 0;
+	}
+	
+	if (lBootloaderFindPattern(response, body, " 206 ", 0) < 0)
+	{
+		return -1;
+	}
+	
+	memcpy(destination, &response[body + 4], expectedLength);
+	
+	return expectedLength;
+}
+
+/**
+* @brief  This function joins the payloads of the socket data frames found in a modem buffer
+* @params char buffer[]						 -> modem buffer
+*					uint32_t length					 -> bytes received in the modem buffer
+*					char frameMarker[]			 -> text before the payload length of a frame
+*					uint32_t terminatorSize	 -> bytes between the payload length and the payload
+*					char payload[]					 -> buffer to be filled
+*					uint32_t maxLength			 -> size of the payload buffer
+* @retval bytes of payload collected from complete frames
+*/
+uint32_t ulBootloaderCollectSocketPayload(char buffer[], uint32_t length, char frameMarker[], uint32_t terminatorSize, char payload[], uint32_t maxLength)
+{
+	uint32_t collected = 0;
+	int32_t frame = 0;
+	
+	while ((frame = lBootloaderFindPattern(buffer, length, frameMarker, frame)) >= 0)
+	{
+		char *end;
+		uint32_t frameLength = strtoul(&buffer[frame + strlen(frameMarker)], &end, 10);
+		uint32_t start = (end - buffer) + terminatorSize;
+		
+		if (start + frameLength > length)/*frame is still arriving*/
+		{
+			break;
+		}
+		
+		if (collected + frameLength > maxLength)
+		{
+			frameLength = maxLength - collected;
+		}
+		
+		memcpy(&payload[collected], &buffer[start], frameLength);
+		
+		collected += frameLength;
+		
+		frame = start + frameLength;
+	}
+	
+	return collected;
+}
+
+/**
+* @brief  This function searches a text in a binary buffer which may contain zeros
+* @params const char buffer[]		-> buffer to be searched
+*					uint32_t length				-> bytes in the buffer
+*					const char pattern[]	-> text to be found
+*					uint32_t from					-> index where the search starts
+* @retval index of the first match, -1 if not found
+*/
+int32_t lBootloaderFindPattern(const char buffer[], uint32_t length, const char pattern[], uint32_t from)
+{
+	uint32_t patternLength = strlen(pattern);
+	
+	for (uint32_t i = from; i + patternLength <= length; i++)
+	{
+		if (memcmp(&buffer[i], pattern, patternLength) == 0)
+		{
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+/**
+* @brief  This function programs a byte buffer to the flash word by word, the last word is padded with erased flash value
+* @params uint32_t address	-> word aligned flash address
+*					uint8_t data[]		-> data to be written
+*					uint32_t length		-> bytes to be written
+*/
+void vBootloaderProgramFlash(uint32_t address, uint8_t data[], uint32_t length)
+{
+	BOOTLOADER_TIMING_START(flashStart);
+	
+	for (uint32_t i = 0; i < length; i += 4)
+	{
+		uint32_t word = 0xFFFFFFFF;
+		
+		memcpy(&word, &data[i], (length - i < 4) ? length - i : 4);
+		
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i, word) != HAL_OK)
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("System Reset: TFTP data could not be written to the flash!\r\n");
+			#endif
+			
+			NVIC_SystemReset();
+		}
+	}
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_FLASH_WRITE, flashStart);
+}
+
+/**
+* @brief  This function sends acknowledge to the server per incoming package
+*         If its the last package, function checks for the CRC matching and if it is OK, function writes the firmware version to the flash
+* @params char ack[]    -> acknowledge buffer to be sent
+*					uint32_t size -> size of the acknowledge buffer
+*/
+void vTFTPSendAcknowledge(char ack[], uint32_t size)
+{	
+	char sendQuantity[50];
+	
+	if (!bBootloaderPacerTake((uint8_t *)ack))/*sent by vBootloaderPacerService once the bucket refills, the block is consumed*/
+	{
+		if (xBootloaderVariables.wifiBootloading)
+		{
+			clearWifiBufferAndResetItsIndex();
+		}
+		else
+		{
+			clearGSMBufferAndResetItsIndex();
+		}
+		
+		return;
+	}
+	
+	if(xBootloaderVariables.wifiBootloading)
+	{
+		clearWifiBufferAndResetItsIndex();
+		
+		sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_UDP_SOCKET_NO, size);
+		
+		bBootloaderTxSendPayload(LINK_WIFI, sendQuantity, ack, size, vBootloaderAckSent, BOOTLOADER_TIMESTAMP());/*the ISRs send the acknowledge on the prompt, the task goes back to the next block*/
+	}
+	else if (xBootloaderVariables.gsmBootloading)
+	{
+		clearGSMBufferAndResetItsIndex();
+		
+		sprintf(sendQuantity, "AT+QISEND=%i,%i,\"%s\",%i\r\n", GSM_UDP_SOCKET_CONNECT_ID, size, xBootloaderVariables.remoteIP, xBootloaderVariables.remotePort);
+		
+		bBootloaderTxSendPayload(LINK_GSM, sendQuantity, ack, size, vBootloaderAckSent, BOOTLOADER_TIMESTAMP());
+	}
+}
+
+/**
+* @brief  This function decides if an acknowledge may be sent now, each one asks the server for another 512 bytes block
+* @param  uint8_t ack[] -> 4 bytes TFTP acknowledge, kept to be sent later if the bucket is empty
+* @retval true if the acknowledge should be sent now
+* @note   Tokens refill at rateCap while APPLICATION_TRAFFIC_PENDING(), the transfer runs at full speed otherwise
+*/
+bool bBootloaderPacerTake(uint8_t ack[])
+{
+	downloadPacer_t *pacer = &xBootloaderVariables.pacer;
+	uint32_t now = BOOTLOADER_GET_TICK(), block = ack[2] * 0x100 + ack[3];
+	bool paced = (pacer->rateCap != 0 && APPLICATION_TRAFFIC_PENDING());
+	
+	pacer->tokens			= paced ? pacer->tokens + (uint32_t)((uint64_t)(now - pacer->lastRefill) * pacer->rateCap / 1000) : DOWNLOAD_BUCKET_SIZE;
+	pacer->tokens			= (pacer->tokens > DOWNLOAD_BUCKET_SIZE) ? DOWNLOAD_BUCKET_SIZE : pacer->tokens;
+	pacer->lastRefill = now;
+	
+	if (paced && pacer->tokens < 512)
+	{
+		memcpy(pacer->pendingAck, ack, sizeof(pacer->pendingAck));
+		
+		pacer->ackPending = true;
+		
+		vBootloaderTimerStart(PACER_TIMER, (512 - pacer->tokens) * 1000 / pacer->rateCap + 1);
+		
+		return false;
+	}
+	
+	if (paced)
+	{
+		pacer->tokens -= 512;
+	}
+	
+	if (block != pacer->lastAckedBlock)/*a repeated acknowledge asks nothing new*/
+	{
+		pacer->lastAckedBlock = block;
+		pacer->bytesAcked		 += 512;
+		pacer->windowBytes	 += 512;
+	}
+	
+	if (now - pacer->windowStart >= DOWNLOAD_RATE_WINDOW)
+	{
+		pacer->currentRate = (uint32_t)((uint64_t)pacer->windowBytes * 1000 / (now - pacer->windowStart));
+		pacer->windowStart = now;
+		pacer->windowBytes = 0;
+	}
+	
+	return true;
+}
+
+/**
+* @brief This function sends the acknowledge held back by bBootloaderPacerTake, called when PACER_TIMER expires
+*/
+void vBootloaderPacerService(void)
+{
+	uint8_t ack[4];
+	
+	vBootloaderTimerStop(PACER_TIMER);
+	
+	if (xBootloaderVariables.pacer.ackPending && (xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading))
+	{
+		xBootloaderVariables.pacer.ackPending = false;
+		
+		memcpy(ack, xBootloaderVariables.pacer.pendingAck, sizeof(ack));
+		
+		vTFTPSendAcknowledge((char *)ack, sizeof(ack));
+	}
+}
+
+/**
+* @brief This function changes the download rate cap applied while the application has modem traffic queued
+* @param uint32_t bytesPerSecond -> new cap, 0 never paces
+*/
+void vBootloaderSetRateCap(uint32_t bytesPerSecond)
+{
+	xBootloaderVariables.pacer.rateCap = bytesPerSecond;
+}
+
+/**
+* @brief  This function tells the download rate of the running transfer
+* @retval bytes/s over the last DOWNLOAD_RATE_WINDOW, 0 when no transfer runs
+*/
+uint32_t ulBootloaderDownloadRate(void)
+{
+	return (xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading) ? xBootloaderVariables.pacer.currentRate : 0;
+}
+
+/**
+* @brief  This function estimates the time left of the running transfer at the current rate
+* @retval seconds, BOOTLOADER_NO_DEADLINE if no transfer runs, the rate is not known yet or the image has no manifest length
+*/
+uint32_t ulBootloaderDownloadETA(void)
+{
+	downloadPacer_t *pacer = &xBootloaderVariables.pacer;
+	
+	if (ulBootloaderDownloadRate() == 0 || !xBootloaderVariables.manifest.present)
+	{
+		return BOOTLOADER_NO_DEADLINE;
+	}
+	
+	return (pacer->bytesAcked >= xBootloaderVariables.manifest.imageLength) ? 0 : (xBootloaderVariables.manifest.imageLength - pacer->bytesAcked) / pacer->currentRate;
+}
+
+/**
+* @brief If 516 bytes of data arrived, it is not the last package of TFTP.
+* @params char tftpBuffer[]					-> input buffer to write into flash
+*					uint32_t tftpBufferIndex  -> how many bytes to be written
+*/
+void vFlashTFTPBuffer(char tftpBuffer[], uint32_t tftpBufferIndex)
+{
+	uint32_t dataToBeWrittenToTheFlash = 0;
+	
+	BOOTLOADER_TIMING_START(flashStart);
+	
+	for (int i = 1; i < tftpBufferIndex/4; i++)
+	{
+		/*data will be written to the flash using byte shifted addition*/
+		dataToBeWrittenToTheFlash = 
+			tftpBuffer[4*i+3]*0x1000000 + 
+			tftpBuffer[4*i+2]*0x10000 + 
+			tftpBuffer[4*i+1]*0x100 + 
+			tftpBuffer[4*i];
+		
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, xBootloaderVariables.applicationStoredAddressEnd, dataToBeWrittenToTheFlash) != HAL_OK)
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("System Reset: TFTP data could not be written to the flash!\r\n");
+			#endif
+				
+			NVIC_SystemReset();
+		}
+		
+		xBootloaderVariables.applicationStoredAddressEnd += 4;
+	}
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_FLASH_WRITE, flashStart);
+}
+
+/**
+* @brief  CRC32 table for calculation mapping
+* @retval chosen array value
+*/
+const uint32_t crc32_tab[] = 
+{
+	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+	0xf3b97148, 0x84be41de,	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,	0x14015c4f, 0x63066cd9,
+	0xfa0f3d63, 0x8d080df5,	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,	0x35b5a8fa, 0x42b2986c,
+	0xdbbbc9d6, 0xacbcf940,	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,	0x76dc4190, 0x01db7106,
+	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+/**
+* @brief  CRC32 tables of the bytes 1, 2 and 3 positions ahead, for the word at a time calculation
+* @retval chosen array value
+*/
+const uint32_t crc32_slice_tab[3][256] = 
+{
+	{
+		0x00000000, 0x191b3141, 0x32366282, 0x2b2d53c3, 0x646cc504, 0x7d77f445,
+		0x565aa786, 0x4f4196c7, 0xc8d98a08, 0xd1c2bb49, 0xfaefe88a, 0xe3f4d9cb,
+		0xacb54f0c, 0xb5ae7e4d, 0x9e832d8e, 0x87981ccf, 0x4ac21251, 0x53d92310,
+		0x78f470d3, 0x61ef4192, 0x2eaed755, 0x37b5e614, 0x1c98b5d7, 0x05838496,
+		0x821b9859, 0x9b00a918, 0xb02dfadb, 0xa936cb9a, 0xe6775d5d, 0xff6c6c1c,
+		0xd4413fdf, 0xcd5a0e9e, 0x958424a2, 0x8c9f15e3, 0xa7b24620, 0xbea97761,
+		0xf1e8e1a6, 0xe8f3d0e7, 0xc3de8324, 0xdac5b265, 0x5d5daeaa, 0x44469feb,
+		0x6f6bcc28, 0x7670fd69, 0x39316bae, 0x202a5aef, 0x0b07092c, 0x121c386d,
+		0xdf4636f3, 0xc65d07b2, 0xed705471, 0xf46b6530, 0xbb2af3f7, 0xa231c2b6,
+		0x891c9175, 0x9007a034, 0x179fbcfb, 0x0e848dba, 0x25a9de79, 0x3cb2ef38,
+		0x73f379ff, 0x6ae848be, 0x41c51b7d, 0x58de2a3c, 0xf0794f05, 0xe9627e44,
+		0xc24f2d87, 0xdb541cc6, 0x94158a01, 0x8d0ebb40, 0xa623e883, 0xbf38d9c2,
+		0x38a0c50d, 0x21bbf44c, 0x0a96a78f, 0x138d96ce, 0x5ccc0009, 0x45d73148,
+		0x6efa628b, 0x77e153ca, 0xbabb5d54, 0xa3a06c15, 0x888d3fd6, 0x91960e97,
+		0xded79850, 0xc7cca911, 0xece1fad2, 0xf5facb93, 0x7262d75c, 0x6b79e61d,
+		0x4054b5de, 0x594f849f, 0x160e1258, 0x0f152319, 0x243870da, 0x3d23419b,
+		0x65fd6ba7, 0x7ce65ae6, 0x57cb0925, 0x4ed03864, 0x0191aea3, 0x188a9fe2,
+		0x33a7cc21, 0x2abcfd60, 0xad24e1af, 0xb43fd0ee, 0x9f12832d, 0x8609b26c,
+		0xc94824ab, 0xd05315ea, 0xfb7e4629, 0xe2657768, 0x2f3f79f6, 0x362448b7,
+		0x1d091b74, 0x04122a35, 0x4b53bcf2, 0x52488db3, 0x7965de70, 0x607eef31,
+		0xe7e6f3fe, 0xfefdc2bf, 0xd5d0917c, 0xcccba03d, 0x838a36fa, 0x9a9107bb,
+		0xb1bc5478, 0xa8a76539, 0x3b83984b, 0x2298a90a, 0x09b5fac9, 0x10aecb88,
+		0x5fef5d4f, 0x46f46c0e, 0x6dd93fcd, 0x74c20e8c, 0xf35a1243, 0xea412302,
+		0xc16c70c1, 0xd8774180, 0x9736d747, 0x8e2de606, 0xa500b5c5, 0xbc1b8484,
+		0x71418a1a, 0x685abb5b, 0x4377e898, 0x5a6cd9d9, 0x152d4f1e, 0x0c367e5f,
+		0x271b2d9c, 0x3e001cdd, 0xb9980012, 0xa0833153, 0x8bae6290, 0x92b553d1,
+		0xddf4c516, 0xc4eff457, 0xefc2a794, 0xf6d996d5, 0xae07bce9, 0xb71c8da8,
+		0x9c31de6b, 0x852aef2a, 0xca6b79ed, 0xd37048ac, 0xf85d1b6f, 0xe1462a2e,
+		0x66de36e1, 0x7fc507a0, 0x54e85463, 0x4df36522, 0x02b2f3e5, 0x1ba9c2a4,
+		0x30849167, 0x299fa026, 0xe4c5aeb8, 0xfdde9ff9, 0xd6f3cc3a, 0xcfe8fd7b,
+		0x80a96bbc, 0x99b25afd, 0xb29f093e, 0xab84387f, 0x2c1c24b0, 0x350715f1,
+		0x1e2a4632, 0x07317773, 0x4870e1b4, 0x516bd0f5, 0x7a468336, 0x635db277,
+		0xcbfad74e, 0xd2e1e60f, 0xf9ccb5cc, 0xe0d7848d, 0xaf96124a, 0xb68d230b,
+		0x9da070c8, 0x84bb4189, 0x03235d46, 0x1a386c07, 0x31153fc4, 0x280e0e85,
+		0x674f9842, 0x7e54a903, 0x5579fac0, 0x4c62cb81, 0x8138c51f, 0x9823f45e,
+		0xb30ea79d, 0xaa1596dc, 0xe554001b, 0xfc4f315a, 0xd7626299, 0xce7953d8,
+		0x49e14f17, 0x50fa7e56, 0x7bd72d95, 0x62cc1cd4, 0x2d8d8a13, 0x3496bb52,
+		0x1fbbe891, 0x06a0d9d0, 0x5e7ef3ec, 0x4765c2ad, 0x6c48916e, 0x7553a02f,
+		0x3a1236e8, 0x230907a9, 0x0824546a, 0x113f652b, 0x96a779e4, 0x8fbc48a5,
+		0xa4911b66, 0xbd8a2a27, 0xf2cbbce0, 0xebd08da1, 0xc0fdde62, 0xd9e6ef23,
+		0x14bce1bd, 0x0da7d0fc, 0x268a833f, 0x3f91b27e, 0x70d024b9, 0x69cb15f8,
+		0x42e6463b, 0x5bfd777a, 0xdc656bb5, 0xc57e5af4, 0xee530937, 0xf7483876,
+		0xb809aeb1, 0xa1129ff0, 0x8a3fcc33, 0x9324fd72
+	},
+	{
+		0x00000000, 0x01c26a37, 0x0384d46e, 0x0246be59, 0x0709a8dc, 0x06cbc2eb,
+		0x048d7cb2, 0x054f1685, 0x0e1351b8, 0x0fd13b8f, 0x0d9785d6, 0x0c55efe1,
+		0x091af964, 0x08d89353, 0x0a9e2d0a, 0x0b5c473d, 0x1c26a370, 0x1de4c947,
+		0x1fa2771e, 0x1e601d29, 0x1b2f0bac, 0x1aed619b, 0x18abdfc2, 0x1969b5f5,
+		0x1235f2c8, 0x13f798ff, 0x11b126a6, 0x10734c91, 0x153c5a14, 0x14fe3023,
+		0x16b88e7a, 0x177ae44d, 0x384d46e0, 0x398f2cd7, 0x3bc9928e, 0x3a0bf8b9,
+		0x3f44ee3c, 0x3e86840b, 0x3cc03a52, 0x3d025065, 0x365e1758, 0x379c7d6f,
+		0x35dac336, 0x3418a901, 0x3157bf84, 0x3095d5b3, 0x32d36bea, 0x331101dd,
+		0x246be590, 0x25a98fa7, 0x27ef31fe, 0x262d5bc9, 0x23624d4c, 0x22a0277b,
+		0x20e69922, 0x2124f315, 0x2a78b428, 0x2bbade1f, 0x29fc6046, 0x283e0a71,
+		0x2d711cf4, 0x2cb376c3, 0x2ef5c89a, 0x2f37a2ad, 0x709a8dc0, 0x7158e7f7,
+		0x731e59ae, 0x72dc3399, 0x7793251c, 0x76514f2b, 0x7417f172, 0x75d59b45,
+		0x7e89dc78, 0x7f4bb64f, 0x7d0d0816, 0x7ccf6221, 0x798074a4, 0x78421e93,
+		0x7a04a0ca, 0x7bc6cafd, 0x6cbc2eb0, 0x6d7e4487, 0x6f38fade, 0x6efa90e9,
+		0x6bb5866c, 0x6a77ec5b, 0x68315202, 0x69f33835, 0x62af7f08, 0x636d153f,
+		0x612bab66, 0x60e9c151, 0x65a6d7d4, 0x6464bde3, 0x662203ba, 0x67e0698d,
+		0x48d7cb20, 0x4915a117, 0x4b531f4e, 0x4a917579, 0x4fde63fc, 0x4e1c09cb,
+		0x4c5ab792, 0x4d98dda5, 0x46c49a98, 0x4706f0af, 0x45404ef6, 0x448224c1,
+		0x41cd3244, 0x400f5873, 0x4249e62a, 0x438b8c1d, 0x54f16850, 0x55330267,
+		0x5775bc3e, 0x56b7d609, 0x53f8c08c, 0x523aaabb, 0x507c14e2, 0x51be7ed5,
+		0x5ae239e8, 0x5b2053df, 0x5966ed86, 0x58a487b1, 0x5deb9134, 0x5c29fb03,
+		0x5e6f455a, 0x5fad2f6d, 0xe1351b80, 0xe0f771b7, 0xe2b1cfee, 0xe373a5d9,
+		0xe63cb35c, 0xe7fed96b, 0xe5b86732, 0xe47a0d05, 0xef264a38, 0xeee4200f,
+		0xeca29e56, 0xed60f461, 0xe82fe2e4, 0xe9ed88d3, 0xebab368a, 0xea695cbd,
+		0xfd13b8f0, 0xfcd1d2c7, 0xfe976c9e, 0xff5506a9, 0xfa1a102c, 0xfbd87a1b,
+		0xf99ec442, 0xf85cae75, 0xf300e948, 0xf2c2837f, 0xf0843d26, 0xf1465711,
+		0xf4094194, 0xf5cb2ba3, 0xf78d95fa, 0xf64fffcd, 0xd9785d60, 0xd8ba3757,
+		0xdafc890e, 0xdb3ee339, 0xde71f5bc, 0xdfb39f8b, 0xddf521d2, 0xdc374be5,
+		0xd76b0cd8, 0xd6a966ef, 0xd4efd8b6, 0xd52db281, 0xd062a404, 0xd1a0ce33,
+		0xd3e6706a, 0xd2241a5d, 0xc55efe10, 0xc49c9427, 0xc6da2a7e, 0xc7184049,
+		0xc25756cc, 0xc3953cfb, 0xc1d382a2, 0xc011e895, 0xcb4dafa8, 0xca8fc59f,
+		0xc8c97bc6, 0xc90b11f1, 0xcc440774, 0xcd866d43, 0xcfc0d31a, 0xce02b92d,
+		0x91af9640, 0x906dfc77, 0x922b422e, 0x93e92819, 0x96a63e9c, 0x976454ab,
+		0x9522eaf2, 0x94e080c5, 0x9fbcc7f8, 0x9e7eadcf, 0x9c381396, 0x9dfa79a1,
+		0x98b56f24, 0x99770513, 0x9b31bb4a, 0x9af3d17d, 0x8d893530, 0x8c4b5f07,
+		0x8e0de15e, 0x8fcf8b69, 0x8a809dec, 0x8b42f7db, 0x89044982, 0x88c623b5,
+		0x839a6488, 0x82580ebf, 0x801eb0e6, 0x81dcdad1, 0x8493cc54, 0x8551a663,
+		0x8717183a, 0x86d5720d, 0xa9e2d0a0, 0xa820ba97, 0xaa6604ce, 0xaba46ef9,
+		0xaeeb787c, 0xaf29124b, 0xad6fac12, 0xacadc625, 0xa7f18118, 0xa633eb2f,
+		0xa4755576, 0xa5b73f41, 0xa0f829c4, 0xa13a43f3, 0xa37cfdaa, 0xa2be979d,
+		0xb5c473d0, 0xb40619e7, 0xb640a7be, 0xb782cd89, 0xb2cddb0c, 0xb30fb13b,
+		0xb1490f62, 0xb08b6555, 0xbbd72268, 0xba15485f, 0xb853f606, 0xb9919c31,
+		0xbcde8ab4, 0xbd1ce083, 0xbf5a5eda, 0xbe9834ed
+	},
+	{
+		0x00000000, 0xb8bc6765, 0xaa09c88b, 0x12b5afee, 0x8f629757, 0x37def032,
+		0x256b5fdc, 0x9dd738b9, 0xc5b428ef, 0x7d084f8a, 0x6fbde064, 0xd7018701,
+		0x4ad6bfb8, 0xf26ad8dd, 0xe0df7733, 0x58631056, 0x5019579f, 0xe8a530fa,
+		0xfa109f14, 0x42acf871, 0xdf7bc0c8, 0x67c7a7ad, 0x75720843, 0xcdce6f26,
+		0x95ad7f70, 0x2d111815, 0x3fa4b7fb, 0x8718d09e, 0x1acfe827, 0xa2738f42,
+		0xb0c620ac, 0x087a47c9, 0xa032af3e, 0x188ec85b, 0x0a3b67b5, 0xb28700d0,
+		0x2f503869, 0x97ec5f0c, 0x8559f0e2, 0x3de59787, 0x658687d1, 0xdd3ae0b4,
+		0xcf8f4f5a, 0x7733283f, 0xeae41086, 0x525877e3, 0x40edd80d, 0xf851bf68,
+		0xf02bf8a1, 0x48979fc4, 0x5a22302a, 0xe29e574f, 0x7f496ff6, 0xc7f50893,
+		0xd540a77d, 0x6dfcc018, 0x359fd04e, 0x8d23b72b, 0x9f9618c5, 0x272a7fa0,
+		0xbafd4719, 0x0241207c, 0x10f48f92, 0xa848e8f7, 0x9b14583d, 0x23a83f58,
+		0x311d90b6, 0x89a1f7d3, 0x1476cf6a, 0xaccaa80f, 0xbe7f07e1, 0x06c36084,
+		0x5ea070d2, 0xe61c17b7, 0xf4a9b859, 0x4c15df3c, 0xd1c2e785, 0x697e80e0,
+		0x7bcb2f0e, 0xc377486b, 0xcb0d0fa2, 0x73b168c7, 0x6104c729, 0xd9b8a04c,
+		0x446f98f5, 0xfcd3ff90, 0xee66507e, 0x56da371b, 0x0eb9274d, 0xb6054028,
+		0xa4b0efc6, 0x1c0c88a3, 0x81dbb01a, 0x3967d77f, 0x2bd27891, 0x936e1ff4,
+		0x3b26f703, 0x839a9066, 0x912f3f88, 0x299358ed, 0xb4446054, 0x0cf80731,
+		0x1e4da8df, 0xa6f1cfba, 0xfe92dfec, 0x462eb889, 0x549b1767, 0xec277002,
+		0x71f048bb, 0xc94c2fde, 0xdbf98030, 0x6345e755, 0x6b3fa09c, 0xd383c7f9,
+		0xc1366817, 0x798a0f72, 0xe45d37cb, 0x5ce150ae, 0x4e54ff40, 0xf6e89825,
+		0xae8b8873, 0x1637ef16, 0x048240f8, 0xbc3e279d, 0x21e91f24, 0x99557841,
+		0x8be0d7af, 0x335cb0ca, 0xed59b63b, 0x55e5d15e, 0x47507eb0, 0xffec19d5,
+		0x623b216c, 0xda874609, 0xc832e9e7, 0x708e8e82, 0x28ed9ed4, 0x9051f9b1,
+		0x82e4565f, 0x3a58313a, 0xa78f0983, 0x1f336ee6, 0x0d86c108, 0xb53aa66d,
+		0xbd40e1a4, 0x05fc86c1, 0x1749292f, 0xaff54e4a, 0x322276f3, 0x8a9e1196,
+		0x982bbe78, 0x2097d91d, 0x78f4c94b, 0xc048ae2e, 0xd2fd01c0, 0x6a4166a5,
+		0xf7965e1c, 0x4f2a3979, 0x5d9f9697, 0xe523f1f2, 0x4d6b1905, 0xf5d77e60,
+		0xe762d18e, 0x5fdeb6eb, 0xc2098e52, 0x7ab5e937, 0x680046d9, 0xd0bc21bc,
+		0x88df31ea, 0x3063568f, 0x22d6f961, 0x9a6a9e04, 0x07bda6bd, 0xbf01c1d8,
+		0xadb46e36, 0x15080953, 0x1d724e9a, 0xa5ce29ff, 0xb77b8611, 0x0fc7e174,
+		0x9210d9cd, 0x2aacbea8, 0x38191146, 0x80a57623, 0xd8c66675, 0x607a0110,
+		0x72cfaefe, 0xca73c99b, 0x57a4f122, 0xef189647, 0xfdad39a9, 0x45115ecc,
+		0x764dee06, 0xcef18963, 0xdc44268d, 0x64f841e8, 0xf92f7951, 0x41931e34,
+		0x5326b1da, 0xeb9ad6bf, 0xb3f9c6e9, 0x0b45a18c, 0x19f00e62, 0xa14c6907,
+		0x3c9b51be, 0x842736db, 0x96929935, 0x2e2efe50, 0x2654b999, 0x9ee8defc,
+		0x8c5d7112, 0x34e11677, 0xa9362ece, 0x118a49ab, 0x033fe645, 0xbb838120,
+		0xe3e09176, 0x5b5cf613, 0x49e959fd, 0xf1553e98, 0x6c820621, 0xd43e6144,
+		0xc68bceaa, 0x7e37a9cf, 0xd67f4138, 0x6ec3265d, 0x7c7689b3, 0xc4caeed6,
+		0x591dd66f, 0xe1a1b10a, 0xf3141ee4, 0x4ba87981, 0x13cb69d7, 0xab770eb2,
+		0xb9c2a15c, 0x017ec639, 0x9ca9fe80, 0x241599e5, 0x36a0360b, 0x8e1c516e,
+		0x866616a7, 0x3eda71c2, 0x2c6fde2c, 0x94d3b949, 0x090481f0, 0xb1b8e695,
+		0xa30d497b, 0x1bb12e1e, 0x43d23e48, 0xfb6e592d, 0xe9dbf6c3, 0x516791a6,
+		0xccb0a91f, 0x740cce7a, 0x66b96194, 0xde0506f1
+	}
+};
+
+/**
+* @brief  This function calculates CRC32 checksum of an input buffer
+* @param  const void *buf --> The iput buffer that its crc32 is to be calculated
+*					size_t size     --> Size of the input buffer
+*				  uint32_t init   --> Result of the previous crc32 calculation. If it is the first calculation, parameter should be entered 0.
+* @retval Result of the crc32 calculation.
+* @note   You can notice that 'p' is incremented 4 times before the process because, first 4 bytes of tftpBuffer is TFTP OP code and the rest is data
+*/
+uint32_t crc32(const void *buf, size_t size, uint32_t init)
+{
+	const uint8_t *p = buf;
+	*p++; *p++; *p++; *p++;
+	uint32_t crc = ~init;
+	while (size--)
+	crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ ~0U;
+}
+
+/**
+* @brief  This function calculates CRC32 checksum of a plain buffer, such as a flash region
+* @params const uint8_t data[] -> input buffer
+*					uint32_t length			 -> size of the input buffer
+*					uint32_t init				 -> result of the previous calculation, 0 for the first one
+* @retval Result of the crc32 calculation.
+*/
+uint32_t ulCRC32Region(const uint8_t data[], uint32_t length, uint32_t init)
+{
+	uint32_t crc = ~init;
+	
+	BOOTLOADER_TIMING_START(crcStart);
+	
+	while (length > 0 && ((uint32_t)data & 3))/*bytes up to the first word boundary*/
+	{
+		crc = crc32_tab[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+	
+	crc = ulCRC32Aligned((const uint32_t *)data, length, crc ^ ~0U);
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_CRC, crcStart);
+	
+	return crc;
+}
+
+/**
+* @brief  This function calculates CRC32 checksum a word at a time (slice by 4), one round of table lookups per word instead of per byte
+* @params const uint32_t data[] -> word aligned input buffer
+*					uint32_t length				-> size of the input buffer in bytes, need not be a multiple of 4
+*					uint32_t init					-> result of the previous calculation, 0 for the first one
+* @retval Result of the crc32 calculation.
+* @note   Doesn't touch any variable, it is safe to be called at systemInit before RAM is initialized
+*/
+uint32_t ulCRC32Aligned(const uint32_t data[], uint32_t length, uint32_t init)
+{
+	uint32_t crc = ~init;
+	const uint8_t *tail = (const uint8_t *)&data[length / 4];
+	
+	for (uint32_t i = 0; i < length / 4; i++)
+	{
+		crc ^= data[i];/*little endian, first byte of the word is the lowest one*/
+		crc  = crc32_slice_tab[2][crc & 0xFF] ^ crc32_slice_tab[1][(crc >> 8) & 0xFF] ^ crc32_slice_tab[0][(crc >> 16) & 0xFF] ^ crc32_tab[crc >> 24];
+	}
+	
+	for (uint32_t i = 0; i < (length & 3); i++)
+	{
+		crc = crc32_tab[(crc ^ tail[i]) & 0xFF] ^ (crc >> 8);
+	}
+	
+	return crc ^ ~0U;
+}
+
+/**
+* @brief  SHA-256 round constants
+* @retval chosen array value
+*/
+const uint32_t sha256_k[64] = 
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/**
+* @brief This function starts a streaming SHA-256 calculation
+* @param sha256Context_t *context -> calculation state
+*/
+void vSHA256Init(sha256Context_t *context)
+{
+	const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+	
+	memcpy(context->state, initial, sizeof(initial));
+	
+	context->length      = 0;
+	context->blockLength = 0;
+}
+
+/**
+* @brief  This function adds bytes to a streaming SHA-256 calculation, it can be called with any length
+* @params sha256Context_t *context -> calculation state
+*					const uint8_t data[]		 -> input buffer
+*					uint32_t length					 -> size of the input buffer
+*/
+void vSHA256Update(sha256Context_t *context, const uint8_t data[], uint32_t length)
+{
+	BOOTLOADER_TIMING_START(hashStart);
+	
+	context->length += length;
+	
+	while (length > 0)
+	{
+		if (context->blockLength == 0 && length >= 64)/*whole blocks are hashed in place*/
+		{
+			vSHA256Transform(context, data);
+			
+			data   += 64;
+			length -= 64;
+		}
+		else
+		{
+			uint32_t copy = (64 - context->blockLength < length) ? 64 - context->blockLength : length;
+			
+			memcpy(&context->block[context->blockLength], data, copy);
+			
+			context->blockLength += copy;
+			data                 += copy;
+			length               -= copy;
+			
+			if (context->blockLength == 64)
+			{
+				vSHA256Transform(context, context->block);
+				
+				context->blockLength = 0;
+			}
+		}
+	}
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_HASH, hashStart);
+}
+
+/**
+* @brief  This function pads the message and gives the SHA-256 digest, the context must be started again to be reused
+* @params sha256Context_t *context -> calculation state
+*					uint8_t digest[32]			 -> filled with the big endian digest
+*/
+void vSHA256Final(sha256Context_t *context, uint8_t digest[32])
+{
+	uint64_t bitLength = context->length * 8;
+	
+	context->block[context->blockLength++] = 0x80;
+	
+	if (context->blockLength > 56)/*no room for the length, one more block*/
+	{
+		memset(&context->block[context->blockLength], 0, 64 - context->blockLength);
+		
+		vSHA256Transform(context, context->block);
+		
+		context->blockLength = 0;
+	}
+	
+	memset(&context->block[context->blockLength], 0, 56 - context->blockLength);
+	
+	for (int i = 0; i < 8; i++)
+	{
+		context->block[63 - i] = bitLength >> (8 * i);
+	}
+	
+	vSHA256Transform(context, context->block);
+	
+	for (int i = 0; i < 32; i++)
+	{
+		digest[i] = context->state[i / 4] >> (24 - 8 * (i % 4));
+	}
+}
+
+/**
+* @brief  This function runs the SHA-256 compression over one 64 bytes block
+* @params sha256Context_t *context -> calculation state
+*					const uint8_t block[]		 -> 64 bytes, need not be word aligned
+*/
+void vSHA256Transform(sha256Context_t *context, const uint8_t block[])
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h;
+	
+	#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+	
+	for (int i = 0; i < 16; i++)
+	{
+		w[i] = (block[4 * i] << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+	}
+	
+	for (int i = 16; i < 64; i++)
+	{
+		w[i] = w[i - 16] + (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 7] + (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	}
+	
+	a = context->state[0]; b = context->state[1]; c = context->state[2]; d = context->state[3];
+	e = context->state[4]; f = context->state[5]; g = context->state[6]; h = context->state[7];
+	
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	
+	#undef ROTR
+	
+	context->state[0] += a; context->state[1] += b; context->state[2] += c; context->state[3] += d;
+	context->state[4] += e; context->state[5] += f; context->state[6] += g; context->state[7] += h;
+}
+
+/**
+* @brief  This function turns a hexadecimal string into bytes
+* @params const char hex[]	-> input string, two characters per byte
+*					uint8_t bytes[]		-> output buffer
+*					uint32_t length		-> bytes to be converted
+* @retval false if the string is shorter or holds a non hexadecimal character
+*/
+bool bBootloaderHexToBytes(const char hex[], uint8_t bytes[], uint32_t length)
+{
+	for (uint32_t i = 0; i < 2 * length; i++)
+	{
+		char character = hex[i];
+		uint8_t nibble;
+		
+		if (character >= '0' && character <= '9')      nibble = character - '0';
+		else if (character >= 'a' && character <= 'f') nibble = character - 'a' + 10;
+		else if (character >= 'A' && character <= 'F') nibble = character - 'A' + 10;
+		else return false;
+		
+		bytes[i / 2] = (i % 2) ? (bytes[i / 2] | nibble) : (nibble << 4);
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function completes the image hash and checks the signature of the manifest against it, before the image is approved
+* @retval true if the image is signed for FIRMWARE_PUBLIC_KEY
+* @note   The hash is streamed as blocks arrive; only chunks downloaded again out of order are read back from the flash
+*/
+bool bBootloaderSignatureValid(void)
+{
+	#if BOOTLOADER_SIGNATURE
+	firmwareManifest_t *manifest = &xBootloaderVariables.manifest;
+	uint8_t digest[32];
+	
+	if (!manifest->signaturePresent)
+	{
+		return false;
+	}
+	
+	if (manifest->present && xBootloaderVariables.imageHash.length < manifest->imageLength)
+	{
+		uint32_t hashed = xBootloaderVariables.imageHash.length;
+		
+		vSHA256Update(&xBootloaderVariables.imageHash, (const uint8_t *)BOOTLOADER_FLASH_POINTER(xBootloaderVariables.applicationStoredAddressStart + hashed), manifest->imageLength - hashed);
+	}
+	
+	vSHA256Final(&xBootloaderVariables.imageHash, digest);
+	
+	return FIRMWARE_SIGNATURE_VERIFY(digest, manifest->signature);
+	#else
+	return true;
+	#endif
+}
+
+/**
+* @brief This function prepares the per transfer state once the TFTP server is connected
+*/
+void vBootloaderTransferStart(void)
+{
+	xBootloaderVariables.timing.transferStartTick = BOOTLOADER_GET_TICK();
+	
+	vSHA256Init(&xBootloaderVariables.imageHash);
+	
+	memset(&xBootloaderVariables.multicast, 0, sizeof(xBootloaderVariables.multicast));
+	
+	xBootloaderVariables.pacer.ackPending		  = false;
+	xBootloaderVariables.pacer.tokens				  = DOWNLOAD_BUCKET_SIZE;
+	xBootloaderVariables.pacer.lastRefill		  = xBootloaderVariables.timing.transferStartTick;
+	xBootloaderVariables.pacer.windowStart	  = xBootloaderVariables.timing.transferStartTick;
+	xBootloaderVariables.pacer.windowBytes	  = 0;
+	xBootloaderVariables.pacer.bytesAcked		  = 0;
+	xBootloaderVariables.pacer.lastAckedBlock = 0;
+	xBootloaderVariables.pacer.currentRate	  = 0;
+	
+	#if BOOTLOADER_DECRYPTION
+	if (xBootloaderVariables.manifest.encrypted)
+	{
+		vAES128KeyExpansion(xBootloaderVariables.aesRoundKeys, (const uint8_t *)BOOTLOADER_FLASH_POINTER(FIRMWARE_KEY_ADDRESS));
+	}
+	#endif
+}
+
+/**
+* @brief  AES forward S-box
+* @retval chosen array value
+*/
+const uint8_t aes_sbox[256] = 
+{
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+/**
+* @brief  This function expands an AES-128 key into the 11 round keys
+* @params uint8_t roundKeys[176] -> filled with the round keys
+*					const uint8_t key[16]	 -> cipher key
+*/
+void vAES128KeyExpansion(uint8_t roundKeys[176], const uint8_t key[16])
+{
+	uint8_t rcon = 0x01;
+	
+	memcpy(roundKeys, key, 16);
+	
+	for (int i = 16; i < 176; i += 4)
+	{
+		uint8_t t0 = roundKeys[i - 4], t1 = roundKeys[i - 3], t2 = roundKeys[i - 2], t3 = roundKeys[i - 1];
+		
+		if (i % 16 == 0)/*RotWord, SubWord and Rcon once per round key*/
+		{
+			uint8_t first = t0;
+			
+			t0 = aes_sbox[t1] ^ rcon;
+			t1 = aes_sbox[t2];
+			t2 = aes_sbox[t3];
+			t3 = aes_sbox[first];
+			
+			rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0x00);
+		}
+		
+		roundKeys[i]     = roundKeys[i - 16] ^ t0;
+		roundKeys[i + 1] = roundKeys[i - 15] ^ t1;
+		roundKeys[i + 2] = roundKeys[i - 14] ^ t2;
+		roundKeys[i + 3] = roundKeys[i - 13] ^ t3;
+	}
+}
+
+/**
+* @brief  This function encrypts one 16 bytes block with AES-128, CTR mode only needs the forward cipher
+* @params const uint8_t roundKeys[176] -> round keys from vAES128KeyExpansion
+*					const uint8_t input[16]			 -> plain block
+*					uint8_t output[16]					 -> encrypted block, may be the same buffer as input
+*/
+void vAES128EncryptBlock(const uint8_t roundKeys[176], const uint8_t input[16], uint8_t output[16])
+{
+	uint8_t state[16];
+	
+	for (int i = 0; i < 16; i++)
+	{
+		state[i] = input[i] ^ roundKeys[i];
+	}
+	
+	for (int round = 1; round <= 10; round++)
+	{
+		uint8_t shifted[16];
+		
+		for (int i = 0; i < 16; i++)/*SubBytes and ShiftRows, state is column major*/
+		{
+			shifted[i] = aes_sbox[state[(i + 4 * (i % 4)) % 16]];
+		}
+		
+		for (int column = 0; column < 4; column++)
+		{
+			uint8_t *s = &shifted[4 * column];
+			
+			if (round != 10)/*MixColumns, left out of the last round*/
+			{
+				uint8_t all = s[0] ^ s[1] ^ s[2] ^ s[3], first = s[0];
+				
+				for (int i = 0; i < 4; i++)
+				{
+					uint8_t pair = s[i] ^ ((i == 3) ? first : s[i + 1]);
+					
+					state[4 * column + i] = s[i] ^ all ^ (uint8_t)((pair << 1) ^ ((pair & 0x80) ? 0x1b : 0x00));
+				}
+			}
+			else
+			{
+				memcpy(&state[4 * column], s, 4);
+			}
+		}
+		
+		for (int i = 0; i < 16; i++)
+		{
+			state[i] ^= roundKeys[16 * round + i];
+		}
+	}
+	
+	memcpy(output, state, 16);
+}
+
+/**
+* @brief  This function decrypts AES-128-CTR data in place, any piece of the file can be decrypted on its own
+* @params uint8_t data[]			 -> encrypted bytes, overwritten with the plain bytes
+*					uint32_t length			 -> number of bytes
+*					uint32_t fileOffset	 -> position of data[0] in the downloaded file
+* @note   Counter block is the manifest iv plus fileOffset / 16, added big endian over the last 4 bytes
+*/
+void vBootloaderDecrypt(uint8_t data[], uint32_t length, uint32_t fileOffset)
+{
+	uint8_t counter[16], keyStream[16];
+	
+	BOOTLOADER_TIMING_START(decryptStart);
+	
+	for (uint32_t i = 0; i < length; )
+	{
+		uint32_t block = (fileOffset + i) / 16, position = (fileOffset + i) % 16;
+		uint32_t low = ((uint32_t)xBootloaderVariables.manifest.iv[12] << 24 | xBootloaderVariables.manifest.iv[13] << 16 | xBootloaderVariables.manifest.iv[14] << 8 | xBootloaderVariables.manifest.iv[15]) + block;
+		
+		memcpy(counter, xBootloaderVariables.manifest.iv, 12);
+		
+		counter[12] = low >> 24;
+		counter[13] = low >> 16;
+		counter[14] = low >> 8;
+		counter[15] = low;
+		
+		vAES128EncryptBlock(xBootloaderVariables.aesRoundKeys, counter, keyStream);
+		
+		for (; position < 16 && i < length; position++, i++)
+		{
+			data[i] ^= keyStream[position];
+		}
+	}
+	
+	BOOTLOADER_TIMING_RECORD(TIMING_DECRYPT, decryptStart);
+}
+
+/**
+* @brief This function extracts CRC32 value from the last TFTP package
+* @params char tftpBuffer[]					-> input buffer to extract CRC32 value from the end of that buffer
+*					uint32_t tftpBufferIndex  -> the end index of the input buffer where CRC32 yields
+*					uint32_t *crcBufferIndex	-> To calculate the last package's crc32 dependency
+*/
+void vExtractCRCFromTheLastTFTPPackage(uint32_t *checsumExtracted, char tftpBuffer[], uint32_t tftpBufferIndex, uint32_t *crcBufferIndex)
+{	
+	for (int i = 1; i < ((tftpBufferIndex)/4); i++)
+	{				
+		if(i == ((tftpBufferIndex)/4)-1)
+		{
+			*checsumExtracted = 
+				tftpBuffer[4*i]  *0x1000000 + 
+				tftpBuffer[4*i+1]*0x10000 + 
+				tftpBuffer[4*i+2]*0x100 + 
+				tftpBuffer[4*i+3];
+		}
+		else
+		{
+			*crcBufferIndex = 4*(i-1) + 3;
+		}			
+	}
+}
+
+/**
+* @brief This function calculates the crc32 in a cyclic way over writing the *calculatedCRC32 value
+* @params uint32_t *calculatedCRC32 -> cyclically calculated CRC32
+*					char tftpBuffer[]					-> input buffer to calculate CRC32 over
+*					uint32_t size							-> size of the input buffer
+*/
+void vCalculateCyclicCRC32(uint32_t *calculatedCRC32, char tftpBuffer[], uint32_t size)
+{
+	if (size != 1)
+	{
+		BOOTLOADER_TIMING_START(crcStart);
+		
+		*calculatedCRC32 = crc32((const void *)tftpBuffer, size, *calculatedCRC32);
+		
+		BOOTLOADER_TIMING_RECORD(TIMING_CRC, crcStart);
+		
+		#if BOOTLOADER_SIGNATURE
+		vSHA256Update(&xBootloaderVariables.imageHash, (const uint8_t *)&tftpBuffer[4], size);/*same bytes as the CRC32, the TFTP header is skipped*/
+		#endif
+	}
+}
+
+/**
+* @brief This function compares the crc32s and writes new firmware version to the flash
+* @note  A failed image ends in a reset, an approved one returns in the ready state, see vBootloaderFirmwareReady
+*/
+void vEvaluateCRC32(uint32_t crcCalculated, uint32_t crcGiven)
+{
+	vBootloaderTimingSave();
+	
+	vBootloaderLinkTransferSample();
+	
+	memset(xBootloaderVariables.aesRoundKeys, 0, sizeof(xBootloaderVariables.aesRoundKeys));
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Size of the new app is = %d bytes \r\n", 	 xBootloaderVariables.applicationStoredAddressEnd - xBootloaderVariables.applicationStoredAddressStart);
+	printf("LAST checksum calculated:     0x%08x\r\nChecksum value on the memory: 0x%08x\r\n", crcCalculated, crcGiven);
+	#endif
+	
+	if(crcCalculated == crcGiven)
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("CRC32 check is OK. \r\n\r\n");
+		#endif
+		
+		#if BOOTLOADER_SIGNATURE
+		if (!bBootloaderSignatureValid())
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Signature check FAILED. \r\n\r\n");
+			#endif
+			
+			vBootloaderDiscardDownload();
+		}
+		#endif
+		
+		/*a bundle is only accepted when its manifest says so, and only if every component would install*/
+		if ((BOOTLOADER_FLASH_WORD(xBootloaderVariables.applicationStoredAddressStart) == BUNDLE_MAGIC) != (xBootloaderVariables.manifest.present && (xBootloaderVariables.manifest.formatFlags & FIRMWARE_FORMAT_BUNDLE)) ||
+			 (BOOTLOADER_FLASH_WORD(xBootloaderVariables.applicationStoredAddressStart) == BUNDLE_MAGIC && !bBootloaderBundleValid(xBootloaderVariables.applicationStoredAddressStart, xBootloaderVariables.applicationStoredAddressEnd - xBootloaderVariables.applicationStoredAddressStart)))
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Bundle check FAILED. \r\n\r\n");
+			#endif
+			
+			vBootloaderDiscardDownload();
+		}
+		
+		vFlashChecksumAndFirmwareVersion();
+		
+		vBootloaderFirmwareReady();
+	}
+	else
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("CRC32 check FAILED. \r\n\r\n");
+		#endif
+		
+		vBootloaderDiscardDownload();
+	}
+}
+
+/**
+* @brief  This function ends the transfer of an approved image and hands the reboot moment over to the application
+* @note   No more version checks are made while the image waits. A reset for any other reason applies it as well,
+*					the approval is already in the metadata log. The TFTP socket is closed, the ESP8266 is put back to 115200
+*					and the flash is locked, so the application gets its modems and flash back as they were before the transfer.
+*/
+void vBootloaderFirmwareReady(void)
+{
+	char closeSocket[50];
+	
+	if (xBootloaderVariables.wifiBootloading && xBootloaderVariables.seedIP[0] == 0)/*a seed download used the web socket, closed already*/
+	{
+		sprintf(closeSocket, "AT+CIPCLOSE=%i\r\n", WIFI_UDP_SOCKET_NO);
+		
+		clearWifiBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_WIFI, closeSocket);
+		bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 750);
+		clearWifiBufferAndResetItsIndex();
+	}
+	else if (xBootloaderVariables.gsmBootloading)
+	{
+		sprintf(closeSocket, "AT+QICLOSE=%i\r\n", GSM_UDP_SOCKET_CONNECT_ID);
+		
+		clearGSMBufferAndResetItsIndex();
+		vBootloaderTxSend(LINK_GSM, closeSocket);
+		bCheckIfResponseReceivedOnTime("OK\r\n", GSM_BUFFER, 5000);
+		clearGSMBufferAndResetItsIndex();
+	}
+	
+	vRestoreWifiBaudRateTo115200();
+	
+	HAL_FLASH_Lock();
+	
+	vBootloaderTimerStop(TFTP_TIMEOUT_TIMER);
+	vBootloaderTimerStop(CONNECTION_TIMER);
+	vBootloaderTimerStop(MULTICAST_REASK_TIMER);
+	vBootloaderTimerStop(PACER_TIMER);
+	
+	xBootloaderVariables.wifiBootloading = false;
+	xBootloaderVariables.gsmBootloading  = false;
+	xBootloaderVariables.firmwareReady   = true;
+	
+	#if FIRMWARE_APPLY_DEADLINE
+	vBootloaderTimerStart(APPLY_TIMER, FIRMWARE_APPLY_DEADLINE);
+	#endif
+	
+	#if TFTP_BOOTLOADER_DEBUG
+	printf("Firmware %.5s is ready to be applied\r\n", xBootloaderVariables.newVersionNumber);
+	#endif
+	
+	vBootloaderOnFirmwareReady(xBootloaderVariables.newVersionNumber);
+}
+
+/**
+* @brief  This function resets the device to apply the ready image, call it from the application when the reboot does no harm
+* @note   The metadata log is compacted here, while the application still runs, if the apply journal might not fit in it.
+*					The CRC32 of the storage space and the header table of a bundle are checked here as well, the boot of the reset
+*					trusts the check. The reset then only erases the application space, copies the image and checks the copy.
+*					A failed check is left to the boot, which checks again and drops the image. Does nothing if no image is ready.
+*/
+void vBootloaderApplyNow(void)
+{
+	bootMetadata_t *metadata = &xBootloaderVariables.metadata;
+	bootVerifyMarker_t *marker = (bootVerifyMarker_t *)BOOT_VERIFY_SRAM_ADDRESS;
+	
+	if (!xBootloaderVariables.firmwareReady)
+	{
+		return;
+	}
+	
+	/*a cut compaction is finished by the next append, the other sector still holds records then and is not erased here*/
+	if (!metadata->incomplete && metadata->nextAddress + APPLY_LOG_RESERVE > metadata->activeSector + METADATA_SECTOR_SIZE)
+	{
+		HAL_FLASH_Unlock();
+		
+		vMetadataCompact(metadata);
+	}
+	
+	if (bBootloaderVerifyImage(STORAGE_ADDRESS))
+	{
+		marker->staged = 1;
+	}
+	
+	NVIC_SystemReset();
+}
+
+/**
+* @brief This function applies the ready image after a delay, such as at the start of a low load window of the application
+* @param uint32_t delay -> ms from now, a later call moves the reset
+*/
+void vBootloaderScheduleApply(uint32_t delay)
+{
+	vBootloaderTimerStart(APPLY_TIMER, delay);
+}
+
+/**
+* @brief This function drops a failed download, the storage space is erased and the system is reset
+*/
+void vBootloaderDiscardDownload(void)
+{
+	vBootloaderTimingSave();
+	
+	vBootloaderLinkTransferSample();
+	
+	memset(xBootloaderVariables.aesRoundKeys, 0, sizeof(xBootloaderVariables.aesRoundKeys));
+	
+	vEraseStorageSpace();
+	
+	SAVE_ENERGY_REGISTERS();
+	
+	NVIC_SystemReset();
+}
+
+/**
+* @brief This function erases chosen flash sector 
+* @param Sector identifying number
+*/
+void vFlashEraseSector(uint32_t sectorNo)
+{
+	HAL_StatusTypeDef HAL = HAL_ERROR;
+	FLASH_EraseInitTypeDef EraseInitStruct;
+	uint32_t SECTORError;
+	
+	HAL_FLASH_Unlock();
+	
+	EraseInitStruct.Sector        = sectorNo;
+	EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
+	EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
+	EraseInitStruct.NbSectors     = 1;
+		
+	while (HAL != HAL_OK) 
+	{
+		HAL = HAL_FLASHEx_Erase(&EraseInitStruct, &SECTORError);
+		
+		if (HAL != HAL_OK){for(int i = 0; i < 5000; i++){}}
+	}
+}
+
+/**
+* @brief This function copies storage space to application space
+*/
+void vCopyStorageSpaceToApplicationSpace(uint32_t appSpace, uint32_t storageSpace, uint32_t spaceSize)
+{
+	uint32_t writeAddress = appSpace, copyAddress  = storageSpace, data = 0;
+	
+	for(int i = 0; i < (spaceSize/4); i++)
+	{
+		data = BOOTLOADER_FLASH_WORD(copyAddress);
+		
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, writeAddress, data) != HAL_OK)
+		{
+			NVIC_SystemReset();
+		}
+		
+		writeAddress += 4;
+		copyAddress  += 4;
+	}
+}
+
+/**
+* @brief  This function installs the approved storage space, a single image goes to the application space and a bundle
+*					to the regions of its components
+* @param  bootMetadata_t *metadata -> scanned log to journal the copy of a single image in, NULL to copy it in one go
+* @retval true if everything installed is intact, the storage space is then no longer needed
+* @note   Runs at systemInit, it touches no variable.
+*/
+bool bBootloaderInstallStorage(bootMetadata_t *metadata)
+{
+	if (BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS) == BUNDLE_MAGIC)
+	{
+		return bBootloaderInstallBundle(STORAGE_ADDRESS) && bBootloaderVerifyImage(APPLICATION_ADDRESS);
+	}
+	
+	if (metadata == NULL)
+	{
+		vEraseApplicationSpace();
+		vCopyStorageSpaceToApplicationSpace(APPLICATION_ADDRESS, STORAGE_ADDRESS, MAX_APPICATION_SIZE);
+		
+		return bBootloaderVerifyImage(APPLICATION_ADDRESS);
+	}
+	
+	if (bBootloaderApplyStorage(metadata) && bBootloaderVerifyImage(APPLICATION_ADDRESS))
+	{
+		return true;
+	}
+	
+	vMetadataSetSlot(metadata, METADATA_APPLY_SLOT, METADATA_SLOT_ERASED, NULL);/*the journal can't be trusted, the next boot erases and copies again*/
+	
+	return false;
+}
+
+/**
+* @brief  This function copies the storage space to the application space chunk by chunk, a journal record in the metadata
+*					log follows every verified chunk, so a copy cut by a power loss resumes at the first unverified chunk
+* @param  bootMetadata_t *metadata -> scanned log holding the approved storage record
+* @retval true if every chunk is copied and verified
+* @note   Runs at systemInit, it touches no variable. The application space is erased only when no journal of the storage
+*					image exists, so repeated brownouts only ever redo the chunk they cut. Only the chunks of the image and the one
+*					holding the trailer are copied.
+*/
+bool bBootloaderApplyStorage(bootMetadata_t *metadata)
+{
+	const metadataRecord_t *storage = &metadata->slots[METADATA_STORAGE_SLOT];
+	metadataRecord_t journal = metadata->slots[METADATA_APPLY_SLOT];
+	uint32_t imageSpan = (storage->imageLength + APPLY_CHUNK_SIZE - 1) / APPLY_CHUNK_SIZE * APPLY_CHUNK_SIZE;
+	
+	if (journal.state != METADATA_SLOT_APPLYING || journal.imageCRC != storage->imageCRC || memcmp(journal.version, storage->version, sizeof(journal.version)) != 0 || journal.imageLength % APPLY_CHUNK_SIZE != 0)
+	{
+		vEraseApplicationSpace();
+		
+		journal							= *storage;
+		journal.imageLength = 0;
+		
+		vMetadataSetSlot(metadata, METADATA_APPLY_SLOT, METADATA_SLOT_APPLYING, &journal);/*written after the erase, a cut erase is simply redone*/
+	}
+	
+	for (uint32_t offset = journal.imageLength; offset < MAX_APPICATION_SIZE; offset += APPLY_CHUNK_SIZE)
+	{
+		if (offset >= imageSpan && offset < MAX_APPICATION_SIZE - APPLY_CHUNK_SIZE)/*nothing between the image and the trailer*/
+		{
+			offset = MAX_APPICATION_SIZE - APPLY_CHUNK_SIZE;
+		}
+		
+		if (!bBootloaderApplyChunk(APPLICATION_ADDRESS + offset, STORAGE_ADDRESS + offset, APPLY_CHUNK_SIZE))
+		{
+			return false;
+		}
+		
+		journal.imageLength = offset + APPLY_CHUNK_SIZE;
+		
+		vMetadataSetSlot(metadata, METADATA_APPLY_SLOT, METADATA_SLOT_APPLYING, &journal);
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function copies one chunk of the storage space, words written before a power loss are kept
+* @params uint32_t appAddress			-> chunk in the application space
+*					uint32_t storageAddress	-> chunk in the storage space
+*					uint32_t length					-> bytes of the chunk, a multiple of 4
+* @retval false if a word torn by a power loss can't be programmed over or the chunk doesn't read back
+*/
+bool bBootloaderApplyChunk(uint32_t appAddress, uint32_t storageAddress, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i += 4)
+	{
+		uint32_t data = BOOTLOADER_FLASH_WORD(storageAddress + i), written = BOOTLOADER_FLASH_WORD(appAddress + i);
+		
+		if (written == data)
+		{
+			continue;
+		}
+		
+		if (written != 0xFFFFFFFF)
+		{
+			return false;
+		}
+		
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, appAddress + i, data) != HAL_OK)
+		{
+			NVIC_SystemReset();
+		}
+	}
+	
+	return memcmp((const void *)BOOTLOADER_FLASH_POINTER(appAddress), (const void *)BOOTLOADER_FLASH_POINTER(storageAddress), length) == 0;
+}
+
+/**
+* @brief  Flash region of every bundle target, modify it to your needs (etc. new mcu different sectors..)
+* @retval chosen array value
+*/
+const bundleRegion_t bundle_regions[BUNDLE_TARGET_COUNT] = 
+{
+	{APPLICATION_ADDRESS,		6,										MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE},
+	{BUNDLE_CONFIG_ADDRESS, BUNDLE_CONFIG_SECTOR, BUNDLE_CONFIG_SIZE}
+};
+
+/**
+* @brief  This function checks the header table of a bundle and the CRC32 of every component on the flash
+* @params uint32_t bundleAddress -> slot holding the bundle
+*					uint32_t bundleLength	 -> bytes of the bundle
+* @retval true if every component is stored, fits its region, is intact and no target is given twice
+* @note   Runs at systemInit too, it touches no variable.
+*/
+bool bBootloaderBundleValid(uint32_t bundleAddress, uint32_t bundleLength)
+{
+	const bundleHeader_t *header = (const bundleHeader_t *)BOOTLOADER_FLASH_POINTER(bundleAddress);
+	uint32_t targets = 0;
+	
+	if (bundleLength > MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE || bundleLength < sizeof(bundleHeader_t) || header->magic != BUNDLE_MAGIC || header->count == 0 || header->count > BUNDLE_MAX_COMPONENTS)
+	{
+		return false;
+	}
+	
+	for (uint32_t i = 0; i < header->count; i++)
+	{
+		const bundleComponent_t *component = &header->components[i];
+		
+		if (component->target >= BUNDLE_TARGET_COUNT || (targets & (1U << component->target)) || component->compression != BUNDLE_COMPRESSION_NONE ||
+				component->offset % 4 != 0 || component->offset > bundleLength || component->length > bundleLength - component->offset || component->length > bundle_regions[component->target].size ||
+				ulCRC32Aligned((const uint32_t *)BOOTLOADER_FLASH_POINTER(bundleAddress + component->offset), component->length, 0) != component->crc)
+		{
+			return false;
+		}
+		
+		targets |= 1U << component->target;
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function erases the region of every component of a checked bundle and copies the component into it
+* @param  uint32_t bundleAddress -> slot holding the bundle
+* @retval true if every component is intact in its region
+* @note   Runs at systemInit, it touches no variable. The application gets the length, CRC32 and version trailer of a
+*					single image, the bundle's version words are copied and the approval word is written last.
+*					A region is erased before its component is written, so a cut install leaves the old application erased,
+*					the storage stays approved and the next boot installs the whole bundle again.
+*/
+bool bBootloaderInstallBundle(uint32_t bundleAddress)
+{
+	const bundleHeader_t *header = (const bundleHeader_t *)BOOTLOADER_FLASH_POINTER(bundleAddress);
+	
+	for (uint32_t i = 0; i < header->count; i++)
+	{
+		const bundleComponent_t *component = &header->components[i];
+		const bundleRegion_t *region = &bundle_regions[component->target];
+		
+		BOOT_WATCHDOG_RELOAD();
+		
+		vFlashEraseSector(region->sector);
+		vCopyStorageSpaceToApplicationSpace(region->address, bundleAddress + component->offset, (component->length + 3) & ~3U);
+		
+		if (ulCRC32Aligned((const uint32_t *)BOOTLOADER_FLASH_POINTER(region->address), component->length, 0) != component->crc)
+		{
+			return false;
+		}
+		
+		if (component->target == BUNDLE_TARGET_APPLICATION)
+		{
+			if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, region->address + IMAGE_LENGTH_OFFSET, component->length) != HAL_OK ||
+					HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, region->address + IMAGE_CRC_OFFSET, component->crc) != HAL_OK)
+			{
+				return false;
+			}
+			
+			for (int j = 0; j < 5; j++)
+			{
+				if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, region->address + MAX_APPICATION_SIZE - (24 - j*4), BOOTLOADER_FLASH_WORD(bundleAddress + MAX_APPICATION_SIZE - (24 - j*4))) != HAL_OK)
+				{
+					return false;
 				}
 			}
+			
+			if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, region->address + MAX_APPICATION_SIZE - 4, 0x01) != HAL_OK)
+			{
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
+/**
+* @brief This function flashes firmware version and '1' to the end of that sector showing checksum of the firmware is approved
+*/
+void vFlashChecksumAndFirmwareVersion(void)
+{
+	uint32_t imageLength = xBootloaderVariables.applicationStoredAddressEnd - xBootloaderVariables.applicationStoredAddressStart;
+	
+	if (imageLength > MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE)/*image runs into the trailer*/
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("Image of %u bytes overlaps the trailer\r\n", imageLength);
+		#endif
+		
+		vBootloaderDiscardDownload();
+	}
+	
+	/*length and CRC32 of the image on the flash are checked at boot*/
+	if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STORAGE_ADDRESS + IMAGE_LENGTH_OFFSET, imageLength) != HAL_OK ||
+		 HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STORAGE_ADDRESS + IMAGE_CRC_OFFSET, ulCRC32Region((const uint8_t *)BOOTLOADER_FLASH_POINTER(STORAGE_ADDRESS), imageLength, 0)) != HAL_OK)
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("System Reset: Image length and CRC32 could not be written to the flash\r\n");
+		#endif
+		
+		NVIC_SystemReset();
+	}
+	
+	/*checksum correction bit held and written to the end of the storage sector*/
+	if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STORAGE_ADDRESS + MAX_APPICATION_SIZE - 4, 0x01) != HAL_OK)
+	{
+		#if TFTP_BOOTLOADER_DEBUG
+		printf("System Reset: CRC32 approval bit could not written to the flash\r\n");
+		#endif
+		
+		NVIC_SystemReset();
+	}
+	
+	/*new version number written to the end of the storage sector*/
+	for(int i = 0; i < 5; i++)
+	{
+		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (STORAGE_ADDRESS + MAX_APPICATION_SIZE - (24 - i*4)), xBootloaderVariables.newVersionNumber[i]) != HAL_OK)
+		{
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("System Reset: Version number bits could not be written to the flash\r\n");
+			#endif
+			
+			NVIC_SystemReset();
+		}
+	}
+	
+	/*the log record is what vBootloader acts on, it is appended once the trailer is complete*/
+	metadataRecord_t image = {0};
+	
+	image.imageLength = imageLength;
+	image.imageCRC    = BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS + IMAGE_CRC_OFFSET);
+	memcpy(image.version, xBootloaderVariables.newVersionNumber, sizeof(xBootloaderVariables.newVersionNumber));
+	
+	vMetadataSetSlot(&xBootloaderVariables.metadata, METADATA_STORAGE_SLOT, METADATA_SLOT_APPROVED, &image);
+}
+
+/**
+* @brief  This function checks the image of a slot against the length and CRC32 in its trailer, called by vBootloader at boot
+* @param  uint32_t slotAddress -> APPLICATION_ADDRESS or STORAGE_ADDRESS
+* @retval true if the image is intact, or it was approved without a length and can't be checked
+* @note   Runs at systemInit, so only the SRAM marker at BOOT_VERIFY_SRAM_ADDRESS is used as a variable.
+*					A check is trusted for BOOT_VERIFY_INTERVAL soft resets, a power on always checks the image again.
+*					The marker counts the boots of the same image since power on, bBootloaderInstallAttemptsLeft reads it.
+*					The header table and the components of a bundle are checked with it.
+*/
+bool bBootloaderVerifyImage(uint32_t slotAddress)
+{
+	bootVerifyMarker_t *marker = (bootVerifyMarker_t *)BOOT_VERIFY_SRAM_ADDRESS;
+	uint32_t length = BOOTLOADER_FLASH_WORD(slotAddress + IMAGE_LENGTH_OFFSET), imageCRC = BOOTLOADER_FLASH_WORD(slotAddress + IMAGE_CRC_OFFSET), crc = 0, start;
+	bool sameImage;
+	
+	if (length == 0xFFFFFFFF)/*approved by an older bootloader*/
+	{
+		return true;
+	}
+	
+	if (length > MAX_APPICATION_SIZE - FIRMWARE_TRAILER_SIZE)
+	{
+		return false;
+	}
+	
+	sameImage = (marker->magic == BOOT_VERIFY_VALUE && marker->slotAddress == slotAddress && marker->imageCRC == imageCRC);
+	
+	if (sameImage && marker->staged && BOOT_VERIFY_INTERVAL != 0)/*checked right before the reset of vBootloaderApplyNow*/
+	{
+		marker->staged = 0;
+		
+		return true;
+	}
+	
+	if (sameImage && ++marker->bootCount % (BOOT_VERIFY_INTERVAL + 1) != 0)
+	{
+		return true;
+	}
+	
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	
+	start = DWT->CYCCNT;
+	
+	for (uint32_t offset = 0; offset < length; offset += BOOT_VERIFY_SLICE)
+	{
+		crc = ulCRC32Aligned((const uint32_t *)BOOTLOADER_FLASH_POINTER(slotAddress + offset), (length - offset < BOOT_VERIFY_SLICE) ? (length - offset) : BOOT_VERIFY_SLICE, crc);
+		
+		BOOT_WATCHDOG_RELOAD();
+	}
+	
+	if (crc != imageCRC || (BOOTLOADER_FLASH_WORD(slotAddress) == BUNDLE_MAGIC && !bBootloaderBundleValid(slotAddress, length)))
+	{
+		if (marker->slotAddress == slotAddress)/*a failed check of the other slot keeps the count of this one*/
+		{
+			marker->magic = 0;
 		}
 		
-		if(xBootloaderVariables.solvePort == 2)
+		return false;
+	}
+	
+	if (!sameImage)
+	{
+		marker->bootCount = 0;
+	}
+	
+	marker->slotAddress    = slotAddress;
+	marker->imageCRC       = imageCRC;
+	marker->verifyCycles   = DWT->CYCCNT - start;
+	marker->verifiedLength = length;
+	marker->staged         = 0;
+	marker->magic          = BOOT_VERIFY_VALUE;
+	
+	return true;
+}
+
+/**
+* @brief  This function tells if the approved storage image may be installed once more
+* @retval false once BOOT_INSTALL_ATTEMPTS boots since power on tried to install the same storage image
+* @note   Runs at systemInit. Every failed install ends in a soft reset which keeps the SRAM marker, so its boot count of
+*					the storage image counts the attempts. A power on clears the marker and the install is tried again.
+*/
+bool bBootloaderInstallAttemptsLeft(void)
+{
+	bootVerifyMarker_t *marker = (bootVerifyMarker_t *)BOOT_VERIFY_SRAM_ADDRESS;
+	
+	return !(marker->magic == BOOT_VERIFY_VALUE && marker->slotAddress == STORAGE_ADDRESS && marker->imageCRC == BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS + IMAGE_CRC_OFFSET) && marker->bootCount + 1 >= BOOT_INSTALL_ATTEMPTS);
+}
+
+/**
+* @brief  This function gives the measured cost of the boot time image check, to be compared against the watchdog window
+* @retval ms per 100 KB on the HSI clock of systemInit, 0 if no check was made since power on
+*/
+uint32_t ulBootloaderBootVerifyMsPer100KB(void)
+{
+	bootVerifyMarker_t *marker = (bootVerifyMarker_t *)BOOT_VERIFY_SRAM_ADDRESS;
+	
+	if (marker->magic != BOOT_VERIFY_VALUE || marker->verifiedLength == 0)
+	{
+		return 0;
+	}
+	
+	return (uint32_t)((uint64_t)marker->verifyCycles * 102400 / marker->verifiedLength / (HSI_VALUE / 1000));
+}
+
+/**
+* @brief  This function boots from the slot states of the metadata log, called by vBootloader
+* @param  bootMetadata_t *metadata -> log scanned by vBootloader
+* @note   Returns only if there is no image to start, the device then works as the bootloader application. An approved
+*					image failing to install BOOT_INSTALL_ATTEMPTS times is left in the storage, the installed image is started if
+*					it is still intact, otherwise the bootloader application runs until the next power on tries again.
+*/
+void vBootFromMetadata(bootMetadata_t *metadata)
+{
+	metadataRecord_t *storage = &metadata->slots[METADATA_STORAGE_SLOT], *application = &metadata->slots[METADATA_APPLICATION_SLOT];
+	
+	if (storage->state == METADATA_SLOT_APPROVED && !bBootloaderInstallAttemptsLeft())
+	{
+		if (application->state == METADATA_SLOT_INSTALLED && bBootloaderVerifyImage(APPLICATION_ADDRESS))
 		{
-			uint32_t dataIndex = 0;
+			vBootloaderJumpToApplication(APPLICATION_ADDRESS);
+		}
+		
+		return;
+	}
+	
+	if (storage->state == METADATA_SLOT_APPROVED)
+	{
+		if (!bBootloaderVerifyImage(STORAGE_ADDRESS))
+		{
+			vMetadataSetSlot(metadata, METADATA_STORAGE_SLOT, METADATA_SLOT_ERASED, NULL);
+			vEraseStorageSpace();
+			NVIC_SystemReset();
+		}
+		
+		if (!bBootloaderInstallStorage(metadata))/*storage is still approved, the copy resumes at the next boot, the log record below commits it*/
+		{
+			NVIC_SystemReset();
+		}
+		
+		vMetadataSetSlot(metadata, METADATA_APPLICATION_SLOT, METADATA_SLOT_INSTALLED, storage);
+		vMetadataSetSlot(metadata, METADATA_STORAGE_SLOT, METADATA_SLOT_ERASED, NULL);
+		vMetadataSetSlot(metadata, METADATA_APPLY_SLOT, METADATA_SLOT_ERASED, NULL);
+		vEraseStorageSpace();
+		vBootloaderJumpToApplication(APPLICATION_ADDRESS);
+	}
+	
+	if (metadata->slots[METADATA_APPLY_SLOT].state == METADATA_SLOT_APPLYING)/*power lost after the storage was released, before the journal was*/
+	{
+		vMetadataSetSlot(metadata, METADATA_APPLY_SLOT, METADATA_SLOT_ERASED, NULL);
+	}
+	
+	if ((int)BOOTLOADER_FLASH_WORD(STORAGE_ADDRESS) != -1)/*download stopped before it was approved*/
+	{
+		vEraseStorageSpace();
+		NVIC_SystemReset();
+	}
+	
+	if (application->state == METADATA_SLOT_INSTALLED || (application->sequence == 0 && BOOTLOADER_FLASH_WORD(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4) == 1))/*installed before the log was in use*/
+	{
+		if (bBootloaderVerifyImage(APPLICATION_ADDRESS))
+		{
+			vBootloaderJumpToApplication(APPLICATION_ADDRESS);
+		}
+		
+		vMetadataSetSlot(metadata, METADATA_APPLICATION_SLOT, METADATA_SLOT_ERASED, NULL);
+		vEraseApplicationSpace();
+		NVIC_SystemReset();
+	}
+}
+
+/**
+* @brief  This function reads both metadata sectors into a compact struct, the latest valid record of every slot wins
+* @param  bootMetadata_t *metadata -> filled with the log state
+* @note   Touches no variable, it is safe at systemInit. Records torn by a power loss fail their CRC32 and are skipped.
+*/
+void vMetadataScan(bootMetadata_t *metadata)
+{
+	const uint32_t sectors[2] = {METADATA_SECTOR_A_ADDRESS, METADATA_SECTOR_B_ADDRESS};
+	uint32_t nextAddress[2], slotSector[METADATA_SLOT_COUNT] = {0};
+	
+	memset(metadata, 0, sizeof(bootMetadata_t));
+	
+	metadata->activeSector = METADATA_SECTOR_A_ADDRESS;
+	
+	for (int i = 0; i < 2; i++)
+	{
+		uint32_t address;
+		
+		for (address = sectors[i]; address < sectors[i] + METADATA_SECTOR_SIZE; address += sizeof(metadataRecord_t))
+		{
+			metadataRecord_t record;
 			
-			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
+			memcpy(&record, (const void *)BOOTLOADER_FLASH_POINTER(address), sizeof(record));
+			
+			if (record.sequence == 0xFFFFFFFF && record.recordCRC == 0xFFFFFFFF)/*end of the appended records*/
 			{
-				if (GSM_BUFFER[i]   == 0x72 
-				 && GSM_BUFFER[i+1] == 0x65 
-				 && GSM_BUFFER[i+2] == 0x63 
-				 && GSM_BUFFER[i+3] == 0x76) /*if gsm buffer includes "recv" meaning that module arrived data*/
-				{
-					while (GSM_BUFFER[i] != 0x2C)/*place the buffer index until you see ","*/
-					{
-						i++;
-					}
-					i++;
-					
-					while (GSM_BUFFER[i] != 0x2C)/*place the buffer index until you see the second ","*/
-					{
-						i++;
-					}
-					i++;
-					
-					while (GSM_BUFFER[i] != 0x2C)/*resolve the incoming data quantity*/
-					{
-						char digit = GSM_BUFFER[i];
-						dataIndex = dataIndex * 10 + atoi(&digit);
-						i++;
-					}
-											
-					i = sizeof(GSM_BUFFER);/*conclude the loop*/
-				}
+				break;
 			}
-							
-			for (int i = 0; i < sizeof(GSM_BUFFER); i++)
+			
+			if (record.recordCRC != ulCRC32Aligned((const uint32_t *)&record, offsetof(metadataRecord_t, recordCRC), 0) || record.slot >= METADATA_SLOT_COUNT)
 			{
-				if (GSM_BUFFER[i]   == 0x72 
-				 && GSM_BUFFER[i+1] == 0x65 
-				 && GSM_BUFFER[i+2] == 0x63 
-				 && GSM_BUFFER[i+3] == 0x76) /*if gsm buffer includes "recv" meaning that module arrived data*/
-				{
-					
-					while (GSM_BUFFER[i] != 0x0A)/*place the buffer index until you see "\n"*/
-					{
-						i++;
-					}
-					i++;
-					
-					/*fulfil the tftp buffer from gsm buffer*/
-					for (int k = 0; k < 516; k++)
-					{
-						xBootloaderVariables.currentTftpBuffer[k] = GSM_BUFFER[i];
-						i++;
-					}
-					i = sizeof(GSM_BUFFER);/*conclude the loop*/
-					
-					vBootloaderCRC32ToFlash(dataIndex);
-				}
+				continue;
+			}
+			
+			if (record.sequence > metadata->slots[record.slot].sequence)
+			{
+				metadata->slots[record.slot] = record;
+				slotSector[record.slot]      = sectors[i];
+			}
+			
+			if (record.sequence > metadata->sequence)
+			{
+				metadata->sequence     = record.sequence;
+				metadata->activeSector = sectors[i];
+			}
+		}
+		
+		nextAddress[i] = address;
+	}
+	
+	metadata->nextAddress = nextAddress[metadata->activeSector == METADATA_SECTOR_B_ADDRESS];
+	
+	for (int i = 0; i < METADATA_SLOT_COUNT; i++)
+	{
+		if (metadata->slots[i].sequence != 0 && slotSector[i] != metadata->activeSector)
+		{
+			metadata->incomplete = true;
+		}
+	}
+}
+
+/**
+* @brief  This function records a new state of a slot in the metadata log
+* @params bootMetadata_t *metadata			-> scanned log
+*					metadataSlot_t slot						-> slot changing state
+*					metadataSlotState_t state			-> new state
+*					const metadataRecord_t *image	-> length, CRC32 and version of the image in the slot, NULL for an erased slot
+*/
+void vMetadataSetSlot(bootMetadata_t *metadata, metadataSlot_t slot, metadataSlotState_t state, const metadataRecord_t *image)
+{
+	metadataRecord_t record = {0};
+	
+	if (image != NULL)
+	{
+		record = *image;
+	}
+	
+	record.slot  = slot;
+	record.state = state;
+	
+	vMetadataAppend(metadata, record);
+}
+
+/**
+* @brief  This function appends a record to the metadata log, the log is compacted into the other sector when it is full
+* @params bootMetadata_t *metadata -> scanned log
+*					metadataRecord_t record	 -> record to be appended, sequence and recordCRC are filled here
+*/
+void vMetadataAppend(bootMetadata_t *metadata, metadataRecord_t record)
+{
+	const uint32_t *words = (const uint32_t *)&record;
+	
+	if (metadata->incomplete)/*finish the cut compaction before the other sector can be erased again*/
+	{
+		metadata->incomplete = false;
+		
+		for (uint32_t i = 0; i < METADATA_SLOT_COUNT; i++)
+		{
+			if (metadata->slots[i].sequence != 0 && i != record.slot)
+			{
+				vMetadataAppend(metadata, metadata->slots[i]);
 			}
 		}
 	}
+	
+	if (metadata->nextAddress + sizeof(record) > metadata->activeSector + METADATA_SECTOR_SIZE)
+	{
+		vMetadataCompact(metadata);
+	}
+	
+	record.sequence  = metadata->sequence + 1;
+	record.recordCRC = ulCRC32Aligned(words, offsetof(metadataRecord_t, recordCRC), 0);
+	
+	for (uint32_t i = 0; i < sizeof(record) / 4; i++)/*recordCRC is the last word, a torn record never validates*/
+	{
+		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, metadata->nextAddress + 4 * i, words[i]) != HAL_OK)
+		{
+			NVIC_SystemReset();
+		}
+	}
+	
+	metadata->sequence             = record.sequence;
+	metadata->nextAddress         += sizeof(record);
+	metadata->slots[record.slot]   = record;
+}
+
+/**
+* @brief  This function erases the other metadata sector and writes the latest record of every slot to it
+* @param  bootMetadata_t *metadata -> scanned log
+* @note   The full sector is left as it is until the next compaction, so a power loss here loses nothing
+*/
+void vMetadataCompact(bootMetadata_t *metadata)
+{
+	bool toSectorB = (metadata->activeSector == METADATA_SECTOR_A_ADDRESS);
+	
+	vFlashEraseSector(toSectorB ? METADATA_SECTOR_B : METADATA_SECTOR_A);
+	
+	metadata->activeSector = toSectorB ? METADATA_SECTOR_B_ADDRESS : METADATA_SECTOR_A_ADDRESS;
+	metadata->nextAddress  = metadata->activeSector;
+	
+	for (int i = 0; i < METADATA_SLOT_COUNT; i++)
+	{
+		if (metadata->slots[i].sequence != 0)
+		{
+			vMetadataAppend(metadata, metadata->slots[i]);
+		}
+	}
+}
+
+/**
+* @brief This function checks the current firmware version of the device
+* @param char array to be filled
+*/
+void vGetDeviceFirmwareVersion(char firmwareVersion[])
+{
+	uint32_t versionAddress = APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24;
+	
+	if (xBootloaderVariables.metadata.slots[METADATA_APPLICATION_SLOT].state == METADATA_SLOT_INSTALLED)
+	{
+		memcpy(firmwareVersion, xBootloaderVariables.metadata.slots[METADATA_APPLICATION_SLOT].version, 5);
+		
+		return;
+	}
+	
+	/*obtain the device firmware version*/
+	for (int i = 0; i < 5; i++)
+	{
+		if ((int)BOOTLOADER_FLASH_WORD(versionAddress) != -1)
+		{
+			firmwareVersion[i] = BOOTLOADER_FLASH_WORD(versionAddress);
+			versionAddress += 4;
+		}
+		else
+		{
+			sprintf(firmwareVersion ,CURRENT_FW_VER);
+			versionAddress += 4;
+		}
+	}
+}
+
+/**
+* @brief This function erases the storage space, modify the function to your needs. (etc. new mcu different sectors..)
+*/
+void vEraseStorageSpace(void)
+{
+	vFlashEraseSector (7);
+}
+
+/**
+* @brief This function erases the application space, modify the function to your needs (etc. new mcu different sectors..)
+*/
+void vEraseApplicationSpace(void)
+{
+	vFlashEraseSector (6);
+}
+
+/**
+* @brief This function jumps to application space
+*/
+void vBootloaderJumpToApplication(uint32_t appSpace)
+{
+	typedef void (*pFunction)(void);
+	
+	uint32_t  JumpAddress = BOOTLOADER_FLASH_WORD(appSpace + 4);
+	
+	pFunction Jump = (pFunction)JumpAddress;
+	
+	HAL_RCC_DeInit();
+	
+	HAL_DeInit();
+	
+	__set_MSP(BOOTLOADER_FLASH_WORD(appSpace));
+	
+	Jump();
+}
+
+/**
+* @brief This function checks bootloader timeouts at a thread
+*/
+void vBootloaderProcessTimers(void)
+{
+	if(bBootloaderTimerExpired(CONNECTION_TIMER))/*if connection is over TFTP_CONNECTION_TIME, corrupt*/
+	{
+		vBootloaderTimerStop(CONNECTION_TIMER);
+		
+		SAVE_ENERGY_REGISTERS();
+		
+		NVIC_SystemReset();
+	}
+	
+	if (bBootloaderTimerExpired(PACER_TIMER))
+	{
+		vBootloaderPacerService();
+	}
+	
+	if (bBootloaderTimerExpired(MULTICAST_REASK_TIMER))
+	{
+		vBootloaderMulticastReask();
+	}
+	
+	if (bBootloaderTimerExpired(APPLY_TIMER))
+	{
+		vBootloaderTimerStop(APPLY_TIMER);
+		
+		vBootloaderApplyNow();
+	}
+	
+	if (bBootloaderTimerExpired(TFTP_TIMEOUT_TIMER))/*if wrong package is arriving over TFTP_TIMEOUT_TIME, corrupt*/
+	{
+		if (xBootloaderVariables.multicast.active)
+		{
+			vBootloaderMulticastLeave();
+		}
+		
+		SAVE_ENERGY_REGISTERS();
+		
+		NVIC_SystemReset();
+	}
 }
 
 /**
-* @brief This function parses incoming wifi buffer as the tftp data 
+* @brief  This function adds the time passed since start to the histogram of a phase
+* @params bootloaderTimingPhase_t phase -> measured phase
+*					uint32_t start								-> BOOTLOADER_TIMESTAMP() taken when the phase started
 */
-void vBootloaderWifiEngage(void)
+void vBootloaderTimingRecord(bootloaderTimingPhase_t phase, uint32_t start)
 {
-	for(int k = 0; k < sizeof(WIFI_BUFFER); k++)
+	vBootloaderTimingRecordSpan(phase, start, BOOTLOADER_TIMESTAMP());
+}
+
+/**
+* @brief  This function adds a duration measured earlier to the histogram of its phase, call it from thread level only
+* @params bootloaderTimingPhase_t phase -> measured phase
+*					uint32_t start								-> BOOTLOADER_TIMESTAMP() at the start of the phase
+*					uint32_t end									-> BOOTLOADER_TIMESTAMP() at the end of the phase
+*/
+void vBootloaderTimingRecordSpan(bootloaderTimingPhase_t phase, uint32_t start, uint32_t end)
+{
+	uint32_t us = BOOTLOADER_TIMESTAMP_TO_US(end - start), bucket = 0;
+	
+	while (bucket < TIMING_HISTOGRAM_BUCKETS - 1 && us >= (1U << bucket))
 	{
-		if (WIFI_BUFFER[k]   == 0x49 &&
-				WIFI_BUFFER[k+1] == 0x50 &&
-				WIFI_BUFFER[k+2] == 0x44 &&
-				WIFI_BUFFER[k+3] == 0x2C &&
-				WIFI_BUFFER[k+4] == (0x30 + WIFI_UDP_SOCKET_NO))/*if "IPD, X" arrives at the wifi buffer, meaning that Xth socket arrived data, which is the udp socket*/
-		{			
-			
-			uint32_t dataIndex = 0;
-			
-			for (int i = 0; i < sizeof(WIFI_BUFFER); i++)
-			{
-				if (WIFI_BUFFER[i] == 0x3A)/*:*/
-				{
-					if (WIFI_BUFFER[i-1] == 0x36 &&
-							WIFI_BUFFER[i-2] == 0x31 &&
-							WIFI_BUFFER[i-3] == 0x35)/*if arrival data includes "516:" meaning that 516 bytes of tftp package arrived*/
-					{
-						i++;
-						
-						for (int j = 0; j < 516; j++)
-						{
-							xBootloaderVariables.currentTftpBuffer[j] = WIFI_BUFFER[i];/*transfer the tftp package from the wifi buffer to the tftp buffer*/
-							i++;
-						}
-						
-						i = sizeof(WIFI_BUFFER);
-						
-						dataIndex = 516;
-						
-						vBootloaderCRC32ToFlash(dataIndex);
-					}
-					else/* if the last package; namely, package arrival quantity is NOT 516 but different*/
-					{
-						/*resolve how many data arrived*/
-						if(WIFI_BUFFER[i-2] == 0x2C || WIFI_BUFFER[i-3] == 0x2C || WIFI_BUFFER[i-4] == 0x2C)/*arrival quantity differ from 1 to 3 digits in the context of TFTP nax buf size 512*/
-						{
-							if(WIFI_BUFFER[i-1] != 0x2C)
-							{
-								char digit = WIFI_BUFFER[i-1];
-								dataIndex = atoi(&digit);
-								if(WIFI_BUFFER[i-2] != 0x2C)
-								{
-									char digit = WIFI_BUFFER[i-2];
-									dataIndex += atoi(&digit)*10;
-									if(WIFI_BUFFER[i-3] != 0x2C)
-									{
-										char digit = WIFI_BUFFER[i-3];
-										dataIndex += atoi(&digit)*100;
-									}
-								}
-							}
-							
-							i++;
-														
-							for(int j = 0; j < dataIndex; j++)/*transfer the data into tftp buffer*/
-							{
-								xBootloaderVariables.currentTftpBuffer[j] = WIFI_BUFFER[i];
-								i++;
-							}
-							
-							i = sizeof(WIFI_BUFFER);
-							
-							vBootloaderCRC32ToFlash(dataIndex);
-						}
-					}
-				}
-			}			
-			k = sizeof(WIFI_BUFFER);/*conclude the loop*/
+		bucket++;
+	}
+	
+	if (xBootloaderVariables.timing.histogram[phase][bucket] < 0xFFFF)
+	{
+		xBootloaderVariables.timing.histogram[phase][bucket]++;
+	}
+}
+
+/**
+* @brief  This function reads a percentile from the histogram of a phase
+* @params bootloaderTimingPhase_t phase -> phase to be read
+*					uint32_t percent							-> such as 50 or 99
+* @retval upper bound in us of the bucket holding the percentile, 0 if nothing was measured
+*/
+uint32_t ulBootloaderTimingPercentile(bootloaderTimingPhase_t phase, uint32_t percent)
+{
+	uint32_t total = 0, cumulative = 0;
+	
+	for (int i = 0; i < TIMING_HISTOGRAM_BUCKETS; i++)
+	{
+		total += xBootloaderVariables.timing.histogram[phase][i];
+	}
+	
+	for (int i = 0; i < TIMING_HISTOGRAM_BUCKETS && total > 0; i++)
+	{
+		cumulative += xBootloaderVariables.timing.histogram[phase][i];
+		
+		if (cumulative * 100 >= total * percent)
+		{
+			return 1U << i;
 		}
 	}
+	
+	return 0;
 }
 
 /**
-* @brief This function puts tftp buffer to crc calculation buffer, calculates its checksum and writes it to the flash
-* @param uint32_t tftpBufferIndex -> telling how full the current tftp buffer is
+* @brief  Timestamp ticks of every kernel run measured on your board by ulBootloaderBenchmark, modify it to your needs
+*					(etc. new mcu different clock..), 0 if not recorded, such a kernel is only reported
+* @retval chosen array value
 */
-void vBootloaderCRC32ToFlash(uint32_t tftpBufferIndex)
-{		
-	xBootloaderVariables.incomingBlockNumber = xBootloaderVariables.currentTftpBuffer[2]*(0x100) + xBootloaderVariables.currentTftpBuffer[3];
+const uint32_t benchmark_baselines[BENCHMARK_KERNEL_COUNT] = 
+{
+	0,	/*BENCHMARK_CRC32*/
+	0,	/*BENCHMARK_CRC32_ALIGNED*/
+	0,	/*BENCHMARK_SOCKET_PAYLOAD*/
+	0,	/*BENCHMARK_RESPONSE_MATCH*/
+	0,	/*BENCHMARK_READ_REQUEST*/
+	0,	/*BENCHMARK_FLASH_TFTP_BUFFER*/
+	0,	/*BENCHMARK_WIFI_ENGAGE*/
+	0		/*BENCHMARK_QUECTEL_ENGAGE*/
+};
+
+/**
+* @brief  This function times the bootloader kernels on synthetic inputs and prints every result as a JSON line,
+*					the lines are kept on the host as the baselines of the next run
+* @retval bit mask of the benchmarkKernel_t slower than their baseline by more than BENCHMARK_REGRESSION_PERCENT, 0 if none
+* @note   Call it while no transfer runs and no image waits in the storage slot: the response match drains the UART
+*					rings, the flash and engage kernels erase the storage slot and program a block per run into it. The engage
+*					kernels take block 2 of a transfer from a capture of the modem, the TFTP state they move is put back.
+*/
+uint32_t ulBootloaderBenchmark(void)
+{
+	uint32_t regressed = 0;
 	
-	if ((xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1) && xBootloaderVariables.incomingBlockNumber > 1)
-	{	
-		xBootloaderVariables.TFTPTimeoutCounter = 0;	
+	#if BOOTLOADER_BENCHMARK
+	static uint32_t words[1024];
+	static char frames[1100], text[1100], payload[1100], block[516];
+	const char *names[BENCHMARK_KERNEL_COUNT] = {"crc32", "crc32Aligned", "socketPayload", "responseMatch", "readRequest", "flashTFTPBuffer", "wifiEngage", "quectelEngage"};
+	uint32_t storedAddressEnd = xBootloaderVariables.applicationStoredAddressEnd, checkSum = xBootloaderVariables.checkSumCalculated;
+	uint32_t blockNumber = xBootloaderVariables.incomingBlockNumber, blockNumberOld = xBootloaderVariables.incomingBlockNumberOld;
+	uint8_t ack[sizeof(xBootloaderVariables.ACK)], solvePort = xBootloaderVariables.solvePort;
+	volatile uint32_t sink;
+	uint32_t framesLength = 0, length;
+	
+	memcpy(ack, xBootloaderVariables.ACK, sizeof(ack));
+	
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	
+	for (uint32_t i = 0; i < 1024; i++)
+	{
+		words[i] = i * 2654435761U;
+	}
+	
+	for (int i = 0; i < 2; i++)/*two TFTP data frames as the ESP8266 delivers them*/
+	{
+		framesLength += sprintf(&frames[framesLength], "\r\n+IPD,%i,516:", WIFI_UDP_SOCKET_NO);
 		
-		xBootloaderVariables.incomingBlockNumberOld = xBootloaderVariables.incomingBlockNumber;
+		memcpy(&frames[framesLength], &words[i * 129], 516);
 		
-		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, true);
+		framesLength += 516;
+	}
+	
+	memset(text, 'x', 1024);
+	strcpy(&text[1024], "SEND OK\r\n");
+	
+	block[1] = 3;/*TFTP DATA of block 2, the engage kernels program the block before it*/
+	block[3] = 2;
+	memcpy(&block[4], words, 512);
+	
+	HAL_FLASH_Unlock();
+	
+	vEraseStorageSpace();
+	
+	xBootloaderVariables.applicationStoredAddressEnd = STORAGE_ADDRESS;
+	
+	for (int kernel = 0; kernel < BENCHMARK_KERNEL_COUNT; kernel++)
+	{
+		uint32_t best = 0xFFFFFFFF;
 		
-		if(!bIsTheLastTFTPPackage(tftpBufferIndex))
-		{
-			vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, tftpBufferIndex);
-			
-			vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
-			
-			memcpy(xBootloaderVariables.previousTftpBuffer, xBootloaderVariables.currentTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
-			
-			vTFTPIncrementACK(xBootloaderVariables.ACK);
-			
-			vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
-		}
-		else
+		switch (kernel)/*the captures are written after the response match drained the rings*/
 		{
-			uint32_t crcIndex = 0;
-			
-			if (tftpBufferIndex == 4)/*if last package does not contain data*/
-			{
-				vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
-				
-				vExtractCRCFromTheLastTFTPPackage(&xBootloaderVariables.checkSumOnTheLastTFTPPackage, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer), &crcIndex);
-
-				vTFTPIncrementACK(xBootloaderVariables.ACK);
-				
-				vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+			case BENCHMARK_WIFI_ENGAGE:
+				clearWifiBufferAndResetItsIndex();
 				
-				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, crcIndex + 1);
+				WIFI_BUFFER_RECEIVE_INDEX = sprintf(WIFI_BUFFER, "\r\n+IPD,%i,516:", WIFI_UDP_SOCKET_NO);/*as the ESP8266 delivers a TFTP block*/
 				
-				vEvaluateCRC32(xBootloaderVariables.checkSumCalculated, xBootloaderVariables.checkSumOnTheLastTFTPPackage);
-			}
-			else
-			{				
-				vFlashTFTPBuffer(xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
+				memcpy(&WIFI_BUFFER[WIFI_BUFFER_RECEIVE_INDEX], block, sizeof(block));
 				
-				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.previousTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer) - 4);
-																
-				vFlashTFTPBuffer(xBootloaderVariables.currentTftpBuffer, tftpBufferIndex - 4);
+				WIFI_BUFFER_RECEIVE_INDEX += sizeof(block);
+				break;
+			case BENCHMARK_QUECTEL_ENGAGE:
+				clearGSMBufferAndResetItsIndex();
 				
-				vExtractCRCFromTheLastTFTPPackage(&xBootloaderVariables.checkSumOnTheLastTFTPPackage, xBootloaderVariables.currentTftpBuffer, tftpBufferIndex, &crcIndex);
+				GSM_BUFFER_RECEIVE_INDEX = sprintf(GSM_BUFFER, "\r\n+QIURC: \"recv\",%i,516,\"10.0.0.2\",69\r\n", GSM_UDP_SOCKET_CONNECT_ID);/*as the UG95 pushes it*/
 				
-				vTFTPIncrementACK(xBootloaderVariables.ACK);
+				memcpy(&GSM_BUFFER[GSM_BUFFER_RECEIVE_INDEX], block, sizeof(block));
 				
-				vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+				GSM_BUFFER_RECEIVE_INDEX += sizeof(block);
 				
-				vCalculateCyclicCRC32(&xBootloaderVariables.checkSumCalculated, xBootloaderVariables.currentTftpBuffer, crcIndex + 1);
+				xBootloaderVariables.solvePort = 2;/*the port of the server is known after the first block*/
 				
-				vEvaluateCRC32(xBootloaderVariables.checkSumCalculated, xBootloaderVariables.checkSumOnTheLastTFTPPackage);
+				vBootloaderTimerStart(GSM_IDLE_TIMER, 0);
+				break;
+			default:
+				break;
+		}
+		
+		for (int run = 0; run < BENCHMARK_RUNS; run++)
+		{
+			uint32_t start, elapsed;
+			
+			xBootloaderVariables.incomingBlockNumberOld = 1;/*the captured block is taken as the next one on every run*/
+			
+			start = BOOTLOADER_TIMESTAMP();
+			
+			switch (kernel)
+			{
+				case BENCHMARK_CRC32:
+					sink = crc32(words, sizeof(words) - 4, 0);/*crc32 passes over a 4 byte TFTP header first*/
+					break;
+				case BENCHMARK_CRC32_ALIGNED:
+					sink = ulCRC32Aligned(words, sizeof(words), 0);
+					break;
+				case BENCHMARK_SOCKET_PAYLOAD:
+					sink = ulBootloaderCollectSocketPayload(frames, framesLength, "+IPD,", 1, payload, sizeof(payload));
+					break;
+				case BENCHMARK_RESPONSE_MATCH:
+					sink = bCheckIfResponseReceivedOnTime("SEND OK\r\n", text, 0);
+					break;
+				case BENCHMARK_READ_REQUEST:
+					vPrepareTFTPReadRequest(payload, "firmware_1.2.3.bin", &length);
+					sink = length;
+					break;
+				case BENCHMARK_FLASH_TFTP_BUFFER:
+					vFlashTFTPBuffer(block, sizeof(block));
+					break;
+				case BENCHMARK_WIFI_ENGAGE:
+					vBootloaderWifiEngage();
+					break;
+				default:
+					vBootloaderQuectelEngage();
+					break;
+			}
+			
+			elapsed = BOOTLOADER_TIMESTAMP() - start;
+			
+			if (elapsed < best)
+			{
+				best = elapsed;
+			}
+		}
+		
+		if (benchmark_baselines[kernel] != 0 && (uint64_t)best * 100 > (uint64_t)benchmark_baselines[kernel] * (100 + BENCHMARK_REGRESSION_PERCENT))
+		{
+			regressed |= 1U << kernel;
+		}
+		
+		printf("{\"kernel\":\"%s\",\"ticks\":%u,\"baseline\":%u,\"regressed\":%s}\r\n", names[kernel], best, benchmark_baselines[kernel], (regressed & (1U << kernel)) ? "true" : "false");
+	}
+	
+	clearWifiBufferAndResetItsIndex();
+	clearGSMBufferAndResetItsIndex();
+	
+	vBootloaderTimerStop(GSM_IDLE_TIMER);
+	vBootloaderTimerStop(TFTP_TIMEOUT_TIMER);
+	
+	xBootloaderVariables.applicationStoredAddressEnd = storedAddressEnd;
+	xBootloaderVariables.checkSumCalculated				 = checkSum;
+	xBootloaderVariables.incomingBlockNumber			 = blockNumber;
+	xBootloaderVariables.incomingBlockNumberOld		 = blockNumberOld;
+	xBootloaderVariables.solvePort								 = solvePort;
+	
+	memcpy(xBootloaderVariables.ACK, ack, sizeof(ack));
+	
+	(void)sink;
+	#endif
+	
+	return regressed;
+}
+
+/**
+* @brief This function keeps the timing summary of the transfer in SRAM over the coming reset, to be uploaded with the next version check
+*/
+void vBootloaderTimingSave(void)
+{
+	#if BOOTLOADER_TIMING
+	updateTimingSummary_t *summary = (updateTimingSummary_t *)TIMING_SUMMARY_SRAM_ADDRESS;
+	uint32_t elapsed = BOOTLOADER_GET_TICK() - xBootloaderVariables.timing.transferStartTick;
+	
+	summary->bytesPerSecond = elapsed ? (uint32_t)((uint64_t)xBootloaderVariables.timing.bytesReceived * 1000 / elapsed) : 0;
+	summary->retransmits    = xBootloaderVariables.timing.retransmits;
+	
+	for (int i = 0; i < TIMING_PHASE_COUNT; i++)
+	{
+		summary->p50[i] = ulBootloaderTimingPercentile((bootloaderTimingPhase_t)i, 50);
+		summary->p99[i] = ulBootloaderTimingPercentile((bootloaderTimingPhase_t)i, 99);
+	}
+	
+	summary->magic = TIMING_SUMMARY_VALUE;
+	#endif
+}
+
+/**
+* @brief This function turns a saved timing summary into checkFirmware query parameters and consumes it
+* @param char query[] -> filled with "&timing=<bytes/s>,<retransmits>,<p50>/<p99>,..." in phase order, left empty if no summary
+*/
+void vBootloaderTimingQuery(char query[])
+{
+	updateTimingSummary_t *summary = (updateTimingSummary_t *)TIMING_SUMMARY_SRAM_ADDRESS;
+	
+	query[0] = 0;
+	
+	if (summary->magic == TIMING_SUMMARY_VALUE)
+	{
+		uint32_t length = sprintf(query, "&timing=%u,%u", summary->bytesPerSecond, summary->retransmits);
+		
+		for (int i = 0; i < TIMING_PHASE_COUNT; i++)
+		{
+			length += sprintf(&query[length], ",%u/%u", summary->p50[i], summary->p99[i]);
+		}
+		
+		summary->magic = 0;
+	}
+}
+
+/**
+* @brief  This function arms a bootloader timer as a deadline, no work is done per tick
+* @params bootloaderTimerId_t timer -> timer to be armed
+*					uint32_t duration					-> ms from now until the timer expires
+*/
+void vBootloaderTimerStart(bootloaderTimerId_t timer, uint32_t duration)
+{
+	xBootloaderVariables.timers[timer].start    = BOOTLOADER_GET_TICK();
+	xBootloaderVariables.timers[timer].duration = duration;
+	xBootloaderVariables.timers[timer].armed    = true;
+}
+
+/**
+* @brief This function disarms a bootloader timer
+*/
+void vBootloaderTimerStop(bootloaderTimerId_t timer)
+{
+	xBootloaderVariables.timers[timer].armed = false;
+}
+
+/**
+* @brief  This function checks if an armed timer reached its deadline
+* @retval true if expired, false if running or not armed
+* @note   Elapsed time is an unsigned difference, so tick wrap around is harmless for durations below 49 days
+*/
+bool bBootloaderTimerExpired(bootloaderTimerId_t timer)
+{
+	bootloaderTimer_t *t = &xBootloaderVariables.timers[timer];
+	
+	return t->armed && (BOOTLOADER_GET_TICK() - t->start) >= t->duration;
+}
+
+/**
+* @brief  This function returns the time until the earliest armed deadline, so the idle task can sleep until then
+* @retval ms until the next deadline, 0 if one has already expired, BOOTLOADER_NO_DEADLINE if no timer is armed
+*/
+uint32_t ulBootloaderNextDeadline(void)
+{
+	uint32_t now = BOOTLOADER_GET_TICK(), next = BOOTLOADER_NO_DEADLINE;
+	
+	for (int i = 0; i < BOOTLOADER_TIMER_COUNT; i++)
+	{
+		bootloaderTimer_t *t = &xBootloaderVariables.timers[i];
+		
+		if (t->armed)
+		{
+			uint32_t elapsed = now - t->start;
+			uint32_t remaining = (elapsed >= t->duration) ? 0 : t->duration - elapsed;
+			
+			if (remaining < next)
+			{
+				next = remaining;
 			}
 		}
 	}
-	else if((xBootloaderVariables.incomingBlockNumber == xBootloaderVariables.incomingBlockNumberOld + 1) && xBootloaderVariables.incomingBlockNumber == 1)
+	
+	return next;
+}
+
+/**
+* @brief This function runs one pass of the update process, call it periodically from a dedicated task or the main loop
+* @note  Priority of the calling task is raised through vBootloaderSetTaskPriority() while a TFTP transfer is active
+*/
+void vBootloaderUpdateTask(void)
+{
+	vBootloaderDrainUartRings();
+	
+	vAskFirmwareVersionRequestWifi();
+	
+	vAskFirmwareVersionRequestGSM();
+	
+	vBootloaderStartDownloadOnBestLink();
+	
+	vBootloaderSeedServe();
+	
+	vBootloaderTxService();
+	
+	if (xBootloaderVariables.wifiBootloading)
 	{
-		xBootloaderVariables.TFTPTimeoutCounter = 0;		
-		
-		xBootloaderVariables.incomingBlockNumberOld = xBootloaderVariables.incomingBlockNumber;
-		
-		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, true);
-		
-		memcpy(xBootloaderVariables.previousTftpBuffer, xBootloaderVariables.currentTftpBuffer, sizeof(xBootloaderVariables.previousTftpBuffer));
-		
-		vTFTPIncrementACK(xBootloaderVariables.ACK);
-		
-		vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+		vBootloaderWifiEngage();
 	}
-	else
-	{				
-		vPrintTFTPBlockNumber(xBootloaderVariables.incomingBlockNumber, false);
-		
-		xBootloaderVariables.incomingBlockNumber = xBootloaderVariables.incomingBlockNumberOld ;
+	else if (xBootloaderVariables.gsmBootloading)
+	{
+		vBootloaderQuectelEngage();
+	}
+	
+	vBootloaderProcessTimers();
+	
+	if ((xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading) != xBootloaderVariables.changeTaskPriority)
+	{
+		xBootloaderVariables.changeTaskPriority = !xBootloaderVariables.changeTaskPriority;/*raised while transferring, restored afterwards*/
 		
-		vTFTPSendAcknowledge((char *)xBootloaderVariables.ACK, sizeof(xBootloaderVariables.ACK));
+		vBootloaderSetTaskPriority(xBootloaderVariables.changeTaskPriority);
 	}
 }
 
 /**
-* @brief  This function sends acknowledge to the server per incoming package
-*         If its the last package, function checks for the CRC matching and if it is OK, function writes the firmware version to the flash
-* @params char ack[]    -> acknowledge buffer to be sent
-*					uint32_t size -> size of the acknowledge buffer
+* @brief This function raises or restores the priority of the task calling vBootloaderUpdateTask, override it for your RTOS
+* @param bool raisePriority -> true when a transfer starts, false when it ends
 */
-void vTFTPSendAcknowledge(char ack[], uint32_t size)
-{	
-	char sendQuantity[50];
+__weak void vBootloaderSetTaskPriority(bool raisePriority)
+{
+	(void)raisePriority;
+}
+
+/**
+* @brief This function tells the application that a new image is ready, override it to pick the reboot moment
+* @param const char version[] -> 5 byte version number of the ready image
+* @note  Call vBootloaderApplyNow() or vBootloaderScheduleApply() once the application can afford the reboot, the default applies at once
+*/
+__weak void vBootloaderOnFirmwareReady(const char version[])
+{
+	(void)version;
 	
-	if(xBootloaderVariables.wifiBootloading)
+	vBootloaderApplyNow();
+}
+
+/**
+* @brief  This function is the sink of vBootloaderTraceDrain, the default sends the records over SWO on ITM stimulus port
+*					TRACE_ITM_PORT so they don't mix with the printf output, override it to write them elsewhere
+* @params const void *data -> trace records
+*					uint32_t length	 -> bytes to be written
+* @note   Records are dropped while no debugger enabled the port
+*/
+__weak void vBootloaderTraceWrite(const void *data, uint32_t length)
+{
+	const uint8_t *bytes = data;
+	
+	if (!(ITM->TCR & ITM_TCR_ITMENA_Msk) || !(ITM->TER & (1UL << TRACE_ITM_PORT)))
 	{
-		clearWifiBufferAndResetItsIndex();
-		
-		sprintf(sendQuantity, "AT+CIPSEND=%i,%i\r\n", WIFI_UDP_SOCKET_NO, size);
-				
-		HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)sendQuantity, sizeof(sendQuantity));
-		
-		bCheckIfResponseReceivedOnTime("> ", WIFI_BUFFER, 100);
-		
-		HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)ack, size);
+		return;
 	}
-	else if (xBootloaderVariables.gsmBootloading)
+	
+	for (uint32_t i = 0; i < length; i++)
 	{
-		clearGSMBufferAndResetItsIndex();
+		while (ITM->PORT[TRACE_ITM_PORT].u32 == 0);/*stimulus FIFO full*/
 		
-		sprintf(sendQuantity, "AT+QISEND=%i,%i,\"%s\",%i\r\n", GSM_UDP_SOCKET_CONNECT_ID, size, xBootloaderVariables.remoteIP, xBootloaderVariables.remotePort);
-		
-		HAL_UART_Transmit_IT(&GSM_UART, (uint8_t *)sendQuantity, strlen(sendQuantity));
+		ITM->PORT[TRACE_ITM_PORT].u8 = bytes[i];
+	}
+}
+
+/**
+* @brief This function pushes a received byte into the ring of its UART, call it from the UART receive complete ISR
+*				 in place of writing GSM_BUFFER or WIFI_BUFFER directly
+* @params UART_HandleTypeDef *huart -> UART that received the byte
+*					uint8_t receivedByte		 -> received byte
+* @note  Only the ISR writes head and only the task writes tail, so no lock is needed
+*/
+void vBootloaderUartRxISR(UART_HandleTypeDef *huart, uint8_t receivedByte)
+{
+	if (huart == &GSM_UART && !xGSMRxRing.replaying)
+	{
+		bBootloaderRingWrite(&xGSMRxRing, receivedByte);
 		
-		bCheckIfResponseReceivedOnTime("> ", GSM_BUFFER, 100);
+		vBootloaderTxGateMatch(&xTxQueue[LINK_GSM], receivedByte);
+	}
+	else if (huart == &WIFI_UART && !xWifiRxRing.replaying)
+	{
+		bBootloaderRingWrite(&xWifiRxRing, receivedByte);
 		
-		HAL_UART_Transmit_IT(&GSM_UART, (uint8_t *)ack, size);
+		vBootloaderTxGateMatch(&xTxQueue[LINK_WIFI], receivedByte);
 	}
 }
 
 /**
-* @brief If 516 bytes of data arrived, it is not the last package of TFTP.
-* @params char tftpBuffer[]					-> input buffer to write into flash
-*					uint32_t tftpBufferIndex  -> how many bytes to be written
+* @brief  This function pushes a byte into a ring, only one context may write a ring
+* @params uartRing_t *ring				-> ring to be written
+*					uint8_t receivedByte		-> received byte
+* @retval false if the ring is full and the byte is dropped
 */
-void vFlashTFTPBuffer(char tftpBuffer[], uint32_t tftpBufferIndex)
+bool bBootloaderRingWrite(uartRing_t *ring, uint8_t receivedByte)
 {
-	uint32_t dataToBeWrittenToTheFlash = 0;
+	uint32_t head = ring->head;
 	
-	for (int i = 1; i < tftpBufferIndex/4; i++)
+	if ((head - ring->tail) >= BOOTLOADER_UART_RING_SIZE)
 	{
-		/*data will be written to the flash using byte shifted addition*/
-		dataToBeWrittenToTheFlash = 
-			tftpBuffer[4*i+3]*0x1000000 + 
-			tftpBuffer[4*i+2]*0x10000 + 
-			tftpBuffer[4*i+1]*0x100 + 
-			tftpBuffer[4*i];
-		
-		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, xBootloaderVariables.applicationStoredAddressEnd, dataToBeWrittenToTheFlash) != HAL_OK)
-		{
-			#if TFTP_BOOTLOADER_DEBUG
-			printf("System Reset: TFTP data could not be written to the flash!\r\n");
-			#endif
-				
-			NVIC_SystemReset();
-		}
+		ring->overflowCounter++;
 		
-		xBootloaderVariables.applicationStoredAddressEnd += 4;
+		return false;
 	}
+	
+	ring->data[head & (BOOTLOADER_UART_RING_SIZE - 1)] = receivedByte;
+	
+	__DMB();/*data must be visible before the new head*/
+	
+	ring->head = head + 1;
+	
+	return true;
 }
 
 /**
-* @brief  CRC32 table for calculation mapping
-* @retval chosen array value
+* @brief  This function moves received bytes out of a ring, call it from thread level only
+* @params uartRing_t *ring				-> ring to be read
+*					uint8_t destination[]		-> buffer to be filled
+*					uint32_t maxLength			-> free space in the destination buffer
+* @retval number of bytes moved
 */
-const uint32_t crc32_tab[] = 
+uint32_t ulBootloaderRingRead(uartRing_t *ring, uint8_t destination[], uint32_t maxLength)
 {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-	0xe963a535, 0x9e6495a3,	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-	0xf3b97148, 0x84be41de,	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,	0x14015c4f, 0x63066cd9,
-	0xfa0f3d63, 0x8d080df5,	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,	0x35b5a8fa, 0x42b2986c,
-	0xdbbbc9d6, 0xacbcf940,	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-	0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,	0x76dc4190, 0x01db7106,
-	0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-	0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-	0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-	0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-	0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-	0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-	0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-	0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-	0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-	0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-	0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-	0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-	0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-	0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-	0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-	0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
-};
+	uint32_t tail = ring->tail, available = ring->head - tail;
+	
+	__DMB();/*head must be read before the data it publishes*/
+	
+	if (available > maxLength)
+	{
+		available = maxLength;
+	}
+	
+	for (uint32_t i = 0; i < available; i++)
+	{
+		destination[i] = ring->data[(tail + i) & (BOOTLOADER_UART_RING_SIZE - 1)];
+	}
+	
+	__DMB();/*data must be copied before the slots are released*/
+	
+	ring->tail = tail + available;
+	
+	return available;
+}
 
 /**
-* @brief  This function calculates CRC32 checksum of an input buffer
-* @param  const void *buf --> The iput buffer that its crc32 is to be calculated
-*					size_t size     --> Size of the input buffer
-*				  uint32_t init   --> Result of the previous crc32 calculation. If it is the first calculation, parameter should be entered 0.
-* @retval Result of the crc32 calculation.
-* @note   You can notice that 'p' is incremented 4 times before the process because, first 4 bytes of tftpBuffer is TFTP OP code and the rest is data
+* @brief This function drops every byte waiting in a ring, call it from thread level only
 */
-uint32_t crc32(const void *buf, size_t size, uint32_t init)
+void vBootloaderFlushUartRing(uartRing_t *ring)
 {
-	const uint8_t *p = buf;
-	*p++; *p++; *p++; *p++;
-	uint32_t crc = ~init;
-	while (size--)
-	crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-	return crc ^ ~0U;
+	ring->tail = ring->head;
 }
 
 /**
-* @brief This function extracts CRC32 value from the last TFTP package
-* @params char tftpBuffer[]					-> input buffer to extract CRC32 value from the end of that buffer
-*					uint32_t tftpBufferIndex  -> the end index of the input buffer where CRC32 yields
-*					uint32_t *crcBufferIndex	-> To calculate the last package's crc32 dependency
+* @brief  This function copies data into the transmit queue of a link, slots own their bytes so callers may pass stack buffers
+* @params bootloaderLink_t link	-> modem the data is sent to
+*					const void *data			-> bytes to be sent
+*					uint32_t length				-> number of bytes, longer data spans consecutive slots
+*					const char *gate			-> response awaited after the data before the next queued data goes out, NULL for none
+*					uartTxDone_t done			-> called from the UART ISR once the data is sent and its gate seen, NULL for none
+*					uint32_t context			-> passed to done
+* @retval false if the queue had no free slot for BOOTLOADER_TX_TIMEOUT, the rest of the data is dropped
+* @note   Call it from thread level only, the gate must outlive the queue such as a string literal
 */
-void vExtractCRCFromTheLastTFTPPackage(uint32_t *checsumExtracted, char tftpBuffer[], uint32_t tftpBufferIndex, uint32_t *crcBufferIndex)
-{	
-	for (int i = 1; i < ((tftpBufferIndex)/4); i++)
-	{				
-		if(i == ((tftpBufferIndex)/4)-1)
+bool bBootloaderTxQueue(bootloaderLink_t link, const void *data, uint32_t length, const char *gate, uartTxDone_t done, uint32_t context)
+{
+	uartTxQueue_t *queue = &xTxQueue[link];
+	
+	for (uint32_t offset = 0; offset < length;)
+	{
+		uint32_t waitStart = BOOTLOADER_GET_TICK(), head = queue->head;
+		uartTxSlot_t *slot = &queue->slots[head & (BOOTLOADER_TX_SLOTS - 1)];
+		
+		while (head - queue->tail >= BOOTLOADER_TX_SLOTS)/*wait for the ISR to release a slot*/
 		{
-			*checsumExtracted = 
-				tftpBuffer[4*i]  *0x1000000 + 
-				tftpBuffer[4*i+1]*0x10000 + 
-				tftpBuffer[4*i+2]*0x100 + 
-				tftpBuffer[4*i+3];
+			if (BOOTLOADER_GET_TICK() - waitStart > BOOTLOADER_TX_TIMEOUT)
+			{
+				return false;
+			}
+			
+			vBootloaderTxService();
+			
+			WATCHDOG_RESET();
 		}
-		else
-		{
-			*crcBufferIndex = 4*(i-1) + 3;
-		}			
+		
+		slot->length = (length - offset < BOOTLOADER_TX_SLOT_SIZE) ? length - offset : BOOTLOADER_TX_SLOT_SIZE;
+		
+		memcpy(slot->data, (const uint8_t *)data + offset, slot->length);
+		
+		offset += slot->length;
+		
+		slot->gate		= (offset == length) ? gate : NULL;/*only the last piece waits and reports*/
+		slot->done		= (offset == length) ? done : NULL;
+		slot->context = context;
+		
+		__DMB();/*slot must be written before the new head*/
+		
+		queue->head = head + 1;
+		
+		vBootloaderTxKick(queue);
 	}
+	
+	return true;
 }
 
 /**
-* @brief This function calculates the crc32 in a cyclic way over writing the *calculatedCRC32 value
-* @params uint32_t *calculatedCRC32 -> cyclically calculated CRC32
-*					char tftpBuffer[]					-> input buffer to calculate CRC32 over
-*					uint32_t size							-> size of the input buffer
+* @brief This function queues a command without a gate, the caller waits for its response as before
+* @params bootloaderLink_t link	-> modem the command is sent to
+*					const char command[]	-> null terminated command
 */
-void vCalculateCyclicCRC32(uint32_t *calculatedCRC32, char tftpBuffer[], uint32_t size)
+void vBootloaderTxSend(bootloaderLink_t link, const char command[])
 {
-	if (size != 1)
+	bBootloaderTxQueue(link, command, strlen(command), NULL, NULL, 0);
+}
+
+/**
+* @brief  This function queues a send command and its payload as one operation, the payload goes out on the "> " prompt
+* @params bootloaderLink_t link	-> modem the payload is sent through
+*					const char command[]	-> AT+CIPSEND or AT+QISEND command announcing the payload length
+*					const void *payload		-> bytes to be sent
+*					uint32_t length				-> number of bytes
+*					uartTxDone_t done			-> called from the UART ISR once the payload is sent, NULL for none
+*					uint32_t context			-> passed to done
+* @retval false if the queue was full or the command is not a send command
+* @note   The task doesn't wait for the prompt, the receive ISR releases the payload once the command is sent and a line
+*					starts with "> ". Socket data received meanwhile is passed over, a payload holding "> " does not release it.
+*/
+bool bBootloaderTxSendPayload(bootloaderLink_t link, const char command[], const void *payload, uint32_t length, uartTxDone_t done, uint32_t context)
+{
+	if (strncmp(command, "AT+CIPSEND=", strlen("AT+CIPSEND=")) != 0 && strncmp(command, "AT+QISEND=", strlen("AT+QISEND=")) != 0)
 	{
-		*calculatedCRC32 = crc32((const void *)tftpBuffer, size, *calculatedCRC32);
+		return false;/*only a send command is answered by the prompt*/
 	}
+	
+	return bBootloaderTxQueue(link, command, strlen(command), BOOTLOADER_TX_PROMPT, NULL, 0) && bBootloaderTxQueue(link, payload, length, NULL, done, context);
 }
 
 /**
-* @brief This function compares the crc32s and writes new firmware version to the flash
+* @brief This function starts the queue if the UART is idle
+* @note  Interrupts are masked so the task and the UART ISR don't both start a transfer
 */
-void vEvaluateCRC32(uint32_t crcCalculated, uint32_t crcGiven)
+void vBootloaderTxKick(uartTxQueue_t *queue)
 {
-	#if TFTP_BOOTLOADER_DEBUG
-	printf("Size of the new app is = %d bytes \r\n", 	 xBootloaderVariables.applicationStoredAddressEnd - xBootloaderVariables.applicationStoredAddressStart);
-	printf("LAST checksum calculated:     0x%08x\r\nChecksum value on the memory: 0x%08x\r\n", crcCalculated, crcGiven);
-	#endif
+	uint32_t primask = __get_PRIMASK();
 	
-	if(crcCalculated == crcGiven)
+	__disable_irq();
+	
+	if (queue->state == TX_IDLE)
 	{
-		#if TFTP_BOOTLOADER_DEBUG
-		printf("CRC32 check is OK. \r\n\r\n");
-		#endif
-		
-		vFlashChecksumAndFirmwareVersion();
-		
-		NVIC_SystemReset();
+		vBootloaderTxStart(queue);
 	}
-	else
+	
+	__set_PRIMASK(primask);
+}
+
+/**
+* @brief This function transmits the slot at the tail, call it from the UART ISR or with interrupts masked
+*/
+void vBootloaderTxStart(uartTxQueue_t *queue)
+{
+	while (queue->tail != queue->head)
 	{
-		#if TFTP_BOOTLOADER_DEBUG
-		printf("CRC32 check FAILED. \r\n\r\n");
-		#endif
+		uartTxSlot_t *slot = &queue->slots[queue->tail & (BOOTLOADER_TX_SLOTS - 1)];
 		
-		vEraseStorageSpace();
+		queue->state			= TX_SENDING;
+		queue->stateStart = BOOTLOADER_GET_TICK();
+		
+		BOOTLOADER_TX_CACHE_CLEAN(slot->data, BOOTLOADER_TX_SLOT_SIZE);
+		
+		if (BOOTLOADER_UART_TRANSMIT(queue->huart, slot->data, slot->length) == HAL_OK)
+		{
+			return;
+		}
 		
-		SAVE_ENERGY_REGISTERS();
+		queue->dropCounter++;/*UART is busy with a transfer the queue didn't start*/
 		
-		NVIC_SystemReset();
+		queue->tail++;
 	}
+	
+	queue->state = TX_IDLE;
 }
 
 /**
-* @brief This function erases chosen flash sector 
-* @param Sector identifying number
+* @brief This function releases the slot at the tail and starts the next one, call it from the UART ISR
 */
-void vFlashEraseSector(uint32_t sectorNo)
+void vBootloaderTxSlotDone(uartTxQueue_t *queue)
 {
-	HAL_StatusTypeDef HAL = HAL_ERROR;
-	FLASH_EraseInitTypeDef EraseInitStruct;
-	uint32_t SECTORError;
-	
-	HAL_FLASH_Unlock();
+	uartTxSlot_t *slot = &queue->slots[queue->tail & (BOOTLOADER_TX_SLOTS - 1)];
 	
-	EraseInitStruct.Sector        = sectorNo;
-	EraseInitStruct.TypeErase     = FLASH_TYPEERASE_SECTORS;
-	EraseInitStruct.VoltageRange  = FLASH_VOLTAGE_RANGE_3;
-	EraseInitStruct.NbSectors     = 1;
-		
-	while (HAL != HAL_OK) 
+	if (slot->done != NULL)
 	{
-		HAL = HAL_FLASHEx_Erase(&EraseInitStruct, &SECTORError);
-		
-		if (HAL != HAL_OK){for(int i = 0; i < 5000; i++){}}
+		slot->done(slot->context);
 	}
+	
+	__DMB();/*slot must be read before it is released*/
+	
+	queue->tail++;
+	
+	vBootloaderTxStart(queue);
 }
 
 /**
-* @brief This function copies storage space to application space
+* @brief  This function moves the queue of a UART on after a transfer, call it from HAL_UART_TxCpltCallback
+* @param  UART_HandleTypeDef *huart -> UART that completed a transfer
+* @note   DMA transfers complete at the TC interrupt, so the modem has not answered yet when the gate wait starts
 */
-void vCopyStorageSpaceToApplicationSpace(uint32_t appSpace, uint32_t storageSpace, uint32_t spaceSize)
+void vBootloaderUartTxISR(UART_HandleTypeDef *huart)
 {
-	uint32_t writeAddress = appSpace, copyAddress  = storageSpace, data = 0;
-	
-	for(int i = 0; i < (spaceSize/4); i++)
+	for (int link = 0; link < LINK_COUNT; link++)
 	{
-		data = *(__IO uint32_t *)copyAddress;
+		uartTxQueue_t *queue = &xTxQueue[link];
 		
-		if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, writeAddress, data) != HAL_OK)
+		if (queue->huart != huart || queue->state != TX_SENDING)
 		{
-			NVIC_SystemReset();
+			continue;
 		}
 		
-		writeAddress += 4;
-		copyAddress  += 4;
+		if (queue->slots[queue->tail & (BOOTLOADER_TX_SLOTS - 1)].gate != NULL)
+		{
+			queue->gateMatched = 0;
+			queue->stateStart	= BOOTLOADER_GET_TICK();
+			queue->state			= TX_GATED;
+		}
+		else
+		{
+			vBootloaderTxSlotDone(queue);
+		}
 	}
 }
 
 /**
-* @brief This function flashes firmware version and '1' to the end of that sector showing checksum of the firmware is approved
+* @brief  This function matches a received byte against the gate of the slot at the tail, called from the receive ISR
+* @params uartTxQueue_t *queue	-> queue of the UART that received the byte
+*					uint8_t receivedByte	-> received byte
+* @note   Payload bytes of socket data frames are never matched, they may hold anything
 */
-void vFlashChecksumAndFirmwareVersion(void)
+void vBootloaderTxGateMatch(uartTxQueue_t *queue, uint8_t receivedByte)
 {
-	/*checksum correction bit held and written to the end of the storage sector*/
-	if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STORAGE_ADDRESS + MAX_APPICATION_SIZE - 4, 0x01) != HAL_OK)
+	const char *gate;
+	
+	if (bBootloaderRxFramePayload(&queue->frame, receivedByte) || queue->state != TX_GATED)
 	{
-		#if TFTP_BOOTLOADER_DEBUG
-		printf("System Reset: CRC32 approval bit could not written to the flash\r\n");
-		#endif
-		
-		NVIC_SystemReset();
+		return;
 	}
 	
-	/*new version number written to the end of the storage sector*/
-	for(int i = 0; i < 5; i++)
+	gate = queue->slots[queue->tail & (BOOTLOADER_TX_SLOTS - 1)].gate;
+	
+	if (receivedByte == (uint8_t)gate[queue->gateMatched])
 	{
-		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (STORAGE_ADDRESS + MAX_APPICATION_SIZE - (24 - i*4)), xBootloaderVariables.newVersionNumber[i]) != HAL_OK)
-		{
-			#if TFTP_BOOTLOADER_DEBUG
-			printf("System Reset: Version number bits could not be written to the flash\r\n");
-			#endif
-			
-			NVIC_SystemReset();
-		}
+		queue->gateMatched++;
+	}
+	else
+	{
+		queue->gateMatched = (receivedByte == (uint8_t)gate[0]);
+	}
+	
+	if (gate[queue->gateMatched] == 0)
+	{
+		vBootloaderTxSlotDone(queue);
 	}
 }
 
 /**
-* @brief This function checks the current firmware version of the device
-* @param char array to be filled
+* @brief  This function follows the socket data frames of a modem, called from the receive ISR for every byte
+* @params uartRxFrame_t *frame	-> frame state of the UART that received the byte
+*					uint8_t receivedByte	-> received byte
+* @retval true if the byte is payload of a frame
+* @note   "+IPD,<id>,<length>:" and "+QIURC: "recv",<id>,<length>[,"<ip>",<port>]\r\n" give the length as their second field
 */
-void vGetDeviceFirmwareVersion(char firmwareVersion[])
+bool bBootloaderRxFramePayload(uartRxFrame_t *frame, uint8_t receivedByte)
 {
-	uint32_t versionAddress = APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24;
+	if (frame->skip > 0)
+	{
+		frame->skip--;
+		
+		return true;
+	}
 	
-	/*obtain the device firmware version*/
-	for (int i = 0; i < 5; i++)
+	if (frame->header[frame->matched] != 0)
 	{
-		if ((int)*(__IO uint32_t *)versionAddress != -1)
+		if (receivedByte == (uint8_t)frame->header[frame->matched])
 		{
-			firmwareVersion[i] = *(__IO uint32_t *)versionAddress;
-			versionAddress += 4;
+			frame->matched++;
 		}
 		else
 		{
-			sprintf(firmwareVersion ,CURRENT_FW_VER);
-			versionAddress += 4;
+			frame->matched = (receivedByte == (uint8_t)frame->header[0]);
+		}
+		
+		frame->field		 = 0;
+		frame->fields[0] = 0;
+		frame->fields[1] = 0;
+	}
+	else if (receivedByte >= '0' && receivedByte <= '9')
+	{
+		if (frame->field < 2)
+		{
+			frame->fields[frame->field] = frame->fields[frame->field] * 10 + (receivedByte - '0');
 		}
 	}
+	else if (receivedByte == ',')
+	{
+		frame->field++;
+	}
+	else if (receivedByte == (uint8_t)frame->end || receivedByte == '\n')/*header ends, or a line which was not a header*/
+	{
+		frame->skip		 = (receivedByte == (uint8_t)frame->end && frame->field >= 1) ? frame->fields[1] : 0;
+		frame->matched = 0;
+	}
+	
+	return false;
 }
 
 /**
-* @brief This function erases the storage space, modify the function to your needs. (etc. new mcu different sectors..)
+* @brief This function flushes a queue whose transfer or gate hangs for BOOTLOADER_TX_TIMEOUT, call it from thread level
+* @note  A gate is missed when the modem answers ERROR, the data queued behind it belongs to the failed exchange
 */
-void vEraseStorageSpace(void)
+void vBootloaderTxService(void)
 {
-	vFlashEraseSector (7);
+	for (int link = 0; link < LINK_COUNT; link++)
+	{
+		uartTxQueue_t *queue = &xTxQueue[link];
+		uint32_t primask = __get_PRIMASK();
+		
+		__disable_irq();
+		
+		if (queue->state != TX_IDLE && BOOTLOADER_GET_TICK() - queue->stateStart > BOOTLOADER_TX_TIMEOUT)
+		{
+			if (queue->state == TX_SENDING)
+			{
+				HAL_UART_AbortTransmit(queue->huart);
+			}
+			
+			queue->dropCounter += queue->head - queue->tail;
+			queue->tail				  = queue->head;
+			queue->state			  = TX_IDLE;
+			
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Transmit queue of link %d flushed\r\n", link);
+			#endif
+		}
+		
+		__set_PRIMASK(primask);
+	}
+	
+	#if BOOTLOADER_TIMING
+	if (xBootloaderVariables.timing.ackPending)
+	{
+		uint32_t primask = __get_PRIMASK(), queued, sent;
+		
+		__disable_irq();/*a new acknowledge must not change the stamps half way*/
+		
+		queued = xBootloaderVariables.timing.ackQueued;
+		sent	 = xBootloaderVariables.timing.ackSent;
+		
+		xBootloaderVariables.timing.ackPending = false;
+		
+		__set_PRIMASK(primask);
+		
+		vBootloaderTimingRecordSpan(TIMING_ACK, queued, sent);
+	}
+	#endif
 }
 
 /**
-* @brief This function erases the application space, modify the function to your needs (etc. new mcu different sectors..)
+* @brief This function stamps the acknowledge once the queue sent it, called from the UART ISR
+* @param uint32_t start -> BOOTLOADER_TIMESTAMP() when the acknowledge was queued
+* @note  The histogram is shared with the task, vBootloaderTxService records the stamps at thread level
 */
-void vEraseApplicationSpace(void)
+void vBootloaderAckSent(uint32_t start)
 {
-	vFlashEraseSector (6);
+	#if BOOTLOADER_TIMING
+	xBootloaderVariables.timing.ackQueued = start;
+	xBootloaderVariables.timing.ackSent   = BOOTLOADER_TIMESTAMP();
+	
+	__DMB();/*stamps must be written before the flag*/
+	
+	xBootloaderVariables.timing.ackPending = true;
+	#else
+	(void)start;
+	#endif
 }
 
 /**
-* @brief This function jumps to application space
+* @brief This function appends the bytes waiting in the UART rings to GSM_BUFFER and WIFI_BUFFER
+* @note  Buffers are kept null terminated for the strstr based response checks
 */
-void vBootloaderJumpToApplication(uint32_t appSpace)
+void vBootloaderDrainUartRings(void)
 {
-	typedef void (*pFunction)(void);
-	
-	uint32_t  JumpAddress = *(__IO uint32_t*)(appSpace + 4);
-	
-	pFunction Jump = (pFunction)JumpAddress;
-	
-	HAL_RCC_DeInit();
+	uint32_t received;
 	
-	HAL_DeInit();
-	
-	__set_MSP(*(__IO uint32_t*)appSpace);
+	if (GSM_BUFFER_RECEIVE_INDEX < sizeof(GSM_BUFFER) - 1)
+	{
+		received = ulBootloaderRingRead(&xGSMRxRing, (uint8_t *)&GSM_BUFFER[GSM_BUFFER_RECEIVE_INDEX], sizeof(GSM_BUFFER) - 1 - GSM_BUFFER_RECEIVE_INDEX);
+		
+		if (received > 0)
+		{
+			#if BOOTLOADER_UART_CAPTURE
+			vBootloaderCaptureUart(CAPTURE_GSM_UART, (uint8_t *)&GSM_BUFFER[GSM_BUFFER_RECEIVE_INDEX], received);
+			#endif
+			
+			GSM_BUFFER_RECEIVE_INDEX += received;
+			
+			GSM_BUFFER[GSM_BUFFER_RECEIVE_INDEX] = 0;
+			
+			vBootloaderTimerStart(GSM_IDLE_TIMER, GSM_IDLE_TIME);
+		}
+	}
 	
-	Jump();
+	if (WIFI_BUFFER_RECEIVE_INDEX < sizeof(WIFI_BUFFER) - 1)
+	{
+		received = ulBootloaderRingRead(&xWifiRxRing, (uint8_t *)&WIFI_BUFFER[WIFI_BUFFER_RECEIVE_INDEX], sizeof(WIFI_BUFFER) - 1 - WIFI_BUFFER_RECEIVE_INDEX);
+		
+		if (received > 0)
+		{
+			#if BOOTLOADER_UART_CAPTURE
+			vBootloaderCaptureUart(CAPTURE_WIFI_UART, (uint8_t *)&WIFI_BUFFER[WIFI_BUFFER_RECEIVE_INDEX], received);
+			#endif
+			
+			WIFI_BUFFER_RECEIVE_INDEX += received;
+			
+			WIFI_BUFFER[WIFI_BUFFER_RECEIVE_INDEX] = 0;
+		}
+	}
 }
 
 /**
-* @brief This function operates bootloader timeouts at systick (1ms periodically ISR called interrupt)
+* @brief This function writes bytes taken out of a UART ring to UART_CAPTURE_WRITE, led by a uartCaptureHeader_t
+* @params uartCaptureSource_t source -> UART the bytes were received from
+*					uint8_t data[]						 -> received bytes
+*					uint32_t length						 -> number of received bytes
 */
-void vBootloadercallOver1ms(void)
+void vBootloaderCaptureUart(uartCaptureSource_t source, uint8_t data[], uint32_t length)
 {
-	xBootloaderVariables.askForUpdateCounter++;
+	uartCaptureHeader_t header = {0};
 	
-	if(xBootloaderVariables.startGSMTimeout && GSM_BUFFER_RECEIVE_INDEX != 0) GSM_TIME_PASSED_FROM_LAST_BYTE_RECEIVED++;
+	header.tick   = BOOTLOADER_GET_TICK();
+	header.source = source;
+	header.length = length;
 	
-	if (xBootloaderVariables.wifiBootloading || xBootloaderVariables.gsmBootloading)/*starts to be processed when TFTP communication starts*/
-	{	
-		xBootloaderVariables.startTFTPTimeout = true;
-		
-		xBootloaderVariables.connectionCounter++;
-
-		if (xBootloaderVariables.startTFTPTimeout)
-		{
-			xBootloaderVariables.TFTPTimeoutCounter++;
-		}
-	}
+	UART_CAPTURE_WRITE(&header, sizeof(header));
+	UART_CAPTURE_WRITE(data, length);
 }
 
 /**
-* @brief This function checks bootloader timeouts at a thread
+* @brief  This function feeds the due records of a capture into the UART rings, as the receive ISR would,
+*					so the captured session runs through the parsers and the TFTP state machine again
+* @params const uint8_t capture[]	-> captured records, starting at the next record to be fed
+*					uint32_t length					-> bytes left in the capture
+*					uint32_t *replayStart		-> 0 at the first call, keeps the tick offset between the capture and now,
+*																		 set it to BOOTLOADER_NO_DEADLINE to feed records as fast as the rings allow
+* @retval number of capture bytes consumed, the caller advances capture by it and calls again from the main loop,
+*					-1 if the capture ends inside a record
+* @note   A ring has a single producer, so the receive ISR drops the live bytes of both UARTs until the whole capture
+*					is consumed or found truncated
 */
-void vBootloaderProcessTimers(void)
+int32_t lBootloaderReplayCapture(const uint8_t capture[], uint32_t length, uint32_t *replayStart)
 {
-	if(xBootloaderVariables.connectionCounter >= 5000000)/*if connection is over 5000 seconds, corrupt*/
+	uint32_t consumed = 0;
+	uartCaptureHeader_t header;
+	
+	xGSMRxRing.replaying	= true;
+	xWifiRxRing.replaying = true;
+	
+	__DMB();/*an ISR entered after this sees the flags and leaves the rings alone*/
+	
+	while (length - consumed >= sizeof(header))
 	{
-		xBootloaderVariables.connectionCounter = 0;
+		memcpy(&header, &capture[consumed], sizeof(header));
 		
-		SAVE_ENERGY_REGISTERS();
+		if (length - consumed - sizeof(header) < header.length)/*truncated capture*/
+		{
+			xGSMRxRing.replaying	= false;
+			xWifiRxRing.replaying = false;
+			
+			#if TFTP_BOOTLOADER_DEBUG
+			printf("Capture is truncated %u bytes before its end\r\n", length - consumed);
+			#endif
+			
+			return -1;
+		}
 		
-		NVIC_SystemReset();
+		if (*replayStart == 0)
+		{
+			*replayStart = BOOTLOADER_GET_TICK() - header.tick;
+		}
+		
+		if (*replayStart != BOOTLOADER_NO_DEADLINE && (int32_t)(BOOTLOADER_GET_TICK() - *replayStart - header.tick) < 0)/*keep the original timing*/
+		{
+			break;
+		}
+		
+		uartRing_t *ring = (header.source == CAPTURE_GSM_UART) ? &xGSMRxRing : &xWifiRxRing;
+		uartTxQueue_t *queue = (header.source == CAPTURE_GSM_UART) ? &xTxQueue[LINK_GSM] : &xTxQueue[LINK_WIFI];
+		
+		if (BOOTLOADER_UART_RING_SIZE - (ring->head - ring->tail) < header.length)/*wait for the parser to drain the ring*/
+		{
+			break;
+		}
+		
+		for (uint32_t i = 0; i < header.length; i++)
+		{
+			bBootloaderRingWrite(ring, capture[consumed + sizeof(header) + i]);
+			
+			vBootloaderTxGateMatch(queue, capture[consumed + sizeof(header) + i]);/*prompts release the queued payloads as live ones do*/
+		}
+		
+		consumed += sizeof(header) + header.length;
 	}
 	
-	if (xBootloaderVariables.TFTPTimeoutCounter >= 40000)/*if wrong package is arriving over 40 secs, corrupt*/
+	if (consumed == length)/*the live bytes belong to the rings again*/
 	{
-		SAVE_ENERGY_REGISTERS();
-		
-		NVIC_SystemReset();
+		xGSMRxRing.replaying	= false;
+		xWifiRxRing.replaying = false;
 	}
+	
+	return consumed;
 }
 
 /**
@@ -1091,6 +5246,17 @@ void vPrepareTFTPReadRequest(char readRequest[], char fileName[], uint32_t *leng
 	readRequest[index++] = 0x74;
 	readRequest[index++] = 0x00;/*parse the file name got from web server to the request*/
 	
+	#if BOOTLOADER_MULTICAST
+	if (xBootloaderVariables.wifiBootloading && xBootloaderVariables.manifest.present)/*blocks can only be taken out of order when the manifest checks them*/
+	{
+		strcpy(&readRequest[index], "multicast");
+		
+		index += strlen("multicast") + 1;
+		
+		readRequest[index++] = 0x00;/*empty value asks the server for a group*/
+	}
+	#endif
+	
 	*length = index;
 }
 
@@ -1118,7 +5284,9 @@ void vTFTPIncrementACK(uint8_t ACK[])
 */
 void vPrintTFTPBlockNumber(uint32_t blockNumber, bool correctOrIncorrect)
 {
-	#if TFTP_BOOTLOADER_DEBUG
+	#if TFTP_BOOTLOADER_TRACE
+	vBootloaderTrace(correctOrIncorrect ? TRACE_BLOCK_CORRECT : TRACE_BLOCK_WRONG, 0, blockNumber);
+	#elif TFTP_BOOTLOADER_DEBUG
 	if (correctOrIncorrect)
 	{
 		printf("incoming block number:       %d\r\n", blockNumber);
@@ -1130,6 +5298,43 @@ void vPrintTFTPBlockNumber(uint32_t blockNumber, bool correctOrIncorrect)
 	#endif
 }
 
+/**
+* @brief  This function logs a binary trace event, it costs a few stores instead of a blocking printf
+* @params bootloaderTraceEvent_t event -> event identifier
+*					uint16_t arg16							 -> small argument of the event
+*					uint32_t arg								 -> argument of the event, string arguments are logged by address and resolved on the host
+* @note   Call it from thread level only
+*/
+void vBootloaderTrace(bootloaderTraceEvent_t event, uint16_t arg16, uint32_t arg)
+{
+	traceRecord_t *record = &xTraceLog.records[xTraceLog.head & (TRACE_RING_SIZE - 1)];
+	
+	record->timestamp = BOOTLOADER_TIMESTAMP();
+	record->event     = event;
+	record->arg16     = arg16;
+	record->arg       = arg;
+	
+	xTraceLog.head++;
+	
+	if (xTraceLog.head - xTraceLog.tail > TRACE_RING_SIZE)/*oldest record is overwritten*/
+	{
+		xTraceLog.tail = xTraceLog.head - TRACE_RING_SIZE;
+	}
+}
+
+/**
+* @brief This function writes the waiting trace records to TRACE_WRITE, call it at idle or after a reset to dump the previous run
+*/
+void vBootloaderTraceDrain(void)
+{
+	while (xTraceLog.tail != xTraceLog.head)
+	{
+		TRACE_WRITE(&xTraceLog.records[xTraceLog.tail & (TRACE_RING_SIZE - 1)], sizeof(traceRecord_t));
+		
+		xTraceLog.tail++;
+	}
+}
+
 /**
 * @brief  If 516 bytes of data arrived, it is not the last package of TFTP.
 * @params uint32_t packageLength			-> package length of the arrival package
@@ -1157,20 +5362,30 @@ bool bCheckIfResponseReceivedOnTime(char expectedResponse[], char inputBuffer[],
 {	
 	uint32_t timeCount = 0;
 	
+	BOOTLOADER_TIMING_START(waitStart);
+	
+	vBootloaderDrainUartRings();
+	
 	while(strstr(inputBuffer, expectedResponse) == NULL && timeCount < timeout)
 	{
 		WATCHDOG_RESET();
 		
 		HAL_Delay(1);
 		
+		vBootloaderDrainUartRings();
+		
 		timeCount++;
 	}
 	
+	BOOTLOADER_TIMING_RECORD(TIMING_RESPONSE_WAIT, waitStart);
+	
 	if (strstr(inputBuffer, expectedResponse) != NULL)
 	{
 		WATCHDOG_RESET();
 		
-		#if TFTP_BOOTLOADER_DEBUG
+		#if TFTP_BOOTLOADER_TRACE
+		vBootloaderTrace(TRACE_RESPONSE_RECEIVED, timeCount, (uint32_t)expectedResponse);
+		#elif TFTP_BOOTLOADER_DEBUG
 		printf("expected response: %s returned 1\r\n", expectedResponse);
 		#endif
 		
@@ -1180,7 +5395,9 @@ bool bCheckIfResponseReceivedOnTime(char expectedResponse[], char inputBuffer[],
 	{
 		WATCHDOG_RESET();
 		
-		#if TFTP_BOOTLOADER_DEBUG
+		#if TFTP_BOOTLOADER_TRACE
+		vBootloaderTrace(TRACE_RESPONSE_TIMEOUT, timeCount, (uint32_t)expectedResponse);
+		#elif TFTP_BOOTLOADER_DEBUG
 		printf("expected response: %s returned 0\r\n", expectedResponse);
 		#endif
 		
@@ -1195,13 +5412,41 @@ void vReduceWifiBaudRateTo19200(void)
 {
 	clearWifiBufferAndResetItsIndex();
 	
-	HAL_UART_Transmit_IT(&WIFI_UART, (uint8_t *)"AT+UART_CUR=19200,8,1,0,1\r\n", sizeof("AT+UART_CUR=19200,8,1,0,1\r\n"));
+	vBootloaderTxSend(LINK_WIFI, "AT+UART_CUR=19200,8,1,0,1\r\n");
 		
 	if (bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 500))
 	{
 		vUsartReInit(&WIFI_UART, 19200, NULL, NULL, NULL);
 		
 		HAL_UART_Receive_IT(&WIFI_UART, &WIFI_UART_RECEIVED_CHARACTER, 1);
+		
+		xBootloaderVariables.wifiBaudReduced = true;
+	}
+	
+	clearWifiBufferAndResetItsIndex();
+}
+
+/**
+* @brief This function puts the Wifi Baud Rate back from 19200 to 115200 after a transfer
+*/
+void vRestoreWifiBaudRateTo115200(void)
+{
+	if (!xBootloaderVariables.wifiBaudReduced)
+	{
+		return;
+	}
+	
+	clearWifiBufferAndResetItsIndex();
+	
+	vBootloaderTxSend(LINK_WIFI, "AT+UART_CUR=115200,8,1,0,1\r\n");
+	
+	if (bCheckIfResponseReceivedOnTime("OK\r\n", WIFI_BUFFER, 500))
+	{
+		vUsartReInit(&WIFI_UART, 115200, NULL, NULL, NULL);
+		
+		HAL_UART_Receive_IT(&WIFI_UART, &WIFI_UART_RECEIVED_CHARACTER, 1);
+		
+		xBootloaderVariables.wifiBaudReduced = false;
 	}
 	
 	clearWifiBufferAndResetItsIndex();
@@ -1222,4 +5467,42 @@ void vBootloadervariablesInit(void)
 	xBootloaderVariables.applicationStoredAddressStart = STORAGE_ADDRESS;
 	
 	xBootloaderVariables.applicationStoredAddressEnd = xBootloaderVariables.applicationStoredAddressStart;
+	
+	vMetadataScan(&xBootloaderVariables.metadata);
+	
+	if (xLinkQuality.magic != LINK_QUALITY_VALUE)/*power on, SRAM content is random*/
+	{
+		memset(&xLinkQuality, 0, sizeof(xLinkQuality));
+		
+		xLinkQuality.magic = LINK_QUALITY_VALUE;
+	}
+	
+	for (int i = 0; i < LINK_COUNT; i++)
+	{
+		xLinkQuality.links[i].fileOffered = false;
+	}
+	
+	if (xTraceLog.magic != TRACE_LOG_VALUE || xTraceLog.head - xTraceLog.tail > TRACE_RING_SIZE)/*power on, SRAM content is random*/
+	{
+		memset(&xTraceLog, 0, sizeof(xTraceLog));
+		
+		xTraceLog.magic = TRACE_LOG_VALUE;
+	}
+	
+	#if BOOTLOADER_TIMING
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;/*start the DWT cycle counter used as timestamp*/
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	#endif
+	
+	xBootloaderVariables.deviceHash = ulBootloaderDeviceHash();
+	
+	xBootloaderVariables.randomState = (xBootloaderVariables.deviceHash ^ BOOTLOADER_GET_TICK()) | 1;/*xorshift state must not be 0*/
+	
+	xBootloaderVariables.rolloutBucket = (xBootloaderVariables.deviceHash >> 8) % 100;
+	
+	vBootloaderTimerStart(STARTUP_CHECK_TIMER, xBootloaderVariables.deviceHash % UPDATE_CHECK_STARTUP_SPREAD);
+	
+	vBootloaderScheduleNextCheck(PERIODIC_FW_UPDATE_RETRY_TIME, true);
+	
+	xBootloaderVariables.pacer.rateCap = DOWNLOAD_RATE_CAP;
 }
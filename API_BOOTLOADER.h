@@ -29,16 +29,71 @@
 #define MAX_APPICATION_SIZE																	262144																			/*bytes*/
 #define GSM_UART  																					huart6
 #define WIFI_UART 																					huart3
+#ifndef BOOTLOADER_FLASH_POINTER
+#define BOOTLOADER_FLASH_POINTER(address)										((__IO uint8_t *)(address))									/*flash is memory mapped, a host build maps it to its flash model*/
+#endif
+#define BOOTLOADER_FLASH_WORD(address)											(*(__IO uint32_t *)BOOTLOADER_FLASH_POINTER(address))
+#define BOOTLOADER_ROM_ADDRESS															(uint32_t)0x08000000U												/*IROM1 start of the bootloader build*/
+#define BOOTLOADER_ROM_SIZE																	(uint32_t)0x00010000U												/*IROM1 size of the bootloader build, sectors 0 and 1, everything up to APPLICATION_ADDRESS above it is data*/
+#define BOOTLOADER_ROM_LIMIT																(BOOTLOADER_ROM_ADDRESS + BOOTLOADER_ROM_SIZE)
+#ifndef BOOTLOADER_IMAGE_END
+extern uint32_t Load$$LR$$LR_IROM1$$Limit;
+#define BOOTLOADER_IMAGE_END(x)															((uint32_t)&Load$$LR$$LR_IROM1$$Limit)			/*end of the linked bootloader image from armlink, a GCC build gives its linker script symbol*/
+#endif
+
+/************************** Firmware Signature Definitions **************************/
+#define BOOTLOADER_SIGNATURE																0																						/*To accept only images signed for FIRMWARE_PUBLIC_KEY, set this definition to '1' and add micro-ecc to the project*/
+#define FIRMWARE_SIGNATURE_SIZE															64																					/*bytes, r and s of an ECDSA P-256 signature over the SHA-256 of the image*/
+#if BOOTLOADER_SIGNATURE
+#include "uECC.h"
+#define FIRMWARE_PUBLIC_KEY																	firmwarePublicKey														/*64 bytes uncompressed P-256 key, defined by the project*/
+#define FIRMWARE_SIGNATURE_VERIFY(hash, signature)					uECC_verify(FIRMWARE_PUBLIC_KEY, hash, 32, signature, uECC_secp256r1())
+#endif
+
+/************************** Firmware Decryption Definitions *************************/
+#define BOOTLOADER_DECRYPTION																0																						/*To accept AES-128-CTR encrypted images, set this definition to '1' and program the key to FIRMWARE_KEY_ADDRESS*/
+#define FIRMWARE_KEY_ADDRESS																(uint32_t)0x0807FFF0U												/*16 bytes at the end of sector 5, above BOOTLOADER_ROM_LIMIT and never erased by the bootloader, keep it under read out protection*/
+
+/************************** Metadata Log Definitions ********************************/
+#define METADATA_SECTOR_A_ADDRESS														(uint32_t)0x08010000U												/*two sectors written in turn, right above BOOTLOADER_ROM_LIMIT*/
+#define METADATA_SECTOR_B_ADDRESS														(uint32_t)0x08018000U
+#define METADATA_SECTOR_A																		2
+#define METADATA_SECTOR_B																		3
+#define METADATA_SECTOR_SIZE																32768																				/*bytes, 1024 records before the log is compacted*/
+#define APPLY_CHUNK_SIZE																		16384																				/*bytes copied and verified between two apply journal records*/
+#define APPLY_LOG_RESERVE																		((MAX_APPICATION_SIZE / APPLY_CHUNK_SIZE + 8) * 32)				/*bytes of the log kept free before an apply, so the apply never compacts it*/
 
 /************************** Built in bootloader SRAM trigger ************************/
 #define CONTROL_VALUE_SRAM_ADDRESS		(uint32_t)0x20003FF0U
 #define CONTROL_VALUE	(uint32_t)								0x626F6F74U
+#define BOOTLOADER_NOINIT																		__attribute__((section(".bss.noinit")))			/*variables left out of startup zeroing survive a soft reset, xTraceLog and xLinkQuality use it.
+																														The scatter file needs an UNINIT region for it, e.g. "RW_NOINIT +0 UNINIT { *(.bss.noinit) }" in LR_IROM1,
+																														a GCC linker script a NOLOAD ".noinit (NOLOAD) : { *(.bss.noinit) } > RAM" section. Without it the section
+																														is zeroed at startup like any .bss and both logs start empty after every reset*/
+
+/************************** Boot Verification Definitions ***************************/
+#define IMAGE_CRC_OFFSET																		(MAX_APPICATION_SIZE - 32)									/*CRC32 of the image, written before the approval word*/
+#define IMAGE_LENGTH_OFFSET																	(MAX_APPICATION_SIZE - 28)									/*bytes of the image, 0xFFFFFFFF for images approved without it*/
+#define BOOT_VERIFY_SRAM_ADDRESS														(uint32_t)0x20003FD0U												/*verification marker survives soft resets, keep it out of the linker's reach, between the timing summary and CONTROL_VALUE_SRAM_ADDRESS*/
+#define BOOT_VERIFY_VALUE																		(uint32_t)0x76657269U												/*marks a valid verification marker*/
+#define BOOT_VERIFY_INTERVAL																16																					/*boots trusting a cached verification before the image is checked again, 0 checks every boot*/
+#define BOOT_INSTALL_ATTEMPTS																3																						/*soft resets an approved storage image is installed on before the bootloader gives up until the next power on*/
+#define BOOT_VERIFY_SLICE																		16384																				/*bytes checked between watchdog reloads*/
+#define BOOT_WATCHDOG_RELOAD(x)															(IWDG->KR = 0x0000AAAAU)										/*HAL is not initialized at systemInit, reload the IWDG by its register*/
 
 /***************************  Bootloader Definitions ********************************/
 #define PERIODIC_FW_UPDATE_TIME       (16 * 60 * 60 * 1000) /* ms */
+#define PERIODIC_FW_UPDATE_RETRY_TIME (PERIODIC_FW_UPDATE_TIME - UPDATE_CHECK_JITTER / 2) /* ms, earliest next check, jitter is added on top */
+#define UPDATE_CHECK_STARTUP_SPREAD   (30 * 60 * 1000)      /* ms, start-up checks are spread over this window by device UID */
+#define UPDATE_CHECK_JITTER           (60 * 60 * 1000)      /* ms, random delay added to a scheduled check the server gave no backoff for */
+#define UPDATE_CHECK_MAX_RETRY_AFTER  (7 * 24 * 60 * 60)    /* s, upper bound accepted from a server backoff hint */
+#define FIRMWARE_APPLY_DEADLINE       0                     /* ms, a ready image is applied after this even if the application didn't ask for it, 0 waits for the application */
 #define CURRENT_FW_VER          			"0.0.0"
 #define BOOTLOADER_MODE         			0											/*To prepare an update, set this definition to '1'.
 																														Additionally, don't forget to make the IROM1 address equal to APPLICATION_ADDRESS at target options of Keil.
+																														With '0', keep IROM1 at BOOTLOADER_ROM_ADDRESS with a size of BOOTLOADER_ROM_SIZE, so armlink fails a bootloader
+																														growing into the metadata log, the bundle configuration region or the firmware key above it. vBootloader
+																														checks BOOTLOADER_IMAGE_END against it again at startup and stops before touching the flash.
 																														This definition decides to call bootloader function at systemInit() and, 
 																														redefines vector table offset at system_stm32f7xx.c:
 																														...
@@ -57,24 +112,52 @@
 																														}
 																														*/
 
+/***************************  Firmware Manifest Definitions *************************/
+#define FIRMWARE_CHUNK_SIZE																	4096																				/*bytes verified per manifest checksum, multiple of the 512 bytes TFTP block*/
+#define FIRMWARE_MAX_CHUNKS																	(MAX_APPICATION_SIZE / FIRMWARE_CHUNK_SIZE)
+#define FIRMWARE_TRAILER_SIZE																32																					/*bytes at the end of a slot for the image CRC32, length, version and approval words*/
+#define FIRMWARE_FORMAT_BUNDLE															0x01																				/*image is a bundle of components led by a bundleHeader_t*/
+#define FIRMWARE_FORMAT_SUPPORTED														FIRMWARE_FORMAT_BUNDLE											/*format flags understood by this bootloader, 0 is a raw binary*/
+#define FIRMWARE_REFETCH_PIECE_SIZE													512																					/*bytes asked per HTTP Range request, response must fit in the UART buffers*/
+#define FIRMWARE_REFETCH_RETRIES														3																						/*range downloads of a corrupted chunk before the image is dropped*/
+#define FIRMWARE_REFETCH_TIMEOUT														15000																				/*ms to receive one range response*/
+#ifndef BOOTLOADER_MULTIPATH
+#define BOOTLOADER_MULTIPATH																0																						/*To download manifest images over Wifi and GSM at once by HTTP Range when both are up, set this definition to '1'*/
+#endif
+#define MULTIPATH_MIN_IMAGE_SIZE														(16 * FIRMWARE_CHUNK_SIZE)									/*bytes, smaller images are not worth the second connection*/
+#define MULTIPATH_LINK_RETRIES															3																						/*failed range requests in a row before a link is left out of the download*/
+#define MULTIPATH_NO_CHUNK																	0xFFFFFFFFU
+
+/***************************  Bundle Definitions ************************************/
+#define BUNDLE_MAGIC																				(uint32_t)0x6C646E62U												/*"bndl", first word of a bundle, never a valid stack pointer*/
+#define BUNDLE_MAX_COMPONENTS																4																						/*entries of the header table, unused ones are zero*/
+#define BUNDLE_COMPRESSION_NONE															0																						/*only stored components are installed*/
+#define BUNDLE_CONFIG_ADDRESS																(uint32_t)0x08020000U												/*calibration and configuration region, sector 4 above BOOTLOADER_ROM_LIMIT*/
+#define BUNDLE_CONFIG_SECTOR																4
+#define BUNDLE_CONFIG_SIZE																	131072																			/*bytes*/
+
 /****************** QUECTEL UG95 GSM Configuration Definitions **********************/
 #define GSM_BUFFER																					gsm.receive																	/*Global GSM buffer*/
 #define GSM_BUFFER_RECEIVE_INDEX														gsm.rx_index 																/*GSM Buffer's global index*/
-#define clearGSMBufferAndResetItsIndex(x)   								gsmquectel_clearAllParams(x)								/*Clear the global GSM buffer and reset its index*/
-#define GSM_TIME_PASSED_FROM_LAST_BYTE_RECEIVED							gsm.timeOut    															/*"ms" time passed after last byte received for gsm*/
+#define clearGSMBufferAndResetItsIndex(x)   								do{vBootloaderFlushUartRing(&xGSMRxRing); gsmquectel_clearAllParams(x);}while(0)	/*Clear the GSM ring, the global GSM buffer and reset its index*/
 #define GSM_EXTERNAL_IP																			gsmParams.ipAddress													/*IP buffer of gsm*/
 #define GSM_TCP_SOCKET_CONTEXT_ID														1																						/*For web server connection, context ID*/
 #define GSM_TCP_SOCKET_CONNECT_ID														0																						/*For web server connection, socket number*/
 #define GSM_UDP_SOCKET_CONTEXT_ID														1																						/*For UDP server connection, context ID*/
 #define GSM_UDP_SOCKET_CONNECT_ID														2																						/*For UDP server connection, socket number*/
+#define GSM_LITERAL(x)																			#x																					/*text of a number, GSM_LITERAL_OF expands a definition to it first*/
+#define GSM_LITERAL_OF(x)																		GSM_LITERAL(x)
+#define GSM_TCP_SOCKET_OPENED																"+QIOPEN: " GSM_LITERAL_OF(GSM_TCP_SOCKET_CONNECT_ID) ",0\r\n"	/*web server socket opened, a literal so the trace logs it by its address in the image*/
+#define GSM_UDP_SOCKET_OPENED																"+QIOPEN: " GSM_LITERAL_OF(GSM_UDP_SOCKET_CONNECT_ID) ",0\r\n"	/*TFTP server socket opened*/
 #define GSM_MODULE_STATE																		gsmState																		/*Current State Of GSM*/
 #define GSM_STEADY_STATE																		GSM_FINAL_STATE															/*If GSM state is steady, ready to communicate*/
 
 /********************* ESP8266 WIFI Configuration Definitions ***********************/
-#define clearWifiBufferAndResetItsIndex(x)									wifi_clearParams(x)													/*Clear the global WIFI buffer and reset its index*/
+#define clearWifiBufferAndResetItsIndex(x)									do{vBootloaderFlushUartRing(&xWifiRxRing); wifi_clearParams(x);}while(0)		/*Clear the WIFI ring, the global WIFI buffer and reset its index*/
 #define WIFI_TCP_SOCKET_NO																	4																						/*For web server connection, socket number*/
 #define WIFI_UDP_SOCKET_NO																	3																						/*For UDP server connection, socket number*/
 #define WIFI_BUFFER																					wifiParams.receiveBuffer										/*Global WIFI buffer*/
+#define WIFI_BUFFER_RECEIVE_INDEX														wifiParams.rx_index													/*WIFI Buffer's global index*/
 #define WIFI_EXTERNAL_IP																		wifiParams.externalIP												/*Wifi IP char buffer*/
 #define WIFI_UART_RECEIVED_CHARACTER  											wifiParams.receivedData											/*Char, for baudrate switch triggering, make this global and known*/
 #define WIFI_STATE																					wifiPreviousState														/*Current State Of wifi*/
@@ -85,6 +168,115 @@
 #define FIRMWARE_VERSION_WEB_SERVER_PORT										5555
 #define FIRMWARE_VERSION_WEB_SERVER_PATH_FIRST_PART					"GET /api/Installer/checkFirmware?version="
 #define FIRMWARE_VERSION_WEB_SERVER_PATH_SECOND_PART        " HTTP/1.1\r\nHost: home.inavitas.io:5555\r\ncache-control: no-cache\r\n\r\n"
+#define FIRMWARE_RANGE_WEB_SERVER_PATH_FIRST_PART						"GET /api/Installer/firmware/"							/*file name is appended, served with HTTP Range support*/
+#define FIRMWARE_RANGE_WEB_SERVER_PATH_SECOND_PART					" HTTP/1.1\r\nHost: home.inavitas.io:5555\r\nRange: bytes="
+#define FIRMWARE_VERSION_RESPONSE_END												"}}"																				/*checkFirmware response is complete once this arrives, the JSON must end with a nested object.
+																														checkFirmware?version=<x.y.z>[&timing=..] is answered with quoted string fields only:
+																														"ip", "port"  -> TFTP server, asked from local port 69 with an octet read request,
+																														"file"        -> image name holding "rx-<version>bin", absent or empty if up to date,
+																														"retryAfter"  -> s before the next check, a Retry-After header works too, an HTTP-date keeps the default,
+																														"rollout"     -> percent of devices, picked by the hash of the device UID,
+																														"seed"        -> LAN IP of a peer serving the image on SEED_HTTP_PORT,
+																														"length", "crc", "chunkSize", "chunks", "format" -> manifest, CRC32s in hex, chunkSize equal to FIRMWARE_CHUNK_SIZE,
+																														"signature", "iv" -> hex ECDSA signature and AES-128-CTR counter block.
+																														TFTP blocks are 512 bytes and acknowledged one by one, blksize and windowsize are never asked,
+																														an OACK only answers the "multicast" option. Without a manifest the file is the image followed by
+																														its big endian CRC32 (zlib polynomial), vExtractCRCFromTheLastTFTPPackage reads it from the last block.
+																														With a manifest the file is exactly "length" bytes of image, nothing follows it, a longer file is rejected.
+																														firmware/<file> answers "Range: bytes=a-b" with 206 and a Content-Length, at most FIRMWARE_REFETCH_PIECE_SIZE bytes.*/
+
+/***************************** LAN Seed Definitions *********************************/
+#ifndef BOOTLOADER_SEED
+#define BOOTLOADER_SEED																			0																						/*To serve the installed image by HTTP Range to devices on the same Wi-Fi network, set this definition to '1'*/
+#endif
+#define SEED_HTTP_PORT																			8266																				/*AT+CIPSERVER port, a "seed" field of the checkFirmware response points peers to it*/
+#define SEED_MAX_PEERS																			3																						/*AT+CIPSERVERMAXCONN, peers take links 0 to 2 below WIFI_UDP_SOCKET_NO and WIFI_TCP_SOCKET_NO*/
+#define SEED_ATTEMPTS																				4																						/*rounds of range requests to the seed before the TFTP server, a round fails in 45 s on a busy seed*/
+#define SEED_PENDING_SIZE																		1024																				/*bytes of peer requests kept while one is answered*/
+#define SEED_NOT_SERVABLE																		0xFFFFFFFFU																	/*installed image is not intact, encrypted or from a bundle, nothing is served*/
+
+/************************** UART Receive Ring Definitions ***************************/
+#define BOOTLOADER_UART_RING_SIZE														1024																				/*bytes per UART, must be a power of two*/
+#ifndef BOOTLOADER_UART_CAPTURE
+#define BOOTLOADER_UART_CAPTURE															0																						/*To capture received modem bytes for replaying them into the rings, set this definition to '1'*/
+#endif
+#ifndef UART_CAPTURE_WRITE
+#define UART_CAPTURE_WRITE(data, length)										fwrite(data, 1, length, stdout)							/*binary sink of the capture, a uartCaptureHeader_t followed by the bytes*/
+#endif
+
+/************************** UART Transmit Queue Definitions *************************/
+#define BOOTLOADER_UART_TX_DMA															0																						/*To send queued bytes by DMA, set this definition to '1' once a TX DMA stream is assigned to both modem UARTs*/
+#define BOOTLOADER_TX_SLOT_SIZE															128																					/*bytes per slot, longer data spans consecutive slots, a multiple of the 32 byte cache line*/
+#define BOOTLOADER_TX_SLOTS																	8																						/*slots per UART, must be a power of two*/
+#define BOOTLOADER_TX_TIMEOUT																5000																				/*ms a slot may be sent or wait for its gate before the queue is flushed*/
+#define BOOTLOADER_TX_PROMPT																"\n> "																			/*send prompt of both modems, only taken at the start of a line*/
+/*The HAL callbacks of the application must hand both modem UARTs to the rings and the queues:
+	void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+	{
+		vBootloaderUartRxISR(huart, <byte received into the 1 byte HAL_UART_Receive_IT buffer>);
+		HAL_UART_Receive_IT(huart, <same buffer>, 1);
+	}
+	void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+	{
+		vBootloaderUartTxISR(huart);
+	}
+	Without the TX hook no slot after the first one is sent, without the RX hook no response arrives and no gate opens*/
+#if BOOTLOADER_UART_TX_DMA
+#define BOOTLOADER_UART_TRANSMIT(huart, data, length)				HAL_UART_Transmit_DMA(huart, data, length)
+#define BOOTLOADER_TX_CACHE_CLEAN(data, length)							SCB_CleanDCache_by_Addr((uint32_t *)(data), length)	/*DMA reads the SRAM, the F7 D-cache must write the slot back first*/
+#else
+#define BOOTLOADER_TX_CACHE_CLEAN(data, length)
+#define BOOTLOADER_UART_TRANSMIT(huart, data, length)				HAL_UART_Transmit_IT(huart, data, length)
+#endif
+
+/***************************** Link Selection Definitions ***************************/
+#define GSM_DATA_COST_WEIGHT																200																					/*percent, projected GSM download time is scaled by it before the links are compared, 100 compares time only*/
+#define LINK_QUALITY_VALUE																	(uint32_t)0x6C696E6BU												/*marks link measurements kept over a reset*/
+#define LINK_EWMA_SHIFT																			2																						/*a new measurement weighs 1/4*/
+
+/***************************** Multicast TFTP Definitions ***************************/
+#ifndef BOOTLOADER_MULTICAST
+#define BOOTLOADER_MULTICAST																0																						/*To ask manifest images over Wifi by RFC 2090 multicast TFTP, set this definition to '1'*/
+#endif
+#define MULTICAST_UDP_SOCKET_NO															2																						/*ESP8266 link joined to the multicast group*/
+#define MULTICAST_REASK_TIME																2000																				/*ms without a new block before the master acknowledges again or a listener asks to become master*/
+#define TFTP_OPCODE_OACK																		6																						/*RFC 2347 option acknowledgement*/
+#define TFTP_MAX_BLOCKS																			(MAX_APPICATION_SIZE / 512 + 1)							/*a slot full image ends with an empty block*/
+
+/***************************** Bootloader Timer Definitions *************************/
+#define BOOTLOADER_GET_TICK(x)															HAL_GetTick(x)															/*ms monotonic clock, timers are compared against it*/
+#define TFTP_TIMEOUT_TIME																		40000																				/*ms, wrong packages arriving longer than this corrupts the transfer*/
+#define TFTP_CONNECTION_TIME																5000000																			/*ms, a transfer lasting longer than this is corrupt*/
+#define GSM_IDLE_TIME																				10																					/*ms of silence after the last byte, meaning gsm responded*/
+#define BOOTLOADER_NO_DEADLINE															0xFFFFFFFFU																	/*returned when no timer is armed*/
+
+/***************************** Download Pacing Definitions **************************/
+#define DOWNLOAD_RATE_CAP																		2048																				/*bytes/s asked while the application has modem traffic queued, 0 never paces, vBootloaderSetRateCap changes it*/
+#define DOWNLOAD_BUCKET_SIZE																(4 * 512)																		/*bytes, burst allowed after the link was quiet*/
+#define DOWNLOAD_RATE_WINDOW																2000																				/*ms over which the current rate is measured*/
+#define APPLICATION_TRAFFIC_PENDING(x)											(0)																					/*nonzero while the application has traffic queued on the modem, full speed otherwise*/
+
+/***************************** Update Timing Definitions ****************************/
+#define BOOTLOADER_TIMING																		0																						/*To collect per phase latency histograms of transfers, set this definition to '1'*/
+#define TIMING_HISTOGRAM_BUCKETS														20																					/*bucket n counts durations below 2^n us*/
+#define TIMING_SUMMARY_SRAM_ADDRESS													(uint32_t)0x20003F80U												/*summary survives the reset after a transfer, keep it out of the linker's reach*/
+#define TIMING_SUMMARY_VALUE																(uint32_t)0x74696D65U												/*marks a summary waiting to be uploaded*/
+#ifndef BOOTLOADER_TIMESTAMP
+#define BOOTLOADER_TIMESTAMP(x)															(DWT->CYCCNT)																/*free running timestamp, a host build maps it to clock_gettime*/
+#define BOOTLOADER_TIMESTAMP_TO_US(x)												((x) / (SystemCoreClock / 1000000U))
+#endif
+#ifndef BOOTLOADER_BENCHMARK
+#define BOOTLOADER_BENCHMARK																0																						/*To time the bootloader kernels on synthetic inputs with ulBootloaderBenchmark, set this definition to '1'*/
+#endif
+#define BENCHMARK_RUNS																			16																					/*runs per kernel, the fastest one is kept*/
+#define BENCHMARK_REGRESSION_PERCENT												10																					/*a kernel slower than its baseline by more than this is reported as regressed*/
+#if BOOTLOADER_TIMING
+#define BOOTLOADER_TIMING_START(x)													uint32_t x = BOOTLOADER_TIMESTAMP()
+#define BOOTLOADER_TIMING_RECORD(phase, x)									vBootloaderTimingRecord(phase, x)
+#else
+#define BOOTLOADER_TIMING_START(x)
+#define BOOTLOADER_TIMING_RECORD(phase, x)
+#endif
 
 /***************************** WATCHDOG RESET Definitions ***************************/
 #define WATCHDOG_RESET(x)																		vIWDGReset(x)
@@ -93,39 +285,455 @@
 #define SAVE_ENERGY_REGISTERS(x)														vFlashSaveEnergyRegisters(x)
 
 /***************************  To Activate Printf Debugs *****************************/
+#ifndef TFTP_BOOTLOADER_DEBUG
 #define TFTP_BOOTLOADER_DEBUG																1
+#endif
+
+/***************************  Trace Log Definitions *********************************/
+#ifndef TFTP_BOOTLOADER_TRACE
+#define TFTP_BOOTLOADER_TRACE																0																						/*To log per block and per AT exchange events in binary instead of printf, set this definition to '1'*/
+#endif
+#define TRACE_RING_SIZE																			128																					/*events, must be a power of two*/
+#define TRACE_LOG_VALUE																			(uint32_t)0x74726365U												/*marks a valid trace log kept over a reset*/
+#define TRACE_ITM_PORT																			1																						/*ITM stimulus port of the default trace sink, printf keeps its UART*/
+#ifndef TRACE_WRITE
+#define TRACE_WRITE(data, length)														vBootloaderTraceWrite(data, length)					/*binary sink of vBootloaderTraceDrain, records are decoded on the host*/
+#endif
 
 /*************************** Typedef Definitions ************************************/
+typedef enum{
+	
+	ASK_FOR_UPDATE_TIMER = 0,																																							/*periodic firmware version check*/
+	STARTUP_CHECK_TIMER,																																									/*per device offset of the check requested at start*/
+	TFTP_TIMEOUT_TIMER,																																										/*restarted by every correct block*/
+	CONNECTION_TIMER,																																											/*whole transfer duration*/
+	GSM_IDLE_TIMER,																																												/*restarted by every byte arriving from gsm*/
+	MULTICAST_REASK_TIMER,																																								/*restarted by every new multicast block*/
+	PACER_TIMER,																																													/*deferred acknowledge is sent when it expires*/
+	APPLY_TIMER,																																													/*reset applying the ready image, armed by the application or the deadline*/
+	BOOTLOADER_TIMER_COUNT
+	
+} bootloaderTimerId_t;
+
+typedef struct{
+	
+	bool armed;
+	uint32_t start;
+	uint32_t duration;
+	
+} bootloaderTimer_t;
+
+typedef enum{
+	
+	TIMING_BLOCK_INTERVAL = 0,																																						/*between two in order TFTP blocks*/
+	TIMING_BLOCK_PROCESS,																																									/*vBootloaderCRC32ToFlash*/
+	TIMING_ACK,																																														/*vTFTPSendAcknowledge until the queue sent it*/
+	TIMING_FLASH_WRITE,																																										/*flash programming*/
+	TIMING_CRC,																																														/*checksum calculation*/
+	TIMING_HASH,																																													/*SHA-256 update*/
+	TIMING_DECRYPT,																																												/*AES-128-CTR decryption*/
+	TIMING_RESPONSE_WAIT,																																									/*bCheckIfResponseReceivedOnTime*/
+	TIMING_PHASE_COUNT
+	
+} bootloaderTimingPhase_t;
+
+typedef enum{
+	
+	BENCHMARK_CRC32 = 0,																																									/*crc32 over 4 KB, the first 4 bytes skipped as its TFTP header*/
+	BENCHMARK_CRC32_ALIGNED,																																							/*ulCRC32Aligned over 4 KB*/
+	BENCHMARK_SOCKET_PAYLOAD,																																							/*ulBootloaderCollectSocketPayload over two "+IPD" TFTP frames*/
+	BENCHMARK_RESPONSE_MATCH,																																							/*bCheckIfResponseReceivedOnTime finding a response after 1 KB of text*/
+	BENCHMARK_READ_REQUEST,																																								/*vPrepareTFTPReadRequest*/
+	BENCHMARK_FLASH_TFTP_BUFFER,																																						/*vFlashTFTPBuffer programming a TFTP block in the storage slot*/
+	BENCHMARK_WIFI_ENGAGE,																																								/*vBootloaderWifiEngage on a "+IPD" capture of a TFTP block, checked and programmed*/
+	BENCHMARK_QUECTEL_ENGAGE,																																							/*vBootloaderQuectelEngage on a "+QIURC" capture of a TFTP block, checked and programmed*/
+	BENCHMARK_KERNEL_COUNT
+	
+} benchmarkKernel_t;
+
+typedef struct{
+	
+	uint16_t histogram[TIMING_PHASE_COUNT][TIMING_HISTOGRAM_BUCKETS];
+	
+	uint32_t lastBlockTimestamp;
+	uint32_t transferStartTick;
+	volatile uint32_t ackQueued, ackSent;																																	/*timestamps of the last acknowledge, written by the UART ISR*/
+	volatile bool ackPending;																																							/*set by the UART ISR, the task records TIMING_ACK and clears it*/
+	uint32_t bytesReceived;
+	uint32_t retransmits;
+	
+} updateTiming_t;
+
+typedef enum{
+	
+	TRACE_BLOCK_CORRECT = 1,																																							/*arg: block number*/
+	TRACE_BLOCK_WRONG,																																										/*arg: block number*/
+	TRACE_RESPONSE_RECEIVED,																																							/*arg16: waited ms, arg: address of the expected response literal*/
+	TRACE_RESPONSE_TIMEOUT																																								/*arg16: waited ms, arg: address of the expected response literal*/
+	
+} bootloaderTraceEvent_t;
+
+typedef struct{																																													/*12 bytes little endian record as written by TRACE_WRITE*/
+	
+	uint32_t timestamp;																																										/*BOOTLOADER_TIMESTAMP()*/
+	uint16_t event;																																												/*bootloaderTraceEvent_t*/
+	uint16_t arg16;
+	uint32_t arg;
+	
+} traceRecord_t;
+
+typedef struct{
+	
+	uint32_t magic;
+	uint32_t head, tail;																																									/*free running, the oldest records are overwritten*/
+	
+	traceRecord_t records[TRACE_RING_SIZE];
+	
+} traceLog_t;
+
+typedef struct{
+	
+	uint32_t magic;
+	uint32_t bytesPerSecond;
+	uint32_t retransmits;
+	uint32_t p50[TIMING_PHASE_COUNT], p99[TIMING_PHASE_COUNT];																						/*us, upper bound of the histogram bucket*/
+	
+} updateTimingSummary_t;
+
+typedef struct{
+	
+	uint32_t state[8];
+	uint64_t length;																																											/*bytes hashed*/
+	uint8_t  block[64];
+	uint32_t blockLength;
+	
+} sha256Context_t;
+
+typedef struct{
+	
+	bool present;																																													/*false when the server sent no manifest, CRC32 is then in the last TFTP block*/
+	bool signaturePresent;
+	bool encrypted;																																												/*image is AES-128-CTR encrypted, counter starts at iv and counts 16 byte blocks of the file*/
+	
+	uint32_t imageLength;
+	uint32_t imageCRC;
+	uint32_t formatFlags;
+	uint32_t chunkCount;
+	uint32_t chunkCRC[FIRMWARE_MAX_CHUNKS];
+	
+	uint8_t signature[FIRMWARE_SIGNATURE_SIZE];
+	uint8_t iv[16];
+	
+} firmwareManifest_t;
+
+typedef enum{
+	
+	METADATA_APPLICATION_SLOT = 0,
+	METADATA_STORAGE_SLOT,
+	METADATA_APPLY_SLOT,																																									/*journal of the copy from the storage to the application slot*/
+	METADATA_SLOT_COUNT
+	
+} metadataSlot_t;
+
+typedef enum{
+	
+	METADATA_SLOT_ERASED = 1,
+	METADATA_SLOT_APPROVED,																																								/*storage holds a verified image waiting to be copied*/
+	METADATA_SLOT_INSTALLED,																																							/*application slot holds the running image*/
+	METADATA_SLOT_APPLYING																																								/*application slot is erased for the storage image, imageLength bytes are verified*/
+	
+} metadataSlotState_t;
+
+typedef struct{																																													/*32 bytes, appended word by word with recordCRC last*/
+	
+	uint32_t sequence;																																										/*1 for the first record, 0xFFFFFFFF is erased flash*/
+	uint32_t slot;																																												/*metadataSlot_t*/
+	uint32_t state;																																												/*metadataSlotState_t*/
+	uint32_t imageLength;
+	uint32_t imageCRC;
+	char     version[8];
+	uint32_t recordCRC;																																										/*CRC32 of the words before it*/
+	
+} metadataRecord_t;
+
+typedef struct{
+	
+	uint32_t sequence;																																										/*highest valid sequence, 0 if the log is empty*/
+	uint32_t activeSector;																																								/*address of the sector appended to*/
+	uint32_t nextAddress;																																									/*first free record of the active sector*/
+	
+	bool incomplete;																																											/*a compaction was cut, a slot's latest record is only in the other sector*/
+	
+	metadataRecord_t slots[METADATA_SLOT_COUNT];																													/*latest record of every slot, sequence 0 if none*/
+	
+} bootMetadata_t;
+
+typedef enum{
+	
+	BUNDLE_TARGET_APPLICATION = 0,																																				/*installed with a trailer, so it boots like a single image*/
+	BUNDLE_TARGET_CONFIG,
+	BUNDLE_TARGET_COUNT
+	
+} bundleTarget_t;
+
+typedef struct{																																													/*20 bytes little endian*/
+	
+	uint32_t target;																																											/*bundleTarget_t*/
+	uint32_t offset;																																											/*word aligned, from the start of the bundle*/
+	uint32_t length;
+	uint32_t crc;																																													/*CRC32 of the component*/
+	uint32_t compression;																																									/*BUNDLE_COMPRESSION_NONE*/
+	
+} bundleComponent_t;
+
+typedef struct{																																													/*88 bytes at the start of a bundle*/
+	
+	uint32_t magic;
+	uint32_t count;
+	
+	bundleComponent_t components[BUNDLE_MAX_COMPONENTS];
+	
+} bundleHeader_t;
+
+typedef struct{
+	
+	uint32_t address;
+	uint32_t sector;																																											/*erased before the component is copied*/
+	uint32_t size;
+	
+} bundleRegion_t;
+
+typedef enum{
+	
+	LINK_WIFI = 0,
+	LINK_GSM,
+	LINK_COUNT
+	
+} bootloaderLink_t;
+
+typedef struct{
+	
+	uint32_t rttMs;																																												/*connect time of the web server*/
+	uint32_t bytesPerSecond;																																							/*goodput of the checkFirmware exchange*/
+	uint32_t transferBytesPerSecond;																																			/*goodput of whole TFTP transfers, 0 until one is made*/
+	
+	bool fileOffered;																																											/*last check on this link offered a download*/
+	
+} linkQuality_t;
+
+typedef struct{
+	
+	uint32_t magic;
+	
+	linkQuality_t links[LINK_COUNT];																																			/*moving averages, kept over checks and resets*/
+	
+} linkQualityLog_t;
+
+typedef struct{
+	
+	char remoteIP[20];
+	char remoteFixedPort[20];
+	char fileName[50];																																										/*empty if the last check on the link offered nothing*/
+	char seedIP[20];
+	
+	firmwareManifest_t manifest;
+	
+} linkOffer_t;
+
+typedef struct{
+	
+	bool up;																																															/*taking part in the download*/
+	bool socketOpen;
+	uint8_t failures;																																											/*failed range requests in a row*/
+	
+	uint8_t *buffer;																																											/*chunk is collected here before it is verified*/
+	uint32_t chunk;																																												/*chunk being downloaded, MULTIPATH_NO_CHUNK when idle*/
+	uint32_t done;																																												/*bytes of the chunk received*/
+	uint32_t requestTick;																																									/*when the range of the current piece was asked*/
+	uint32_t storedBytes;																																									/*bytes of chunks this link stored first*/
+	
+} multipathLink_t;
+
+typedef struct{
+	
+	uint32_t rateCap;																																											/*bytes/s while the application has traffic queued, 0 never paces*/
+	uint32_t tokens;																																											/*bytes that may be asked now*/
+	uint32_t lastRefill;
+	
+	bool ackPending;																																											/*an acknowledge waits for tokens*/
+	uint8_t pendingAck[4];
+	
+	uint32_t lastAckedBlock;
+	uint32_t bytesAcked;																																									/*bytes asked from the server during the transfer*/
+	uint32_t windowStart, windowBytes;
+	uint32_t currentRate;																																									/*bytes/s over the last DOWNLOAD_RATE_WINDOW*/
+	
+} downloadPacer_t;
+
+typedef struct{
+	
+	bool active;																																													/*server accepted the multicast option*/
+	bool master;																																													/*this client acknowledges for the group*/
+	
+	char groupIP[20];
+	char groupPort[8];
+	
+	uint32_t blockCount;																																									/*blocks of the image, the last one is short*/
+	uint32_t receivedBlocks;
+	uint32_t contiguousBlocks;																																						/*blocks received without a gap from the first one*/
+	uint32_t duplicateBlocks;																																						/*blocks received again for another client, dropped*/
+	uint32_t receivedMap[(TFTP_MAX_BLOCKS + 31) / 32];																										/*bit n set when block n + 1 is programmed*/
+	
+} multicastState_t;
+
 typedef struct{
 	
-	bool triggerUpdateAtStartWifi, triggerUpdateAtStartGSM;
+	bool triggerUpdateAtStartWifi, triggerUpdateAtStartGSM;																								/*version check pending on the link*/
 	bool wifiBootloading, gsmBootloading;
 	bool changeTaskPriority;
-	bool startTFTPTimeout;
-	bool startGSMTimeout;
+	bool seedListening;
+	bool wifiBaudReduced;																																									/*ESP8266 runs at 19200 for a TFTP transfer*/
+	bool firmwareReady;																																										/*an approved image waits in the storage space for vBootloaderApplyNow*/
 	
 	char previousTftpBuffer[516], currentTftpBuffer[516];
+	uint8_t chunkBuffer[FIRMWARE_CHUNK_SIZE];																															/*a chunk is verified here before it is programmed*/
+	#if BOOTLOADER_MULTIPATH
+	uint8_t multipathBuffer[FIRMWARE_CHUNK_SIZE];																													/*chunk buffer of the GSM link while both links download*/
+	#endif
 	char remoteFixedPort[20];
 	char newVersionNumber[5];
 	char oldVersionNumber[5];
 	char fileName[50];
 	char remoteIP[20];
+	char seedIP[20];																																											/*device on the LAN serving the offered image, empty to use the servers*/
 	
 	uint8_t solvePort;
+	uint8_t rolloutBucket;
 	uint8_t ACK[4];
 	
-	uint32_t askForUpdateCounter;
-	uint32_t TFTPTimeoutCounter, connectionCounter;
+	bootloaderTimer_t timers[BOOTLOADER_TIMER_COUNT];
+	uint32_t deviceHash, randomState;
 	uint32_t incomingBlockNumber, incomingBlockNumberOld; 
 	uint32_t checkSumCalculated, checkSumOnTheLastTFTPPackage;
+	uint32_t receivedImageLength;
+	uint32_t failedChunks[(FIRMWARE_MAX_CHUNKS + 31) / 32];																								/*bitmap of chunks left erased because their CRC32 failed*/
 	uint32_t applicationStoredAddressStart, applicationStoredAddressEnd;
+	uint32_t seedImageLength;																																							/*bytes of the installed image served to peers, 0 until vBootloaderSeedServe checks it, SEED_NOT_SERVABLE if it is refused*/
 	
 	int remotePort;
 	
+	firmwareManifest_t manifest;																																					/*manifest of the download in progress, taken from the offer of its link*/
+	
+	linkOffer_t offers[LINK_COUNT];																																				/*answer of the last check on every link*/
+	
+	sha256Context_t imageHash;																																						/*updated as the image arrives, in image order*/
+	
+	uint8_t aesRoundKeys[176];																																						/*expanded from FIRMWARE_KEY_ADDRESS for a transfer, wiped when it ends*/
+	
+	multicastState_t multicast;
+	
+	downloadPacer_t pacer;
+	
+	bootMetadata_t metadata;																																							/*log scanned at init, appended when an image is approved*/
+	
+	updateTiming_t timing;
+	
 } bootloaderVariables_t;
 
+typedef struct{
+	
+	volatile uint32_t head;																																								/*written by the receive ISR only, by lBootloaderReplayCapture while replaying*/
+	volatile uint32_t tail;																																								/*written by the update task only*/
+	volatile uint32_t overflowCounter;																																		/*bytes dropped because the task was late*/
+	volatile bool replaying;																																							/*lBootloaderReplayCapture writes the ring, the receive ISR drops live bytes*/
+	
+	uint8_t data[BOOTLOADER_UART_RING_SIZE];
+	
+} uartRing_t;
+
+typedef void (*uartTxDone_t)(uint32_t context);
+
+typedef enum{
+	
+	TX_IDLE = 0,
+	TX_SENDING,																																														/*slot at the tail is on the wire*/
+	TX_GATED																																															/*slot at the tail is sent, its gate is awaited*/
+	
+} uartTxState_t;
+
+typedef struct{
+	
+	uint8_t data[BOOTLOADER_TX_SLOT_SIZE] __ALIGNED(32);																									/*whole cache lines, cleaned alone before a DMA transfer*/
+	uint16_t length;
+	const char *gate;																																											/*response awaited before the next slot goes out, NULL for none*/
+	uartTxDone_t done;																																										/*called from the UART ISR once the slot is sent and its gate seen*/
+	uint32_t context;
+	
+} uartTxSlot_t;
+
+typedef struct{
+	
+	const char *header;																																										/*text leading a socket data frame, "+IPD," or "+QIURC: \"recv\","*/
+	char end;																																															/*character closing the frame header, the payload follows it*/
+	uint8_t matched;																																											/*header characters received so far*/
+	uint8_t field;																																												/*comma separated field of the header being read*/
+	uint32_t fields[2];																																										/*connection id and payload length*/
+	uint32_t skip;																																												/*payload bytes still to be passed over*/
+	
+} uartRxFrame_t;
+
+typedef struct{
+	
+	UART_HandleTypeDef *huart;
+	uartRxFrame_t frame;																																									/*written by the receive ISR only*/
+	volatile uint32_t head;																																								/*written by the task only*/
+	volatile uint32_t tail;																																								/*advanced by the UART ISR, or by the task with interrupts masked*/
+	volatile uartTxState_t state;
+	volatile uint32_t stateStart;																																					/*tick the tail slot entered its state*/
+	volatile uint32_t gateMatched;																																				/*gate characters received so far*/
+	volatile uint32_t dropCounter;																																				/*slots dropped by a busy UART or a timeout*/
+	
+	uartTxSlot_t slots[BOOTLOADER_TX_SLOTS];
+	
+} uartTxQueue_t;
+
 /************************* Extern Typedefs ******************************************/
+typedef enum{
+	
+	CAPTURE_GSM_UART = 0,
+	CAPTURE_WIFI_UART
+	
+} uartCaptureSource_t;
+
+typedef struct{																																													/*8 bytes little endian record header, length bytes follow it*/
+	
+	uint32_t tick;																																												/*BOOTLOADER_GET_TICK() when the bytes were taken out of the ring*/
+	uint8_t  source;																																											/*uartCaptureSource_t*/
+	uint8_t  reserved;
+	uint16_t length;
+	
+} uartCaptureHeader_t;
+
+typedef struct{
+	
+	uint32_t magic;
+	uint32_t slotAddress, imageCRC;																																				/*image the marker belongs to*/
+	uint32_t bootCount;																																										/*boots since the image was first checked after power on*/
+	uint32_t verifyCycles, verifiedLength;																																/*cost of the last check, core runs on HSI at systemInit*/
+	uint32_t staged;																																											/*checked by vBootloaderApplyNow, trusted by the boot of its reset without counting it*/
+	
+} bootVerifyMarker_t;
+
 extern bootloaderVariables_t  xBootloaderVariables;
+extern uartRing_t             xGSMRxRing, xWifiRxRing;
+extern uartTxQueue_t          xTxQueue[LINK_COUNT];
+extern traceLog_t             xTraceLog;
+extern linkQualityLog_t       xLinkQuality;
+extern const bundleRegion_t   bundle_regions[BUNDLE_TARGET_COUNT];
+extern const uint32_t         benchmark_baselines[BENCHMARK_KERNEL_COUNT];
+#if BOOTLOADER_SIGNATURE
+extern const uint8_t          firmwarePublicKey[64];
+#endif
 
 /************************ Bootloader Function Prototypes ****************************/
 void vBootloader(void);
@@ -133,12 +741,115 @@ void vEraseStorageSpace(void);
 void vBuiltInBootloader(void);
 void vBootloaderWifiEngage(void);
 void vEraseApplicationSpace(void);
-void vBootloadercallOver1ms(void);
+void vBootloaderUpdateTask(void);
+void vBootloaderDiscardDownload(void);
+void vBootloaderTimingSave(void);
+bool bBootloaderVerifyImage(uint32_t slotAddress);
+bool bBootloaderInstallAttemptsLeft(void);
+void vMetadataScan(bootMetadata_t *metadata);
+void vMetadataCompact(bootMetadata_t *metadata);
+void vBootFromMetadata(bootMetadata_t *metadata);
+void vMetadataAppend(bootMetadata_t *metadata, metadataRecord_t record);
+void vMetadataSetSlot(bootMetadata_t *metadata, metadataSlot_t slot, metadataSlotState_t state, const metadataRecord_t *image);
+uint32_t ulBootloaderBootVerifyMsPer100KB(void);
+void vBootloaderTraceDrain(void);
+void vBootloaderTimingQuery(char query[]);
+void vBootloaderWebSocketClose(bootloaderLink_t link);
+bool bBootloaderWebSocketOpen(bootloaderLink_t link);
+bool bBootloaderRefetchFailedChunks(void);
 void vBootloaderProcessTimers(void);
 void vBootloaderQuectelEngage(void);
 void vBootloadervariablesInit(void);
+void vBootloaderDrainUartRings(void);
+bool bBootloaderRingWrite(uartRing_t *ring, uint8_t receivedByte);
+void vBootloaderCaptureUart(uartCaptureSource_t source, uint8_t data[], uint32_t length);
+int32_t lBootloaderReplayCapture(const uint8_t capture[], uint32_t length, uint32_t *replayStart);
+void vBootloaderFlushUartRing(uartRing_t *ring);
+void vBootloaderUartTxISR(UART_HandleTypeDef *huart);
+void vBootloaderTxService(void);
+void vBootloaderAckSent(uint32_t start);
+void vBootloaderTxKick(uartTxQueue_t *queue);
+void vBootloaderTxStart(uartTxQueue_t *queue);
+void vBootloaderTxSlotDone(uartTxQueue_t *queue);
+void vBootloaderTxSend(bootloaderLink_t link, const char command[]);
+void vBootloaderTxGateMatch(uartTxQueue_t *queue, uint8_t receivedByte);
+bool bBootloaderRxFramePayload(uartRxFrame_t *frame, uint8_t receivedByte);
+bool bBootloaderTxQueue(bootloaderLink_t link, const void *data, uint32_t length, const char *gate, uartTxDone_t done, uint32_t context);
+bool bBootloaderTxSendPayload(bootloaderLink_t link, const char command[], const void *payload, uint32_t length, uartTxDone_t done, uint32_t context);
+uint32_t ulBootloaderRandom(void);
+uint32_t ulBootloaderDeviceHash(void);
+uint32_t ulBootloaderNextDeadline(void);
+void vBootloaderScheduleNextCheck(uint32_t earliest, bool jitter);
+void vBootloaderGetField(const char response[], const char start[], const char end[], char value[], uint32_t size);
+bool bBootloaderUpdateCheckDue(bool *triggerUpdateAtStart);
+bool bBootloaderApplySchedulingHints(char response[]);
+bool bBootloaderManifestNumber(const char response[], const char start[], int base, uint32_t *value);
+bool bBootloaderParseManifest(char response[], firmwareManifest_t *manifest);
+void vBootloaderTakeOffer(bootloaderLink_t link);
+void vBootloaderManifestBlockToFlash(uint32_t tftpBufferIndex);
+void vBootloaderStoreChunk(uint32_t chunk, uint8_t data[], uint32_t length);
+void vBootloaderWebSocketSend(bootloaderLink_t link, char data[], uint32_t length);
+uint32_t ulCRC32Region(const uint8_t data[], uint32_t length, uint32_t init);
+uint32_t ulCRC32Aligned(const uint32_t data[], uint32_t length, uint32_t init);
+void vSHA256Init(sha256Context_t *context);
+void vSHA256Final(sha256Context_t *context, uint8_t digest[32]);
+void vSHA256Transform(sha256Context_t *context, const uint8_t block[]);
+void vSHA256Update(sha256Context_t *context, const uint8_t data[], uint32_t length);
+bool bBootloaderHexToBytes(const char hex[], uint8_t bytes[], uint32_t length);
+bool bBootloaderSignatureValid(void);
+void vBootloaderTransferStart(void);
+bool bBootloaderLinkUp(bootloaderLink_t link);
+void vBootloaderLinkTransferSample(void);
+bootloaderLink_t eBootloaderActiveLink(void);
+void vBootloaderMultipathDownload(void);
+void vBootloaderSeedDownload(void);
+void vBootloaderSeedServe(void);
+bool bBootloaderSeedAnswer(void);
+uint32_t ulBootloaderSeedKeepRequests(char pending[], uint32_t pendingLength, uint32_t skipFrom, uint32_t skipTo);
+void vBootloaderMulticastOption(uint32_t tftpBufferIndex);
+void vBootloaderMulticastBlockToFlash(uint32_t tftpBufferIndex);
+void vBootloaderMulticastAcknowledge(void);
+void vBootloaderMulticastReask(void);
+void vBootloaderMulticastLeave(void);
+bool bBootloaderPacerTake(uint8_t ack[]);
+void vBootloaderPacerService(void);
+void vBootloaderSetRateCap(uint32_t bytesPerSecond);
+bool bBootloaderInstallStorage(bootMetadata_t *metadata);
+bool bBootloaderApplyStorage(bootMetadata_t *metadata);
+bool bBootloaderApplyChunk(uint32_t appAddress, uint32_t storageAddress, uint32_t length);
+bool bBootloaderBundleValid(uint32_t bundleAddress, uint32_t bundleLength);
+bool bBootloaderInstallBundle(uint32_t bundleAddress);
+uint32_t ulBootloaderDownloadRate(void);
+uint32_t ulBootloaderDownloadETA(void);
+void vBootloaderMultipathAsk(multipathLink_t *path, bootloaderLink_t link);
+uint32_t ulBootloaderChunkLength(uint32_t chunk);
+void vBootloaderMultipathFailed(multipathLink_t *path, bootloaderLink_t link, uint8_t attempts[]);
+uint32_t ulBootloaderMultipathNextChunk(multipathLink_t paths[], bootloaderLink_t link);
+void vBootloaderLinkGoodputSample(bootloaderLink_t link, uint32_t bytes, uint32_t elapsedMs);
+int32_t lBootloaderPollHTTPBody(bootloaderLink_t link, uint8_t destination[], uint32_t expectedLength);
+void vBootloaderStartDownloadOnBestLink(void);
+uint32_t ulBootloaderProjectedTime(bootloaderLink_t link, uint32_t imageLength);
+void vBootloaderLinkSample(bootloaderLink_t link, uint32_t rttMs, uint32_t bytes, uint32_t elapsedMs);
+void vAES128KeyExpansion(uint8_t roundKeys[176], const uint8_t key[16]);
+void vAES128EncryptBlock(const uint8_t roundKeys[176], const uint8_t input[16], uint8_t output[16]);
+void vBootloaderDecrypt(uint8_t data[], uint32_t length, uint32_t fileOffset);
+bool bBootloaderRangeFetch(bootloaderLink_t link, uint32_t offset, uint32_t length, uint8_t destination[]);
+void vBootloaderProgramFlash(uint32_t address, uint8_t data[], uint32_t length);
+uint32_t ulBootloaderReceiveHTTPBody(bootloaderLink_t link, uint8_t destination[], uint32_t expectedLength, uint32_t timeout);
+int32_t lBootloaderFindPattern(const char buffer[], uint32_t length, const char pattern[], uint32_t from);
+uint32_t ulBootloaderCollectSocketPayload(char buffer[], uint32_t length, char frameMarker[], uint32_t terminatorSize, char payload[], uint32_t maxLength);
+void vBootloaderTimerStop(bootloaderTimerId_t timer);
+bool bBootloaderTimerExpired(bootloaderTimerId_t timer);
+void vBootloaderTimerStart(bootloaderTimerId_t timer, uint32_t duration);
+void vBootloaderSetTaskPriority(bool raisePriority);
+void vBootloaderFirmwareReady(void);
+void vBootloaderOnFirmwareReady(const char version[]);
+void vBootloaderTraceWrite(const void *data, uint32_t length);
+void vBootloaderApplyNow(void);
+void vBootloaderScheduleApply(uint32_t delay);
 void vTFTPIncrementACK(uint8_t ACK[]);
 void vReduceWifiBaudRateTo19200(void);
+void vRestoreWifiBaudRateTo115200(void);
 void vBootloaderJumpToApplication(uint32_t appSpace);
 void vAskFirmwareVersionRequestGSM(void);
 void vFlashEraseSector(uint32_t sectorNo);
@@ -151,12 +862,22 @@ void vBootloaderCRC32ToFlash(uint32_t tftpBufferIndex);
 void vGetDeviceFirmwareVersion(char firmwareVersion[]);
 uint32_t crc32(const void *buf, size_t size, uint32_t init);
 void vFlashTFTPBuffer(char tftpBuffer[], uint32_t bufferIndex);
+void vBootloaderUartRxISR(UART_HandleTypeDef *huart, uint8_t receivedByte);
 void vEvaluateCRC32(uint32_t crcCalculated, uint32_t crcGiven);
 void vPrintTFTPBlockNumber(uint32_t blockNumber, bool correctOrIncorrect);
 void vTFTPReadRequestWifi(char remoteIP[], char remoteFixedPort[], char fileName[]);
 void vPrepareTFTPReadRequest(char readRequest[], char fileName[], uint32_t *length);
+void vPrepareFirmwareVersionRequest(char request[], char versionNumber[], char query[]);
+void vPrepareRangeRequest(char request[], uint32_t first, uint32_t last);
+void vBootloaderTimingRecord(bootloaderTimingPhase_t phase, uint32_t start);
+void vBootloaderTimingRecordSpan(bootloaderTimingPhase_t phase, uint32_t start, uint32_t end);
+void vBootloaderTrace(bootloaderTraceEvent_t event, uint16_t arg16, uint32_t arg);
+uint32_t ulBootloaderTimingPercentile(bootloaderTimingPhase_t phase, uint32_t percent);
+uint32_t ulBootloaderBenchmark(void);
+void vParseFirmwareVersionResponse(char response[], linkOffer_t *offer);
 void vTFTPReadRequestQuectel(char remoteIP[], char remoteFixedPort[], char fileName[]);
 void vCalculateCyclicCRC32(uint32_t *calculatedCRC32, char tftpBuffer[], uint32_t size);
+uint32_t ulBootloaderRingRead(uartRing_t *ring, uint8_t destination[], uint32_t maxLength);
 bool bCheckIfResponseReceivedOnTime(char expectedResponse[], char inputBuffer[], uint32_t timeout);
 void vExtractCRCFromTheLastTFTPPackage(uint32_t *checsumExtracted, char tftpBuffer[], uint32_t tftpBufferIndex, uint32_t *crcBufferIndex);
 
@@ -0,0 +1,845 @@
+/**
+  ******************************************************************************
+  * @file    fw_server.c
+  * @brief   Stand-in of the checkFirmware web server and the TFTP server
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "fw_server.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define TFTP_OPTION_BLKSIZE																0x01
+#define TFTP_OPTION_WINDOWSIZE															0x02
+#define TFTP_OPTION_TSIZE																0x04
+#define TFTP_OPTION_MULTICAST															0x08
+
+/**
+* @brief  This function calculates the CRC32 the bootloader checks, the one of zlib
+* @params const uint8_t data[] -> input buffer
+*					uint32_t length			 -> size of the input buffer
+*					uint32_t init				 -> result of the previous calculation, 0 for the first one
+*/
+uint32_t ulFwServerCRC32(const uint8_t data[], uint32_t length, uint32_t init)
+{
+	uint32_t crc = ~init;
+	
+	for (uint32_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+		}
+	}
+	
+	return ~crc;
+}
+
+/**
+* @brief  This function offers the image the server holds, shared by bFwServerInit and bFwServerMap
+* @note   The TFTP file carries the CRC32 of the image in its last 4 bytes, big endian, as vExtractCRCFromTheLastTFTPPackage reads it
+*/
+static bool bFwServerOffer(fwServer_t *server, const char version[], const char tftpIP[])
+{
+	uint32_t crc;
+	
+	if (server->imageLength % 4 != 0 || strlen(version) != 5 || strlen(tftpIP) >= sizeof(server->tftpIP))
+	{
+		return false;
+	}
+	
+	crc = ulFwServerCRC32(server->image, server->imageLength, 0);
+	
+	server->trailer[0] = (uint8_t)(crc >> 24);
+	server->trailer[1] = (uint8_t)(crc >> 16);
+	server->trailer[2] = (uint8_t)(crc >> 8);
+	server->trailer[3] = (uint8_t)crc;
+	
+	server->fileLength       = server->imageLength + 4;
+	server->tftpTimeout      = FW_SERVER_TFTP_TIMEOUT;
+	server->tftpMaxBlockSize = FW_SERVER_TFTP_BLOCK_SIZE;
+	server->tftpMaxWindow    = 1;
+	
+	strcpy(server->version, version);
+	strcpy(server->tftpIP, tftpIP);
+	sprintf(server->tftpPort, "%u", FW_SERVER_TFTP_PORT);
+	sprintf(server->fileName, "rx-%sbin", version);
+	
+	return true;
+}
+
+/**
+* @brief  This function puts an image on offer
+* @params fwServer_t *server			-> server to be set up
+*					const uint8_t image[]		-> image, copied
+*					uint32_t imageLength		-> bytes of the image, a multiple of 4 as the bootloader programs words
+*					const char version[]		-> 5 character version, "1.2.3"
+*					const char tftpIP[]			-> address of the TFTP server given in the checkFirmware answer
+* @retval false if the image can't be offered
+*/
+bool bFwServerInit(fwServer_t *server, const uint8_t image[], uint32_t imageLength, const char version[], const char tftpIP[])
+{
+	memset(server, 0, sizeof(fwServer_t));
+	
+	if ((server->image = malloc(imageLength)) == NULL)
+	{
+		return false;
+	}
+	
+	memcpy(server->image, image, imageLength);
+	
+	server->imageLength = imageLength;
+	
+	if (!bFwServerOffer(server, version, tftpIP))
+	{
+		vFwServerFree(server);
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function puts an image file on offer, mapped read only so every answer is sent from the page cache
+* @params const char path[] -> image file, a multiple of 4 bytes
+* @retval false if the file can't be mapped or offered
+*/
+bool bFwServerMap(fwServer_t *server, const char path[], const char version[], const char tftpIP[])
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat status;
+	void *image;
+	
+	memset(server, 0, sizeof(fwServer_t));
+	
+	if (fd < 0 || fstat(fd, &status) != 0 || status.st_size == 0 || (uint64_t)status.st_size > 0xFFFFFFFFULL - 4)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		
+		return false;
+	}
+	
+	image = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	
+	close(fd);
+	
+	if (image == MAP_FAILED)
+	{
+		return false;
+	}
+	
+	madvise(image, (size_t)status.st_size, MADV_WILLNEED);
+	
+	server->image       = image;
+	server->imageLength = (uint32_t)status.st_size;
+	server->mapped      = true;
+	
+	if (!bFwServerOffer(server, version, tftpIP))
+	{
+		vFwServerFree(server);
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function offers the image with a manifest: its length, CRC32 and chunk CRC32s go in the checkFirmware
+*					answer and the TFTP file is the image alone, as a LAN seed serves it
+* @retval false if the server holds no image
+*/
+bool bFwServerManifest(fwServer_t *server)
+{
+	uint32_t chunkCount = (server->imageLength + FW_SERVER_CHUNK_SIZE - 1) / FW_SERVER_CHUNK_SIZE, length = 0;
+	
+	if (server->image == NULL || (server->chunks = malloc(chunkCount * 9 + 1)) == NULL)
+	{
+		return false;
+	}
+	
+	server->chunks[0] = 0;
+	
+	for (uint32_t offset = 0; offset < server->imageLength; offset += FW_SERVER_CHUNK_SIZE)
+	{
+		uint32_t chunkLength = (server->imageLength - offset < FW_SERVER_CHUNK_SIZE) ? server->imageLength - offset : FW_SERVER_CHUNK_SIZE;
+		
+		length += (uint32_t)sprintf(&server->chunks[length], "%s%08X", (offset == 0) ? "" : ",", ulFwServerCRC32(&server->image[offset], chunkLength, 0));
+	}
+	
+	server->fileLength = server->imageLength;
+	
+	return true;
+}
+
+void vFwServerFree(fwServer_t *server)
+{
+	if (server->mapped && server->image != NULL)
+	{
+		munmap(server->image, server->imageLength);
+	}
+	else
+	{
+		free(server->image);
+	}
+	
+	free(server->chunks);
+	
+	server->image  = NULL;
+	server->chunks = NULL;
+	server->mapped = false;
+}
+
+/**
+* @brief  This function builds the answer of an HTTP request, the image bytes of a Range answer are left to the caller
+* @retval bytes of the header and any JSON body in response, *bodyLength bytes of the image at *bodyOffset follow them
+*/
+static uint32_t ulFwServerHttpAnswer(fwServer_t *server, const char request[], uint32_t length, char response[], uint32_t size, uint32_t *bodyOffset, uint32_t *bodyLength)
+{
+	const char checkPath[] = "GET /api/Installer/checkFirmware?version=", rangePath[] = "GET /api/Installer/firmware/";
+	char body[1024], version[6] = {0};
+	const char *range;
+	uint32_t first, last;
+	
+	*bodyOffset = 0;
+	*bodyLength = 0;
+	
+	if (length < 4 || memmem(request, length, "\r\n\r\n", 4) == NULL)
+	{
+		return 0;
+	}
+	
+	if (strncmp(request, checkPath, strlen(checkPath)) == 0)
+	{
+		server->checks++;
+		
+		memcpy(version, &request[strlen(checkPath)], 5);
+		
+		if (strcmp(version, server->version) == 0)
+		{
+			sprintf(body, "{\"data\":{}}");
+		}
+		else if (server->seeding && server->seedIP[0] == 0 && server->offers != 0)
+		{
+			server->held++;
+			
+			sprintf(body, "{\"data\":{\"retryAfter\":\"%s\"}}", FW_SERVER_SEED_RETRY_AFTER);
+		}
+		else
+		{
+			int bodyLength = sprintf(body, "{\"data\":{\"ip\":\"%s\",\"port\":\"%s\",\"file\":\"%s\"", server->tftpIP, server->tftpPort, server->fileName);
+			
+			server->offers++;
+			
+			if (server->chunks != NULL)
+			{
+				bodyLength += snprintf(&body[bodyLength], sizeof(body) - (uint32_t)bodyLength, ",\"length\":\"%u\",\"crc\":\"%08X\",\"chunkSize\":\"%u\",\"chunks\":\"%s\"",
+															 server->imageLength, ulFwServerCRC32(server->image, server->imageLength, 0), FW_SERVER_CHUNK_SIZE, server->chunks);
+			}
+			
+			if (server->seedIP[0] != 0 && (uint32_t)bodyLength < sizeof(body))
+			{
+				bodyLength += snprintf(&body[bodyLength], sizeof(body) - (uint32_t)bodyLength, ",\"seed\":\"%s\"", server->seedIP);
+			}
+			
+			if ((uint32_t)bodyLength < sizeof(body))
+			{
+				snprintf(&body[bodyLength], sizeof(body) - (uint32_t)bodyLength, "}}");
+			}
+		}
+		
+		return (uint32_t)snprintf(response, size, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %u\r\n\r\n%s", (uint32_t)strlen(body), body);
+	}
+	
+	range = memmem(request, length, "Range: bytes=", strlen("Range: bytes="));
+	
+	if (strncmp(request, rangePath, strlen(rangePath)) != 0 || strncmp(&request[strlen(rangePath)], server->fileName, strlen(server->fileName)) != 0)
+	{
+		return (uint32_t)snprintf(response, size, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+	}
+	
+	server->rangeRequests++;
+	
+	if (range == NULL || sscanf(range, "Range: bytes=%u-%u", &first, &last) != 2 || first > last || last >= server->imageLength)
+	{
+		return (uint32_t)snprintf(response, size, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%u\r\nContent-Length: 0\r\n\r\n", server->imageLength);
+	}
+	
+	*bodyOffset = first;
+	*bodyLength = last - first + 1;
+	
+	return (uint32_t)snprintf(response, size, "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %u-%u/%u\r\nContent-Length: %u\r\n\r\n", first, last, server->imageLength, last - first + 1);
+}
+
+/**
+* @brief  This function answers one HTTP request
+* @params fwServer_t *server					-> server
+*					const char request[]	-> bytes received on the connection so far
+*					uint32_t length				-> number of bytes received
+*					char response[]				-> filled with the response
+*					uint32_t size					-> size of response
+* @retval bytes of the response, 0 while the request is incomplete
+* @note   "GET /api/Installer/checkFirmware?version=<v>" offers the image to any other version, the JSON ends with "}}"
+*					as the bootloader waits for it. "GET /api/Installer/firmware/<file>" with a Range header serves part of the image.
+*					While seeding, the image is offered once and the next devices are told to retry until a seedIP is given.
+*					A pending corruptOffset is flipped in the Range answer holding it.
+*/
+uint32_t ulFwServerHttp(fwServer_t *server, const char request[], uint32_t length, char response[], uint32_t size)
+{
+	uint32_t bodyOffset, bodyLength, responseLength = ulFwServerHttpAnswer(server, request, length, response, size, &bodyOffset, &bodyLength);
+	
+	if (bodyLength != 0 && responseLength + bodyLength > size)
+	{
+		responseLength = (uint32_t)snprintf(response, size, "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\n\r\n");
+	}
+	else if (bodyLength != 0)
+	{
+		memcpy(&response[responseLength], &server->image[bodyOffset], bodyLength);
+		
+		if (server->corruptPending && server->corruptOffset >= bodyOffset && server->corruptOffset < bodyOffset + bodyLength)
+		{
+			response[responseLength + server->corruptOffset - bodyOffset] ^= 0xFF;
+			
+			server->corruptPending = false;
+		}
+		
+		responseLength += bodyLength;
+	}
+	
+	server->bytesSent += (responseLength < size) ? responseLength : size;
+	
+	return responseLength;
+}
+
+/**
+* @brief  This function answers one HTTP request as ulFwServerHttp does, without copying the image bytes of a Range answer
+* @params uint32_t *bodyOffset -> offset in server->image of the bytes to be sent after the response, no copy is made
+*					uint32_t *bodyLength -> number of those bytes, 0 if the response is complete
+* @retval bytes of the response header and any JSON body, 0 while the request is incomplete
+*/
+uint32_t ulFwServerHttpHeader(fwServer_t *server, const char request[], uint32_t length, char response[], uint32_t size, uint32_t *bodyOffset, uint32_t *bodyLength)
+{
+	uint32_t responseLength = ulFwServerHttpAnswer(server, request, length, response, size, bodyOffset, bodyLength);
+	
+	responseLength = (responseLength < size) ? responseLength : size;
+	
+	server->bytesSent += responseLength + *bodyLength;
+	
+	return responseLength;
+}
+
+/**
+* @brief  This function builds the data packet of the current block of a session
+*/
+static void vFwServerTftpData(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer)
+{
+	answer->offset = (session->block - 1) * session->blockSize;
+	answer->length = (server->fileLength - answer->offset < session->blockSize) ? server->fileLength - answer->offset : session->blockSize;
+	
+	answer->header[0]    = 0;
+	answer->header[1]    = 3;
+	answer->header[2]    = (uint8_t)(session->block >> 8);
+	answer->header[3]    = (uint8_t)session->block;
+	answer->headerLength = 4;
+	answer->to           = NULL;
+	answer->group        = false;
+	
+	server->blocks++;
+	server->bytesSent += answer->length + 4;
+}
+
+/**
+* @brief  This function builds the option acknowledge of a session, RFC 2347
+*/
+static void vFwServerTftpOack(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer)
+{
+	uint32_t length = 2;
+	
+	answer->header[0] = 0;
+	answer->header[1] = 6;
+	
+	if (session->options & TFTP_OPTION_BLKSIZE)
+	{
+		length += (uint32_t)sprintf((char *)&answer->header[length], "blksize%c%u", 0, session->blockSize) + 1;
+	}
+	
+	if (session->options & TFTP_OPTION_WINDOWSIZE)
+	{
+		length += (uint32_t)sprintf((char *)&answer->header[length], "windowsize%c%u", 0, session->windowSize) + 1;
+	}
+	
+	if (session->options & TFTP_OPTION_TSIZE)
+	{
+		length += (uint32_t)sprintf((char *)&answer->header[length], "tsize%c%u", 0, server->fileLength) + 1;
+	}
+	
+	if (session->options & TFTP_OPTION_MULTICAST)/*the address every time, a client already in the group reads the role only*/
+	{
+		length += (uint32_t)sprintf((char *)&answer->header[length], "multicast%c%s,%u,%u", 0, server->multicastIP, server->multicastPort, session == server->multicastMaster) + 1;
+	}
+	
+	answer->headerLength = length;
+	answer->offset       = 0;
+	answer->length       = 0;
+	answer->to           = NULL;
+	answer->group        = false;
+	
+	server->bytesSent += length;
+}
+
+/**
+* @brief  This function reads the options after the file name and mode of a read request, unknown ones are ignored
+* @note   blksize and windowsize are granted up to tftpMaxBlockSize and tftpMaxWindow, RFC 2348 and RFC 7440. multicast
+*					is granted once a group is set, RFC 2090
+*/
+static void vFwServerTftpOptions(fwServer_t *server, fwTftpSession_t *session, const uint8_t packet[], uint32_t length)
+{
+	const char *text = (const char *)packet;
+	uint32_t index = 2;
+	
+	for (int field = 0; field < 2 && index < length; field++)/*file name, then mode*/
+	{
+		index += (uint32_t)strnlen(&text[index], length - index) + 1;
+	}
+	
+	while (index < length)
+	{
+		const char *name = &text[index];
+		char value[12] = {0};
+		uint32_t nameLength = (uint32_t)strnlen(name, length - index), valueLength, number;
+		
+		if (index + nameLength + 1 >= length)
+		{
+			break;
+		}
+		
+		valueLength = (uint32_t)strnlen(&text[index + nameLength + 1], length - index - nameLength - 1);
+		
+		memcpy(value, &text[index + nameLength + 1], (valueLength < sizeof(value) - 1) ? valueLength : sizeof(value) - 1);
+		
+		number = strtoul(value, NULL, 10);
+		index += nameLength + valueLength + 2;
+		
+		if (strcasecmp(name, "blksize") == 0 && number >= 8)
+		{
+			session->blockSize = (number < server->tftpMaxBlockSize) ? number : server->tftpMaxBlockSize;
+			session->options  |= TFTP_OPTION_BLKSIZE;
+		}
+		else if (strcasecmp(name, "windowsize") == 0 && number >= 1)
+		{
+			session->windowSize = (number < server->tftpMaxWindow) ? number : server->tftpMaxWindow;
+			session->options   |= TFTP_OPTION_WINDOWSIZE;
+		}
+		else if (strcasecmp(name, "tsize") == 0)
+		{
+			session->options |= TFTP_OPTION_TSIZE;
+		}
+		else if (strcasecmp(name, "multicast") == 0 && server->multicastIP[0] != 0)
+		{
+			session->options |= TFTP_OPTION_MULTICAST;
+		}
+	}
+}
+
+/**
+* @brief  This function takes a read request with the multicast option into the group, RFC 2090: the first client is the
+*					master, a client asking again while in the group is made master for the blocks it still misses
+*/
+static void vFwServerTftpJoin(fwServer_t *server, fwTftpSession_t *session)
+{
+	uint32_t i;
+	
+	for (i = 0; i < server->multicastMemberCount && server->multicastMembers[i] != session; i++)
+	{
+	}
+	
+	if (i == FW_SERVER_MULTICAST_MEMBERS)
+	{
+		session->options &= ~TFTP_OPTION_MULTICAST;/*a full group, the read goes on unicast*/
+		
+		return;
+	}
+	
+	if (i < server->multicastMemberCount)
+	{
+		server->reasks++;
+		
+		server->multicastMaster = session;
+	}
+	else
+	{
+		server->multicastMembers[server->multicastMemberCount++] = session;
+	}
+	
+	session->multicast = true;
+	
+	if (server->multicastMaster == NULL || server->multicastMaster->done)
+	{
+		server->multicastMaster = session;
+	}
+}
+
+/**
+* @brief  This function hands the master role to the first client of the group that isn't done, its OACK tells it
+* @retval false if every client is done, the group waits for a read request
+*/
+static bool bFwServerTftpHandOff(fwServer_t *server, fwTftpPacket_t *answer)
+{
+	server->multicastMaster = NULL;
+	
+	for (uint32_t i = 0; i < server->multicastMemberCount && server->multicastMaster == NULL; i++)
+	{
+		if (!server->multicastMembers[i]->done)
+		{
+			server->multicastMaster = server->multicastMembers[i];
+		}
+	}
+	
+	if (server->multicastMaster == NULL)
+	{
+		return false;
+	}
+	
+	server->handOffs++;
+	
+	server->multicastMaster->block = 0;
+	
+	vFwServerTftpOack(server, server->multicastMaster, answer);
+	
+	answer->to = server->multicastMaster;
+	
+	return true;
+}
+
+/**
+* @brief  This function moves the group on from an acknowledge of its master: the count of blocks it has without a gap,
+*					the block after them goes to the group. Acknowledges of the other clients are ignored.
+*/
+static bool bFwServerTftpGroupAck(fwServer_t *server, fwTftpSession_t *session, uint32_t acked, fwTftpPacket_t *answer)
+{
+	if (session != server->multicastMaster)
+	{
+		return false;
+	}
+	
+	if (acked >= session->blocks)
+	{
+		session->done = true;
+		
+		server->completed++;
+		
+		return bFwServerTftpHandOff(server, answer);
+	}
+	
+	session->acked = acked;
+	session->block = acked + 1;
+	
+	vFwServerTftpData(server, session, answer);
+	
+	answer->group = true;
+	
+	return true;
+}
+
+/**
+* @brief  This function answers a datagram sent to the TFTP server
+* @params fwServer_t *server					-> server
+*					fwTftpSession_t *session		-> session of the client, zeroed before its read request
+*					const uint8_t packet[]			-> received datagram
+*					uint32_t length							-> bytes of the datagram
+*					fwTftpPacket_t *answer			-> filled with the answer
+* @retval true if the answer is to be sent, bFwServerTftpNext then gives the rest of the window
+* @note   A read request without options starts at block 1 with 512 byte blocks, acknowledged one by one as the
+*					bootloader does. With blksize, windowsize or tsize it is answered by an OACK, the transfer starts at its
+*					acknowledge. An acknowledge inside the window sent moves on from the block after it, older ones are ignored
+*					so a duplicated acknowledge doesn't send every following block twice. A session never started keeps 0 blocks.
+*					A multicast read sends its blocks to the group as its master acknowledges them, the answer then says where
+*					it goes: the group, or another client handed the master role.
+*/
+bool bFwServerTftpAnswer(fwServer_t *server, fwTftpSession_t *session, const uint8_t packet[], uint32_t length, fwTftpPacket_t *answer)
+{
+	uint32_t delta;
+	
+	if (length >= 2 && packet[0] == 0 && packet[1] == 1)/*read request*/
+	{
+		if (length < 3 || strncmp((const char *)&packet[2], server->fileName, length - 2) != 0)
+		{
+			answer->header[0] = 0;
+			answer->header[1] = 5;
+			answer->header[2] = 0;
+			answer->header[3] = 1;
+			
+			strcpy((char *)&answer->header[4], "File not found");
+			
+			answer->headerLength = 4 + strlen("File not found") + 1;
+			answer->offset       = 0;
+			answer->length       = 0;
+			answer->to           = NULL;
+			answer->group        = false;
+			
+			return true;
+		}
+		
+		if (session->blocks == 0)
+		{
+			server->sessions++;
+		}
+		
+		session->blockSize  = FW_SERVER_TFTP_BLOCK_SIZE;
+		session->windowSize = 1;
+		session->options    = 0;
+		session->multicast  = false;
+		
+		vFwServerTftpOptions(server, session, packet, length);
+		
+		session->blocks = server->fileLength / session->blockSize + 1;
+		session->acked  = 0;
+		session->done   = false;
+		
+		if (session->options & TFTP_OPTION_MULTICAST)
+		{
+			vFwServerTftpJoin(server, session);
+		}
+		
+		if (session->options != 0)
+		{
+			server->negotiated++;
+			
+			session->block = 0;
+			
+			vFwServerTftpOack(server, session, answer);
+			
+			return true;
+		}
+		
+		session->block = 1;
+		
+		vFwServerTftpData(server, session, answer);
+		
+		return true;
+	}
+	
+	if (length >= 2 && packet[0] == 0 && packet[1] == 5 && session->blocks != 0)/*the client gave up*/
+	{
+		session->done = true;
+		
+		return session == server->multicastMaster && bFwServerTftpHandOff(server, answer);
+	}
+	
+	if (length < 4 || packet[0] != 0 || packet[1] != 4 || session->blocks == 0 || session->done)
+	{
+		return false;
+	}
+	
+	if (session->multicast)
+	{
+		return bFwServerTftpGroupAck(server, session, (uint32_t)(packet[2] << 8 | packet[3]), answer);
+	}
+	
+	if (session->block == 0)/*acknowledge of the OACK*/
+	{
+		if ((packet[2] << 8 | packet[3]) != 0)
+		{
+			return false;
+		}
+		
+		session->block = 1;
+		
+		vFwServerTftpData(server, session, answer);
+		
+		return true;
+	}
+	
+	delta = ((uint32_t)(packet[2] << 8 | packet[3]) - session->acked) & 0xFFFF;
+	
+	if (delta == 0 || delta > session->block - session->acked)
+	{
+		return false;
+	}
+	
+	session->acked += delta;
+	
+	if (session->acked == session->blocks)
+	{
+		session->done = true;
+		
+		server->completed++;
+		
+		return false;
+	}
+	
+	session->block = session->acked + 1;
+	
+	vFwServerTftpData(server, session, answer);
+	
+	return true;
+}
+
+/**
+* @brief  This function gives the next block of the window of a session, call it after every answer until it returns false
+*/
+bool bFwServerTftpNext(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer)
+{
+	if (session->blocks == 0 || session->done || session->block == 0 || session->block >= session->blocks || session->block >= session->acked + session->windowSize)
+	{
+		return false;
+	}
+	
+	session->block++;
+	
+	vFwServerTftpData(server, session, answer);
+	
+	return true;
+}
+
+/**
+* @brief  This function starts the unacknowledged window of a session again, call it once the window timed out
+* @retval true if the first packet of the window is to be sent, bFwServerTftpNext gives the rest
+*/
+bool bFwServerTftpRetry(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer)
+{
+	if (session->blocks == 0 || session->done || (session->multicast && session != server->multicastMaster))/*a listening client asks again by itself*/
+	{
+		return false;
+	}
+	
+	server->retransmits++;
+	
+	if (session->block == 0)
+	{
+		vFwServerTftpOack(server, session, answer);
+		
+		return true;
+	}
+	
+	session->block = session->acked + 1;
+	
+	vFwServerTftpData(server, session, answer);
+	
+	answer->group = session->multicast;
+	
+	return true;
+}
+
+/**
+* @brief  This function takes a client out of the multicast group once its transport closed, a master that leaves hands
+*					its role over as when it is done: its last acknowledge may not have reached the server
+* @retval true if the answer, the OACK of the new master, is to be sent
+*/
+bool bFwServerTftpLeave(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer)
+{
+	for (uint32_t i = 0; i < server->multicastMemberCount; i++)
+	{
+		if (server->multicastMembers[i] == session)
+		{
+			memmove(&server->multicastMembers[i], &server->multicastMembers[i + 1], (server->multicastMemberCount - i - 1) * sizeof(server->multicastMembers[0]));
+			
+			server->multicastMemberCount--;
+			break;
+		}
+	}
+	
+	session->multicast = false;
+	
+	return server->multicastMaster == session && bFwServerTftpHandOff(server, answer);
+}
+
+/**
+* @brief  This function gives an answer as the pieces of memory it is made of, for sendmsg without a copy
+* @params fwTftpPacket_t *answer	-> answer to be sent
+*					struct iovec vector[3]	-> filled with its header, the part of the image and the part of the CRC32 trailer
+* @retval number of vector entries used
+*/
+uint32_t ulFwServerTftpVector(const fwServer_t *server, fwTftpPacket_t *answer, struct iovec vector[3])
+{
+	uint32_t count = 1, end = answer->offset + answer->length;
+	
+	vector[0].iov_base = answer->header;
+	vector[0].iov_len  = answer->headerLength;
+	
+	if (answer->length != 0 && answer->offset < server->imageLength)
+	{
+		vector[count].iov_base = &server->image[answer->offset];
+		vector[count].iov_len  = ((end < server->imageLength) ? end : server->imageLength) - answer->offset;
+		count++;
+	}
+	
+	if (end > server->imageLength)
+	{
+		uint32_t start = (answer->offset > server->imageLength) ? answer->offset : server->imageLength;
+		
+		vector[count].iov_base = (void *)&server->trailer[start - server->imageLength];
+		vector[count].iov_len  = end - start;
+		count++;
+	}
+	
+	return count;
+}
+
+/**
+* @brief  This function copies an answer into a datagram
+* @retval bytes of the datagram
+*/
+uint32_t ulFwServerTftpCopy(const fwServer_t *server, fwTftpPacket_t *answer, uint8_t reply[])
+{
+	struct iovec vector[3];
+	uint32_t count = ulFwServerTftpVector(server, answer, vector), length = 0;
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		memcpy(&reply[length], vector[i].iov_base, vector[i].iov_len);
+		
+		length += (uint32_t)vector[i].iov_len;
+	}
+	
+	return length;
+}
+
+/**
+* @brief  This function answers a datagram sent to the TFTP server as bFwServerTftpAnswer does, copied into a datagram
+* @params uint8_t reply[] -> filled with the answer, 4 bytes more than tftpMaxBlockSize
+* @retval bytes of the answer, 0 if nothing is to be sent
+*/
+uint32_t ulFwServerTftp(fwServer_t *server, fwTftpSession_t *session, const uint8_t packet[], uint32_t length, uint8_t reply[])
+{
+	fwTftpPacket_t answer;
+	
+	return bFwServerTftpAnswer(server, session, packet, length, &answer) ? ulFwServerTftpCopy(server, &answer, reply) : 0;
+}
+
+/**
+* @brief  This function gives the next block of the window copied into a datagram, 0 once the window is sent
+*/
+uint32_t ulFwServerTftpNext(fwServer_t *server, fwTftpSession_t *session, uint8_t reply[])
+{
+	fwTftpPacket_t answer;
+	
+	return bFwServerTftpNext(server, session, &answer) ? ulFwServerTftpCopy(server, &answer, reply) : 0;
+}
+
+/**
+* @brief  This function sends the unacknowledged block of a session again, call it once the block timed out
+* @retval bytes of the answer, 0 if nothing is waiting for an acknowledge
+* @note   A session with a window gives the rest of it with ulFwServerTftpNext.
+*/
+uint32_t ulFwServerTftpResend(fwServer_t *server, fwTftpSession_t *session, uint8_t reply[])
+{
+	fwTftpPacket_t answer;
+	
+	return bFwServerTftpRetry(server, session, &answer) ? ulFwServerTftpCopy(server, &answer, reply) : 0;
+}
@@ -0,0 +1,106 @@
+/**
+  ************************************************************************************
+  * @file    fw_server.h
+  * @brief   Stand-in of the firmware servers the bootloader talks to: the checkFirmware
+  *          web server, the TFTP server of the image and its HTTP Range downloads.
+  *          Transport free, a harness feeds it requests and datagrams and sends the
+  *          answers back over its own sockets or its simulated network.
+  ************************************************************************************
+  */
+
+#ifndef __FW_SERVER_H__
+#define __FW_SERVER_H__
+
+/* Includes ------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/***************************  Server Definitions ************************************/
+#define FW_SERVER_TFTP_BLOCK_SIZE														512																					/*bytes of data per TFTP block*/
+#define FW_SERVER_TFTP_PACKET_SIZE													(FW_SERVER_TFTP_BLOCK_SIZE + 4)
+#define FW_SERVER_TFTP_MAX_BLOCK_SIZE													65464																				/*largest blksize of RFC 2348*/
+#define FW_SERVER_TFTP_MAX_WINDOW														64																					/*largest windowsize of RFC 7440 granted*/
+#define FW_SERVER_TFTP_TIMEOUT															2000																				/*ms a block may stay unacknowledged before it is sent again*/
+#define FW_SERVER_HTTP_PORT																	5555
+#define FW_SERVER_TFTP_PORT																	69
+#define FW_SERVER_CHUNK_SIZE																4096																				/*bytes per chunk CRC32 of a manifest, FIRMWARE_CHUNK_SIZE*/
+#define FW_SERVER_MULTICAST_MEMBERS													16																					/*clients of the RFC 2090 group at once, more go on unicast*/
+#define FW_SERVER_SEED_RETRY_AFTER													"60"																				/*s a device of a seeded site waits while the first one downloads*/
+
+/* Typedefs ------------------------------------------------------------------------*/
+typedef struct fwTftpSession fwTftpSession_t;
+
+/*Image on offer and the counters of everything served*/
+typedef struct
+{
+	char      version[6];																													/*offered version, "1.2.3"*/
+	char      fileName[32];																													/*"rx-<version>bin" as the bootloader takes the version out of it*/
+	char      tftpIP[16];																													/*TFTP server given in the checkFirmware answer*/
+	char      tftpPort[6];
+	uint8_t  *image;
+	uint32_t  imageLength;
+	bool      mapped;																														/*image is a read only mapping of a file, not a copy*/
+	uint8_t   trailer[4];																													/*CRC32 of the image big endian, the TFTP file ends with it*/
+	uint32_t  fileLength;																													/*TFTP file, the image and its trailer, the image alone with a manifest*/
+	uint32_t  tftpTimeout;																													/*ms, FW_SERVER_TFTP_TIMEOUT by default*/
+	uint32_t  tftpMaxBlockSize;																												/*largest blksize granted, FW_SERVER_TFTP_BLOCK_SIZE by default*/
+	uint32_t  tftpMaxWindow;																												/*largest windowsize granted, 1 by default*/
+	char     *chunks;																														/*chunk CRC32s of the manifest, NULL for an offer without one*/
+	bool      seeding;																														/*one device of the site downloads, the others wait for its seedIP*/
+	char      seedIP[16];																													/*LAN address given as "seed", empty for none*/
+	uint32_t  corruptOffset;																												/*image byte flipped in the next Range answer of ulFwServerHttp holding it, a chunk failing its CRC32*/
+	bool      corruptPending;																												/*corruptOffset is still to be flipped*/
+	char      multicastIP[16];																												/*group of RFC 2090 multicast reads, empty to ignore the multicast option*/
+	uint16_t  multicastPort;
+	fwTftpSession_t *multicastMembers[FW_SERVER_MULTICAST_MEMBERS];																			/*clients of the group in the order they joined*/
+	uint32_t  multicastMemberCount;
+	fwTftpSession_t *multicastMaster;																										/*client whose acknowledges move the group on, NULL for none*/
+	uint32_t  handOffs, reasks;																												/*master role given to the next client, read requests of a client already in the group*/
+	uint32_t  checks, offers, rangeRequests, sessions, negotiated, completed, blocks, retransmits, held;
+	uint64_t  bytesSent;																													/*HTTP and TFTP answers, the WAN traffic of the site*/
+} fwServer_t;
+
+/*State of one TFTP read, kept per client by the transport*/
+struct fwTftpSession
+{
+	uint32_t block;																															/*last block sent, 0 before the read request or while its OACK waits*/
+	uint32_t acked;																															/*last block acknowledged*/
+	uint32_t blocks;																														/*blocks of the file, the last one is shorter than blockSize*/
+	uint32_t blockSize;																														/*bytes of data per block, blksize*/
+	uint32_t windowSize;																													/*blocks sent per acknowledge, windowsize*/
+	uint8_t  options;																														/*options of the read request answered by the OACK*/
+	bool     done;																															/*last block acknowledged, or the client gave up*/
+	bool     multicast;																														/*client of the multicast group, its blocks go to multicastIP*/
+};
+
+/*One TFTP answer: a header, then length bytes of the file at offset, sent from where they lie*/
+typedef struct
+{
+	uint8_t  header[64];																													/*opcode and block of a DATA, or a whole OACK or ERROR*/
+	uint32_t headerLength;
+	uint32_t offset;
+	uint32_t length;																														/*0 for an OACK or ERROR*/
+	fwTftpSession_t *to;																													/*client the answer goes to, NULL for the one the datagram came from*/
+	bool     group;																															/*sent to the multicast group instead*/
+} fwTftpPacket_t;
+
+/* Functions -----------------------------------------------------------------------*/
+bool     bFwServerInit(fwServer_t *server, const uint8_t image[], uint32_t imageLength, const char version[], const char tftpIP[]);
+bool     bFwServerMap(fwServer_t *server, const char path[], const char version[], const char tftpIP[]);
+bool     bFwServerManifest(fwServer_t *server);
+void     vFwServerFree(fwServer_t *server);
+uint32_t ulFwServerCRC32(const uint8_t data[], uint32_t length, uint32_t init);
+uint32_t ulFwServerHttp(fwServer_t *server, const char request[], uint32_t length, char response[], uint32_t size);
+uint32_t ulFwServerHttpHeader(fwServer_t *server, const char request[], uint32_t length, char response[], uint32_t size, uint32_t *bodyOffset, uint32_t *bodyLength);
+bool     bFwServerTftpAnswer(fwServer_t *server, fwTftpSession_t *session, const uint8_t packet[], uint32_t length, fwTftpPacket_t *answer);
+bool     bFwServerTftpNext(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer);
+bool     bFwServerTftpRetry(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer);
+bool     bFwServerTftpLeave(fwServer_t *server, fwTftpSession_t *session, fwTftpPacket_t *answer);
+uint32_t ulFwServerTftpVector(const fwServer_t *server, fwTftpPacket_t *answer, struct iovec vector[3]);
+uint32_t ulFwServerTftpCopy(const fwServer_t *server, fwTftpPacket_t *answer, uint8_t reply[]);
+uint32_t ulFwServerTftp(fwServer_t *server, fwTftpSession_t *session, const uint8_t packet[], uint32_t length, uint8_t reply[]);
+uint32_t ulFwServerTftpNext(fwServer_t *server, fwTftpSession_t *session, uint8_t reply[]);
+uint32_t ulFwServerTftpResend(fwServer_t *server, fwTftpSession_t *session, uint8_t reply[]);
+
+#endif /* __FW_SERVER_H__ */
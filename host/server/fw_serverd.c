@@ -0,0 +1,532 @@
+/**
+  ******************************************************************************
+  * @file    fw_serverd.c
+  * @brief   Stand-in firmware server on real sockets: checkFirmware and HTTP
+  *          Range over TCP, TFTP over UDP with a port per session and the
+  *          blksize, windowsize and tsize options, one epoll loop for all of
+  *          them. The image is mapped from its file and every answer is sent
+  *          from the mapping, a header and the image slice in one sendmsg.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "fw_server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SERVERD_EVENTS																	256
+#define SERVERD_TFTP_TRIES																6																					/*sends of a window before the session is dropped*/
+#define SERVERD_RECEIVE_BUFFER															(4 * 1024 * 1024)																	/*bytes of read requests the TFTP port queues while the loop is busy*/
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef enum
+{
+	ENDPOINT_HTTP_LISTEN = 0,
+	ENDPOINT_HTTP,
+	ENDPOINT_TFTP_LISTEN,
+	ENDPOINT_TFTP
+} endpointType_t;
+
+typedef struct endpoint
+{
+	endpointType_t      type;
+	int                 fd;
+	char                request[1024];																										/*HTTP request received so far*/
+	uint32_t            requestLength;
+	char                header[1536];																										/*HTTP response header and JSON body*/
+	uint32_t            headerLength, headerSent;
+	uint32_t            bodyOffset, bodyLength, bodySent;																					/*image bytes of a Range response, sent from the mapping*/
+	bool                writing;																											/*EPOLLOUT armed*/
+	struct sockaddr_in  client;																												/*TFTP client*/
+	fwTftpSession_t     tftp;
+	uint64_t            deadline;																											/*ms the unacknowledged window is sent again*/
+	uint32_t            tries;
+	struct endpoint    *previous, *next;																									/*TFTP sessions, the earliest deadline first*/
+} endpoint_t;
+
+/* Private variables ---------------------------------------------------------*/
+static fwServer_t server;
+static int epollFd;
+static endpoint_t *sessions, *lastSession;
+static uint32_t activeSessions, mostSessions;
+static volatile sig_atomic_t stop;
+
+static uint64_t ullServerdMs(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+static void vServerdStop(int signal)
+{
+	(void)signal;
+	
+	stop = 1;
+}
+
+static endpoint_t *pxServerdEndpoint(endpointType_t type, int fd, uint32_t events)
+{
+	endpoint_t *endpoint = calloc(1, sizeof(endpoint_t));
+	struct epoll_event event = {.events = events, .data.ptr = endpoint};
+	
+	endpoint->type = type;
+	endpoint->fd   = fd;
+	
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+	
+	return endpoint;
+}
+
+/**
+* @brief  This function takes a TFTP session out of the deadline list
+*/
+static void vServerdUnlink(endpoint_t *session)
+{
+	if (session->previous != NULL)
+	{
+		session->previous->next = session->next;
+	}
+	else
+	{
+		sessions = session->next;
+	}
+	
+	if (session->next != NULL)
+	{
+		session->next->previous = session->previous;
+	}
+	else
+	{
+		lastSession = session->previous;
+	}
+	
+	session->previous = NULL;
+	session->next     = NULL;
+}
+
+/**
+* @brief  This function puts a TFTP session at the end of the deadline list, every deadline is its last send and the
+*					same timeout, so the list stays in deadline order and the timeouts only look at its head
+*/
+static void vServerdAppend(endpoint_t *session)
+{
+	session->previous = lastSession;
+	session->next     = NULL;
+	
+	if (lastSession != NULL)
+	{
+		lastSession->next = session;
+	}
+	else
+	{
+		sessions = session;
+	}
+	
+	lastSession = session;
+}
+
+static void vServerdClose(endpoint_t *endpoint)
+{
+	if (endpoint->type == ENDPOINT_TFTP)
+	{
+		vServerdUnlink(endpoint);
+		
+		activeSessions--;
+	}
+	
+	close(endpoint->fd);
+	free(endpoint);
+}
+
+/**
+* @brief  This function binds a socket to a port of the server address, 0 for an ephemeral one
+*/
+static int lServerdSocket(int type, struct in_addr address, uint16_t port)
+{
+	struct sockaddr_in socketAddress = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr = address};
+	int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0), one = 1;
+	
+	if (port != 0)/*an ephemeral port of a session is its own, a shared one would take the datagrams of another session*/
+	{
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+	
+	if (bind(fd, (struct sockaddr *)&socketAddress, sizeof(socketAddress)) != 0 || (type == SOCK_STREAM && listen(fd, 4096) != 0))
+	{
+		perror("bind");
+		
+		exit(1);
+	}
+	
+	return fd;
+}
+
+/**
+* @brief  This function writes what is left of an HTTP response, the header and the image slice in one sendmsg, the rest
+*					waits for EPOLLOUT
+* @retval false if the connection failed
+*/
+static bool bServerdFlush(endpoint_t *endpoint)
+{
+	while (endpoint->headerSent < endpoint->headerLength || endpoint->bodySent < endpoint->bodyLength)
+	{
+		struct iovec vector[2];
+		struct msghdr message = {.msg_iov = vector};
+		ssize_t sent;
+		
+		if (endpoint->headerSent < endpoint->headerLength)
+		{
+			vector[message.msg_iovlen].iov_base = &endpoint->header[endpoint->headerSent];
+			vector[message.msg_iovlen].iov_len  = endpoint->headerLength - endpoint->headerSent;
+			message.msg_iovlen++;
+		}
+		
+		if (endpoint->bodySent < endpoint->bodyLength)
+		{
+			vector[message.msg_iovlen].iov_base = &server.image[endpoint->bodyOffset + endpoint->bodySent];
+			vector[message.msg_iovlen].iov_len  = endpoint->bodyLength - endpoint->bodySent;
+			message.msg_iovlen++;
+		}
+		
+		if ((sent = sendmsg(endpoint->fd, &message, MSG_NOSIGNAL)) <= 0)
+		{
+			if (sent < 0 && errno != EAGAIN)
+			{
+				return false;
+			}
+			
+			break;
+		}
+		
+		if ((uint32_t)sent <= endpoint->headerLength - endpoint->headerSent)
+		{
+			endpoint->headerSent += (uint32_t)sent;
+			
+			continue;
+		}
+		
+		sent                 -= endpoint->headerLength - endpoint->headerSent;
+		endpoint->headerSent  = endpoint->headerLength;
+		endpoint->bodySent   += (uint32_t)sent;
+	}
+	
+	if (endpoint->writing != (endpoint->bodySent < endpoint->bodyLength || endpoint->headerSent < endpoint->headerLength))
+	{
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = endpoint};
+		
+		endpoint->writing = !endpoint->writing;
+		event.events     |= endpoint->writing ? EPOLLOUT : 0;
+		
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, endpoint->fd, &event);
+	}
+	
+	return true;
+}
+
+/**
+* @brief  This function answers the requests of an HTTP connection one after the other, a request is read once the
+*					response before it is written
+*/
+static void vServerdHttp(endpoint_t *endpoint)
+{
+	ssize_t received = 1;
+	
+	while (received > 0)
+	{
+		if (!bServerdFlush(endpoint))
+		{
+			received = -1;
+			
+			break;
+		}
+		
+		if (endpoint->writing)
+		{
+			return;
+		}
+		
+		if ((endpoint->headerLength = ulFwServerHttpHeader(&server, endpoint->request, endpoint->requestLength, endpoint->header, sizeof(endpoint->header), &endpoint->bodyOffset, &endpoint->bodyLength)) != 0)
+		{
+			endpoint->headerSent    = 0;
+			endpoint->bodySent      = 0;
+			endpoint->requestLength = 0;
+			
+			continue;
+		}
+		
+		if (endpoint->requestLength == sizeof(endpoint->request))
+		{
+			received = 0;
+			
+			break;
+		}
+		
+		if ((received = recv(endpoint->fd, &endpoint->request[endpoint->requestLength], sizeof(endpoint->request) - endpoint->requestLength, 0)) > 0)
+		{
+			endpoint->requestLength += (uint32_t)received;
+		}
+	}
+	
+	if (received == 0 || (received < 0 && errno != EAGAIN))
+	{
+		vServerdClose(endpoint);
+	}
+}
+
+/**
+* @brief  This function sends a TFTP answer from where its bytes lie, the header and the slice of the mapping
+*/
+static void vServerdTftpSendOne(endpoint_t *session, fwTftpPacket_t *answer)
+{
+	struct iovec vector[3];
+	struct msghdr message = {.msg_name = &session->client, .msg_namelen = sizeof(session->client), .msg_iov = vector};
+	
+	message.msg_iovlen = ulFwServerTftpVector(&server, answer, vector);
+	
+	sendmsg(session->fd, &message, 0);
+}
+
+/**
+* @brief  This function sends an answer and the rest of its window, then arms the retransmission of the session
+*/
+static void vServerdTftpSend(endpoint_t *session, fwTftpPacket_t *answer)
+{
+	do
+	{
+		vServerdTftpSendOne(session, answer);
+	}
+	while (bFwServerTftpNext(&server, &session->tftp, answer));
+	
+	session->deadline = ullServerdMs() + server.tftpTimeout;
+	
+	vServerdUnlink(session);
+	vServerdAppend(session);
+}
+
+/**
+* @brief  This function starts a TFTP session on its own port for every read request
+*/
+static void vServerdTftpListen(endpoint_t *endpoint, struct in_addr address)
+{
+	uint8_t packet[FW_SERVER_TFTP_PACKET_SIZE];
+	struct sockaddr_in client;
+	socklen_t clientLength = sizeof(client);
+	fwTftpPacket_t answer;
+	ssize_t received;
+	
+	while ((received = recvfrom(endpoint->fd, packet, sizeof(packet), 0, (struct sockaddr *)&client, &clientLength)) > 0)
+	{
+		endpoint_t *session = pxServerdEndpoint(ENDPOINT_TFTP, lServerdSocket(SOCK_DGRAM, address, 0), EPOLLIN);
+		
+		session->client = client;
+		
+		vServerdAppend(session);
+		
+		mostSessions = (++activeSessions > mostSessions) ? activeSessions : mostSessions;
+		
+		if (bFwServerTftpAnswer(&server, &session->tftp, packet, (uint32_t)received, &answer))
+		{
+			vServerdTftpSend(session, &answer);
+		}
+		
+		if (session->tftp.blocks == 0)/*error answered*/
+		{
+			vServerdClose(session);
+		}
+		
+		clientLength = sizeof(client);
+	}
+}
+
+static void vServerdTftp(endpoint_t *session)
+{
+	uint8_t packet[FW_SERVER_TFTP_PACKET_SIZE];
+	fwTftpPacket_t answer;
+	ssize_t received;
+	
+	while ((received = recv(session->fd, packet, sizeof(packet), 0)) > 0)
+	{
+		if (bFwServerTftpAnswer(&server, &session->tftp, packet, (uint32_t)received, &answer))
+		{
+			session->tries = 0;
+			
+			vServerdTftpSend(session, &answer);
+		}
+	}
+	
+	if (session->tftp.done)
+	{
+		vServerdClose(session);
+	}
+}
+
+/**
+* @brief  This function sends the windows of the sessions that timed out again, a session silent for SERVERD_TFTP_TRIES is dropped
+* @retval ms until the next deadline
+*/
+static int lServerdTimeouts(void)
+{
+	uint64_t now = ullServerdMs();
+	fwTftpPacket_t answer;
+	
+	while (sessions != NULL && sessions->deadline <= now)
+	{
+		endpoint_t *session = sessions;
+		
+		if (!bFwServerTftpRetry(&server, &session->tftp, &answer) || ++session->tries >= SERVERD_TFTP_TRIES)
+		{
+			vServerdClose(session);
+			
+			continue;
+		}
+		
+		vServerdTftpSend(session, &answer);
+	}
+	
+	return (sessions == NULL) ? 1000 : (int)(sessions->deadline - now);
+}
+
+/**
+* @brief  fw_serverd [-a address] [-p HTTP port] [-t TFTP port] [-f image file | -k image KB] [-v version] [-s seed]
+*										[-b largest blksize] [-w largest windowsize]
+*					Serves the image file, or a random image of the given size, as the given version. Prints "ready" once it
+*					listens, its counters and exits on SIGTERM or SIGINT.
+*/
+int main(int argc, char *argv[])
+{
+	struct epoll_event events[SERVERD_EVENTS];
+	struct in_addr address = {.s_addr = htonl(INADDR_LOOPBACK)};
+	uint16_t httpPort = FW_SERVER_HTTP_PORT, tftpPort = 6969;
+	uint32_t imageLength = 64 * 1024, seed = 123, *words, maxBlockSize = FW_SERVER_TFTP_MAX_BLOCK_SIZE, maxWindow = FW_SERVER_TFTP_MAX_WINDOW;
+	const char *version = "1.2.3", *path = NULL;
+	endpoint_t *tftpListen;
+	struct rlimit files;
+	int option, count, size = SERVERD_RECEIVE_BUFFER;
+	
+	while ((option = getopt(argc, argv, "a:p:t:f:k:v:s:b:w:")) != -1)
+	{
+		switch (option)
+		{
+			case 'a': address.s_addr = inet_addr(optarg); break;
+			case 'p': httpPort = (uint16_t)strtoul(optarg, NULL, 0); break;
+			case 't': tftpPort = (uint16_t)strtoul(optarg, NULL, 0); break;
+			case 'f': path = optarg; break;
+			case 'k': imageLength = strtoul(optarg, NULL, 0) * 1024; break;
+			case 'v': version = optarg; break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'b': maxBlockSize = strtoul(optarg, NULL, 0); break;
+			case 'w': maxWindow = strtoul(optarg, NULL, 0); break;
+			default:  return 2;
+		}
+	}
+	
+	if (path != NULL)
+	{
+		if (!bFwServerMap(&server, path, version, inet_ntoa(address)))
+		{
+			fprintf(stderr, "%s can't be offered as %s, its length must be a multiple of 4\n", path, version);
+			
+			return 2;
+		}
+	}
+	else
+	{
+		words = malloc(imageLength);
+		
+		for (uint32_t i = 0; i < imageLength / 4; i++)
+		{
+			seed     = seed * 1664525U + 1013904223U;
+			words[i] = seed;
+		}
+		
+		words[0] = 0x20004000U;/*vector table of the application slot*/
+		words[1] = 0x08080201U;
+		
+		if (!bFwServerInit(&server, (const uint8_t *)words, imageLength, version, inet_ntoa(address)))
+		{
+			return 2;
+		}
+		
+		free(words);
+	}
+	
+	sprintf(server.tftpPort, "%u", tftpPort);
+	
+	server.tftpMaxBlockSize = (maxBlockSize >= FW_SERVER_TFTP_BLOCK_SIZE && maxBlockSize <= FW_SERVER_TFTP_MAX_BLOCK_SIZE) ? maxBlockSize : FW_SERVER_TFTP_BLOCK_SIZE;
+	server.tftpMaxWindow    = (maxWindow >= 1 && maxWindow <= FW_SERVER_TFTP_MAX_WINDOW) ? maxWindow : 1;
+	
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0)/*a socket per TFTP session*/
+	{
+		files.rlim_cur = files.rlim_max;
+		
+		setrlimit(RLIMIT_NOFILE, &files);
+	}
+	
+	signal(SIGTERM, vServerdStop);
+	signal(SIGINT, vServerdStop);
+	
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	
+	pxServerdEndpoint(ENDPOINT_HTTP_LISTEN, lServerdSocket(SOCK_STREAM, address, httpPort), EPOLLIN);
+	tftpListen = pxServerdEndpoint(ENDPOINT_TFTP_LISTEN, lServerdSocket(SOCK_DGRAM, address, tftpPort), EPOLLIN);
+	
+	setsockopt(tftpListen->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	
+	printf("ready\n");
+	fflush(stdout);
+	
+	while (!stop)
+	{
+		count = epoll_wait(epollFd, events, SERVERD_EVENTS, lServerdTimeouts());
+		
+		for (int i = 0; i < count; i++)
+		{
+			endpoint_t *endpoint = events[i].data.ptr;
+			int fd;
+			
+			switch (endpoint->type)
+			{
+				case ENDPOINT_HTTP_LISTEN:
+					while ((fd = accept4(endpoint->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+					{
+						pxServerdEndpoint(ENDPOINT_HTTP, fd, EPOLLIN);
+					}
+					break;
+				
+				case ENDPOINT_HTTP:
+					vServerdHttp(endpoint);
+					break;
+				
+				case ENDPOINT_TFTP_LISTEN:
+					vServerdTftpListen(endpoint, address);
+					break;
+				
+				case ENDPOINT_TFTP:
+					vServerdTftp(endpoint);
+					break;
+			}
+		}
+	}
+	
+	printf("checks %u offers %u range %u sessions %u completed %u blocks %u retransmits %u negotiated %u most sessions %u bytes %llu\n", server.checks, server.offers, server.rangeRequests, server.sessions,
+				 server.completed, server.blocks, server.retransmits, server.negotiated, mostSessions, (unsigned long long)server.bytesSent);
+	
+	vFwServerFree(&server);
+	
+	return 0;
+}
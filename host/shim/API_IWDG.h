@@ -0,0 +1,14 @@
+/**
+  ************************************************************************************
+  * @file    API_IWDG.h
+  * @brief   Host stand-in of the watchdog reload of the application
+  ************************************************************************************
+  */
+
+#ifndef __API_IWDG_H__
+#define __API_IWDG_H__
+
+/* Functions -----------------------------------------------------------------------*/
+void vIWDGReset(void);
+
+#endif /* __API_IWDG_H__ */
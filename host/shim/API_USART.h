@@ -0,0 +1,17 @@
+/**
+  ************************************************************************************
+  * @file    API_USART.h
+  * @brief   Host stand-in of the UART reinitialization of the application
+  ************************************************************************************
+  */
+
+#ifndef __API_USART_H__
+#define __API_USART_H__
+
+/* Includes ------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/* Functions -----------------------------------------------------------------------*/
+void vUsartReInit(UART_HandleTypeDef *huart, uint32_t baudRate, void *rxBuffer, void *txBuffer, void *dmaHandle);
+
+#endif /* __API_USART_H__ */
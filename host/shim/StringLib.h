@@ -0,0 +1,14 @@
+/**
+  ************************************************************************************
+  * @file    StringLib.h
+  * @brief   Host stand-in of the string helpers of the application
+  ************************************************************************************
+  */
+
+#ifndef __STRINGLIB_H__
+#define __STRINGLIB_H__
+
+/* Functions -----------------------------------------------------------------------*/
+void vGetSubstringBetweenTwoStrings(char *input, char *first, char *second, char *output);
+
+#endif /* __STRINGLIB_H__ */
@@ -0,0 +1,114 @@
+/**
+  ******************************************************************************
+  * @file    application.c
+  * @brief   Host stand-in of the application parts the bootloader relies on:
+  *          modem driver globals, UART callbacks, watchdog and string helpers
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+
+/* Typedefs ------------------------------------------------------------------*/
+gsm_t              gsm;
+gsmParams_t        gsmParams;
+int                gsmState;
+wifiParams_t       wifiParams;
+int                wifiPreviousState;
+UART_HandleTypeDef huart3 = {.Instance = 3, .Init = {.BaudRate = 115200}, .gState = HAL_UART_STATE_READY};
+UART_HandleTypeDef huart6 = {.Instance = 6, .Init = {.BaudRate = 115200}, .gState = HAL_UART_STATE_READY};
+
+/**
+* @brief  This function starts the receptions of both modem UARTs, as the application does after its UART init
+*/
+void vHostApplicationInit(void)
+{
+	HAL_UART_Receive_IT(&WIFI_UART, &WIFI_UART_RECEIVED_CHARACTER, 1);
+	HAL_UART_Receive_IT(&GSM_UART, &gsm.receivedData, 1);
+}
+
+/**
+* @brief  This function hands a received byte to the bootloader ring and arms the next one
+*/
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	uint8_t *buffer = (huart == &WIFI_UART) ? &WIFI_UART_RECEIVED_CHARACTER : &gsm.receivedData;
+	
+	vBootloaderUartRxISR(huart, *buffer);
+	
+	HAL_UART_Receive_IT(huart, buffer, 1);
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	vBootloaderUartTxISR(huart);
+}
+
+/**
+* @brief  This function switches the baudrate of a UART, the reception is armed again by the caller
+*/
+void vUsartReInit(UART_HandleTypeDef *huart, uint32_t baudRate, void *rxBuffer, void *txBuffer, void *dmaHandle)
+{
+	(void)rxBuffer;
+	(void)txBuffer;
+	(void)dmaHandle;
+	
+	huart->Init.BaudRate = baudRate;
+	huart->pRxBuffPtr    = NULL;
+	huart->gState        = HAL_UART_STATE_READY;
+	
+	if (xHostPort.baudrate != NULL)
+	{
+		xHostPort.baudrate(huart, baudRate);
+	}
+}
+
+void gsmquectel_clearAllParams(void)
+{
+	memset(gsm.receive, 0, sizeof(gsm.receive));
+	
+	gsm.rx_index = 0;
+}
+
+void wifi_clearParams(void)
+{
+	memset(wifiParams.receiveBuffer, 0, sizeof(wifiParams.receiveBuffer));
+	
+	wifiParams.rx_index = 0;
+}
+
+void vFlashSaveEnergyRegisters(void)
+{
+}
+
+void vIWDGReset(void)
+{
+	xHostDevice.watchdogReloads++;
+}
+
+/**
+* @brief  This function copies the text between the first occurrence of first and the following occurrence of second
+* @note   output is left as it is if either is missing
+*/
+void vGetSubstringBetweenTwoStrings(char *input, char *first, char *second, char *output)
+{
+	char *start = strstr(input, first), *end;
+	
+	if (start == NULL)
+	{
+		return;
+	}
+	
+	start += strlen(first);
+	
+	end = strstr(start, second);
+	
+	if (end == NULL)
+	{
+		return;
+	}
+	
+	memcpy(output, start, (size_t)(end - start));
+	
+	output[end - start] = '\0';
+}
@@ -0,0 +1,497 @@
+/**
+  ******************************************************************************
+  * @file    hal_shim.c
+  * @brief   Host HAL of the bootloader: flash model, SRAM, clocks, UARTs and core
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "API_BOOTLOADER.h"
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+hostPort_t     xHostPort;
+hostDevice_t   xHostDevice;
+DWT_Type       xHostDWT;
+CoreDebug_Type xHostCoreDebug;
+ITM_Type       xHostITM;
+IWDG_TypeDef   xHostIWDG;
+DWT_Type       *DWT       = &xHostDWT;
+CoreDebug_Type *CoreDebug = &xHostCoreDebug;
+ITM_Type       *ITM       = &xHostITM;
+IWDG_TypeDef   *IWDG      = &xHostIWDG;
+uint32_t       SystemCoreClock = 216000000U;
+
+/* Private variables ---------------------------------------------------------*/
+static const uint32_t sectorSize[HOST_FLASH_SECTORS] = {0x8000, 0x8000, 0x8000, 0x8000, 0x20000, 0x40000, 0x40000, 0x40000, 0x40000, 0x40000, 0x40000, 0x40000};
+static int erasedFlash = -1;/*memfd of an erased flash, mapped copy on write by every device*/
+static uint32_t tornState = 0x2545F491U;
+
+/**
+* @brief  This function maps the SRAM words the bootloader keeps over a reset at their own address
+*/
+__attribute__((constructor)) static void vHostSramMap(void)
+{
+	if (mmap((void *)(uintptr_t)HOST_SRAM_BASE, HOST_SRAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != (void *)(uintptr_t)HOST_SRAM_BASE)
+	{
+		perror("SRAM at 0x20000000");
+		
+		abort();
+	}
+}
+
+/**
+* @brief  This function gives CLOCK_MONOTONIC in ns
+*/
+static uint64_t ullHostMonotonic(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/**
+* @brief  This function gives the bits a torn program or erase leaves behind
+*/
+static uint32_t ulHostTornBits(void)
+{
+	tornState ^= tornState << 13;
+	tornState ^= tornState >> 17;
+	tornState ^= tornState << 5;
+	
+	return tornState;
+}
+
+/**
+* @brief  This function creates an erased flash for one device
+* @retval HOST_FLASH_SIZE bytes, erasing a sector maps the erased pages back over it
+*/
+uint8_t *pucHostFlashCreate(void)
+{
+	uint8_t *flash;
+	
+	if (erasedFlash < 0)
+	{
+		erasedFlash = memfd_create("erased-flash", MFD_CLOEXEC);
+		
+		if (erasedFlash < 0 || ftruncate(erasedFlash, HOST_FLASH_SIZE) != 0)
+		{
+			abort();
+		}
+		
+		flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, erasedFlash, 0);
+		
+		memset(flash, HOST_FLASH_ERASED, HOST_FLASH_SIZE);
+		
+		munmap(flash, HOST_FLASH_SIZE);
+	}
+	
+	flash = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, erasedFlash, 0);
+	
+	if (flash == MAP_FAILED)
+	{
+		abort();
+	}
+	
+	return flash;
+}
+
+/**
+* @brief  This function releases a flash of pucHostFlashCreate
+*/
+void vHostFlashDestroy(uint8_t *flash)
+{
+	munmap(flash, HOST_FLASH_SIZE);
+}
+
+/**
+* @brief  This function gives the start of a sector
+*/
+uint32_t ulHostFlashSectorAddress(uint32_t sector)
+{
+	uint32_t address = HOST_FLASH_BASE;
+	
+	for (uint32_t i = 0; i < sector && i < HOST_FLASH_SECTORS; i++)
+	{
+		address += sectorSize[i];
+	}
+	
+	return address;
+}
+
+/**
+* @brief  This function gives the size of a sector
+*/
+uint32_t ulHostFlashSectorSize(uint32_t sector)
+{
+	return (sector < HOST_FLASH_SECTORS) ? sectorSize[sector] : 0;
+}
+
+/**
+* @brief  This function writes the flash of the current device as a programmer would, outside of the model
+*/
+void vHostFlashWrite(uint32_t address, const void *data, uint32_t length)
+{
+	memcpy(&xHostDevice.flash[address - HOST_FLASH_BASE], data, length);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	xHostDevice.flashUnlocked = true;
+	
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	xHostDevice.flashUnlocked = false;
+	
+	return HAL_OK;
+}
+
+/**
+* @brief  This function programs a byte or a word, which must be erased as on the STM32F7
+* @note   A cut of the power supply clears a random part of the bits being programmed and resets the device
+*/
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	uint32_t length = (TypeProgram == FLASH_TYPEPROGRAM_WORD) ? 4 : (TypeProgram == FLASH_TYPEPROGRAM_HALFWORD) ? 2 : 1, torn;
+	uint8_t *cell, data[4];
+	
+	if (!xHostDevice.flashUnlocked || Address < HOST_FLASH_BASE || Address + length > HOST_FLASH_BASE + HOST_FLASH_SIZE || Address % length != 0)
+	{
+		xHostDevice.flashFaults++;
+		
+		return HAL_ERROR;
+	}
+	
+	cell = &xHostDevice.flash[Address - HOST_FLASH_BASE];
+	
+	for (uint32_t i = 0; i < length; i++)
+	{
+		if (cell[i] != HOST_FLASH_ERASED)
+		{
+			xHostDevice.flashFaults++;
+			
+			return HAL_ERROR;
+		}
+		
+		data[i] = (uint8_t)(Data >> (8 * i));
+	}
+	
+	xHostDevice.flashPrograms++;
+	
+	if (xHostPort.busy != NULL)
+	{
+		xHostPort.busy(HOST_FLASH_PROGRAM_US);
+	}
+	
+	if (xHostPort.powerCut != NULL && xHostPort.powerCut(Address, length))
+	{
+		torn = ulHostTornBits();
+		
+		for (uint32_t i = 0; i < length; i++)
+		{
+			cell[i] &= data[i] | (uint8_t)(torn >> (8 * i));
+		}
+		
+		xHostPort.reset(true);
+	}
+	
+	memcpy(cell, data, length);
+	
+	return HAL_OK;
+}
+
+/**
+* @brief  This function erases sectors by mapping the erased flash back over them
+* @note   A cut of the power supply erases only a random part of the sector being erased and resets the device
+*/
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+	uint32_t address, size, part;
+	
+	*SectorError = 0xFFFFFFFFU;
+	
+	for (uint32_t sector = pEraseInit->Sector; sector < pEraseInit->Sector + pEraseInit->NbSectors; sector++)
+	{
+		if (!xHostDevice.flashUnlocked || sector >= HOST_FLASH_SECTORS)
+		{
+			*SectorError = sector;
+			
+			xHostDevice.flashFaults++;
+			
+			return HAL_ERROR;
+		}
+		
+		address = ulHostFlashSectorAddress(sector) - HOST_FLASH_BASE;
+		size    = sectorSize[sector];
+		
+		xHostDevice.flashErases++;
+		
+		if (xHostPort.busy != NULL)
+		{
+			xHostPort.busy(size / 1024 * HOST_FLASH_ERASE_US_PER_KB);
+		}
+		
+		if (xHostPort.powerCut != NULL && xHostPort.powerCut(address + HOST_FLASH_BASE, size))
+		{
+			part = ulHostTornBits() % size;
+			
+			memset(&xHostDevice.flash[address], HOST_FLASH_ERASED, part);
+			
+			xHostPort.reset(true);
+		}
+		
+		if (mmap(&xHostDevice.flash[address], size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, erasedFlash, address) == MAP_FAILED)
+		{
+			abort();
+		}
+	}
+	
+	return HAL_OK;
+}
+
+/**
+* @brief  This function gives the ms clock of the device
+*/
+uint32_t HAL_GetTick(void)
+{
+	if (xHostPort.tick != NULL)
+	{
+		return xHostPort.tick();
+	}
+	
+	return (uint32_t)(ullHostMonotonic() / 1000000ULL);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	struct timespec wait = {Delay / 1000, (long)(Delay % 1000) * 1000000L};
+	
+	if (xHostPort.delay != NULL)
+	{
+		xHostPort.delay(Delay);
+		
+		return;
+	}
+	
+	nanosleep(&wait, NULL);
+}
+
+/**
+* @brief  This function gives BOOTLOADER_TIMESTAMP, HOST_TIMESTAMP_PER_US ticks per us
+*/
+uint32_t ulHostTimestamp(void)
+{
+	if (xHostPort.timestamp != NULL)
+	{
+		return xHostPort.timestamp();
+	}
+	
+	return (uint32_t)(ullHostMonotonic() * HOST_TIMESTAMP_PER_US / 1000ULL);
+}
+
+/**
+* @brief  This function is UART_CAPTURE_WRITE, the records go to the capture hook
+*/
+void vHostCaptureWrite(const void *data, uint32_t length)
+{
+	if (xHostPort.capture != NULL)
+	{
+		xHostPort.capture(data, length);
+	}
+}
+
+/**
+* @brief  This function is TRACE_WRITE, the records drained by vBootloaderTraceDrain go to the trace hook
+*/
+void vHostTraceWrite(const void *data, uint32_t length)
+{
+	if (xHostPort.trace != NULL)
+	{
+		xHostPort.trace(data, length);
+	}
+}
+
+uint32_t HAL_GetUIDw0(void)
+{
+	return xHostDevice.uid[0];
+}
+
+uint32_t HAL_GetUIDw1(void)
+{
+	return xHostDevice.uid[1];
+}
+
+uint32_t HAL_GetUIDw2(void)
+{
+	return xHostDevice.uid[2];
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void)
+{
+	return SystemCoreClock;
+}
+
+void HAL_DeInit(void)
+{
+}
+
+void HAL_RCC_DeInit(void)
+{
+}
+
+/**
+* @brief  This function starts a transmission, the harness ends it with vHostUartTxComplete
+* @note   Without a transmit hook the bytes leave at once and the complete callback runs before this returns
+*/
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if (huart->gState == HAL_UART_STATE_BUSY_TX)
+	{
+		return HAL_BUSY;
+	}
+	
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	
+	if (xHostPort.transmit != NULL)
+	{
+		xHostPort.transmit(huart, pData, Size);
+	}
+	else
+	{
+		vHostUartTxComplete(huart);
+	}
+	
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	return HAL_UART_Transmit_IT(huart, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart)
+{
+	huart->gState = HAL_UART_STATE_READY;
+	
+	return HAL_OK;
+}
+
+/**
+* @brief  This function arms the reception of one byte, vHostUartReceive fills it
+*/
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	(void)Size;
+	
+	huart->pRxBuffPtr = pData;
+	
+	return HAL_OK;
+}
+
+/**
+* @brief  This function ends a transmission of the transmit hook, as the transmit complete interrupt
+*/
+void vHostUartTxComplete(UART_HandleTypeDef *huart)
+{
+	if (huart->gState != HAL_UART_STATE_BUSY_TX)/*aborted meanwhile*/
+	{
+		return;
+	}
+	
+	huart->gState = HAL_UART_STATE_READY;
+	
+	HAL_UART_TxCpltCallback(huart);
+}
+
+/**
+* @brief  This function receives bytes from the wire, as one receive interrupt per byte
+* @note   A byte arriving while no reception is armed is lost as an overrun
+*/
+void vHostUartReceive(UART_HandleTypeDef *huart, const uint8_t *data, uint32_t length)
+{
+	uint8_t *buffer;
+	
+	for (uint32_t i = 0; i < length; i++)
+	{
+		buffer = huart->pRxBuffPtr;
+		
+		if (buffer == NULL)
+		{
+			continue;
+		}
+		
+		huart->pRxBuffPtr = NULL;
+		
+		*buffer = data[i];
+		
+		HAL_UART_RxCpltCallback(huart);
+	}
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return xHostDevice.primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+	xHostDevice.primask = priMask;
+}
+
+void __disable_irq(void)
+{
+	xHostDevice.primask = 1;
+}
+
+void __enable_irq(void)
+{
+	xHostDevice.primask = 0;
+}
+
+void SCB_CleanDCache_by_Addr(uint32_t *addr, int32_t dsize)
+{
+	(void)addr;
+	(void)dsize;
+}
+
+/**
+* @brief  This function resets the device through the harness
+*/
+void NVIC_SystemReset(void)
+{
+	if (xHostPort.reset == NULL)
+	{
+		fprintf(stderr, "NVIC_SystemReset without a reset hook\n");
+		
+		abort();
+	}
+	
+	xHostPort.reset(false);
+	
+	abort();
+}
+
+/**
+* @brief  This function hands the device to its application through the harness
+*/
+void __set_MSP(uint32_t topOfMainStack)
+{
+	if (xHostPort.jump == NULL)
+	{
+		fprintf(stderr, "jump to the application without a jump hook\n");
+		
+		abort();
+	}
+	
+	xHostPort.jump(topOfMainStack);
+	
+	abort();
+}
@@ -0,0 +1,88 @@
+/**
+  ************************************************************************************
+  * @file    host_port.h
+  * @brief   Host port of the bootloader: flash model, clocks and the hooks a harness
+  *          plugs its time, modems and power supply into
+  ************************************************************************************
+  */
+
+#ifndef __HOST_PORT_H__
+#define __HOST_PORT_H__
+
+/* Includes ------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/***************************  Flash Model Definitions *******************************/
+#define HOST_FLASH_BASE																			(uint32_t)0x08000000U
+#define HOST_FLASH_SIZE																			(uint32_t)0x00200000U												/*2 MB single bank STM32F7, sectors 0-3 of 32 KB, 4 of 128 KB, 5-11 of 256 KB*/
+#define HOST_FLASH_SECTORS																	12
+#define HOST_FLASH_ERASED																		0xFFU
+#define HOST_BOOTLOADER_IMAGE_SIZE													(uint32_t)0x00008000U												/*bytes taken by the bootloader build in sector 0*/
+#define HOST_FLASH_PROGRAM_US																16																					/*word program time of the STM32F7, x32 parallelism*/
+#define HOST_FLASH_ERASE_US_PER_KB													7800																				/*sector erase time of the STM32F7, 256 KB in 2 s*/
+
+/***************************  SRAM Model Definitions ********************************/
+#define HOST_SRAM_BASE																			(uint32_t)0x20000000U												/*mapped at its own address, the words kept over a reset are dereferenced*/
+#define HOST_SRAM_SIZE																			(uint32_t)0x00004000U
+#define HOST_SRAM_KEPT_ADDRESS															(uint32_t)0x20003F80U												/*timing summary, boot verification marker and control word*/
+#define HOST_SRAM_KEPT_SIZE																	(uint32_t)0x00000080U
+
+/***************************  Clock Definitions *************************************/
+#define HOST_TIMESTAMP_PER_US																16U																					/*BOOTLOADER_TIMESTAMP ticks per us, wraps after 268 s*/
+
+/***************************  Bootloader Overrides **********************************/
+#define BOOTLOADER_FLASH_POINTER(address)										((__IO uint8_t *)&xHostDevice.flash[(uint32_t)(address) - HOST_FLASH_BASE])
+#define BOOTLOADER_IMAGE_END(x)															(HOST_FLASH_BASE + HOST_BOOTLOADER_IMAGE_SIZE)
+#define BOOTLOADER_TIMESTAMP(x)															ulHostTimestamp(x)
+#define BOOTLOADER_TIMESTAMP_TO_US(x)												((x) / HOST_TIMESTAMP_PER_US)
+#define UART_CAPTURE_WRITE(data, length)										vHostCaptureWrite(data, length)
+#define TRACE_WRITE(data, length)														vHostTraceWrite(data, length)
+
+/* Typedefs ------------------------------------------------------------------------*/
+/*Hooks of the harness, a NULL hook keeps the stand alone behaviour noted beside it*/
+typedef struct
+{
+	uint32_t (*tick)(void);																												/*ms clock of HAL_GetTick, CLOCK_MONOTONIC if NULL*/
+	void     (*delay)(uint32_t ms);																										/*HAL_Delay, sleeps if NULL*/
+	uint32_t (*timestamp)(void);																									/*BOOTLOADER_TIMESTAMP, CLOCK_MONOTONIC if NULL*/
+	void     (*transmit)(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t length);	/*bytes on the wire, vHostUartTxComplete ends them, completes at once if NULL*/
+	void     (*baudrate)(UART_HandleTypeDef *huart, uint32_t baudrate);								/*vUsartReInit switched a UART*/
+	bool     (*powerCut)(uint32_t address, uint32_t length);												/*true cuts the power in the middle of this program or erase*/
+	void     (*reset)(bool powerLoss);																							/*NVIC_SystemReset or a power cut, must not return, aborts if NULL*/
+	void     (*jump)(uint32_t stack);																								/*__set_MSP of the jump to an application, must not return, aborts if NULL*/
+	void     (*busy)(uint32_t us);																									/*CPU held by a flash program or erase, not spent if NULL*/
+	void     (*capture)(const void *data, uint32_t length);											/*UART_CAPTURE_WRITE of a BOOTLOADER_UART_CAPTURE build, dropped if NULL*/
+	void     (*trace)(const void *data, uint32_t length);												/*TRACE_WRITE of a TFTP_BOOTLOADER_TRACE build, dropped if NULL*/
+} hostPort_t;
+
+/*State of one simulated device, everything else it owns is the data of the bootloader build*/
+typedef struct
+{
+	uint8_t  *flash;																															/*HOST_FLASH_SIZE bytes standing for HOST_FLASH_BASE*/
+	bool      flashUnlocked;
+	uint32_t  flashPrograms;																												/*program operations since the flash was created*/
+	uint32_t  flashErases;																													/*sector erases since the flash was created*/
+	uint32_t  flashFaults;																													/*programs of a word not erased or of a locked flash*/
+	uint32_t  uid[3];																																/*96 bit unique ID*/
+	uint32_t  primask;
+	uint32_t  watchdogReloads;
+} hostDevice_t;
+
+/* Variables -----------------------------------------------------------------------*/
+extern hostPort_t   xHostPort;
+extern hostDevice_t xHostDevice;
+
+/* Functions -----------------------------------------------------------------------*/
+uint8_t *pucHostFlashCreate(void);
+void     vHostFlashDestroy(uint8_t *flash);
+uint32_t ulHostFlashSectorAddress(uint32_t sector);
+uint32_t ulHostFlashSectorSize(uint32_t sector);
+void     vHostFlashWrite(uint32_t address, const void *data, uint32_t length);
+uint32_t ulHostTimestamp(void);
+void     vHostCaptureWrite(const void *data, uint32_t length);
+void     vHostTraceWrite(const void *data, uint32_t length);
+void     vHostUartReceive(UART_HandleTypeDef *huart, const uint8_t *data, uint32_t length);
+void     vHostUartTxComplete(UART_HandleTypeDef *huart);
+void     vHostApplicationInit(void);
+
+#endif /* __HOST_PORT_H__ */
@@ -0,0 +1,54 @@
+/**
+  ************************************************************************************
+  * @file    main.h
+  * @brief   Host stand-in of the application globals the bootloader shares with the
+  *          GSM and Wi-Fi drivers
+  ************************************************************************************
+  */
+
+#ifndef __MAIN_H
+#define __MAIN_H
+
+/* Includes ------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/***************************  Driver Definitions ************************************/
+#define GSM_RECEIVE_BUFFER_SIZE															2048																				/*bytes*/
+#define WIFI_RECEIVE_BUFFER_SIZE														2048																				/*bytes*/
+#define GSM_FINAL_STATE																			7																						/*GSM driver state once registered with an IP*/
+#define PROCESS_SUCCESS																			1																						/*Wi-Fi driver state once joined with an IP*/
+
+/* Typedefs ------------------------------------------------------------------------*/
+typedef struct
+{
+	char              receive[GSM_RECEIVE_BUFFER_SIZE];
+	volatile uint32_t rx_index;
+	uint8_t           receivedData;																								/*1 byte HAL_UART_Receive_IT buffer*/
+} gsm_t;
+
+typedef struct
+{
+	char ipAddress[20];
+} gsmParams_t;
+
+typedef struct
+{
+	char              receiveBuffer[WIFI_RECEIVE_BUFFER_SIZE];
+	char              externalIP[20];
+	uint8_t           receivedData;																								/*1 byte HAL_UART_Receive_IT buffer*/
+	volatile uint32_t rx_index;
+} wifiParams_t;
+
+/* Variables -----------------------------------------------------------------------*/
+extern gsm_t        gsm;
+extern gsmParams_t  gsmParams;
+extern int          gsmState;
+extern wifiParams_t wifiParams;
+extern int          wifiPreviousState;
+
+/* Functions -----------------------------------------------------------------------*/
+void gsmquectel_clearAllParams(void);
+void wifi_clearParams(void);
+void vFlashSaveEnergyRegisters(void);
+
+#endif /* __MAIN_H */
@@ -0,0 +1,159 @@
+/**
+  ************************************************************************************
+  * @file    stm32f4xx_hal.h
+  * @brief   Host stand-in of the STM32 HAL and CMSIS core used by API_BOOTLOADER.c
+  ************************************************************************************
+  */
+
+#ifndef __STM32F4xx_HAL_H
+#define __STM32F4xx_HAL_H
+
+/* Includes ------------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/***************************  HAL Definitions ***************************************/
+#define __IO																								volatile
+#define __weak																							__attribute__((weak))
+#define __ALIGNED(x)																				__attribute__((aligned(x)))
+#define HSI_VALUE																						16000000U																		/*Hz*/
+
+typedef enum
+{
+	HAL_OK       = 0x00U,
+	HAL_ERROR    = 0x01U,
+	HAL_BUSY     = 0x02U,
+	HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+/***************************  Flash Definitions *************************************/
+#define FLASH_TYPEERASE_SECTORS															0x00000000U
+#define FLASH_TYPEPROGRAM_BYTE															0x00000000U
+#define FLASH_TYPEPROGRAM_HALFWORD													0x00000001U
+#define FLASH_TYPEPROGRAM_WORD															0x00000002U
+#define FLASH_VOLTAGE_RANGE_3																0x00000002U
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+/***************************  UART Definitions **************************************/
+typedef enum
+{
+	HAL_UART_STATE_READY   = 0x20U,
+	HAL_UART_STATE_BUSY_TX = 0x21U
+} HAL_UART_StateTypeDef;
+
+typedef struct
+{
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct __UART_HandleTypeDef
+{
+	uint32_t                       Instance;																	/*USART number*/
+	UART_InitTypeDef               Init;
+	uint8_t                       *pRxBuffPtr;																/*byte buffer of the armed HAL_UART_Receive_IT, NULL while not receiving*/
+	volatile HAL_UART_StateTypeDef gState;
+} UART_HandleTypeDef;
+
+/***************************  Core Peripheral Definitions ***************************/
+typedef struct
+{
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct
+{
+	volatile union
+	{
+		volatile uint8_t  u8;
+		volatile uint16_t u16;
+		volatile uint32_t u32;
+	} PORT[32];
+	uint32_t RESERVED0[864];
+	volatile uint32_t TER;
+	uint32_t RESERVED1[15];
+	volatile uint32_t TPR;
+	uint32_t RESERVED2[15];
+	volatile uint32_t TCR;
+} ITM_Type;
+
+typedef struct
+{
+	volatile uint32_t KR;
+	volatile uint32_t PR;
+	volatile uint32_t RLR;
+	volatile uint32_t SR;
+} IWDG_TypeDef;
+
+#define DWT_CTRL_CYCCNTENA_Msk															(1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk													(1UL << 24)
+#define ITM_TCR_ITMENA_Msk																	(1UL << 0)
+
+extern DWT_Type       *DWT;
+extern CoreDebug_Type *CoreDebug;
+extern ITM_Type       *ITM;
+extern IWDG_TypeDef   *IWDG;
+extern uint32_t        SystemCoreClock;
+
+/***************************  Core Functions ****************************************/
+static inline void __DMB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __DSB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __ISB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+uint32_t __get_PRIMASK(void);
+void     __set_PRIMASK(uint32_t priMask);
+void     __disable_irq(void);
+void     __enable_irq(void);
+void     __set_MSP(uint32_t topOfMainStack);
+void     NVIC_SystemReset(void);
+void     SCB_CleanDCache_by_Addr(uint32_t *addr, int32_t dsize);
+
+/***************************  HAL Functions *****************************************/
+void              HAL_DeInit(void);
+void              HAL_RCC_DeInit(void);
+uint32_t          HAL_RCC_GetHCLKFreq(void);
+uint32_t          HAL_GetTick(void);
+void              HAL_Delay(uint32_t Delay);
+uint32_t          HAL_GetUIDw0(void);
+uint32_t          HAL_GetUIDw1(void);
+uint32_t          HAL_GetUIDw2(void);
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart);
+void              HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void              HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+
+/* The host port maps flash, clock and timestamp of the bootloader to the model */
+#include "host_port.h"
+
+#endif /* __STM32F4xx_HAL_H */
@@ -0,0 +1,18 @@
+/**
+  ************************************************************************************
+  * @file    usart.h
+  * @brief   Host stand-in of the modem UART handles
+  ************************************************************************************
+  */
+
+#ifndef __USART_H__
+#define __USART_H__
+
+/* Includes ------------------------------------------------------------------------*/
+#include "stm32f4xx_hal.h"
+
+/* Variables -----------------------------------------------------------------------*/
+extern UART_HandleTypeDef huart3;																							/*ESP8266*/
+extern UART_HandleTypeDef huart6;																							/*UG95*/
+
+#endif /* __USART_H__ */
@@ -0,0 +1,349 @@
+/**
+  ******************************************************************************
+  * @file    esp8266.c
+  * @brief   ESP8266 AT firmware emulator of the device simulator, multiple
+  *          connections: AT+CIPSTART, AT+CIPSEND, AT+CIPCLOSE, +IPD,
+  *          AT+CIPSERVER and AT+CIPSERVERMAXCONN for the other modems of the
+  *          site and AT+UART_CUR
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+
+/* Private define ------------------------------------------------------------*/
+#define ESP8266_LINKS																				5
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	simModem_t  *modem;
+	char         line[256];
+	uint32_t     lineLength;
+	int32_t      sendLink;																											/*link taking the raw bytes of AT+CIPSEND, -1 while reading commands*/
+	char         sendIP[16];																										/*remote given to AT+CIPSEND, empty for the remote of the link*/
+	uint16_t     sendPort;
+	uint32_t     sendLength, sendReceived;
+	uint8_t      sendBuffer[2048];
+	simSocket_t *links[ESP8266_LINKS];
+	char         remoteIP[ESP8266_LINKS][16];																			/*UDP mode 2 follows the last sender*/
+	uint16_t     remotePort[ESP8266_LINKS];
+	bool         followSender[ESP8266_LINKS];
+	bool         established[ESP8266_LINKS];																				/*connected, a close of the remote is then reported*/
+	bool         accepted[ESP8266_LINKS];																						/*taken by the server*/
+	uint32_t     maxConnections;																									/*of the server, AT+CIPSERVERMAXCONN*/
+} esp8266_t;
+
+static void vEsp8266Connected(void *context, simSocket_t *socket, bool connected)
+{
+	esp8266_t *esp = context;
+	char text[64];
+	
+	for (int32_t id = 0; id < ESP8266_LINKS; id++)
+	{
+		if (esp->links[id] == socket)
+		{
+			if (connected)
+			{
+				sprintf(text, "%i,CONNECT\r\n\r\nOK\r\n", id);
+			}
+			else
+			{
+				vSimSocketClose(socket);
+				
+				esp->links[id] = NULL;
+				
+				sprintf(text, esp->established[id] ? "%i,CLOSED\r\n" : "%i,CLOSED\r\n\r\nERROR\r\n", id);
+			}
+			
+			esp->established[id] = connected;
+			
+			vSimModemOutput(esp->modem, text, strlen(text));
+		}
+	}
+}
+
+/**
+* @brief  This function hands a packet of a link to the device as one "+IPD,<link>,<length>:<data>" frame
+*/
+static void vEsp8266Receive(void *context, simSocket_t *socket, const char ip[], uint16_t port, const uint8_t data[], uint32_t length)
+{
+	esp8266_t *esp = context;
+	uint8_t frame[32 + 2048];
+	int header;
+	
+	for (int32_t id = 0; id < ESP8266_LINKS; id++)
+	{
+		if (esp->links[id] == socket && length <= 2048)
+		{
+			if (esp->followSender[id])
+			{
+				snprintf(esp->remoteIP[id], sizeof(esp->remoteIP[id]), "%s", ip);
+				
+				esp->remotePort[id] = port;
+			}
+			
+			header = sprintf((char *)frame, "\r\n+IPD,%i,%u:", id, length);
+			
+			memcpy(&frame[header], data, length);
+			
+			vSimModemOutput(esp->modem, frame, (uint32_t)header + length);
+		}
+	}
+}
+
+/**
+* @brief  This function gives a connection of another modem of the site the lowest free link, as the server mode does
+*/
+static void vEsp8266Accepted(void *context, simSocket_t *socket, const char ip[])
+{
+	esp8266_t *esp = context;
+	uint32_t connections = 0;
+	char text[32];
+	
+	for (int32_t id = 0; id < ESP8266_LINKS; id++)
+	{
+		connections += (esp->links[id] != NULL && esp->accepted[id]);
+	}
+	
+	for (int32_t id = 0; id < ESP8266_LINKS && connections < esp->maxConnections; id++)
+	{
+		if (esp->links[id] == NULL)
+		{
+			esp->links[id]        = socket;
+			esp->established[id]  = true;
+			esp->accepted[id]     = true;
+			esp->followSender[id] = false;
+			
+			snprintf(esp->remoteIP[id], sizeof(esp->remoteIP[id]), "%s", ip);
+			
+			sprintf(text, "%i,CONNECT\r\n", id);
+			
+			vSimModemOutput(esp->modem, text, strlen(text));
+			
+			return;
+		}
+	}
+	
+	vSimSocketClose(socket);
+}
+
+static const simSocketHandler_t esp8266Handler = {vEsp8266Connected, vEsp8266Receive, vEsp8266Accepted};
+
+/**
+* @brief  This function runs one command line, the "\r\n" already removed
+*/
+static void vEsp8266Command(esp8266_t *esp, char line[])
+{
+	simModem_t *modem = esp->modem;
+	char type[8], host[64], text[64];
+	int32_t id;
+	uint32_t baud, length, localPort, mode;
+	unsigned int port;
+	
+	if (strcmp(line, "AT") == 0 || strncmp(line, "AT+CWMODE=", 10) == 0 || strncmp(line, "AT+CIPMUX=", 10) == 0)
+	{
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+	}
+	else if (sscanf(line, "AT+UART_CUR=%u", &baud) == 1)
+	{
+		vSimModemReply(modem, "\r\nOK\r\n", baud);
+	}
+	else if (sscanf(line, "AT+CIPSTART=%i,\"%7[^\"]\",\"%63[^\"]\",%u", &id, type, host, &port) == 4 && id >= 0 && id < ESP8266_LINKS)
+	{
+		bool udp = (strcmp(type, "UDP") == 0);
+		
+		if (esp->links[id] != NULL)
+		{
+			vSimModemReply(modem, "ALREADY CONNECTED\r\n\r\nERROR\r\n", 0);
+			
+			return;
+		}
+		
+		mode              = 0;
+		esp->accepted[id] = false;
+		
+		sscanf(line, "AT+CIPSTART=%*i,\"%*[^\"]\",\"%*[^\"]\",%*u,%u,%u", &localPort, &mode);
+		
+		esp->links[id]        = pxSimSocketOpen(&modem->config.link, udp, host, (uint16_t)port, &esp8266Handler, esp);
+		esp->followSender[id] = udp && mode == 2;
+		esp->remotePort[id]   = (uint16_t)port;
+		
+		snprintf(esp->remoteIP[id], sizeof(esp->remoteIP[id]), "%.15s", host);
+		
+		if (udp)
+		{
+			sprintf(text, "%i,CONNECT\r\n\r\nOK\r\n", id);
+			
+			vSimModemReply(modem, text, 0);
+		}
+	}
+	else if (sscanf(line, "AT+CIPSERVERMAXCONN=%u", &length) == 1 && length >= 1 && length <= ESP8266_LINKS)
+	{
+		esp->maxConnections = length;
+		
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+	}
+	else if (sscanf(line, "AT+CIPSERVER=%u", &mode) == 1)
+	{
+		char ip[16];
+		
+		port = 333;																																/*default port of the AT firmware*/
+		
+		sscanf(line, "AT+CIPSERVER=%*u,%u", &port);
+		
+		vSimLanIP(modem->device->index, ip);
+		vSimSocketUnlisten(esp);
+		
+		if (mode == 1)
+		{
+			vSimSocketListen(ip, (uint16_t)port, &esp8266Handler, esp);
+		}
+		
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+	}
+	else if (sscanf(line, "AT+CIPSEND=%i,%u", &id, &length) == 2 && id >= 0 && id < ESP8266_LINKS)
+	{
+		if (esp->links[id] == NULL || length > sizeof(esp->sendBuffer))
+		{
+			vSimModemReply(modem, "link is not valid\r\n\r\nERROR\r\n", 0);
+			
+			return;
+		}
+		
+		esp->sendIP[0] = 0;
+		
+		sscanf(line, "AT+CIPSEND=%*i,%*u,\"%15[^\"]\",%u", esp->sendIP, &port);
+		
+		esp->sendLink     = id;
+		esp->sendLength   = length;
+		esp->sendReceived = 0;
+		esp->sendPort     = (uint16_t)port;
+		
+		vSimModemReply(modem, "\r\nOK\r\n> ", 0);
+	}
+	else if (sscanf(line, "AT+CIPCLOSE=%i", &id) == 1 && id >= 0 && id < ESP8266_LINKS)
+	{
+		if (esp->links[id] == NULL)
+		{
+			vSimModemReply(modem, "UNLINK\r\n\r\nERROR\r\n", 0);
+			
+			return;
+		}
+		
+		vSimSocketClose(esp->links[id]);
+		
+		esp->links[id]        = NULL;
+		esp->established[id]  = false;
+		
+		sprintf(text, "%i,CLOSED\r\n\r\nOK\r\n", id);
+		
+		vSimModemReply(modem, text, 0);
+	}
+	else
+	{
+		vSimModemReply(modem, "\r\nERROR\r\n", 0);
+	}
+}
+
+/**
+* @brief  This function takes the bytes of the device: command lines, or the payload announced by AT+CIPSEND
+*/
+static void vEsp8266Input(simModem_t *modem, const uint8_t data[], uint32_t length)
+{
+	esp8266_t *esp = modem->state;
+	char text[48];
+	
+	for (uint32_t i = 0; i < length; i++)
+	{
+		if (esp->sendLink >= 0)
+		{
+			esp->sendBuffer[esp->sendReceived++] = data[i];
+			
+			if (esp->sendReceived == esp->sendLength)
+			{
+				int32_t id = esp->sendLink;
+				
+				if (esp->sendIP[0] != 0)
+				{
+					vSimSocketSend(esp->links[id], esp->sendIP, esp->sendPort, esp->sendBuffer, esp->sendLength);
+				}
+				else
+				{
+					vSimSocketSend(esp->links[id], esp->remoteIP[id], esp->remotePort[id], esp->sendBuffer, esp->sendLength);
+				}
+				
+				esp->sendLink = -1;
+				
+				sprintf(text, "\r\nRecv %u bytes\r\n\r\nSEND OK\r\n", esp->sendLength);
+				
+				vSimModemReply(modem, text, 0);
+			}
+			
+			continue;
+		}
+		
+		if (esp->lineLength < sizeof(esp->line) - 1)
+		{
+			esp->line[esp->lineLength++] = (char)data[i];
+		}
+		
+		if (data[i] == '\n')
+		{
+			esp->line[esp->lineLength] = 0;
+			
+			if (esp->lineLength >= 2 && esp->line[esp->lineLength - 2] == '\r')
+			{
+				esp->line[esp->lineLength - 2] = 0;
+			}
+			
+			if (esp->line[0] != '\r' && esp->line[0] != '\n' && esp->line[0] != 0)
+			{
+				vEsp8266Command(esp, esp->line);
+			}
+			
+			esp->lineLength = 0;
+		}
+	}
+}
+
+/**
+* @brief  This function restarts the module: links closed, back at the configured speed
+*/
+static void vEsp8266Reset(simModem_t *modem)
+{
+	esp8266_t *esp = modem->state;
+	
+	for (uint32_t id = 0; id < ESP8266_LINKS; id++)
+	{
+		if (esp->links[id] != NULL)
+		{
+			vSimSocketClose(esp->links[id]);
+			
+			esp->links[id] = NULL;
+		}
+		
+		esp->established[id] = false;
+	}
+	
+	vSimSocketUnlisten(esp);
+	
+	esp->lineLength     = 0;
+	esp->sendLink       = -1;
+	esp->maxConnections = ESP8266_LINKS;
+	
+	vSimModemSetBaud(modem, modem->config.baud);
+}
+
+void vEsp8266Attach(simModem_t *modem)
+{
+	esp8266_t *esp = calloc(1, sizeof(esp8266_t));
+	
+	esp->modem          = modem;
+	esp->sendLink       = -1;
+	esp->maxConnections = ESP8266_LINKS;
+	
+	modem->state   = esp;
+	modem->receive = vEsp8266Input;
+	modem->reset   = vEsp8266Reset;
+}
@@ -0,0 +1,139 @@
+/**
+  ************************************************************************************
+  * @file    sim.h
+  * @brief   Device simulator of the host build: every device runs the bootloader build
+  *          as a coroutine on a virtual clock with its data swapped in while it runs,
+  *          its modems are emulated on the UARTs and reach the servers over a network
+  *          model with latency, jitter and loss, or each other over the Wi-Fi LAN
+  *          of their site. In realtime mode the clock follows the wall clock and the
+  *          sockets are loopback sockets to a server process
+  ************************************************************************************
+  */
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/* Includes ------------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include "fw_server.h"
+#include <ucontext.h>
+
+/***************************  Kernel Definitions ************************************/
+#define SIM_STACK_SIZE																			(256 * 1024)																/*bytes of stack per device*/
+#define SIM_QUANTUM_US																			5																						/*CPU time charged for every tick read, so busy waits move on*/
+#define SIM_LOOKAHEAD_US																		1000																				/*a device may run this far ahead of another one before it yields*/
+#define SIM_IDLE_MAX_MS																			1000																				/*longest sleep of an idle device, the transmit queue timeouts are polled*/
+#define SIM_POLL_US																					1000																				/*realtime: sockets are read at least this often while events are late*/
+#define SIM_LAN_LATENCY_US																	2000																				/*one way between two modems of a site, no loss*/
+#define SIM_FOREVER																					UINT64_MAX
+
+/* Typedefs ------------------------------------------------------------------------*/
+typedef uint64_t simTime_t;																											/*us since the simulation started*/
+
+typedef struct simDevice simDevice_t;
+typedef struct simModem  simModem_t;
+typedef struct simSocket simSocket_t;
+
+typedef void (*simHandler_t)(void *payload);
+
+/*Network between a modem and the servers*/
+typedef struct
+{
+	uint32_t latencyUs;																														/*one way*/
+	uint32_t jitterUs;																														/*random extra delay of a datagram, TCP keeps its order*/
+	uint32_t lossPermille;																												/*datagrams lost per thousand, both ways*/
+} simLink_t;
+
+typedef enum
+{
+	SIM_MODEM_ESP8266 = 0,
+	SIM_MODEM_UG95
+} simModemType_t;
+
+typedef struct
+{
+	simModemType_t type;
+	uint32_t       baud;																													/*UART speed the modem starts at*/
+	uint32_t       atDelayUs;																											/*time the modem takes to answer a command*/
+	simLink_t      link;
+} simModemConfig_t;
+
+/*Modem emulator on a UART of a device*/
+struct simModem
+{
+	simDevice_t        *device;
+	UART_HandleTypeDef *huart;
+	simModemConfig_t    config;
+	uint32_t            baud, nextBaud;																						/*nextBaud is taken once the line is free at baudAt*/
+	simTime_t           baudAt, lineFree;																					/*modem to device line is busy until lineFree*/
+	void              (*receive)(simModem_t *modem, const uint8_t data[], uint32_t length);	/*bytes the device sent*/
+	void              (*reset)(simModem_t *modem);																		/*device reset, the application restarts its modems*/
+	void               *state;																										/*of the emulator*/
+	uint64_t            bytesIn, bytesOut, garbled;																/*garbled bytes were sent at another baud than received*/
+};
+
+struct simDevice
+{
+	uint32_t     index;
+	ucontext_t   context;
+	uint8_t     *stack;
+	uint8_t     *segment;																												/*data of the bootloader build while the device is swapped out*/
+	uint8_t      sram[HOST_SRAM_KEPT_SIZE];																				/*SRAM words kept over a soft reset, while swapped out*/
+	uint32_t     uid[3];
+	uint8_t     *flash;
+	simTime_t    clock;																													/*time the device has run up to*/
+	simTime_t    bootTime;																												/*HAL_GetTick counts from here*/
+	uint32_t     resumeGeneration;																								/*a resume of an older generation is stale*/
+	bool         idle, halted, resetPending, powerLoss;
+	simModem_t  *modems[LINK_COUNT];
+	void       (*application)(simDevice_t *device);															/*started by a jump or once the bootloader found no image, vSimBootloaderApplication if NULL*/
+	uint32_t     resets, powerLosses, jumps;
+	simTime_t    jumpTime;																												/*time of the last jump to the application*/
+	void        *user;																													/*of the harness*/
+};
+
+/* Variables -----------------------------------------------------------------------*/
+extern fwServer_t *pxSimServer;																									/*server reached over the network model, NULL for none*/
+
+/* Functions -----------------------------------------------------------------------*/
+void         vSimInit(uint32_t seed);
+simDevice_t *pxSimDeviceCreate(uint32_t index);
+simModem_t  *pxSimModemAttach(simDevice_t *device, const simModemConfig_t *config);
+void         vSimRun(simTime_t until);
+void         vSimRealtime(void);
+void         vSimTimeSync(void);
+simTime_t    xSimNow(void);
+simTime_t    xSimLateness(void);
+simDevice_t *pxSimCurrent(void);
+uint32_t     ulSimRandom(void);
+void        *pvSimAt(simTime_t time, simDevice_t *device, simHandler_t handler, uint32_t size);
+void         vSimLoad(simDevice_t *device);
+void         vSimWake(simDevice_t *device);
+void         vSimIdle(void);
+void         vSimHalt(void);
+void         vSimApplicationStart(simDevice_t *device);
+void         vSimBootloaderApplication(simDevice_t *device);
+void         vSimModemOutput(simModem_t *modem, const void *data, uint32_t length);
+void         vSimModemSetBaud(simModem_t *modem, uint32_t baud);
+void         vSimModemReply(simModem_t *modem, const char text[], uint32_t baud);
+void         vEsp8266Attach(simModem_t *modem);
+void         vUg95Attach(simModem_t *modem);
+
+/* Network Functions ---------------------------------------------------------------*/
+typedef struct
+{
+	void (*connected)(void *context, simSocket_t *socket, bool connected);
+	void (*receive)(void *context, simSocket_t *socket, const char ip[], uint16_t port, const uint8_t data[], uint32_t length);
+	void (*accepted)(void *context, simSocket_t *socket, const char ip[]);											/*a LAN peer connected to a listener, connected tells when it leaves*/
+} simSocketHandler_t;
+
+simSocket_t *pxSimSocketOpen(const simLink_t *link, bool udp, const char host[], uint16_t port, const simSocketHandler_t *handler, void *context);
+void         vSimSocketSend(simSocket_t *socket, const char ip[], uint16_t port, const void *data, uint32_t length);
+void         vSimSocketClose(simSocket_t *socket);
+void         vSimSocketListen(const char ip[], uint16_t port, const simSocketHandler_t *handler, void *context);
+void         vSimSocketUnlisten(void *context);
+void         vSimLanIP(uint32_t index, char ip[16]);
+void         vSimNetLoopback(uint16_t httpPort);
+void         vSimNetPoll(int timeoutMs);
+
+#endif /* __SIM_H__ */
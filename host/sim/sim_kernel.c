@@ -0,0 +1,967 @@
+/**
+  ******************************************************************************
+  * @file    sim_kernel.c
+  * @brief   Kernel of the device simulator: event queue on the virtual clock,
+  *          device coroutines, data swapping and the host port hooks
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "sim.h"
+#include <link.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	simTime_t     time;
+	uint64_t      order;																															/*events of the same time run in the order they were queued*/
+	simDevice_t  *device;																															/*loaded before the handler runs, NULL for the network*/
+	simHandler_t  handler;
+	uint8_t       payload[] __attribute__((aligned(8)));
+} simEvent_t;
+
+/*Bytes on a UART line, handed over once the last one arrived*/
+typedef struct
+{
+	simModem_t         *modem;
+	UART_HandleTypeDef *huart;
+	uint32_t            baud;																														/*speed the sender used*/
+	uint32_t            length;
+	uint8_t             data[];
+} simTransfer_t;
+
+typedef struct
+{
+	simModem_t *modem;
+	uint32_t    baud;																																/*taken after the text, 0 keeps the speed*/
+	char        text[];
+} simReply_t;
+
+/* Variables -----------------------------------------------------------------*/
+fwServer_t *pxSimServer;
+
+/* Private variables ---------------------------------------------------------*/
+static simEvent_t **events;
+static uint32_t eventCount, eventCapacity;
+static uint64_t eventOrder;
+static simTime_t now;
+static ucontext_t scheduler;
+static simDevice_t *current;																												/*device whose coroutine runs, NULL in the scheduler*/
+static simDevice_t *loaded;																													/*device whose data is in the bootloader build*/
+static uint8_t *segment, *pristine;																									/*writable segment of the bootloader build and its content after start up*/
+static size_t segmentSize;
+static uint64_t randomState;
+static bool realtime;																																/*the clock follows CLOCK_MONOTONIC*/
+static struct timespec epoch;
+static simTime_t lateness;																													/*longest an event ran after its time*/
+static simTime_t polled;																														/*last read of the loopback sockets*/
+
+static void vSimResume(void *payload);
+static void vSimDeviceEntry(void);
+
+/**
+* @brief  This function finds the writable segment of the bootloader build, the whole data of one device
+*/
+static int lSimFindSegment(struct dl_phdr_info *info, size_t size, void *data)
+{
+	uintptr_t address = (uintptr_t)&xBootloaderVariables;
+	
+	(void)size;
+	(void)data;
+	
+	for (uint32_t i = 0; i < info->dlpi_phnum; i++)
+	{
+		const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+		uintptr_t start = info->dlpi_addr + header->p_vaddr;
+		
+		if (header->p_type == PT_LOAD && (header->p_flags & PF_W) && address >= start && address < start + header->p_memsz)
+		{
+			segment     = (uint8_t *)start;
+			segmentSize = header->p_memsz;
+			
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+/**
+* @brief  This function gives a random number of the simulation, the same seed gives the same run
+*/
+uint32_t ulSimRandom(void)
+{
+	randomState ^= randomState >> 12;
+	randomState ^= randomState << 25;
+	randomState ^= randomState >> 27;
+	
+	return (uint32_t)((randomState * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+simTime_t xSimNow(void)
+{
+	return now;
+}
+
+/**
+* @brief  This function moves the clock of a realtime simulation to the wall clock
+*/
+void vSimTimeSync(void)
+{
+	struct timespec wall;
+	simTime_t elapsed;
+	
+	if (realtime)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &wall);
+		
+		elapsed = (simTime_t)(wall.tv_sec - epoch.tv_sec) * 1000000 + (simTime_t)((wall.tv_nsec - epoch.tv_nsec) / 1000);
+		
+		if (elapsed > now)
+		{
+			now = elapsed;
+		}
+	}
+}
+
+/**
+* @brief  This function runs the simulation on the wall clock from now on, the sockets of vSimNetLoopback are polled
+*					while no event is due
+*/
+void vSimRealtime(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &epoch);
+	
+	epoch.tv_sec -= (time_t)(now / 1000000);
+	
+	realtime = true;
+}
+
+/**
+* @brief  This function gives the longest delay of an event behind its time, a realtime simulation not keeping up lags
+*/
+simTime_t xSimLateness(void)
+{
+	return lateness;
+}
+
+simDevice_t *pxSimCurrent(void)
+{
+	return (current != NULL) ? current : loaded;
+}
+
+/**
+* @brief  This function gives the time a device sees, its own clock while it runs, at least the event time in an interrupt
+*/
+static simTime_t xSimDeviceTime(simDevice_t *device)
+{
+	return (device == current || device->clock > now) ? device->clock : now;
+}
+
+static bool bSimEventBefore(const simEvent_t *a, const simEvent_t *b)
+{
+	return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+/**
+* @brief  This function queues an event
+* @params simTime_t time				-> time it runs at, not before the current time
+*					simDevice_t *device		-> device loaded for the handler, NULL for none
+*					simHandler_t handler	-> called with the payload, which is released after it
+*					uint32_t size					-> bytes of the payload
+* @retval zeroed payload to be filled by the caller
+*/
+void *pvSimAt(simTime_t time, simDevice_t *device, simHandler_t handler, uint32_t size)
+{
+	simEvent_t *event = calloc(1, sizeof(simEvent_t) + size);
+	uint32_t i;
+	
+	if (event == NULL)
+	{
+		abort();
+	}
+	
+	if (eventCount == eventCapacity)
+	{
+		eventCapacity = (eventCapacity == 0) ? 1024 : eventCapacity * 2;
+		events        = realloc(events, eventCapacity * sizeof(simEvent_t *));
+		
+		if (events == NULL)
+		{
+			abort();
+		}
+	}
+	
+	event->time    = (time < now) ? now : time;
+	event->order   = eventOrder++;
+	event->device  = device;
+	event->handler = handler;
+	
+	for (i = eventCount++; i > 0 && bSimEventBefore(event, events[(i - 1) / 2]); i = (i - 1) / 2)
+	{
+		events[i] = events[(i - 1) / 2];
+	}
+	
+	events[i] = event;
+	
+	return event->payload;
+}
+
+static simEvent_t *pxSimEventPop(void)
+{
+	simEvent_t *first = events[0], *last = events[--eventCount];
+	uint32_t i = 0, child;
+	
+	while ((child = 2 * i + 1) < eventCount)
+	{
+		if (child + 1 < eventCount && bSimEventBefore(events[child + 1], events[child]))
+		{
+			child++;
+		}
+		
+		if (!bSimEventBefore(events[child], last))
+		{
+			break;
+		}
+		
+		events[i] = events[child];
+		i = child;
+	}
+	
+	if (eventCount > 0)
+	{
+		events[i] = last;
+	}
+	
+	return first;
+}
+
+/**
+* @brief  This function swaps the data of a device into the bootloader build
+*/
+void vSimLoad(simDevice_t *device)
+{
+	if (device == loaded || device == NULL)
+	{
+		return;
+	}
+	
+	if (loaded != NULL)
+	{
+		memcpy(loaded->segment, segment, segmentSize);
+		memcpy(loaded->sram, (void *)(uintptr_t)HOST_SRAM_KEPT_ADDRESS, HOST_SRAM_KEPT_SIZE);
+	}
+	
+	memcpy(segment, device->segment, segmentSize);
+	memcpy((void *)(uintptr_t)HOST_SRAM_KEPT_ADDRESS, device->sram, HOST_SRAM_KEPT_SIZE);
+	
+	loaded = device;
+}
+
+/**
+* @brief  This function lets the scheduler run the device again at a time
+*/
+static void vSimScheduleResume(simDevice_t *device, simTime_t time)
+{
+	uint32_t *generation = pvSimAt(time, device, vSimResume, sizeof(uint32_t));
+	
+	*generation = ++device->resumeGeneration;
+}
+
+/**
+* @brief  This function gives the CPU of the running device back to the scheduler until a time
+*/
+static void vSimSleep(simTime_t time)
+{
+	simDevice_t *device = current;
+	
+	vSimScheduleResume(device, time);
+	
+	swapcontext(&device->context, &scheduler);
+}
+
+/**
+* @brief  This function yields the running device once an event of another party is due, so no one runs too far ahead
+* @note   Never with the interrupts disabled, the code between __disable_irq and __enable_irq runs at once
+*/
+static void vSimPreempt(simDevice_t *device)
+{
+	simTime_t horizon;
+	
+	if (xHostDevice.primask != 0 || eventCount == 0)
+	{
+		return;
+	}
+	
+	horizon = events[0]->time;
+	
+	if (events[0]->handler == vSimResume && events[0]->device != device)
+	{
+		horizon += SIM_LOOKAHEAD_US;
+	}
+	
+	if (device->clock >= horizon)
+	{
+		vSimSleep(device->clock);
+	}
+}
+
+/**
+* @brief  This function is HAL_GetTick, every read costs SIM_QUANTUM_US of the running device
+*/
+static uint32_t ulSimTick(void)
+{
+	simDevice_t *device = current;
+	
+	if (device == NULL)
+	{
+		return (uint32_t)((xSimDeviceTime(loaded) - loaded->bootTime) / 1000);
+	}
+	
+	device->clock += SIM_QUANTUM_US;
+	
+	vSimPreempt(device);
+	
+	return (uint32_t)((device->clock - device->bootTime) / 1000);
+}
+
+static uint32_t ulSimTimestamp(void)
+{
+	simDevice_t *device = pxSimCurrent();
+	
+	return (uint32_t)(xSimDeviceTime(device) * HOST_TIMESTAMP_PER_US);
+}
+
+static void vSimDelay(uint32_t ms)
+{
+	if (current != NULL)
+	{
+		current->clock += (simTime_t)ms * 1000;
+		
+		vSimSleep(current->clock);
+	}
+}
+
+static void vSimBusy(uint32_t us)
+{
+	if (current != NULL)
+	{
+		current->clock += us;
+		
+		vSimPreempt(current);
+	}
+}
+
+/**
+* @brief  This function gives the speed of a modem at a time, taking a pending switch once it is due
+*/
+static uint32_t ulSimModemBaud(simModem_t *modem, simTime_t time)
+{
+	if (modem->baudAt != 0 && time >= modem->baudAt)
+	{
+		modem->baud   = modem->nextBaud;
+		modem->baudAt = 0;
+	}
+	
+	return modem->baud;
+}
+
+/**
+* @brief  This function ends a device to modem transfer, the modem gets the bytes only if both sides used the same speed
+*/
+static void vSimTransmitDone(void *payload)
+{
+	simTransfer_t *transfer = payload;
+	simModem_t *modem = transfer->modem;
+	
+	if (modem != NULL)
+	{
+		if (ulSimModemBaud(modem, now) == transfer->baud)
+		{
+			modem->bytesIn += transfer->length;
+			
+			modem->receive(modem, transfer->data, transfer->length);
+		}
+		else
+		{
+			modem->garbled += transfer->length;
+		}
+	}
+	
+	vHostUartTxComplete(transfer->huart);
+	
+	vSimWake(loaded);
+}
+
+static void vSimTransmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t length)
+{
+	simDevice_t *device = pxSimCurrent();
+	simTransfer_t *transfer = pvSimAt(xSimDeviceTime(device) + (simTime_t)length * 10000000 / huart->Init.BaudRate, device, vSimTransmitDone, sizeof(simTransfer_t) + length);
+	
+	for (uint32_t i = 0; i < LINK_COUNT; i++)
+	{
+		if (device->modems[i] != NULL && device->modems[i]->huart == huart)
+		{
+			transfer->modem = device->modems[i];
+		}
+	}
+	
+	transfer->huart  = huart;
+	transfer->baud   = huart->Init.BaudRate;
+	transfer->length = length;
+	
+	memcpy(transfer->data, data, length);
+}
+
+/**
+* @brief  This function is NVIC_SystemReset and the power cut, the scheduler boots the device again
+*/
+static void vSimReset(bool powerLoss)
+{
+	simDevice_t *device = current;
+	
+	if (device == NULL)
+	{
+		abort();
+	}
+	
+	device->resetPending = true;
+	device->powerLoss    = powerLoss;
+	
+	swapcontext(&device->context, &scheduler);
+	
+	abort();
+}
+
+/**
+* @brief  This function fills the bootloader build with its data after start up, as the C runtime of a new start does
+* @param  bool keepNoinit -> true keeps the variables of BOOTLOADER_NOINIT and the SRAM words, false leaves them random
+*/
+static void vSimStartData(simDevice_t *device, bool keepNoinit)
+{
+	traceLog_t trace = xTraceLog;
+	linkQualityLog_t quality = xLinkQuality;
+	
+	memcpy(segment, pristine, segmentSize);
+	
+	xHostDevice.flash = device->flash;
+	
+	memcpy(xHostDevice.uid, device->uid, sizeof(device->uid));
+	
+	if (keepNoinit)
+	{
+		xTraceLog    = trace;
+		xLinkQuality = quality;
+	}
+	else
+	{
+		uint8_t *sram = (void *)(uintptr_t)HOST_SRAM_KEPT_ADDRESS;
+		
+		for (uint32_t i = 0; i < HOST_SRAM_KEPT_SIZE; i++)
+		{
+			sram[i] = (uint8_t)ulSimRandom();
+		}
+		
+		for (uint32_t i = 0; i < sizeof(xTraceLog); i += 4)
+		{
+			((uint8_t *)&xTraceLog)[i] = (uint8_t)ulSimRandom();
+		}
+		
+		for (uint32_t i = 0; i < sizeof(xLinkQuality); i += 4)
+		{
+			((uint8_t *)&xLinkQuality)[i] = (uint8_t)ulSimRandom();
+		}
+	}
+}
+
+/**
+* @brief  This function starts the coroutine of a device at vSimDeviceEntry
+*/
+static void vSimBoot(simDevice_t *device)
+{
+	getcontext(&device->context);
+	
+	device->context.uc_stack.ss_sp   = device->stack;
+	device->context.uc_stack.ss_size = SIM_STACK_SIZE;
+	device->context.uc_link          = &scheduler;
+	
+	makecontext(&device->context, vSimDeviceEntry, 0);
+	
+	device->bootTime = device->clock;
+	
+	vSimScheduleResume(device, device->clock);
+}
+
+/**
+* @brief  This function boots a device again after its reset, the modems are restarted by the application of the new start
+*/
+static void vSimRestart(simDevice_t *device)
+{
+	device->resetPending = false;
+	
+	if (device->powerLoss)
+	{
+		device->powerLosses++;
+	}
+	else
+	{
+		device->resets++;
+	}
+	
+	vSimStartData(device, !device->powerLoss);
+	
+	for (uint32_t i = 0; i < LINK_COUNT; i++)
+	{
+		if (device->modems[i] != NULL && device->modems[i]->reset != NULL)
+		{
+			device->modems[i]->reset(device->modems[i]);
+		}
+	}
+	
+	vSimBoot(device);
+}
+
+/**
+* @brief  This function is the jump to the application, it runs on the stack of the bootloader as the stack pointer of the
+*					image is not used on the host
+*/
+static void vSimJump(uint32_t stack)
+{
+	simDevice_t *device = current;
+	
+	(void)stack;
+	
+	device->jumps++;
+	device->jumpTime = device->clock;
+	
+	vSimStartData(device, true);
+	
+	if (device->application != NULL)
+	{
+		device->application(device);
+	}
+	else
+	{
+		vSimBootloaderApplication(device);
+	}
+	
+	vSimHalt();
+}
+
+/**
+* @brief  This function is the reset handler of a device: the bootloader, then the application if it didn't jump
+*/
+static void vSimDeviceEntry(void)
+{
+	simDevice_t *device = current;
+	
+	vBootloader();
+	
+	if (device->application != NULL)
+	{
+		device->application(device);
+	}
+	else
+	{
+		vSimBootloaderApplication(device);
+	}
+	
+	vSimHalt();
+}
+
+/**
+* @brief  This function switches to the coroutine of a device until it gives the CPU back
+*/
+static void vSimResume(void *payload)
+{
+	simDevice_t *device = loaded;
+	
+	if (device->halted || *(uint32_t *)payload != device->resumeGeneration)
+	{
+		return;
+	}
+	
+	if (device->clock < now)
+	{
+		device->clock = now;
+	}
+	
+	device->idle = false;
+	current      = device;
+	
+	swapcontext(&scheduler, &device->context);
+	
+	current = NULL;
+	
+	if (device->resetPending)
+	{
+		vSimRestart(device);
+	}
+}
+
+/**
+* @brief  This function starts the simulation at time 0, devices of an earlier simulation are dropped
+* @param  uint32_t seed -> seed of ulSimRandom
+* @note   The data of the bootloader build at the first call is what every device starts with
+*/
+void vSimInit(uint32_t seed)
+{
+	vHostFlashDestroy(pucHostFlashCreate());																		/*creates the erased flash all devices map*/
+	
+	if (segment == NULL && dl_iterate_phdr(lSimFindSegment, NULL) == 0)
+	{
+		abort();
+	}
+	
+	randomState = ((uint64_t)seed << 32) | 0x9E3779B9U;
+	
+	xHostPort.tick      = ulSimTick;
+	xHostPort.delay     = vSimDelay;
+	xHostPort.timestamp = ulSimTimestamp;
+	xHostPort.transmit  = vSimTransmit;
+	xHostPort.reset     = vSimReset;
+	xHostPort.jump      = vSimJump;
+	xHostPort.busy      = vSimBusy;
+	
+	if (pristine == NULL)																													/*the first start takes the data the harness set up*/
+	{
+		pristine = malloc(segmentSize);
+		
+		memcpy(pristine, segment, segmentSize);
+	}
+	else
+	{
+		memcpy(segment, pristine, segmentSize);
+	}
+	
+	while (eventCount > 0)
+	{
+		free(pxSimEventPop());
+	}
+	
+	vSimSocketUnlisten(NULL);
+	
+	now      = 0;
+	loaded   = NULL;
+	realtime = false;
+	lateness = 0;
+	polled   = 0;
+}
+
+/**
+* @brief  This function creates a device with an erased flash, powered on at the current time
+* @param  uint32_t index -> number of the device, gives its UID
+*/
+simDevice_t *pxSimDeviceCreate(uint32_t index)
+{
+	simDevice_t *device = calloc(1, sizeof(simDevice_t));
+	
+	device->index   = index;
+	device->uid[0]  = 0x00470031U + index / 4096;																						/*wafer coordinates, lot and wafer number of an STM32 UID*/
+	device->uid[1]  = 0x3436510BU;
+	device->uid[2]  = 0x30383935U + index % 4096 * 0x00010003U;
+	device->flash   = pucHostFlashCreate();
+	device->segment = malloc(segmentSize);
+	device->stack   = mmap(NULL, SIM_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	device->clock   = now;
+	
+	if (device->segment == NULL || device->stack == MAP_FAILED)
+	{
+		abort();
+	}
+	
+	memcpy(device->segment, pristine, segmentSize);
+	
+	vSimLoad(device);
+	
+	vSimStartData(device, false);																															/*power on*/
+	
+	vSimBoot(device);
+	
+	return device;
+}
+
+/**
+* @brief  This function attaches a modem emulator to the UART of a link
+*/
+simModem_t *pxSimModemAttach(simDevice_t *device, const simModemConfig_t *config)
+{
+	simModem_t *modem = calloc(1, sizeof(simModem_t));
+	
+	modem->device = device;
+	modem->config = *config;
+	modem->baud   = config->baud;
+	
+	if (config->type == SIM_MODEM_ESP8266)
+	{
+		modem->huart = &WIFI_UART;
+		device->modems[LINK_WIFI] = modem;
+		
+		vEsp8266Attach(modem);
+	}
+	else
+	{
+		modem->huart = &GSM_UART;
+		device->modems[LINK_GSM] = modem;
+		
+		vUg95Attach(modem);
+	}
+	
+	return modem;
+}
+
+/**
+* @brief  This function runs the events up to a time
+* @param  simTime_t until -> last time to run, SIM_FOREVER runs until nothing is left to do
+*/
+void vSimRun(simTime_t until)
+{
+	for (;;)
+	{
+		simEvent_t *event;
+		
+		if (realtime)
+		{
+			vSimTimeSync();
+			
+			if (now >= until)
+			{
+				break;
+			}
+			
+			if (eventCount == 0 || events[0]->time > now)
+			{
+				simTime_t next = (eventCount > 0 && events[0]->time < until) ? events[0]->time : until;
+				
+				polled = now;
+				
+				vSimNetPoll((int)((next - now + 999) / 1000));
+				
+				continue;
+			}
+			
+			if (now - polled >= SIM_POLL_US)/*behind the wall clock, the sockets are not starved*/
+			{
+				polled = now;
+				
+				vSimNetPoll(0);
+			}
+		}
+		else if (eventCount == 0 || events[0]->time > until)
+		{
+			break;
+		}
+		
+		event = pxSimEventPop();
+		
+		if (realtime && now - event->time > lateness)
+		{
+			lateness = now - event->time;
+		}
+		
+		now = (event->time > now) ? event->time : now;
+		
+		vSimLoad(event->device);
+		
+		event->handler(event->payload);
+		
+		free(event);
+	}
+	
+	if (until != SIM_FOREVER && now < until)
+	{
+		now = until;
+	}
+}
+
+/**
+* @brief  This function runs an idle device again at once, call it once an interrupt gave it something to do
+*/
+void vSimWake(simDevice_t *device)
+{
+	if (device != NULL && device->idle && !device->halted)
+	{
+		device->idle = false;
+		
+		vSimScheduleResume(device, xSimDeviceTime(device));
+	}
+}
+
+/**
+* @brief  This function sleeps until the next bootloader timer expires or vSimWake, at most SIM_IDLE_MAX_MS
+* @note   Expired timers still armed, as the startup check before its link is up, don't shorten the sleep
+*/
+void vSimIdle(void)
+{
+	simDevice_t *device = current;
+	uint32_t tick = (uint32_t)((device->clock - device->bootTime) / 1000), sleep = SIM_IDLE_MAX_MS;
+	
+	for (uint32_t i = 0; i < BOOTLOADER_TIMER_COUNT; i++)
+	{
+		bootloaderTimer_t *timer = &xBootloaderVariables.timers[i];
+		uint32_t elapsed = tick - timer->start;
+		
+		if (timer->armed && elapsed < timer->duration && timer->duration - elapsed < sleep)
+		{
+			sleep = timer->duration - elapsed;
+		}
+	}
+	
+	device->idle = true;
+	
+	vSimSleep(device->clock + (simTime_t)sleep * 1000);
+}
+
+/**
+* @brief  This function stops the running device for good
+*/
+void vSimHalt(void)
+{
+	current->halted = true;
+	
+	swapcontext(&current->context, &scheduler);
+	
+	abort();
+}
+
+/**
+* @brief  This function gives the address of a device on the Wi-Fi LAN of its site, a TCP socket opened to it reaches
+*					the modem of that device if it listens
+*/
+void vSimLanIP(uint32_t index, char ip[16])
+{
+	snprintf(ip, 16, "192.168.%u.%u", 1 + (index / 200) % 254, 10 + index % 200);
+}
+
+/**
+* @brief  This function starts the application of the bootloader build: its links come up and a check is requested
+*					on each of them
+*/
+void vSimApplicationStart(simDevice_t *device)
+{
+	vBootloadervariablesInit();
+	
+	vHostApplicationInit();
+	
+	if (device->modems[LINK_WIFI] != NULL)
+	{
+		vSimLanIP(device->index, WIFI_EXTERNAL_IP);
+		
+		WIFI_STATE = WIFI_STEADY_STATE;
+		
+		xBootloaderVariables.triggerUpdateAtStartWifi = true;
+	}
+	
+	if (device->modems[LINK_GSM] != NULL)
+	{
+		strcpy(GSM_EXTERNAL_IP, "10.64.12.7");
+		
+		GSM_MODULE_STATE = GSM_STEADY_STATE;
+		
+		xBootloaderVariables.triggerUpdateAtStartGSM = true;
+	}
+}
+
+/**
+* @brief  This function is the application of the bootloader build, it runs the update task whenever there is something to do
+*/
+void vSimBootloaderApplication(simDevice_t *device)
+{
+	vSimApplicationStart(device);
+	
+	for (;;)
+	{
+		vBootloaderUpdateTask();
+		
+		vSimIdle();
+	}
+}
+
+/**
+* @brief  This function hands the bytes of a modem to the device once they crossed the line
+*/
+static void vSimModemDeliver(void *payload)
+{
+	simTransfer_t *transfer = payload;
+	
+	if (transfer->huart->Init.BaudRate == transfer->baud)
+	{
+		vHostUartReceive(transfer->huart, transfer->data, transfer->length);
+	}
+	else
+	{
+		transfer->modem->garbled += transfer->length;
+	}
+	
+	vSimWake(loaded);
+}
+
+/**
+* @brief  This function sends bytes of a modem to its device, after the bytes sent before
+* @note   The bytes are handed over together once the last one arrived, as one interrupt burst
+*/
+void vSimModemOutput(simModem_t *modem, const void *data, uint32_t length)
+{
+	simTime_t start = (modem->lineFree > now) ? modem->lineFree : now;
+	simTransfer_t *transfer;
+	
+	modem->lineFree = start + (simTime_t)length * 10000000 / ulSimModemBaud(modem, start);
+	modem->bytesOut += length;
+	
+	transfer = pvSimAt(modem->lineFree, modem->device, vSimModemDeliver, sizeof(simTransfer_t) + length);
+	
+	transfer->modem  = modem;
+	transfer->huart  = modem->huart;
+	transfer->baud   = modem->baud;
+	transfer->length = length;
+	
+	memcpy(transfer->data, data, length);
+}
+
+/**
+* @brief  This function switches the speed of a modem once the bytes it already sent are out
+*/
+void vSimModemSetBaud(simModem_t *modem, uint32_t baud)
+{
+	if (modem->lineFree <= now)
+	{
+		modem->baud   = baud;
+		modem->baudAt = 0;
+	}
+	else
+	{
+		modem->nextBaud = baud;
+		modem->baudAt   = modem->lineFree;
+	}
+}
+
+static void vSimModemReplyOut(void *payload)
+{
+	simReply_t *reply = payload;
+	
+	vSimModemOutput(reply->modem, reply->text, strlen(reply->text));
+	
+	if (reply->baud != 0)
+	{
+		vSimModemSetBaud(reply->modem, reply->baud);
+	}
+}
+
+/**
+* @brief  This function answers a command after the AT delay of the modem
+* @params simModem_t *modem	-> modem answering
+*					const char text[]	-> answer
+*					uint32_t baud			-> speed taken after the answer, 0 keeps the speed
+*/
+void vSimModemReply(simModem_t *modem, const char text[], uint32_t baud)
+{
+	simReply_t *reply = pvSimAt(now + modem->config.atDelayUs, NULL, vSimModemReplyOut, sizeof(simReply_t) + strlen(text) + 1);
+	
+	reply->modem = modem;
+	reply->baud  = baud;
+	
+	strcpy(reply->text, text);
+}
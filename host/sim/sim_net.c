@@ -0,0 +1,618 @@
+/**
+  ******************************************************************************
+  * @file    sim_net.c
+  * @brief   Network model of the device simulator: the sockets of the modem
+  *          emulators reach pxSimServer after the latency of their link, TCP in
+  *          order, UDP with jitter and loss. A TCP socket opened to the LAN
+  *          address of a listening modem is paired with a socket of that modem.
+  *          A UDP socket opened to a multicast address joins that group and
+  *          gets what the server sends to it.
+  *          After vSimNetLoopback they are real loopback sockets polled with
+  *          epoll instead.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define SIM_NET_EVENTS																			256
+#define SIM_NET_LISTENERS																		64
+
+/* Typedefs ------------------------------------------------------------------*/
+struct simSocket
+{
+	simLink_t                 link;
+	bool                      udp, open;
+	char                      host[64];																									/*remote of the socket, the server side for a datagram without an address*/
+	uint16_t                  port;
+	const simSocketHandler_t *handler;
+	void                     *context;
+	simTime_t                 upFree, downFree;																				/*TCP segments arrive in order*/
+	uint32_t                  pending;																									/*events referring to the socket, freed once closed and none is left*/
+	char                      request[1024];																						/*HTTP request received so far*/
+	uint32_t                  requestLength;
+	fwTftpSession_t           tftp;																											/*TFTP read of the socket*/
+	uint16_t                  tid;																											/*server port of the TFTP read*/
+	uint32_t                  resendGeneration;
+	int                       fd;																												/*loopback socket, -1 on the network model*/
+	bool                      connecting;
+	bool                      lan;																											/*to or from a listening modem of the site*/
+	simSocket_t              *peer;																										/*other end of a LAN connection, NULL once either end closed*/
+	bool                      member;																										/*joined the multicast group of its host*/
+	simSocket_t              *nextMember;
+};
+
+typedef struct
+{
+	char                      ip[16];
+	uint16_t                  port;
+	const simSocketHandler_t *handler;
+	void                     *context;
+} simListener_t;
+
+typedef struct
+{
+	simSocket_t *socket;
+	char         ip[16];
+	uint16_t     port;
+	uint32_t     length;
+	uint8_t      data[];
+} simPacket_t;
+
+/* Private variables ---------------------------------------------------------*/
+static uint16_t nextTid = 49152;
+static int epollFd = -1;
+static uint16_t loopbackHttpPort;
+static simListener_t listeners[SIM_NET_LISTENERS];
+static uint32_t listenerCount;
+static simSocket_t *members;																														/*sockets of every multicast group*/
+static const simLink_t lanLink = {SIM_LAN_LATENCY_US, 0, 0};
+
+/**
+* @brief  This function frees a socket closed by its modem, its loopback socket closes once nothing is in flight
+*/
+static void vSimSocketFree(simSocket_t *socket)
+{
+	if (socket->fd >= 0)
+	{
+		close(socket->fd);
+	}
+	
+	free(socket);
+}
+
+static void vSimSocketRelease(simSocket_t *socket)
+{
+	if (--socket->pending == 0 && !socket->open)
+	{
+		vSimSocketFree(socket);
+	}
+}
+
+static simPacket_t *pxSimPacket(simSocket_t *socket, simTime_t time, simHandler_t handler, const char ip[], uint16_t port, const void *data, uint32_t length)
+{
+	simPacket_t *packet = pvSimAt(time, NULL, handler, sizeof(simPacket_t) + length);
+	
+	socket->pending++;
+	
+	packet->socket = socket;
+	packet->port   = port;
+	packet->length = length;
+	
+	snprintf(packet->ip, sizeof(packet->ip), "%.15s", ip);
+	memcpy(packet->data, data, length);
+	
+	return packet;
+}
+
+/**
+* @brief  This function gives the arrival time of a packet sent now in one direction of a socket
+* @retval 0 if the datagram is lost
+*/
+static simTime_t xSimArrival(simSocket_t *socket, simTime_t *lineFree)
+{
+	simTime_t arrival = xSimNow() + socket->link.latencyUs;
+	
+	if (socket->udp)
+	{
+		if (ulSimRandom() % 1000 < socket->link.lossPermille)
+		{
+			return 0;
+		}
+		
+		return arrival + ((socket->link.jitterUs != 0) ? ulSimRandom() % socket->link.jitterUs : 0);
+	}
+	
+	if (arrival < *lineFree)
+	{
+		arrival = *lineFree;
+	}
+	
+	*lineFree = arrival;
+	
+	return arrival;
+}
+
+static void vSimClientReceive(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket;
+	
+	if (socket->open)
+	{
+		socket->handler->receive(socket->context, socket, packet->ip, packet->port, packet->data, packet->length);
+	}
+	
+	vSimSocketRelease(socket);
+}
+
+/**
+* @brief  This function sends an answer of the server down to the client of a socket
+*/
+static void vSimServerSend(simSocket_t *socket, const char ip[], uint16_t port, const void *data, uint32_t length)
+{
+	simTime_t arrival = xSimArrival(socket, &socket->downFree);
+	
+	if (arrival != 0)
+	{
+		pxSimPacket(socket, arrival, vSimClientReceive, ip, port, data, length);
+	}
+}
+
+static void vSimServerResend(void *payload);
+
+/**
+* @brief  This function sends a TFTP answer of the server to the client of a socket, to the client it names or to every
+*					member of the multicast group, then waits for its acknowledge
+*/
+static void vSimServerTftpSend(simSocket_t *socket, fwTftpPacket_t *answer)
+{
+	static uint8_t reply[FW_SERVER_TFTP_PACKET_SIZE + 2048];
+	uint32_t length = ulFwServerTftpCopy(pxSimServer, answer, reply);
+	
+	if (answer->to != NULL)
+	{
+		socket = (simSocket_t *)((uint8_t *)answer->to - offsetof(simSocket_t, tftp));/*the session of another socket*/
+	}
+	
+	if (answer->group)
+	{
+		for (simSocket_t *member = members; member != NULL; member = member->nextMember)
+		{
+			if (member->port == pxSimServer->multicastPort && strcmp(member->host, pxSimServer->multicastIP) == 0)
+			{
+				vSimServerSend(member, pxSimServer->tftpIP, socket->tid, reply, length);
+			}
+		}
+	}
+	else
+	{
+		vSimServerSend(socket, pxSimServer->tftpIP, socket->tid, reply, length);
+	}
+	
+	pxSimPacket(socket, xSimNow() + (simTime_t)pxSimServer->tftpTimeout * 1000, vSimServerResend, "", (uint16_t)++socket->resendGeneration, NULL, 0);
+}
+
+static void vSimServerResend(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket;
+	fwTftpPacket_t answer;
+	
+	if (socket->open && packet->port == (uint16_t)socket->resendGeneration && bFwServerTftpRetry(pxSimServer, &socket->tftp, &answer))
+	{
+		vSimServerTftpSend(socket, &answer);
+	}
+	
+	vSimSocketRelease(socket);
+}
+
+/**
+* @brief  This function is the server receiving a packet of a client: HTTP over TCP, TFTP over UDP
+*/
+static void vSimServerReceive(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket;
+	static uint8_t response[FW_SERVER_TFTP_PACKET_SIZE + 2048];
+	fwTftpPacket_t answer;
+	uint32_t length = 0;
+	
+	if (pxSimServer != NULL && !socket->udp)
+	{
+		length = (packet->length < sizeof(socket->request) - socket->requestLength) ? packet->length : sizeof(socket->request) - socket->requestLength;
+		
+		memcpy(&socket->request[socket->requestLength], packet->data, length);
+		
+		socket->requestLength += length;
+		
+		if ((length = ulFwServerHttp(pxSimServer, socket->request, socket->requestLength, (char *)response, sizeof(response))) != 0)
+		{
+			socket->requestLength = 0;
+			
+			vSimServerSend(socket, pxSimServer->tftpIP, FW_SERVER_HTTP_PORT, response, length);
+		}
+	}
+	else if (pxSimServer != NULL && strcmp(packet->ip, pxSimServer->tftpIP) == 0)
+	{
+		if (packet->port == FW_SERVER_TFTP_PORT)
+		{
+			memset(&socket->tftp, 0, sizeof(socket->tftp));
+			
+			socket->tid = nextTid;
+			nextTid     = (nextTid == 65535) ? 49152 : nextTid + 1;
+		}
+		
+		if ((packet->port == FW_SERVER_TFTP_PORT || (packet->port == socket->tid && socket->tid != 0)) && bFwServerTftpAnswer(pxSimServer, &socket->tftp, packet->data, packet->length, &answer))
+		{
+			vSimServerTftpSend(socket, &answer);
+		}
+	}
+	
+	vSimSocketRelease(socket);
+}
+
+static void vSimSocketConnected(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket;
+	
+	if (socket->open)
+	{
+		socket->handler->connected(socket->context, socket, socket->lan ? socket->peer != NULL : (epollFd >= 0) ? packet->port != 0 : pxSimServer != NULL && socket->port == FW_SERVER_HTTP_PORT);
+	}
+	
+	vSimSocketRelease(socket);
+}
+
+/**
+* @brief  This function is the connection request of a LAN socket reaching the modem it was opened to, the modem gets
+*					the other end of the connection if it listens on that port
+*/
+static void vSimLanAccept(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket, *accepted;
+	
+	for (uint32_t i = 0; i < listenerCount && socket->open; i++)
+	{
+		if (strcmp(listeners[i].ip, socket->host) == 0 && listeners[i].port == socket->port)
+		{
+			accepted = calloc(1, sizeof(simSocket_t));
+			
+			accepted->link    = lanLink;
+			accepted->open    = true;
+			accepted->lan     = true;
+			accepted->port    = socket->port;
+			accepted->handler = listeners[i].handler;
+			accepted->context = listeners[i].context;
+			accepted->fd      = -1;
+			accepted->peer    = socket;
+			socket->peer      = accepted;
+			
+			snprintf(accepted->host, sizeof(accepted->host), "%s", packet->ip);
+			
+			accepted->handler->accepted(accepted->context, accepted, packet->ip);
+			
+			break;
+		}
+	}
+	
+	pxSimPacket(socket, xSimNow() + SIM_LAN_LATENCY_US, vSimSocketConnected, "", 0, NULL, 0);
+	
+	vSimSocketRelease(socket);
+}
+
+static int lSimLoopbackSocket(bool udp)
+{
+	return socket(AF_INET, (udp ? SOCK_DGRAM : SOCK_STREAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+}
+
+/**
+* @brief  This function opens the loopback socket of a modem socket, a TCP connection ends in vSimSocketConnected
+*/
+static void vSimLoopbackOpen(simSocket_t *socket)
+{
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons((socket->port == FW_SERVER_HTTP_PORT) ? loopbackHttpPort : socket->port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = socket};
+	
+	socket->fd = lSimLoopbackSocket(socket->udp);
+	
+	if (!socket->udp)
+	{
+		socket->connecting = true;
+		event.events      |= EPOLLOUT;
+		
+		connect(socket->fd, (struct sockaddr *)&address, sizeof(address));
+	}
+	
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, socket->fd, &event);
+}
+
+/**
+* @brief  This function sends a packet on the loopback socket once it crossed the link
+*/
+static void vSimLoopbackSend(void *payload)
+{
+	simPacket_t *packet = payload;
+	simSocket_t *socket = packet->socket;
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(packet->port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	
+	if (socket->fd >= 0)/*on the wire before the modem closed the socket*/
+	{
+		if (socket->udp)
+		{
+			sendto(socket->fd, packet->data, packet->length, 0, (struct sockaddr *)&address, sizeof(address));
+		}
+		else
+		{
+			send(socket->fd, packet->data, packet->length, MSG_NOSIGNAL);
+		}
+	}
+	
+	vSimSocketRelease(socket);
+}
+
+/**
+* @brief  This function opens a socket of a modem
+* @params const simLink_t *link						-> network between the modem and the server
+*					bool udp											-> true for a datagram socket, connected at once
+*					const char host[]							-> remote, quotes are dropped, an address of vSimLanIP is a modem of the site
+*					uint16_t port									-> remote port
+*					const simSocketHandler_t *handler	-> connected is called once a TCP handshake ended, receive for every packet
+*					void *context									-> given to the handler
+*/
+simSocket_t *pxSimSocketOpen(const simLink_t *link, bool udp, const char host[], uint16_t port, const simSocketHandler_t *handler, void *context)
+{
+	simSocket_t *socket = calloc(1, sizeof(simSocket_t));
+	uint32_t j = 0;
+	
+	socket->link    = *link;
+	socket->udp     = udp;
+	socket->open    = true;
+	socket->port    = port;
+	socket->handler = handler;
+	socket->context = context;
+	socket->fd      = -1;
+	
+	for (uint32_t i = 0; host[i] != 0 && j < sizeof(socket->host) - 1; i++)
+	{
+		if (host[i] != '"')
+		{
+			socket->host[j++] = host[i];
+		}
+	}
+	
+	if (epollFd >= 0)
+	{
+		vSimLoopbackOpen(socket);
+	}
+	else if (!udp && strncmp(socket->host, "192.168.", 8) == 0)
+	{
+		char ip[16];
+		
+		vSimLanIP(pxSimCurrent()->index, ip);
+		
+		socket->link = lanLink;
+		socket->lan  = true;
+		
+		pxSimPacket(socket, xSimNow() + SIM_LAN_LATENCY_US, vSimLanAccept, ip, 0, NULL, 0);
+	}
+	else if (!udp)
+	{
+		pxSimPacket(socket, xSimNow() + 2 * (simTime_t)link->latencyUs, vSimSocketConnected, "", 0, NULL, 0);
+	}
+	else if (atoi(socket->host) >= 224 && atoi(socket->host) <= 239)/*224.0.0.0/4*/
+	{
+		socket->member     = true;
+		socket->nextMember = members;
+		members            = socket;
+	}
+	
+	return socket;
+}
+
+/**
+* @brief  This function sends a packet to the server
+* @params simSocket_t *socket	-> socket
+*					const char ip[]				-> remote of a datagram, NULL for the remote the socket was opened to
+*					uint16_t port					-> its port
+*/
+void vSimSocketSend(simSocket_t *socket, const char ip[], uint16_t port, const void *data, uint32_t length)
+{
+	simTime_t arrival = xSimArrival(socket, &socket->upFree);
+	
+	if (socket->lan)
+	{
+		if (socket->peer != NULL)
+		{
+			pxSimPacket(socket->peer, arrival, vSimClientReceive, socket->peer->host, socket->port, data, length);/*from the address of the sender*/
+		}
+	}
+	else if (arrival != 0)
+	{
+		pxSimPacket(socket, arrival, (socket->fd >= 0) ? vSimLoopbackSend : vSimServerReceive, (ip != NULL) ? ip : socket->host, (ip != NULL) ? port : socket->port, data, length);
+	}
+}
+
+/**
+* @brief  This function closes a socket, packets still on the way are dropped, the other end of a LAN connection gets
+*					what was sent before and then a close
+*/
+void vSimSocketClose(simSocket_t *socket)
+{
+	fwTftpPacket_t answer;
+	
+	socket->open = false;
+	
+	if (socket->member)
+	{
+		simSocket_t **link = &members;
+		
+		while (*link != socket)
+		{
+			link = &(*link)->nextMember;
+		}
+		
+		*link = socket->nextMember;
+	}
+	
+	if (socket->udp && pxSimServer != NULL && bFwServerTftpLeave(pxSimServer, &socket->tftp, &answer))
+	{
+		vSimServerTftpSend(socket, &answer);/*to the new master of the group*/
+	}
+	
+	if (socket->peer != NULL)
+	{
+		pxSimPacket(socket->peer, (socket->upFree > xSimNow() + SIM_LAN_LATENCY_US) ? socket->upFree : xSimNow() + SIM_LAN_LATENCY_US, vSimSocketConnected, "", 0, NULL, 0);
+		
+		socket->peer->peer = NULL;
+		socket->peer       = NULL;
+	}
+	
+	if (socket->fd >= 0)
+	{
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, socket->fd, NULL);
+	}
+	
+	if (socket->pending == 0)
+	{
+		vSimSocketFree(socket);
+	}
+}
+
+/**
+* @brief  This function makes a modem take the TCP connections of its site to a port, as AT+CIPSERVER does
+* @params const char ip[]										-> LAN address of the modem, of vSimLanIP
+*					uint16_t port											-> listening port
+*					const simSocketHandler_t *handler	-> accepted is called for every connection, then as for pxSimSocketOpen
+*					void *context											-> given to the handler, a listener of the same address and port is replaced
+*/
+void vSimSocketListen(const char ip[], uint16_t port, const simSocketHandler_t *handler, void *context)
+{
+	uint32_t i;
+	
+	for (i = 0; i < listenerCount && !(strcmp(listeners[i].ip, ip) == 0 && listeners[i].port == port); i++)
+	{
+	}
+	
+	if (i == SIM_NET_LISTENERS)
+	{
+		return;
+	}
+	
+	listenerCount += (i == listenerCount);
+	
+	snprintf(listeners[i].ip, sizeof(listeners[i].ip), "%s", ip);
+	
+	listeners[i].port    = port;
+	listeners[i].handler = handler;
+	listeners[i].context = context;
+}
+
+/**
+* @brief  This function drops the listeners of a modem, the connections it took stay open
+* @param  void *context -> context given to vSimSocketListen, NULL drops every listener and group member as vSimInit does
+*/
+void vSimSocketUnlisten(void *context)
+{
+	for (; context == NULL && members != NULL; members = members->nextMember)
+	{
+		members->member = false;
+	}
+	
+	for (uint32_t i = listenerCount; i-- > 0;)
+	{
+		if (context == NULL || listeners[i].context == context)
+		{
+			listeners[i] = listeners[--listenerCount];
+		}
+	}
+}
+
+/**
+* @brief  This function makes the sockets opened from now on real loopback sockets, the web server is reached at a port
+*					of 127.0.0.1 and every other address is taken as 127.0.0.1
+* @param  uint16_t httpPort -> port of the web server, the bootloader connects to FW_SERVER_HTTP_PORT
+* @note   The link latency and loss still apply, on top of the loopback
+*/
+void vSimNetLoopback(uint16_t httpPort)
+{
+	if (epollFd < 0)
+	{
+		epollFd = epoll_create1(EPOLL_CLOEXEC);
+	}
+	
+	loopbackHttpPort = httpPort;
+}
+
+/**
+* @brief  This function waits for the loopback sockets and hands what they received to the modems after the link latency
+* @param  int timeoutMs -> longest wait
+*/
+void vSimNetPoll(int timeoutMs)
+{
+	static uint8_t buffer[65536];
+	struct epoll_event events[SIM_NET_EVENTS];
+	struct sockaddr_in from;
+	socklen_t fromLength;
+	ssize_t received;
+	simTime_t arrival;
+	int count, error;
+	
+	count = epoll_wait(epollFd, events, SIM_NET_EVENTS, timeoutMs);
+	
+	vSimTimeSync();
+	
+	for (int i = 0; i < count; i++)
+	{
+		simSocket_t *socket = events[i].data.ptr;
+		
+		if (socket->connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+		{
+			struct epoll_event event = {.events = EPOLLIN, .data.ptr = socket};
+			socklen_t errorLength = sizeof(error);
+			
+			getsockopt(socket->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+			
+			socket->connecting = false;
+			
+			epoll_ctl(epollFd, EPOLL_CTL_MOD, socket->fd, &event);
+			
+			pxSimPacket(socket, xSimNow() + 2 * (simTime_t)socket->link.latencyUs, vSimSocketConnected, "", (error == 0) ? 1 : 0, NULL, 0);
+			
+			continue;
+		}
+		
+		for (;;)
+		{
+			fromLength = sizeof(from);
+			received   = recvfrom(socket->fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLength);
+			
+			if (received <= 0)
+			{
+				break;
+			}
+			
+			arrival = xSimArrival(socket, &socket->downFree);
+			
+			if (arrival != 0)
+			{
+				pxSimPacket(socket, arrival, vSimClientReceive, "127.0.0.1", socket->udp ? ntohs(from.sin_port) : socket->port, buffer, (uint32_t)received);
+			}
+		}
+		
+		if (!socket->udp && (received == 0 || errno != EAGAIN))
+		{
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, socket->fd, NULL);/*closed by the server, the modem closes it*/
+		}
+	}
+}
@@ -0,0 +1,242 @@
+/**
+  ******************************************************************************
+  * @file    ug95.c
+  * @brief   Quectel UG95 emulator of the device simulator: AT+QIOPEN,
+  *          AT+QISEND, AT+QICLOSE and the +QIURC "recv" reports in direct push
+  *          mode
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+
+/* Private define ------------------------------------------------------------*/
+#define UG95_SOCKETS																				12
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	simModem_t  *modem;
+	char         line[256];
+	uint32_t     lineLength;
+	int32_t      sendSocket;																											/*socket taking the raw bytes of AT+QISEND, -1 while reading commands*/
+	char         sendIP[16];																										/*remote given to AT+QISEND of a "UDP SERVICE" socket*/
+	uint16_t     sendPort;
+	uint32_t     sendLength, sendReceived;
+	uint8_t      sendBuffer[1460];
+	simSocket_t *sockets[UG95_SOCKETS];
+	bool         service[UG95_SOCKETS];																						/*"UDP SERVICE" reports the sender of every datagram*/
+} ug95_t;
+
+static void vUg95Connected(void *context, simSocket_t *socket, bool connected)
+{
+	ug95_t *ug95 = context;
+	char text[32];
+	
+	for (int32_t id = 0; id < UG95_SOCKETS; id++)
+	{
+		if (ug95->sockets[id] == socket)
+		{
+			sprintf(text, "\r\n+QIOPEN: %i,%i\r\n", id, connected ? 0 : 566);
+			
+			if (!connected)
+			{
+				vSimSocketClose(socket);
+				
+				ug95->sockets[id] = NULL;
+			}
+			
+			vSimModemOutput(ug95->modem, text, strlen(text));
+		}
+	}
+}
+
+/**
+* @brief  This function reports a packet of a socket and pushes its data right after the report
+*/
+static void vUg95Receive(void *context, simSocket_t *socket, const char ip[], uint16_t port, const uint8_t data[], uint32_t length)
+{
+	ug95_t *ug95 = context;
+	uint8_t frame[64 + 1460];
+	int header;
+	
+	for (int32_t id = 0; id < UG95_SOCKETS; id++)
+	{
+		if (ug95->sockets[id] == socket && length <= 1460)
+		{
+			if (ug95->service[id])
+			{
+				header = sprintf((char *)frame, "\r\n+QIURC: \"recv\",%i,%u,\"%s\",%u\r\n", id, length, ip, port);
+			}
+			else
+			{
+				header = sprintf((char *)frame, "\r\n+QIURC: \"recv\",%i,%u\r\n", id, length);
+			}
+			
+			memcpy(&frame[header], data, length);
+			
+			vSimModemOutput(ug95->modem, frame, (uint32_t)header + length);
+		}
+	}
+}
+
+static const simSocketHandler_t ug95Handler = {vUg95Connected, vUg95Receive};
+
+/**
+* @brief  This function runs one command line, the "\r\n" already removed
+*/
+static void vUg95Command(ug95_t *ug95, char line[])
+{
+	simModem_t *modem = ug95->modem;
+	char type[16], host[64], text[32];
+	int32_t contextId, id;
+	uint32_t length;
+	unsigned int port;
+	
+	if (strcmp(line, "AT") == 0)
+	{
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+	}
+	else if (sscanf(line, "AT+QIOPEN=%i,%i,\"%15[^\"]\",\"%63[^\"]\",%u", &contextId, &id, type, host, &port) == 5 && id >= 0 && id < UG95_SOCKETS)
+	{
+		bool udp = (strncmp(type, "UDP", 3) == 0);
+		
+		if (ug95->sockets[id] != NULL)
+		{
+			vSimModemReply(modem, "\r\nERROR\r\n", 0);
+			
+			return;
+		}
+		
+		ug95->sockets[id] = pxSimSocketOpen(&modem->config.link, udp, host, (uint16_t)port, &ug95Handler, ug95);
+		ug95->service[id] = (strcmp(type, "UDP SERVICE") == 0);
+		
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+		
+		if (udp)
+		{
+			sprintf(text, "\r\n+QIOPEN: %i,0\r\n", id);
+			
+			vSimModemReply(modem, text, 0);
+		}
+	}
+	else if (sscanf(line, "AT+QISEND=%i,%u", &id, &length) == 2 && id >= 0 && id < UG95_SOCKETS)
+	{
+		if (ug95->sockets[id] == NULL || length > sizeof(ug95->sendBuffer))
+		{
+			vSimModemReply(modem, "\r\nERROR\r\n", 0);
+			
+			return;
+		}
+		
+		ug95->sendIP[0] = 0;
+		
+		sscanf(line, "AT+QISEND=%*i,%*u,\"%15[^\"]\",%u", ug95->sendIP, &port);
+		
+		ug95->sendSocket   = id;
+		ug95->sendLength   = length;
+		ug95->sendReceived = 0;
+		ug95->sendPort     = (uint16_t)port;
+		
+		vSimModemReply(modem, "\r\n> ", 0);
+	}
+	else if (sscanf(line, "AT+QICLOSE=%i", &id) == 1 && id >= 0 && id < UG95_SOCKETS)
+	{
+		if (ug95->sockets[id] != NULL)
+		{
+			vSimSocketClose(ug95->sockets[id]);
+			
+			ug95->sockets[id] = NULL;
+		}
+		
+		vSimModemReply(modem, "\r\nOK\r\n", 0);
+	}
+	else
+	{
+		vSimModemReply(modem, "\r\nERROR\r\n", 0);
+	}
+}
+
+/**
+* @brief  This function takes the bytes of the device: command lines, or the payload announced by AT+QISEND
+*/
+static void vUg95Input(simModem_t *modem, const uint8_t data[], uint32_t length)
+{
+	ug95_t *ug95 = modem->state;
+	
+	for (uint32_t i = 0; i < length; i++)
+	{
+		if (ug95->sendSocket >= 0)
+		{
+			ug95->sendBuffer[ug95->sendReceived++] = data[i];
+			
+			if (ug95->sendReceived == ug95->sendLength)
+			{
+				vSimSocketSend(ug95->sockets[ug95->sendSocket], (ug95->sendIP[0] != 0) ? ug95->sendIP : NULL, ug95->sendPort, ug95->sendBuffer, ug95->sendLength);
+				
+				ug95->sendSocket = -1;
+				
+				vSimModemReply(modem, "\r\nSEND OK\r\n", 0);
+			}
+			
+			continue;
+		}
+		
+		if (ug95->lineLength < sizeof(ug95->line) - 1)
+		{
+			ug95->line[ug95->lineLength++] = (char)data[i];
+		}
+		
+		if (data[i] == '\n')
+		{
+			ug95->line[ug95->lineLength] = 0;
+			
+			if (ug95->lineLength >= 2 && ug95->line[ug95->lineLength - 2] == '\r')
+			{
+				ug95->line[ug95->lineLength - 2] = 0;
+			}
+			
+			if (ug95->line[0] != '\r' && ug95->line[0] != '\n' && ug95->line[0] != 0)
+			{
+				vUg95Command(ug95, ug95->line);
+			}
+			
+			ug95->lineLength = 0;
+		}
+	}
+}
+
+/**
+* @brief  This function restarts the module: sockets closed, back at the configured speed
+*/
+static void vUg95Reset(simModem_t *modem)
+{
+	ug95_t *ug95 = modem->state;
+	
+	for (uint32_t id = 0; id < UG95_SOCKETS; id++)
+	{
+		if (ug95->sockets[id] != NULL)
+		{
+			vSimSocketClose(ug95->sockets[id]);
+			
+			ug95->sockets[id] = NULL;
+		}
+	}
+	
+	ug95->lineLength = 0;
+	ug95->sendSocket = -1;
+	
+	vSimModemSetBaud(modem, modem->config.baud);
+}
+
+void vUg95Attach(simModem_t *modem)
+{
+	ug95_t *ug95 = calloc(1, sizeof(ug95_t));
+	
+	ug95->modem      = modem;
+	ug95->sendSocket = -1;
+	
+	modem->state   = ug95;
+	modem->receive = vUg95Input;
+	modem->reset   = vUg95Reset;
+}
@@ -0,0 +1,287 @@
+/**
+  ******************************************************************************
+  * @file    apply_power.c
+  * @brief   Power loss at every flash operation of the journaled apply: an
+  *          approved image in the storage space is installed over an older
+  *          application by vBootloader, the power is cut in every program and
+  *          erase of that boot, and the device is booted again until it jumps
+  *          to the application, which must then be the image byte for byte
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define APPLY_REGION_ADDRESS																APPLICATION_ADDRESS													/*application and storage spaces, adjacent*/
+#define APPLY_REGION_SIZE																		(2 * MAX_APPICATION_SIZE)
+#define METADATA_LOG_ADDRESS																METADATA_SECTOR_A_ADDRESS										/*both sectors, A then B*/
+#define METADATA_LOG_SIZE																		(2 * METADATA_SECTOR_SIZE)
+#define APPLY_BOOT_LIMIT																		8																						/*boots after the cut before the apply counts as stuck*/
+#define POWER_ON																						1																						/*setjmp value of a power cut*/
+#define SOFT_RESET																					2																						/*setjmp value of NVIC_SystemReset*/
+#define JUMPED																							3																						/*setjmp value of the jump to the application*/
+
+/* Private variables ---------------------------------------------------------*/
+static jmp_buf  powerOn;
+static uint32_t operations, cutAt;																										/*program and erase operations so far, the one to cut, 0 for none*/
+static uint32_t applicationPrograms;																									/*programs of the application space so far*/
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static bool bPowerCut(uint32_t address, uint32_t length)
+{
+	applicationPrograms += (address >= APPLICATION_ADDRESS && address < APPLICATION_ADDRESS + MAX_APPICATION_SIZE && length == 4);
+	
+	return ++operations == cutAt;
+}
+
+/**
+* @brief  This function resets the device, a power loss doesn't keep the SRAM words a soft reset keeps
+*/
+static void vReset(bool powerLoss)
+{
+	if (powerLoss)
+	{
+		memset((void *)(uintptr_t)HOST_SRAM_KEPT_ADDRESS, 0, HOST_SRAM_KEPT_SIZE);
+	}
+	
+	longjmp(powerOn, powerLoss ? POWER_ON : SOFT_RESET);
+}
+
+static void vJump(uint32_t stack)
+{
+	(void)stack;
+	
+	longjmp(powerOn, JUMPED);
+}
+
+/**
+* @brief  This function programs an image and its trailer in a slot as the bootloader does once it is downloaded
+*/
+static void vProgramImage(uint32_t slotAddress, const uint8_t image[], uint32_t length, const char version[])
+{
+	uint32_t word;
+	
+	vHostFlashWrite(slotAddress, image, length);
+	
+	word = length;
+	vHostFlashWrite(slotAddress + IMAGE_LENGTH_OFFSET, &word, 4);
+	
+	word = ulCRC32Aligned((const uint32_t *)image, length, 0);
+	vHostFlashWrite(slotAddress + IMAGE_CRC_OFFSET, &word, 4);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		word = (uint8_t)version[i];
+		vHostFlashWrite(slotAddress + MAX_APPICATION_SIZE - 24 + 4 * i, &word, 4);
+	}
+	
+	word = 1;
+	vHostFlashWrite(slotAddress + MAX_APPICATION_SIZE - 4, &word, 4);
+}
+
+/**
+* @brief  This function gives the log record of an image programmed by vProgramImage
+*/
+static metadataRecord_t xImageRecord(uint32_t slotAddress, const char version[])
+{
+	metadataRecord_t record = {0};
+	
+	record.imageLength = BOOTLOADER_FLASH_WORD(slotAddress + IMAGE_LENGTH_OFFSET);
+	record.imageCRC    = BOOTLOADER_FLASH_WORD(slotAddress + IMAGE_CRC_OFFSET);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		record.version[i] = (uint8_t)version[i];
+	}
+	
+	return record;
+}
+
+/**
+* @brief  This function boots the device until it jumps to an application
+* @retval boots it took, 0 if it stayed in the bootloader or didn't jump within APPLY_BOOT_LIMIT boots
+*/
+static uint32_t ulBootUntilJump(void)
+{
+	static uint32_t boots;																																/*static, kept over the longjmp of a reset*/
+	
+	boots = 0;
+	
+	switch (setjmp(powerOn))
+	{
+		case JUMPED:
+			return boots;
+		default:
+			break;
+	}
+	
+	if (++boots > APPLY_BOOT_LIMIT)
+	{
+		return 0;
+	}
+	
+	vBootloader();
+	
+	return 0;
+}
+
+/**
+* @brief  This function checks the flash after an apply: the application is the storage image, the log records it as
+*					installed and the storage slot and the journal are released
+* @note   A cut erase of the storage space may leave it partly programmed, every download erases it before it starts.
+*/
+static bool bInstalled(const uint8_t storage[], const metadataRecord_t *image)
+{
+	static bootMetadata_t metadata;
+	const metadataRecord_t *application = &metadata.slots[METADATA_APPLICATION_SLOT];
+	
+	vMetadataScan(&metadata);
+	
+	return memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), storage, MAX_APPICATION_SIZE) == 0 && application->state == METADATA_SLOT_INSTALLED && application->imageCRC == image->imageCRC && application->imageLength == image->imageLength &&
+				 metadata.slots[METADATA_STORAGE_SLOT].state == METADATA_SLOT_ERASED && metadata.slots[METADATA_APPLY_SLOT].state == METADATA_SLOT_ERASED;
+}
+
+/**
+* @brief  apply_power [-k image KB] [-s cut every n-th operation]
+*					Fails if a cut apply doesn't end with the image installed, byte for byte, within a few boots.
+*/
+int main(int argc, char *argv[])
+{
+	static uint8_t savedRegion[APPLY_REGION_SIZE], savedLog[METADATA_LOG_SIZE], storage[MAX_APPICATION_SIZE];
+	static uint32_t cuts, failures, restarts, mostBoots, mostRedone, cut, bootOperations, cleanPrograms, faults;	/*static, kept over the longjmp of a power cut*/
+	static uint64_t redone;
+	static bootMetadata_t metadata;
+	metadataRecord_t image, factory;
+	uint32_t imageLength = 32 * 1024, stride = 1, seed = 1;
+	uint8_t *data;
+	double start;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "k:s:")) != -1)
+	{
+		uint32_t value = strtoul(optarg, NULL, 0);
+		
+		switch (option)
+		{
+			case 'k': imageLength = (value > 0 && value * 1024 <= MAX_APPICATION_SIZE - APPLY_CHUNK_SIZE) ? value * 1024 : 32 * 1024; break;
+			case 's': stride = (value > 0) ? value : 1; break;
+			default:  return 2;
+		}
+	}
+	
+	xHostDevice.flash  = pucHostFlashCreate();
+	xHostPort.powerCut = bPowerCut;
+	xHostPort.reset    = vReset;
+	xHostPort.jump     = vJump;
+	
+	HAL_FLASH_Unlock();
+	
+	data = malloc(imageLength);
+	
+	for (uint32_t i = 0; i < imageLength; i++)
+	{
+		seed    = seed * 1664525U + 1013904223U;
+		data[i] = (uint8_t)(seed >> 24);
+	}
+	
+	vProgramImage(APPLICATION_ADDRESS, data, imageLength, "1.0.0");
+	
+	for (uint32_t i = 0; i < imageLength; i++)
+	{
+		data[i] ^= 0x5A;
+	}
+	
+	vProgramImage(STORAGE_ADDRESS, data, imageLength, "1.2.3");
+	
+	factory = xImageRecord(APPLICATION_ADDRESS, "1.0.0");
+	image   = xImageRecord(STORAGE_ADDRESS, "1.2.3");
+	
+	vMetadataScan(&metadata);
+	vMetadataSetSlot(&metadata, METADATA_APPLICATION_SLOT, METADATA_SLOT_INSTALLED, &factory);
+	vMetadataSetSlot(&metadata, METADATA_STORAGE_SLOT, METADATA_SLOT_APPROVED, &image);
+	
+	memcpy(storage, (const void *)BOOTLOADER_FLASH_POINTER(STORAGE_ADDRESS), MAX_APPICATION_SIZE);
+	memcpy(savedRegion, (const void *)BOOTLOADER_FLASH_POINTER(APPLY_REGION_ADDRESS), APPLY_REGION_SIZE);
+	memcpy(savedLog, (const void *)BOOTLOADER_FLASH_POINTER(METADATA_LOG_ADDRESS), METADATA_LOG_SIZE);
+	
+	operations          = 0;
+	cutAt               = 0;
+	applicationPrograms = 0;
+	faults              = xHostDevice.flashFaults;
+	
+	if (ulBootUntilJump() != 1 || !bInstalled(storage, &image))
+	{
+		printf("the apply without a power cut didn't install the image\n");
+		printf("FAIL\n");
+		
+		return 1;
+	}
+	
+	bootOperations = operations;
+	cleanPrograms  = applicationPrograms;
+	
+	printf("apply of a %u KB image in %u KB chunks: %u programs and erases, %u words copied\n", imageLength / 1024, APPLY_CHUNK_SIZE / 1024, bootOperations, cleanPrograms);
+	
+	start = dSeconds();
+	
+	for (cut = 1; cut <= bootOperations; cut += stride)
+	{
+		uint32_t boots;
+		
+		memcpy((void *)BOOTLOADER_FLASH_POINTER(APPLY_REGION_ADDRESS), savedRegion, APPLY_REGION_SIZE);
+		memcpy((void *)BOOTLOADER_FLASH_POINTER(METADATA_LOG_ADDRESS), savedLog, METADATA_LOG_SIZE);
+		memset((void *)(uintptr_t)HOST_SRAM_KEPT_ADDRESS, 0, HOST_SRAM_KEPT_SIZE);
+		
+		operations          = 0;
+		cutAt               = cut;
+		applicationPrograms = 0;
+		
+		boots = ulBootUntilJump();
+		
+		cuts++;
+		
+		if (boots < 2)
+		{
+			printf("cut at operation %u of %u: %s\n", cut, bootOperations, (boots == 1) ? "not cut" : "no jump to the application");
+			failures++;
+			continue;
+		}
+		
+		if (!bInstalled(storage, &image))
+		{
+			printf("cut at operation %u of %u: the application is not the image, or the log doesn't record it as installed\n", cut, bootOperations);
+			failures++;
+			continue;
+		}
+		
+		redone     += applicationPrograms;
+		mostBoots   = (boots > mostBoots) ? boots : mostBoots;
+		mostRedone  = (applicationPrograms > mostRedone) ? applicationPrograms : mostRedone;
+		restarts   += (applicationPrograms > cleanPrograms);
+	}
+	
+	faults = xHostDevice.flashFaults - faults;
+	
+	printf("%u power cuts, one in every %u programs and erases: %u failures, at most %u boots to the application, %.1f s\n", cuts, stride, failures, mostBoots, dSeconds() - start);
+	printf("words of the application programmed per cut apply: %.0f on average, %u at most, %u copies restarted from the erase, a torn word can't be programmed over\n", (cuts > failures) ? (double)redone / (cuts - failures) : 0.0, mostRedone, restarts);
+	printf("programs of words not erased: %u\n", faults);
+	printf("%s\n", (failures == 0 && faults == 0) ? "PASS" : "FAIL");
+	
+	free(data);
+	
+	return (failures == 0 && faults == 0) ? 0 : 1;
+}
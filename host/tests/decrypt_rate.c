@@ -0,0 +1,209 @@
+/**
+  ******************************************************************************
+  * @file    decrypt_rate.c
+  * @brief   Throughput of the AES-128-CTR decryption at the TFTP block size:
+  *          vBootloaderDecrypt timed in place per block, alone and with the
+  *          CRC32 and SHA-256 of the block, against the rate of every modem link
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	const char *name;
+	uint32_t    baud;
+	uint32_t    overhead;																															/*bytes the modem adds to a block on the UART*/
+} decryptLink_t;
+
+/* Private define ------------------------------------------------------------*/
+#define DECRYPT_RUNS																				16																					/*runs over the image, the fastest one is kept*/
+
+/* Private variables ---------------------------------------------------------*/
+static const decryptLink_t links[] =
+{
+	{"ESP8266 TFTP",   19200, 16},																												/*"\r\n+IPD,N,516:", the ESP8266 runs at 19200 for a transfer*/
+	{"ESP8266",       115200, 16},
+	{"UG95",          115200, 28},																												/*"\r\n+QIURC: \"recv\",N,516\r\n"*/
+	{"UART at 921600", 921600, 16},																											/*margin for a faster modem link*/
+};
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint64_t ullCycles(void)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+	#else
+	return 0;
+	#endif
+}
+
+/**
+* @brief  This function checks the cipher against FIPS-197 C.1 and the CTR mode against SP 800-38A F.5.1, the CTR
+*					blocks decrypted in two pieces split inside a block as an out of order chunk would be
+*/
+static bool bDecryptKnownAnswers(void)
+{
+	static const uint8_t fipsKey[16]    = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+	static const uint8_t fipsPlain[16]  = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+	static const uint8_t fipsCipher[16] = {0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30, 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+	static const uint8_t ctrKey[16]     = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+	static const uint8_t ctrIv[16]      = {0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF};
+	static const uint8_t ctrPlain[32]   = {0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+																				 0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51};
+	static const uint8_t ctrCipher[32]  = {0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE,
+																				 0x98, 0x06, 0xF6, 0x6B, 0x79, 0x70, 0xFD, 0xFF, 0x86, 0x17, 0x18, 0x7B, 0xB9, 0xFF, 0xFD, 0xFF};
+	uint8_t roundKeys[176], block[32];
+	bool passed;
+	
+	vAES128KeyExpansion(roundKeys, fipsKey);
+	vAES128EncryptBlock(roundKeys, fipsPlain, block);
+	
+	passed = (memcmp(block, fipsCipher, 16) == 0);
+	
+	vAES128KeyExpansion(xBootloaderVariables.aesRoundKeys, ctrKey);
+	
+	memcpy(xBootloaderVariables.manifest.iv, ctrIv, 16);
+	memcpy(block, ctrCipher, 32);
+	
+	vBootloaderDecrypt(&block[21], 11, 21);
+	vBootloaderDecrypt(block, 21, 0);
+	
+	return passed && memcmp(block, ctrPlain, 32) == 0;
+}
+
+/**
+* @brief  This function runs the per block path of an encrypted image over a copy of it, in place as the receive buffer is
+* @retval seconds of the fastest run, *cycles its time stamp counter ticks
+*/
+static double dDecryptImage(const uint8_t image[], uint32_t imageLength, uint32_t blockSize, bool checks, uint64_t *cycles)
+{
+	static uint8_t packet[4 + 65464];
+	double best = 1e9;
+	
+	for (uint32_t run = 0; run < DECRYPT_RUNS; run++)
+	{
+		sha256Context_t context;
+		uint32_t checksum = 0;
+		uint8_t digest[32] = {0};
+		uint64_t startCycles = ullCycles();
+		double start = dSeconds(), elapsed;
+		
+		vSHA256Init(&context);
+		
+		for (uint32_t offset = 0; offset < imageLength; offset += blockSize)
+		{
+			uint32_t length = (imageLength - offset < blockSize) ? imageLength - offset : blockSize;
+			
+			memcpy(&packet[4], &image[offset], length);
+			
+			vBootloaderDecrypt(&packet[4], length, offset);
+			
+			if (checks)
+			{
+				checksum = crc32(packet, length, checksum);
+				
+				vSHA256Update(&context, &packet[4], length);
+			}
+		}
+		
+		if (checks)
+		{
+			vSHA256Final(&context, digest);
+		}
+		
+		elapsed = dSeconds() - start;
+		
+		if (elapsed < best)
+		{
+			best    = elapsed;
+			*cycles = ullCycles() - startCycles;
+		}
+		
+		__asm__ volatile("" : : "r"(checksum), "r"(digest[0]) : "memory");
+	}
+	
+	return best;
+}
+
+/**
+* @brief  decrypt_rate [-k image KB] [-b block bytes] [-l most load percent]
+*					Fails if the decryption with the block checks takes more than the given share of the block interval on any link.
+*/
+int main(int argc, char *argv[])
+{
+	uint32_t imageLength = 256 * 1024, blockSize = 512, limit = 10, seed = 1;
+	uint64_t decryptCycles = 0, pathCycles = 0;
+	double decryptTime, pathTime, worst = 0;
+	uint8_t *image;
+	bool passed;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "k:b:l:")) != -1)
+	{
+		uint32_t value = strtoul(optarg, NULL, 0);
+		
+		switch (option)
+		{
+			case 'k': imageLength = value * 1024; break;
+			case 'b': blockSize = (value >= 16 && value <= 65464) ? value : 512; break;
+			case 'l': limit = value; break;
+			default:  return 2;
+		}
+	}
+	
+	image = malloc(imageLength);
+	
+	for (uint32_t i = 0; i < imageLength; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		image[i] = (uint8_t)(seed >> 24);
+	}
+	
+	passed      = bDecryptKnownAnswers();
+	decryptTime = dDecryptImage(image, imageLength, blockSize, false, &decryptCycles);
+	pathTime    = dDecryptImage(image, imageLength, blockSize, true, &pathCycles);
+	
+	printf("AES-128 known answers: %s\n", passed ? "match" : "MISMATCH");
+	printf("AES-128-CTR of %u KB in %u byte blocks: %.2f ns/byte, %.1f host cycles/byte, %.2f MB/s\n", imageLength / 1024, blockSize, decryptTime * 1e9 / imageLength, (double)decryptCycles / imageLength, imageLength / decryptTime / 1e6);
+	printf("with the CRC32 and SHA-256 of the block: %.2f ns/byte, %.1f host cycles/byte, %.2f MB/s\n", pathTime * 1e9 / imageLength, (double)pathCycles / imageLength, imageLength / pathTime / 1e6);
+	
+	for (uint32_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+	{
+		double bytesPerSecond = links[i].baud / 10.0;
+		double interval = (blockSize + 4 + links[i].overhead) / bytesPerSecond;
+		double perBlock = pathTime * blockSize / imageLength;
+		
+		printf("%-15s %7.0f bytes/s, a block every %8.3f ms, processed in %6.3f ms: %6.3f%%, decryption %8.0f times the line rate\n", links[i].name, bytesPerSecond, interval * 1e3, perBlock * 1e3, perBlock / interval * 100, imageLength / decryptTime / bytesPerSecond);
+		
+		if (perBlock / interval > worst)
+		{
+			worst = perBlock / interval;
+		}
+	}
+	
+	passed &= (worst * 100 <= limit);
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	free(image);
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/**
+  ******************************************************************************
+  * @file    e2e_update.c
+  * @brief   End to end update of one simulated device per transport: a device
+  *          running 1.0.0 asks the stand-in server over the emulated ESP8266 or
+  *          UG95, downloads 1.2.3 over TFTP, resets, installs and runs it. The
+  *          multipath transport offers a manifest image to a device with both
+  *          modems, a BOOTLOADER_MULTIPATH build stripes its chunks over the two
+  *          links and asks again the chunk the server corrupts once
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <time.h>
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	bool      installed;																														/*the new image started*/
+	char      version[6];																														/*of the installed metadata record*/
+	uint32_t  transferMs;																														/*HAL_GetTick from the transfer start to the firmware ready*/
+	simTime_t runningTime;																													/*new image started*/
+} e2eRun_t;
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t imageLength = 120 * 1024;
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+* @brief  This function builds an image: the vector table of the application slot, random code after it
+*/
+static void vMakeImage(uint8_t image[], uint32_t length, uint32_t seed)
+{
+	uint32_t *words = (uint32_t *)image;
+	
+	for (uint32_t i = 0; i < length / 4; i++)
+	{
+		seed  = seed * 1664525U + 1013904223U;
+		words[i] = seed;
+	}
+	
+	words[0] = 0x20004000U;
+	words[1] = APPLICATION_ADDRESS + 0x201;
+}
+
+/**
+* @brief  This function programs an approved image in the application slot as the factory does, trailer of the legacy layout
+*/
+static void vProgramFactoryImage(const uint8_t image[], uint32_t length, const char version[])
+{
+	uint32_t word;
+	
+	vHostFlashWrite(APPLICATION_ADDRESS, image, length);
+	
+	word = length;
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_LENGTH_OFFSET, &word, 4);
+	
+	word = ulFwServerCRC32(image, length, 0);
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET, &word, 4);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		word = (uint8_t)version[i];
+		vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24 + 4 * i, &word, 4);
+	}
+	
+	word = 1;
+	vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4, &word, 4);
+}
+
+/**
+* @brief  This function takes the firmware ready callback of the bootloader to time the transfer
+*/
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	e2eRun_t *run = pxSimCurrent()->user;
+	
+	(void)version;
+	
+	run->transferMs = HAL_GetTick() - xBootloaderVariables.timing.transferStartTick;
+	
+	vBootloaderApplyNow();
+}
+
+/**
+* @brief  This function is the application of the device: 1.0.0 checks for updates as the bootloader application does,
+*					the new image records that it runs and stops
+*/
+static void vDeviceApplication(simDevice_t *device)
+{
+	e2eRun_t *run = device->user;
+	bootMetadata_t metadata;
+	
+	if (memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), pxSimServer->image, pxSimServer->imageLength) != 0)
+	{
+		vSimBootloaderApplication(device);
+	}
+	
+	vMetadataScan(&metadata);
+	
+	memcpy(run->version, metadata.slots[METADATA_APPLICATION_SLOT].version, 5);
+	
+	run->installed   = (metadata.slots[METADATA_APPLICATION_SLOT].state == METADATA_SLOT_INSTALLED);
+	run->runningTime = device->clock;
+}
+
+/**
+* @brief  This function updates one device over one modem, or over both for a multipath download
+* @params const simModemConfig_t *config	-> modem of the device
+*					const simModemConfig_t *second	-> other modem of a multipath download, NULL for none
+*					const char name[]								-> transport printed
+* @retval true if the device runs the offered image, a multipath download must have used both links and asked the
+*					corrupted chunk again
+*/
+static bool bUpdate(const simModemConfig_t *config, const simModemConfig_t *second, const char name[])
+{
+	static fwServer_t server;
+	uint8_t *image = malloc(imageLength), *factory = malloc(imageLength);
+	e2eRun_t run = {0};
+	simDevice_t *device;
+	simModem_t *modem, *other = NULL;
+	double start = dSeconds(), wall, transfer;
+	uint32_t rangeRequests = 0;
+	bool passed;
+	
+	vMakeImage(image, imageLength, 123);
+	vMakeImage(factory, imageLength, 100);
+	
+	vSimInit(1);
+	
+	bFwServerInit(&server, image, imageLength, "1.2.3", "10.0.0.2");
+	
+	pxSimServer = &server;
+	
+	device = pxSimDeviceCreate(0);
+	modem  = pxSimModemAttach(device, config);
+	
+	if (second != NULL)
+	{
+		other = pxSimModemAttach(device, second);
+		
+		bFwServerManifest(&server);
+		
+		server.corruptOffset  = imageLength / 2;																		/*a chunk in the middle fails its CRC32 once*/
+		server.corruptPending = true;
+		
+		rangeRequests = (imageLength + FIRMWARE_REFETCH_PIECE_SIZE - 1) / FIRMWARE_REFETCH_PIECE_SIZE;
+	}
+	
+	device->user        = &run;
+	device->application = vDeviceApplication;
+	
+	vProgramFactoryImage(factory, imageLength, "1.0.0");
+	
+	while (!device->halted && xSimNow() < 3600ULL * 1000000)
+	{
+		vSimRun(xSimNow() + 1000000);
+	}
+	
+	wall     = dSeconds() - start;
+	transfer = (double)run.transferMs / 1000.0;
+	passed   = run.installed && strcmp(run.version, "1.2.3") == 0 && memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), image, imageLength) == 0;
+	
+	printf("%s: %u bytes in %.1f s of transfer, %.0f bytes/s, 1.2.3 running %.1f s after power on, %.2f s wall time\n", name, server.fileLength, transfer, (transfer > 0) ? server.fileLength / transfer : 0, (double)run.runningTime / 1e6, wall);
+	printf("  %u resets, %u blocks sent, %u retransmitted, %llu bytes to the modem, %llu from it, %llu garbled by a baud mismatch: %s\n", device->resets, server.blocks, server.retransmits, (unsigned long long)modem->bytesIn, (unsigned long long)modem->bytesOut, (unsigned long long)modem->garbled, passed ? "updated" : "NOT UPDATED");
+	
+	if (other != NULL)
+	{
+		bool striped = server.blocks == 0 && modem->bytesOut > imageLength / 4 && other->bytesOut > imageLength / 4;/*both links carried chunks, none went over TFTP*/
+		bool refetched = !server.corruptPending && server.rangeRequests > rangeRequests && device->resets == 1;				/*the corrupted chunk was asked again, the image not dropped*/
+		
+		printf("  %u range requests for %u pieces, %llu bytes from the other modem, corrupted chunk %s: %s\n", server.rangeRequests, rangeRequests, (unsigned long long)other->bytesOut, server.corruptPending ? "never served" : "served", (striped && refetched) ? "striped and refetched" : "NOT STRIPED OR NOT REFETCHED");
+		
+		passed = passed && striped && refetched;
+	}
+	
+	vFwServerFree(&server);
+	
+	free(image);
+	free(factory);
+	
+	return passed;
+}
+
+/**
+* @brief  e2e_update [-t wifi|gsm|both|multipath] [-k image KB] [-l latency ms] [-j jitter ms] [-p loss permille] [-b baud]
+*					Latency, jitter and loss given apply to both transports, GSM defaults to 5 times the Wi-Fi latency. Multipath
+*					needs a BOOTLOADER_MULTIPATH build.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t wifi = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}};
+	simModemConfig_t gsm  = {SIM_MODEM_UG95, 115200, 5000, {150000, 50000, 0}};
+	const char *transport = "both";
+	bool passed = true;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "t:k:l:j:p:b:")) != -1)
+	{
+		uint32_t value = (optarg != NULL) ? strtoul(optarg, NULL, 0) : 0;
+		
+		switch (option)
+		{
+			case 't': transport = optarg; break;
+			case 'k': imageLength = value * 1024; break;
+			case 'l': wifi.link.latencyUs = gsm.link.latencyUs = value * 1000; break;
+			case 'j': wifi.link.jitterUs = gsm.link.jitterUs = value * 1000; break;
+			case 'p': wifi.link.lossPermille = gsm.link.lossPermille = value; break;
+			case 'b': wifi.baud = gsm.baud = value; break;
+			default:  return 2;
+		}
+	}
+	
+	WIFI_UART.Init.BaudRate = wifi.baud;																							/*UART init of the application, every device starts with it*/
+	GSM_UART.Init.BaudRate  = gsm.baud;
+	
+	if (strcmp(transport, "multipath") == 0)
+	{
+		passed &= bUpdate(&wifi, &gsm, "multipath");
+	}
+	else
+	{
+		if (strcmp(transport, "gsm") != 0)
+		{
+			passed &= bUpdate(&wifi, NULL, "wifi");
+		}
+		
+		if (strcmp(transport, "wifi") != 0)
+		{
+			passed &= bUpdate(&gsm, NULL, "gsm ");
+		}
+	}
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/**
+  ******************************************************************************
+  * @file    fleet_load.c
+  * @brief   Fleet load generator: simulated devices run the version check and
+  *          the TFTP download of the bootloader on the wall clock, their modem
+  *          sockets are loopback sockets to a fw_serverd process
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <libgen.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	simTime_t askTime;																															/*start-up check due*/
+	simTime_t readyTime;																														/*image ready, 0 while downloading*/
+	uint32_t  transferMs;																														/*HAL_GetTick from the transfer start to the firmware ready*/
+} fleetRecord_t;
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t spreadMs = 10000;
+static uint32_t ready;
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int lCompare(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	
+	return (x > y) - (x < y);
+}
+
+/**
+* @brief  This function gives a percentile of sorted values
+*/
+static double dPercentile(const double values[], uint32_t count, double percent)
+{
+	uint32_t i = (uint32_t)(percent / 100.0 * count);
+	
+	return (count == 0) ? 0 : values[(i < count) ? i : count - 1];
+}
+
+/**
+* @brief  This function stops a device once its image is ready, the apply is not part of the load
+*/
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	simDevice_t *device = pxSimCurrent();
+	fleetRecord_t *record = device->user;
+	
+	(void)version;
+	
+	record->readyTime  = device->clock;
+	record->transferMs = HAL_GetTick() - xBootloaderVariables.timing.transferStartTick;
+	
+	ready++;
+	
+	vSimHalt();
+}
+
+/**
+* @brief  This function is the application of a fleet device: the start-up check spread over spreadMs instead of
+*					UPDATE_CHECK_STARTUP_SPREAD, so a run of a few minutes covers the whole fleet
+*/
+static void vFleetApplication(simDevice_t *device)
+{
+	fleetRecord_t *record = device->user;
+	bootloaderTimer_t *startup = &xBootloaderVariables.timers[STARTUP_CHECK_TIMER];
+	
+	vSimApplicationStart(device);
+	
+	startup->duration = (spreadMs != 0) ? xBootloaderVariables.deviceHash % spreadMs : 0;
+	record->askTime   = device->clock + (simTime_t)startup->duration * 1000;
+	
+	for (;;)
+	{
+		vBootloaderUpdateTask();
+		
+		vSimIdle();
+	}
+}
+
+/**
+* @brief  This function starts fw_serverd and waits until it listens
+* @retval its pid, its stdout is left in *output for the counters it prints at exit
+*/
+static pid_t xServerStart(const char path[], uint16_t httpPort, uint16_t tftpPort, uint32_t imageKB, FILE **output)
+{
+	char http[8], tftp[8], image[12], line[64];
+	int pipeFd[2];
+	pid_t pid;
+	
+	sprintf(http, "%u", httpPort);
+	sprintf(tftp, "%u", tftpPort);
+	sprintf(image, "%u", imageKB);
+	
+	if (pipe(pipeFd) != 0 || (pid = fork()) < 0)
+	{
+		return -1;
+	}
+	
+	if (pid == 0)
+	{
+		dup2(pipeFd[1], STDOUT_FILENO);
+		close(pipeFd[0]);
+		
+		execl(path, path, "-p", http, "-t", tftp, "-k", image, (char *)NULL);
+		
+		perror(path);
+		
+		_exit(127);
+	}
+	
+	close(pipeFd[1]);
+	
+	*output = fdopen(pipeFd[0], "r");
+	
+	if (fgets(line, sizeof(line), *output) == NULL || strcmp(line, "ready\n") != 0)
+	{
+		waitpid(pid, NULL, 0);
+		
+		return -1;
+	}
+	
+	return pid;
+}
+
+/**
+* @brief  fleet_load [-n devices] [-k image KB] [-s start-up spread s] [-m wifi|gsm|mixed] [-l latency ms] [-p loss permille]
+*										[-d longest run s] [-S fw_serverd path]
+*					Every device powers on at once and asks within the spread, the run ends once all images are ready.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t wifi = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}};
+	simModemConfig_t gsm  = {SIM_MODEM_UG95, 115200, 5000, {150000, 50000, 0}};
+	uint32_t deviceCount = 200, imageKB = 16, limit = 600, checks = 0, offers = 0, range = 0, sessions = 0, completed = 0, blocks = 0, retransmits = 0;
+	const char *mode = "mixed";
+	char serverPath[4096], line[256];
+	fleetRecord_t *records;
+	double *total, *download, start, wall, cpu, generator;
+	uint16_t httpPort = (uint16_t)(20000 + getpid() % 20000);
+	struct rusage usage, own;
+	FILE *serverOutput;
+	pid_t server;
+	int option, status;
+	bool passed;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	snprintf(serverPath, sizeof(serverPath), "%s/fw_serverd", dirname(strdup(argv[0])));
+	
+	while ((option = getopt(argc, argv, "n:k:s:m:l:p:d:S:")) != -1)
+	{
+		uint32_t value = strtoul(optarg, NULL, 0);
+		
+		switch (option)
+		{
+			case 'n': deviceCount = value; break;
+			case 'k': imageKB = value; break;
+			case 's': spreadMs = value * 1000; break;
+			case 'm': mode = optarg; break;
+			case 'l': wifi.link.latencyUs = gsm.link.latencyUs = value * 1000; break;
+			case 'p': wifi.link.lossPermille = gsm.link.lossPermille = value; break;
+			case 'd': limit = value; break;
+			case 'S': snprintf(serverPath, sizeof(serverPath), "%s", optarg); break;
+			default:  return 2;
+		}
+	}
+	
+	if ((server = xServerStart(serverPath, httpPort, httpPort + 1, imageKB, &serverOutput)) < 0)
+	{
+		printf("%s didn't start\n", serverPath);
+		
+		return 1;
+	}
+	
+	records  = calloc(deviceCount, sizeof(fleetRecord_t));
+	total    = calloc(deviceCount, sizeof(double));
+	download = calloc(deviceCount, sizeof(double));
+	
+	vSimInit(1);
+	
+	vSimNetLoopback(httpPort);
+	
+	for (uint32_t i = 0; i < deviceCount; i++)
+	{
+		simDevice_t *device = pxSimDeviceCreate(i);
+		bool useGsm = (strcmp(mode, "gsm") == 0) || (strcmp(mode, "mixed") == 0 && i % 2 == 1);
+		
+		pxSimModemAttach(device, useGsm ? &gsm : &wifi);
+		
+		device->user        = &records[i];
+		device->application = vFleetApplication;
+	}
+	
+	start = dSeconds();
+	
+	vSimRealtime();
+	
+	while (ready < deviceCount && xSimNow() < (simTime_t)limit * 1000000)
+	{
+		vSimRun(xSimNow() + 100000);
+	}
+	
+	wall = dSeconds() - start;
+	
+	kill(server, SIGTERM);
+	
+	if (fgets(line, sizeof(line), serverOutput) != NULL)
+	{
+		sscanf(line, "checks %u offers %u range %u sessions %u completed %u blocks %u retransmits %u", &checks, &offers, &range, &sessions, &completed, &blocks, &retransmits);
+	}
+	
+	wait4(server, &status, 0, &usage);
+	
+	getrusage(RUSAGE_SELF, &own);
+	
+	cpu       = (double)usage.ru_utime.tv_sec + (double)usage.ru_stime.tv_sec + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	generator = (double)own.ru_utime.tv_sec + (double)own.ru_stime.tv_sec + (double)(own.ru_utime.tv_usec + own.ru_stime.tv_usec) / 1e6;
+	
+	for (uint32_t i = 0, n = 0; i < deviceCount; i++)
+	{
+		if (records[i].readyTime != 0)
+		{
+			total[n]    = (double)(records[i].readyTime - records[i].askTime) / 1e6;
+			download[n] = (double)records[i].transferMs / 1000.0;
+			n++;
+		}
+	}
+	
+	qsort(total, ready, sizeof(double), lCompare);
+	qsort(download, ready, sizeof(double), lCompare);
+	
+	printf("%u %s devices, %u KB image, start-up spread %u s: %u ready in %.1f s\n", deviceCount, mode, imageKB, spreadMs / 1000, ready, wall);
+	printf("server: %u checks %.1f/s, %u TFTP sessions, %u blocks %.0f/s, %u retransmitted, %.2f MB/s served\n", checks, checks / wall, sessions, blocks, blocks / wall, retransmits, (double)blocks * FW_SERVER_TFTP_BLOCK_SIZE / wall / 1e6);
+	printf("server CPU: %.3f s, %.1f%% of a core, %.1f us per request\n", cpu, cpu / wall * 100, (checks + blocks != 0) ? cpu * 1e6 / (checks + blocks) : 0);
+	printf("check to image ready: p50 %.1f s, p90 %.1f s, p99 %.1f s, max %.1f s\n", dPercentile(total, ready, 50), dPercentile(total, ready, 90), dPercentile(total, ready, 99), dPercentile(total, ready, ready ? 100 : 0));
+	printf("download: p50 %.1f s, p90 %.1f s, p99 %.1f s, max %.1f s\n", dPercentile(download, ready, 50), dPercentile(download, ready, 90), dPercentile(download, ready, 99), dPercentile(download, ready, 100));
+	printf("simulator: %.1f s CPU, %.1f%% of a core, longest lag %.1f ms, close to a core the devices are slowed down by the generator\n", generator, generator / wall * 100, (double)xSimLateness() / 1000.0);
+	
+	passed = (ready == deviceCount && checks >= deviceCount);
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,204 @@
+/**
+  ******************************************************************************
+  * @file    hash_rate.c
+  * @brief   Cost of the image hash against the block arrival rate: the SHA-256
+  *          and the CRC32 of vCalculateCyclicCRC32 timed per TFTP block, as a
+  *          share of the time the next block takes on every modem link
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	const char *name;
+	uint32_t    baud;
+	uint32_t    overhead;																															/*bytes the modem adds to a block on the UART*/
+} hashLink_t;
+
+/* Private define ------------------------------------------------------------*/
+#define HASH_RUNS																						16																					/*runs over the image, the fastest one is kept*/
+
+/* Private variables ---------------------------------------------------------*/
+static const hashLink_t links[] =
+{
+	{"ESP8266 TFTP",   19200, 16},																												/*"\r\n+IPD,N,516:", the ESP8266 runs at 19200 for a transfer*/
+	{"ESP8266",       115200, 16},
+	{"UG95",          115200, 28},																												/*"\r\n+QIURC: \"recv\",N,516\r\n"*/
+	{"UART at 921600", 921600, 16},																											/*margin for a faster modem link*/
+};
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint64_t ullCycles(void)
+{
+	#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+	#else
+	return 0;
+	#endif
+}
+
+/**
+* @brief  This function checks the SHA-256 against the FIPS 180-2 vectors, one of them fed a byte at a time
+*/
+static bool bHashKnownAnswers(void)
+{
+	static const uint8_t abc[32] = {0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+																	0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD};
+	static const uint8_t twoBlocks[32] = {0x24, 0x8D, 0x6A, 0x61, 0xD2, 0x06, 0x38, 0xB8, 0xE5, 0xC0, 0x26, 0x93, 0x0C, 0x3E, 0x60, 0x39,
+																				0xA3, 0x3C, 0xE4, 0x59, 0x64, 0xFF, 0x21, 0x67, 0xF6, 0xEC, 0xED, 0xD4, 0x19, 0xDB, 0x06, 0xC1};
+	const char *message = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	sha256Context_t context;
+	uint8_t digest[32];
+	bool passed;
+	
+	vSHA256Init(&context);
+	vSHA256Update(&context, (const uint8_t *)"abc", 3);
+	vSHA256Final(&context, digest);
+	
+	passed = (memcmp(digest, abc, 32) == 0);
+	
+	vSHA256Init(&context);
+	
+	for (uint32_t i = 0; i < strlen(message); i++)
+	{
+		vSHA256Update(&context, (const uint8_t *)&message[i], 1);
+	}
+	
+	vSHA256Final(&context, digest);
+	
+	return passed && memcmp(digest, twoBlocks, 32) == 0;
+}
+
+/**
+* @brief  This function runs the per block path over an image, TFTP header included as the receive buffer holds it
+* @retval seconds of the fastest run, *cycles its time stamp counter ticks
+*/
+static double dHashImage(const uint8_t image[], uint32_t imageLength, uint32_t blockSize, bool crc, uint64_t *cycles)
+{
+	static uint8_t packet[4 + 65464];
+	double best = 1e9;
+	
+	for (uint32_t run = 0; run < HASH_RUNS; run++)
+	{
+		sha256Context_t context;
+		uint32_t checksum = 0;
+		uint8_t digest[32];
+		uint64_t startCycles = ullCycles();
+		double start = dSeconds(), elapsed;
+		
+		vSHA256Init(&context);
+		
+		for (uint32_t offset = 0; offset < imageLength; offset += blockSize)
+		{
+			uint32_t length = (imageLength - offset < blockSize) ? imageLength - offset : blockSize;
+			
+			memcpy(&packet[4], &image[offset], length);
+			
+			if (crc)
+			{
+				checksum = crc32(packet, length, checksum);
+			}
+			
+			vSHA256Update(&context, &packet[4], length);
+		}
+		
+		vSHA256Final(&context, digest);
+		
+		elapsed = dSeconds() - start;
+		
+		if (elapsed < best)
+		{
+			best    = elapsed;
+			*cycles = ullCycles() - startCycles;
+		}
+		
+		__asm__ volatile("" : : "r"(checksum), "r"(digest[0]) : "memory");
+	}
+	
+	return best;
+}
+
+/**
+* @brief  hash_rate [-k image KB] [-b block bytes] [-l most load percent]
+*					Fails if the hash takes more than the given share of the block interval on any link.
+*/
+int main(int argc, char *argv[])
+{
+	uint32_t imageLength = 256 * 1024, blockSize = 512, limit = 10, seed = 1;
+	uint64_t hashCycles = 0, bothCycles = 0;
+	double hashTime, bothTime, worst = 0;
+	uint8_t *image;
+	bool passed;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "k:b:l:")) != -1)
+	{
+		uint32_t value = strtoul(optarg, NULL, 0);
+		
+		switch (option)
+		{
+			case 'k': imageLength = value * 1024; break;
+			case 'b': blockSize = (value >= 8 && value <= 65464) ? value : 512; break;
+			case 'l': limit = value; break;
+			default:  return 2;
+		}
+	}
+	
+	image = malloc(imageLength);
+	
+	for (uint32_t i = 0; i < imageLength; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		image[i] = (uint8_t)(seed >> 24);
+	}
+	
+	passed   = bHashKnownAnswers();
+	hashTime = dHashImage(image, imageLength, blockSize, false, &hashCycles);
+	bothTime = dHashImage(image, imageLength, blockSize, true, &bothCycles);
+	
+	printf("SHA-256 known answers: %s\n", passed ? "match" : "MISMATCH");
+	printf("SHA-256 of %u KB in %u byte blocks: %.2f ns/byte, %.1f host cycles/byte, %.2f MB/s\n", imageLength / 1024, blockSize, hashTime * 1e9 / imageLength, (double)hashCycles / imageLength, imageLength / hashTime / 1e6);
+	printf("with the CRC32 of the same block: %.2f ns/byte, %.1f host cycles/byte, %.2f MB/s\n", bothTime * 1e9 / imageLength, (double)bothCycles / imageLength, imageLength / bothTime / 1e6);
+	
+	for (uint32_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+	{
+		double bytesPerSecond = links[i].baud / 10.0;
+		double interval = (blockSize + 4 + links[i].overhead) / bytesPerSecond;
+		double perBlock = bothTime * blockSize / imageLength;
+		
+		printf("%-15s %7.0f bytes/s, a block every %8.3f ms, hashed in %6.3f ms: %6.3f%% load, %6.0f cycles/byte at %u MHz before the hash would fall behind\n", links[i].name, bytesPerSecond, interval * 1e3, perBlock * 1e3, perBlock / interval * 100, SystemCoreClock / bytesPerSecond, SystemCoreClock / 1000000);
+		
+		if (perBlock / interval > worst)
+		{
+			worst = perBlock / interval;
+		}
+	}
+	
+	printf("the signature is checked once, on the finished hash, after the last block\n");
+	
+	passed &= (worst * 100 <= limit);
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	free(image);
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,294 @@
+/**
+  ******************************************************************************
+  * @file    kernel_benchmark.c
+  * @brief   Regression gate of ulBootloaderBenchmark on the host: the JSON lines
+  *          it prints are taken from its output, the fastest ticks of several
+  *          calls are compared kernel by kernel with a JSON baselines file, and
+  *          --update writes the file from the run instead. The file records a
+  *          calibration loop of the harness too, its baselines are scaled by the
+  *          speed of the host running the gate
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define KERNEL_NAME_SIZE																		32
+#define CALIBRATION_NAME																		"calibration"																/*kernel of the baselines file holding the calibration loop*/
+
+/* Private variables ---------------------------------------------------------*/
+static char kernelNames[BENCHMARK_KERNEL_COUNT][KERNEL_NAME_SIZE];
+
+/**
+* @brief  This function gives BOOTLOADER_TIMESTAMP in ns, finer than the ticks of the shim for kernels of a few hundred ns
+*/
+static uint32_t ulNanoseconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (uint32_t)((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+}
+
+/**
+* @brief  This function times a fixed loop of the harness, the same work on every host
+* @retval fastest ns of the loop
+*/
+static uint32_t ulCalibrate(void)
+{
+	uint32_t best = 0xFFFFFFFF;
+	
+	for (int run = 0; run < BENCHMARK_RUNS; run++)
+	{
+		volatile uint32_t sink;
+		uint32_t start = ulNanoseconds(), state = 2463534242U, elapsed;
+		
+		for (int i = 0; i < 4096; i++)/*xorshift32, a chain of dependent ALU operations*/
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+		}
+		
+		sink    = state;
+		elapsed = ulNanoseconds() - start;
+		best    = (elapsed < best) ? elapsed : best;
+		
+		(void)sink;
+	}
+	
+	return best;
+}
+
+/**
+* @brief  This function reads the kernels of JSON text: the lines ulBootloaderBenchmark prints, or a baselines file
+* @params ticks				-> ticks of every kernel found, the others are left as they are
+*					calibration	-> ticks of the CALIBRATION_NAME object of a baselines file, NULL to skip it
+* @retval kernels found
+*/
+static uint32_t ulParseKernels(FILE *file, uint32_t ticks[BENCHMARK_KERNEL_COUNT], uint32_t *calibration)
+{
+	char line[256], name[KERNEL_NAME_SIZE];
+	uint32_t found = 0, value;
+	
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		const char *object = strstr(line, "{\"kernel\":\"");
+		
+		if (object == NULL || sscanf(object, "{\"kernel\":\"%31[^\"]\",\"ticks\":%u", name, &value) != 2)
+		{
+			continue;
+		}
+		
+		if (calibration != NULL && strcmp(name, CALIBRATION_NAME) == 0)
+		{
+			*calibration = value;
+			
+			continue;
+		}
+		
+		for (uint32_t kernel = 0; kernel < BENCHMARK_KERNEL_COUNT; kernel++)
+		{
+			if (kernelNames[kernel][0] == 0)
+			{
+				strcpy(kernelNames[kernel], name);
+			}
+			
+			if (strcmp(kernelNames[kernel], name) == 0)
+			{
+				ticks[kernel] = value;
+				found++;
+				break;
+			}
+		}
+	}
+	
+	return found;
+}
+
+/**
+* @brief  This function calls ulBootloaderBenchmark with its output taken into a temporary file
+* @retval kernels it printed
+*/
+static uint32_t ulRunBenchmark(uint32_t ticks[BENCHMARK_KERNEL_COUNT])
+{
+	FILE *output = tmpfile();
+	uint32_t found;
+	int console;
+	
+	if (output == NULL)
+	{
+		return 0;
+	}
+	
+	fflush(stdout);
+	
+	console = dup(STDOUT_FILENO);
+	dup2(fileno(output), STDOUT_FILENO);
+	
+	(void)ulBootloaderBenchmark();
+	
+	fflush(stdout);
+	dup2(console, STDOUT_FILENO);
+	close(console);
+	
+	rewind(output);
+	
+	found = ulParseKernels(output, ticks, NULL);
+	
+	fclose(output);
+	
+	return found;
+}
+
+/**
+* @brief  This function writes the baselines file, a JSON array of the objects ulBootloaderBenchmark prints led by the
+*					calibration loop
+*/
+static bool bWriteBaselines(const char path[], const uint32_t ticks[BENCHMARK_KERNEL_COUNT], uint32_t calibration)
+{
+	FILE *file = fopen(path, "w");
+	
+	if (file == NULL)
+	{
+		perror(path);
+		
+		return false;
+	}
+	
+	fprintf(file, "[\n");
+	fprintf(file, "  {\"kernel\":\"%s\",\"ticks\":%u},\n", CALIBRATION_NAME, calibration);
+	
+	for (uint32_t kernel = 0; kernel < BENCHMARK_KERNEL_COUNT; kernel++)
+	{
+		fprintf(file, "  {\"kernel\":\"%s\",\"ticks\":%u}%s\n", kernelNames[kernel], ticks[kernel], (kernel + 1 < BENCHMARK_KERNEL_COUNT) ? "," : "");
+	}
+	
+	fprintf(file, "]\n");
+	
+	return fclose(file) == 0;
+}
+
+/**
+* @brief  kernel_benchmark [-b baselines file] [-p most regression percent] [-m ticks never counted as a regression]
+*					[-r calls, the fastest of them kept] [-u | --update]
+*					Fails if a kernel is slower than its baseline by more than the percent, or if the baselines file is missing.
+*					--update writes the file from the run. Ticks are ns, the baselines are scaled by the calibration loop of
+*					this run against the one of the file.
+*/
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {{"update", no_argument, NULL, 'u'}, {NULL, 0, NULL, 0}};
+	uint32_t ticks[BENCHMARK_KERNEL_COUNT], best[BENCHMARK_KERNEL_COUNT], baselines[BENCHMARK_KERNEL_COUNT] = {0};
+	uint32_t percent = 25, margin = 50, calls = 20, found = 0, regressed = 0, calibration = 0xFFFFFFFF, recorded = 0;
+	const char *path = "benchmark_baselines.json";
+	bool update = false, passed = true;
+	FILE *file;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt_long(argc, argv, "b:p:m:r:u", options, NULL)) != -1)
+	{
+		switch (option)
+		{
+			case 'b': path = optarg; break;
+			case 'p': percent = strtoul(optarg, NULL, 0); break;
+			case 'm': margin = strtoul(optarg, NULL, 0); break;
+			case 'r': calls = (strtoul(optarg, NULL, 0) > 0) ? strtoul(optarg, NULL, 0) : 1; break;
+			case 'u': update = true; break;
+			default:  return 2;
+		}
+	}
+	
+	xHostPort.timestamp = ulNanoseconds;
+	xHostDevice.flash   = pucHostFlashCreate();																						/*the flash and engage kernels program the storage slot*/
+	
+	memset(best, 0xFF, sizeof(best));
+	
+	for (uint32_t call = 0; call < calls; call++)
+	{
+		uint32_t loop = ulCalibrate();
+		
+		calibration = (loop < calibration) ? loop : calibration;
+		
+		if (ulRunBenchmark(ticks) != BENCHMARK_KERNEL_COUNT)
+		{
+			printf("ulBootloaderBenchmark printed no result of every kernel, is BOOTLOADER_BENCHMARK set?\n");
+			printf("FAIL\n");
+			
+			return 1;
+		}
+		
+		for (uint32_t kernel = 0; kernel < BENCHMARK_KERNEL_COUNT; kernel++)
+		{
+			best[kernel] = (ticks[kernel] < best[kernel]) ? ticks[kernel] : best[kernel];
+		}
+	}
+	
+	if (!update && (file = fopen(path, "r")) == NULL)
+	{
+		perror(path);
+		printf("no baselines to compare with, run with --update to record them\n");
+		printf("FAIL\n");
+		
+		return 1;
+	}
+	
+	if (!update)
+	{
+		found = ulParseKernels(file, baselines, &recorded);
+		
+		fclose(file);
+		
+		for (uint32_t kernel = 0; kernel < BENCHMARK_KERNEL_COUNT && recorded != 0; kernel++)/*to the speed of this host*/
+		{
+			baselines[kernel] = (uint32_t)((uint64_t)baselines[kernel] * calibration / recorded);
+		}
+		
+		printf("calibration loop %u ns, %u ns in %s\n", calibration, recorded, path);
+	}
+	
+	for (uint32_t kernel = 0; kernel < BENCHMARK_KERNEL_COUNT; kernel++)
+	{
+		bool slower = !update && baselines[kernel] != 0 && best[kernel] > baselines[kernel] + margin && (uint64_t)best[kernel] * 100 > (uint64_t)baselines[kernel] * (100 + percent);
+		
+		printf("%-14s %8u ns", kernelNames[kernel], best[kernel]);
+		
+		if (!update && baselines[kernel] != 0)
+		{
+			printf(", baseline %8u ns, %+6.1f%%%s", baselines[kernel], ((double)best[kernel] / baselines[kernel] - 1) * 100, slower ? " REGRESSED" : "");
+		}
+		
+		printf("\n");
+		
+		regressed += slower;
+	}
+	
+	if (update)
+	{
+		passed = bWriteBaselines(path, best, calibration);
+		
+		printf("baselines written to %s\n", path);
+	}
+	else
+	{
+		printf("%u of %u kernels slower than their baseline in %s by more than %u%%\n", regressed, BENCHMARK_KERNEL_COUNT, path, percent);
+		
+		passed = (regressed == 0 && found == BENCHMARK_KERNEL_COUNT);
+		
+		if (found != BENCHMARK_KERNEL_COUNT)
+		{
+			printf("%s holds %u of the %u kernels, run with --update\n", path, found, BENCHMARK_KERNEL_COUNT);
+		}
+	}
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+/**
+  ******************************************************************************
+  * @file    metadata_power.c
+  * @brief   Power loss at every write of the metadata log: the slot state
+  *          changes of update after update are appended through two
+  *          compactions, the power is cut in every program and erase of every
+  *          change, and the scan at the next power on must find the log either
+  *          before or after that change, then carry on from it
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define METADATA_LOG_ADDRESS																METADATA_SECTOR_A_ADDRESS										/*both sectors, A then B*/
+#define METADATA_LOG_SIZE																		(2 * METADATA_SECTOR_SIZE)
+#define POWER_ON																						1																						/*setjmp value of a power cut*/
+#define SOFT_RESET																					2																						/*setjmp value of NVIC_SystemReset, the log gave up*/
+
+/* Private variables ---------------------------------------------------------*/
+static jmp_buf  powerOn;
+static uint32_t operations, cutAt;																										/*program and erase operations so far, the one to cut, 0 for none*/
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static bool bPowerCut(uint32_t address, uint32_t length)
+{
+	(void)address;
+	(void)length;
+	
+	return ++operations == cutAt;
+}
+
+static void vReset(bool powerLoss)
+{
+	longjmp(powerOn, powerLoss ? POWER_ON : SOFT_RESET);
+}
+
+/**
+* @brief  This function gives the slot state change number n, the changes of an update: the storage is approved, the
+*					copy journaled, the image installed, the storage and the journal released, every update a new version
+*/
+static metadataRecord_t xChange(uint32_t n)
+{
+	metadataRecord_t record = {0};
+	uint32_t update = n / 5;
+	
+	record.imageLength = 0x10000 + update * 4;
+	record.imageCRC    = update * 2654435761U;
+	
+	sprintf(record.version, "%u.%u.%u", (update / 100) % 10, (update / 10) % 10, update % 10);
+	
+	switch (n % 5)
+	{
+		case 0:  record.slot = METADATA_STORAGE_SLOT;     record.state = METADATA_SLOT_APPROVED;  break;
+		case 1:  record.slot = METADATA_APPLY_SLOT;       record.state = METADATA_SLOT_APPLYING;  break;
+		case 2:  record.slot = METADATA_APPLICATION_SLOT; record.state = METADATA_SLOT_INSTALLED; break;
+		case 3:  record.slot = METADATA_STORAGE_SLOT;     record.state = METADATA_SLOT_ERASED;    break;
+		default: record.slot = METADATA_APPLY_SLOT;       record.state = METADATA_SLOT_ERASED;    break;
+	}
+	
+	return record;
+}
+
+/**
+* @brief  This function makes a slot state change as the bootloader does, an erased slot carries no image
+*/
+static void vApplyChange(bootMetadata_t *metadata, uint32_t n)
+{
+	metadataRecord_t record = xChange(n);
+	
+	vMetadataSetSlot(metadata, (metadataSlot_t)record.slot, (metadataSlotState_t)record.state, (record.state == METADATA_SLOT_ERASED) ? NULL : &record);
+}
+
+/**
+* @brief  This function keeps the expected slots up to date with a change, sequence 1 marks a slot that has a record
+*/
+static void vModelChange(metadataRecord_t model[METADATA_SLOT_COUNT], uint32_t n)
+{
+	metadataRecord_t record = xChange(n);
+	
+	if (record.state == METADATA_SLOT_ERASED)
+	{
+		record.imageLength = 0;
+		record.imageCRC    = 0;
+		
+		memset(record.version, 0, sizeof(record.version));
+	}
+	
+	record.sequence    = 1;
+	model[record.slot] = record;
+}
+
+/**
+* @brief  This function compares the slots of a scan with the expected ones, sequence numbers aside
+*/
+static bool bSameSlots(const bootMetadata_t *metadata, const metadataRecord_t model[METADATA_SLOT_COUNT])
+{
+	for (uint32_t i = 0; i < METADATA_SLOT_COUNT; i++)
+	{
+		const metadataRecord_t *scanned = &metadata->slots[i];
+		
+		if ((scanned->sequence != 0) != (model[i].sequence != 0))
+		{
+			return false;
+		}
+		
+		if (model[i].sequence != 0 && (scanned->state != model[i].state || scanned->imageLength != model[i].imageLength ||
+																	 scanned->imageCRC != model[i].imageCRC || memcmp(scanned->version, model[i].version, sizeof(model[i].version)) != 0))
+		{
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/**
+* @brief  metadata_power [-n slot state changes]
+*					The default crosses both compactions of the log, every program and erase of every change is cut once.
+*/
+int main(int argc, char *argv[])
+{
+	static uint8_t saved[METADATA_LOG_SIZE];
+	static bootMetadata_t metadata;
+	static uint32_t cuts, done, undone, failures, compactions, cut;																/*static, kept over the longjmp of a power cut*/
+	metadataRecord_t model[METADATA_SLOT_COUNT] = {0}, before[METADATA_SLOT_COUNT], after[METADATA_SLOT_COUNT], next[METADATA_SLOT_COUNT];
+	volatile uint32_t changes = 2200;
+	double start, scanTime;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': changes = strtoul(optarg, NULL, 0); break;
+			default:  return 2;
+		}
+	}
+	
+	xHostDevice.flash = pucHostFlashCreate();
+	xHostPort.powerCut = bPowerCut;
+	xHostPort.reset    = vReset;
+	
+	HAL_FLASH_Unlock();
+	
+	start = dSeconds();
+	
+	for (uint32_t n = 0; n < changes; n++)
+	{
+		uint32_t changeOperations;
+		
+		memcpy(saved, (const void *)BOOTLOADER_FLASH_POINTER(METADATA_LOG_ADDRESS), METADATA_LOG_SIZE);
+		memcpy(before, model, sizeof(model));
+		memcpy(after, model, sizeof(model));
+		vModelChange(after, n);
+		memcpy(next, after, sizeof(after));
+		vModelChange(next, n + 1);
+		
+		vMetadataScan(&metadata);
+		
+		operations = 0;
+		cutAt      = 0;
+		
+		vApplyChange(&metadata, n);
+		
+		changeOperations = operations;
+		compactions     += (changeOperations > sizeof(metadataRecord_t) / 4);
+		
+		for (cut = 1; cut <= changeOperations; cut++)
+		{
+			memcpy((void *)BOOTLOADER_FLASH_POINTER(METADATA_LOG_ADDRESS), saved, METADATA_LOG_SIZE);
+			
+			vMetadataScan(&metadata);
+			
+			operations = 0;
+			cutAt      = cut;
+			
+			switch (setjmp(powerOn))
+			{
+				case 0:
+					vApplyChange(&metadata, n);
+					
+					printf("change %u: operation %u of %u not cut\n", n, cut, changeOperations);
+					failures++;
+					continue;
+				case POWER_ON:
+					break;
+				default:
+					printf("change %u cut at operation %u: the log reset the device\n", n, cut);
+					failures++;
+					continue;
+			}
+			
+			cuts++;
+			cutAt = 0;
+			
+			if (setjmp(powerOn) != 0)
+			{
+				printf("change %u cut at operation %u: the log reset the device on its next writes\n", n, cut);
+				failures++;
+				continue;
+			}
+			
+			vMetadataScan(&metadata);
+			
+			if (bSameSlots(&metadata, after))
+			{
+				done++;
+			}
+			else if (bSameSlots(&metadata, before))
+			{
+				undone++;
+				
+				vApplyChange(&metadata, n);/*the change is made again as the bootloader redoes its step*/
+			}
+			else
+			{
+				printf("change %u cut at operation %u: the scan found neither the slots before nor after it\n", n, cut);
+				failures++;
+				continue;
+			}
+			
+			vApplyChange(&metadata, n + 1);
+			vMetadataScan(&metadata);
+			
+			if (!bSameSlots(&metadata, next))
+			{
+				printf("change %u cut at operation %u: the next change was lost\n", n, cut);
+				failures++;
+			}
+		}
+		
+		cutAt = 0;
+		
+		memcpy((void *)BOOTLOADER_FLASH_POINTER(METADATA_LOG_ADDRESS), saved, METADATA_LOG_SIZE);
+		
+		vMetadataScan(&metadata);
+		vApplyChange(&metadata, n);
+		
+		memcpy(model, after, sizeof(model));
+	}
+	
+	scanTime = dSeconds();
+	
+	vMetadataScan(&metadata);
+	
+	scanTime = dSeconds() - scanTime;
+	
+	if (!bSameSlots(&metadata, model))
+	{
+		printf("the log doesn't end with the last change\n");
+		failures++;
+	}
+	
+	printf("%u slot state changes, %u compactions, %u power cuts at every program and erase: %u came back with the change made, %u without it, %u failures, %.1f s\n", changes, compactions, cuts, done, undone, failures, dSeconds() - start);
+	printf("scan of the log at sequence %u, %u records in the active sector: %.1f us\n", metadata.sequence, (metadata.nextAddress - metadata.activeSector) / (uint32_t)sizeof(metadataRecord_t), scanTime * 1e6);
+	printf("%s\n", (failures == 0 && compactions >= 2) ? "PASS" : "FAIL");
+	
+	return (failures == 0 && compactions >= 2) ? 0 : 1;
+}
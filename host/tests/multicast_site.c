@@ -0,0 +1,258 @@
+/**
+  ******************************************************************************
+  * @file    multicast_site.c
+  * @brief   RFC 2090 multicast TFTP of a site: the Wi-Fi devices ask 1.2.3
+  *          with a manifest and the server sends its blocks to one group as
+  *          the master client acknowledges them. A device joining late takes
+  *          them from the middle of the image, the gaps of a lossy one are sent
+  *          to the group again once it is handed the master role, and when the
+  *          master is switched off the device left asks again to be made master.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	bool     installed;																																/*1.2.3 started*/
+	bool     outOfOrder;																															/*held a block past a gap*/
+	uint32_t duplicates;																															/*blocks it already had, sent again for another device*/
+} multicastRecord_t;
+
+/* Private define ------------------------------------------------------------*/
+#define MULTICAST_GROUP_IP																	"239.0.0.1"
+#define MULTICAST_GROUP_PORT																1758																				/*tftp-mcast*/
+#define MULTICAST_STARTUP_CHECK_MS													1000																				/*a device checks for updates a second after power on*/
+#define MULTICAST_POLL_US																		50000																				/*virtual time between looks at the devices*/
+#define MULTICAST_SITE_LIMIT_US															(600ULL * 1000000)
+
+/* Private variables ---------------------------------------------------------*/
+static fwServer_t server;
+static uint32_t imageLength = 64 * 1024;
+
+/**
+* @brief  This function builds an image: the vector table of the application slot, random code after it
+*/
+static void vMakeImage(uint8_t image[], uint32_t length, uint32_t seed)
+{
+	uint32_t *words = (uint32_t *)image;
+	
+	for (uint32_t i = 0; i < length / 4; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		words[i] = seed;
+	}
+	
+	words[0] = 0x20004000U;
+	words[1] = APPLICATION_ADDRESS + 0x201;
+}
+
+/**
+* @brief  This function programs an approved image in the application slot as the factory does, trailer of the legacy layout
+*/
+static void vProgramFactoryImage(const uint8_t image[], uint32_t length, const char version[])
+{
+	uint32_t word;
+	
+	vHostFlashWrite(APPLICATION_ADDRESS, image, length);
+	
+	word = length;
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_LENGTH_OFFSET, &word, 4);
+	
+	word = ulFwServerCRC32(image, length, 0);
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET, &word, 4);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		word = (uint8_t)version[i];
+		vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24 + 4 * i, &word, 4);
+	}
+	
+	word = 1;
+	vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4, &word, 4);
+}
+
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	(void)version;
+	
+	vBootloaderApplyNow();
+}
+
+/**
+* @brief  This function is the application of a device: 1.0.0 checks for updates soon after power on, the new image
+*					stops the device
+*/
+static void vDeviceApplication(simDevice_t *device)
+{
+	multicastRecord_t *record = device->user;
+	
+	if (memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), server.image, server.imageLength) == 0)
+	{
+		record->installed = true;
+		
+		return;
+	}
+	
+	vSimApplicationStart(device);
+	
+	xBootloaderVariables.timers[STARTUP_CHECK_TIMER].duration = MULTICAST_STARTUP_CHECK_MS;
+	
+	for (;;)
+	{
+		vBootloaderUpdateTask();
+		
+		vSimIdle();
+	}
+}
+
+/**
+* @brief  This function powers on a device of the site running 1.0.0
+*/
+static simDevice_t *pxSiteDevice(uint32_t index, const simModemConfig_t *config, multicastRecord_t *record, const uint8_t factory[])
+{
+	simDevice_t *device = pxSimDeviceCreate(index);
+	
+	pxSimModemAttach(device, config);
+	
+	device->user        = record;
+	device->application = vDeviceApplication;
+	
+	vProgramFactoryImage(factory, imageLength, "1.0.0");
+	
+	return device;
+}
+
+/**
+* @brief  This function runs a site until its devices stopped, looking at their multicast state in between: the first
+*					device, one joining a quarter into the image and a lossy one joining at once
+* @params bool switchOff -> true switches the first device off once half of the blocks were sent, there is no lossy one
+* @retval false if a device that wasn't switched off was not updated
+*/
+static bool bRunSite(const char name[], bool switchOff, const simModemConfig_t *config, const simModemConfig_t *lossy, const uint8_t image[], const uint8_t factory[],
+										 multicastRecord_t records[3])
+{
+	simDevice_t *devices[3] = {NULL};
+	uint32_t blocks = imageLength / FW_SERVER_TFTP_BLOCK_SIZE + 1, count = switchOff ? 2 : 3;
+	bool done = false, updated = true;
+	
+	vSimInit(switchOff ? 2 : 1);
+	
+	bFwServerInit(&server, image, imageLength, "1.2.3", "10.0.0.2");
+	bFwServerManifest(&server);
+	
+	strcpy(server.multicastIP, MULTICAST_GROUP_IP);
+	
+	server.multicastPort = MULTICAST_GROUP_PORT;
+	pxSimServer          = &server;
+	
+	memset(records, 0, 3 * sizeof(multicastRecord_t));
+	
+	devices[0] = pxSiteDevice(0, config, &records[0], factory);
+	
+	while (!done && xSimNow() < MULTICAST_SITE_LIMIT_US)
+	{
+		vSimRun(xSimNow() + MULTICAST_POLL_US);
+		
+		if (!switchOff && devices[2] == NULL && server.multicastMemberCount >= 1)
+		{
+			devices[2] = pxSiteDevice(2, lossy, &records[2], factory);															/*joins while the first one is master*/
+		}
+		
+		if (devices[1] == NULL && server.blocks >= blocks / 4)
+		{
+			devices[1] = pxSiteDevice(1, config, &records[1], factory);															/*joins a quarter into the image*/
+		}
+		
+		if (switchOff && !devices[0]->halted && server.blocks >= blocks / 2)
+		{
+			devices[0]->halted = true;																												/*switched off, the server isn't told*/
+		}
+		
+		done = true;
+		
+		for (uint32_t i = 0; i < count; i++)
+		{
+			done &= (devices[i] != NULL && devices[i]->halted);/*1.2.3 started, or switched off*/
+			
+			if (devices[i] != NULL && !devices[i]->halted)
+			{
+				vSimLoad(devices[i]);
+				
+				if (xBootloaderVariables.multicast.active)
+				{
+					records[i].outOfOrder |= xBootloaderVariables.multicast.receivedBlocks > xBootloaderVariables.multicast.contiguousBlocks;
+					records[i].duplicates  = (xBootloaderVariables.multicast.duplicateBlocks > records[i].duplicates) ? xBootloaderVariables.multicast.duplicateBlocks : records[i].duplicates;
+				}
+			}
+		}
+	}
+	
+	printf("%-10s %u blocks of a %u KB image, %u sessions, %u group blocks, %u retransmits, %u hand-offs, %u asked again, %.0f s\n",
+				 name, blocks, imageLength / 1024, server.sessions, server.blocks, server.retransmits, server.handOffs, server.reasks, (double)xSimNow() / 1e6);
+	
+	for (uint32_t i = 0; i < count; i++)
+	{
+		updated &= records[i].installed || (switchOff && i == 0);
+		
+		printf("%-10s device %u: %s, %s, %u duplicate blocks\n", name, i, (switchOff && i == 0) ? "switched off" : records[i].installed ? "installed" : "NOT INSTALLED",
+					 records[i].outOfOrder ? "blocks out of order" : "blocks in order", records[i].duplicates);
+	}
+	
+	vFwServerFree(&server);
+	
+	pxSimServer = NULL;
+	
+	return done && updated;
+}
+
+/**
+* @brief  multicast_site [-k image KB] [-l loss permille of the lossy device]
+*					Fails if a device is not updated, the late one didn't take blocks out of order, no device dropped duplicates,
+*					or the master role was neither handed over nor taken by asking again.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t wifi  = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}};
+	simModemConfig_t lossy = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 100}};
+	multicastRecord_t records[3];
+	uint8_t *image, *factory;
+	bool passed;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "k:l:")) != -1)
+	{
+		switch (option)
+		{
+			case 'k': imageLength = strtoul(optarg, NULL, 0) * 1024; break;
+			case 'l': lossy.link.lossPermille = strtoul(optarg, NULL, 0); break;
+			default:  return 2;
+		}
+	}
+	
+	WIFI_UART.Init.BaudRate = wifi.baud;																							/*UART init of the application, every device starts with it*/
+	
+	image   = malloc(imageLength);
+	factory = malloc(imageLength);
+	
+	vMakeImage(image, imageLength, 123);
+	vMakeImage(factory, imageLength, 100);
+	
+	passed  = bRunSite("hand-off", false, &wifi, &lossy, image, factory, records);
+	passed &= records[1].outOfOrder && (records[1].duplicates > 0 || records[2].duplicates > 0) && server.handOffs >= 1;
+	
+	passed &= bRunSite("switch-off", true, &wifi, &lossy, image, factory, records);
+	passed &= records[1].outOfOrder && server.reasks >= 1;
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	free(image);
+	free(factory);
+	
+	return passed ? 0 : 1;
+}
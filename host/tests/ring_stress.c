@@ -0,0 +1,247 @@
+/**
+  ******************************************************************************
+  * @file    ring_stress.c
+  * @brief   Stress test of the UART receive rings: the receive interrupts and the
+  *          update task run as threads, producing and draining as fast as they can
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	UART_HandleTypeDef *huart;
+	uartRing_t         *ring;
+	uint64_t            length;																										/*bytes to produce*/
+	bool                throttle;																									/*wait while the ring is full instead of dropping*/
+	uint64_t            produced;
+} producer_t;
+
+/* Private variables ---------------------------------------------------------*/
+static volatile bool producersDone;
+
+/**
+* @brief  This function gives the byte at a position of the test stream of a ring
+*/
+static inline uint8_t ucStreamByte(uint64_t position, uint32_t ringNo)
+{
+	uint64_t x = (position + 1) * 0x9E3779B97F4A7C15ULL + ringNo;
+	
+	return (uint8_t)(x >> 56);
+}
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+* @brief  This function is the receive interrupt of a ring, writing it as fast as it can
+*/
+static void *pvRawProducer(void *argument)
+{
+	producer_t *producer = argument;
+	
+	for (uint64_t i = 0; i < producer->length; i++)
+	{
+		while (!bBootloaderRingWrite(producer->ring, ucStreamByte(i, 0)))
+		{
+			sched_yield();/*the host may have fewer cores than threads*/
+		}
+	}
+	
+	__atomic_store_n(&producer->produced, producer->length, __ATOMIC_RELEASE);
+	
+	return NULL;
+}
+
+/**
+* @brief  This function is the receive interrupt of a modem UART, entering through vBootloaderUartRxISR
+*/
+static void *pvIsrProducer(void *argument)
+{
+	producer_t *producer = argument;
+	uint32_t ringNo = (producer->ring == &xGSMRxRing) ? 1 : 2;
+	
+	for (uint64_t i = 0; i < producer->length; i++)
+	{
+		while (producer->throttle && producer->ring->head - producer->ring->tail >= BOOTLOADER_UART_RING_SIZE)
+		{
+			sched_yield();
+		}
+		
+		vBootloaderUartRxISR(producer->huart, ucStreamByte(i, ringNo));
+	}
+	
+	__atomic_store_n(&producer->produced, producer->length, __ATOMIC_RELEASE);
+	
+	return NULL;
+}
+
+/**
+* @brief  This function checks a ring written at the raw ring interface with back pressure, nothing may be lost
+*/
+static bool bRawRing(uint64_t length)
+{
+	producer_t producer = {.ring = &xWifiRxRing, .length = length};
+	uint8_t chunk[256];
+	uint64_t received = 0, mismatches = 0;
+	uint32_t got;
+	pthread_t thread;
+	double start = dSeconds(), seconds;
+	
+	memset(&xWifiRxRing, 0, sizeof(xWifiRxRing));
+	
+	pthread_create(&thread, NULL, pvRawProducer, &producer);
+	
+	while (received < length)
+	{
+		got = ulBootloaderRingRead(&xWifiRxRing, chunk, (uint32_t)((length - received < sizeof(chunk)) ? length - received : sizeof(chunk)));
+		
+		for (uint32_t i = 0; i < got; i++)
+		{
+			mismatches += (chunk[i] != ucStreamByte(received + i, 0));
+		}
+		
+		received += got;
+		
+		if (got == 0)
+		{
+			sched_yield();
+		}
+	}
+	
+	pthread_join(thread, NULL);
+	
+	seconds = dSeconds() - start;
+	
+	printf("raw ring: %llu bytes in %.3f s, %.1f MB/s, %llu mismatches, %u full ring retries\n", (unsigned long long)received, seconds, (double)received / seconds / 1e6, (unsigned long long)mismatches, xWifiRxRing.overflowCounter);
+	
+	return mismatches == 0 && xWifiRxRing.head == xWifiRxRing.tail;
+}
+
+/**
+* @brief  This function runs both receive interrupts against the draining update task
+* @param  throttle -> true holds each interrupt while its ring is full, the task must then get every byte in order,
+*										 false runs the interrupts unpaced, every byte must then be either delivered or counted as dropped
+*/
+static bool bModemRings(uint64_t length, bool throttle)
+{
+	producer_t producer[2] = {{.huart = &GSM_UART, .ring = &xGSMRxRing, .length = length, .throttle = throttle}, {.huart = &WIFI_UART, .ring = &xWifiRxRing, .length = length, .throttle = throttle}};
+	uint64_t received[2] = {0}, mismatches = 0, dropped;
+	pthread_t thread[2];
+	double start = dSeconds(), seconds;
+	bool passed = true;
+	
+	memset(&xGSMRxRing, 0, sizeof(xGSMRxRing));
+	memset(&xWifiRxRing, 0, sizeof(xWifiRxRing));
+	
+	gsmquectel_clearAllParams();
+	wifi_clearParams();
+	
+	producersDone = false;
+	
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		pthread_create(&thread[i], NULL, pvIsrProducer, &producer[i]);
+	}
+	
+	for (;;)
+	{
+		bool idle = producersDone && xGSMRxRing.head == xGSMRxRing.tail && xWifiRxRing.head == xWifiRxRing.tail;
+		
+		vBootloaderDrainUartRings();
+		
+		if (throttle)
+		{
+			for (uint32_t i = 0; i < GSM_BUFFER_RECEIVE_INDEX; i++)
+			{
+				mismatches += ((uint8_t)GSM_BUFFER[i] != ucStreamByte(received[0] + i, 1));
+			}
+			
+			for (uint32_t i = 0; i < WIFI_BUFFER_RECEIVE_INDEX; i++)
+			{
+				mismatches += ((uint8_t)WIFI_BUFFER[i] != ucStreamByte(received[1] + i, 2));
+			}
+		}
+		
+		received[0] += GSM_BUFFER_RECEIVE_INDEX;
+		received[1] += WIFI_BUFFER_RECEIVE_INDEX;
+		
+		if (GSM_BUFFER_RECEIVE_INDEX == 0 && WIFI_BUFFER_RECEIVE_INDEX == 0)
+		{
+			sched_yield();
+		}
+		
+		GSM_BUFFER_RECEIVE_INDEX  = 0;
+		WIFI_BUFFER_RECEIVE_INDEX = 0;
+		
+		if (idle)
+		{
+			break;
+		}
+		
+		if (__atomic_load_n(&producer[0].produced, __ATOMIC_ACQUIRE) == length && __atomic_load_n(&producer[1].produced, __ATOMIC_ACQUIRE) == length)
+		{
+			producersDone = true;
+		}
+	}
+	
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		pthread_join(thread[i], NULL);
+	}
+	
+	seconds = dSeconds() - start;
+	
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		dropped = producer[i].ring->overflowCounter;
+		
+		printf("%s %s: %llu bytes produced, %llu delivered, %llu dropped in %.3f s, %.1f MB/s delivered, %.0f times 115200 baud\n", throttle ? "paced" : "unpaced", (i == 0) ? "GSM " : "WIFI", (unsigned long long)length, (unsigned long long)received[i], (unsigned long long)dropped, seconds, (double)received[i] / seconds / 1e6, (double)received[i] / seconds / 11520.0);
+		
+		if (received[i] + dropped != length || (throttle && dropped != 0))
+		{
+			passed = false;
+		}
+	}
+	
+	if (mismatches != 0)
+	{
+		printf("%llu bytes delivered out of order\n", (unsigned long long)mismatches);
+		
+		passed = false;
+	}
+	
+	return passed;
+}
+
+/**
+* @brief  ring_stress [bytes per ring]
+*/
+int main(int argc, char *argv[])
+{
+	uint64_t length = (argc > 1) ? strtoull(argv[1], NULL, 0) : 4000000ULL;
+	bool passed = true;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	vHostApplicationInit();
+	
+	passed &= bRawRing(length);
+	passed &= bModemRings(length, true);
+	passed &= bModemRings(length, false);
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,348 @@
+/**
+  ******************************************************************************
+  * @file    schedule_sim.c
+  * @brief   Fleet simulation of the firmware version check schedule: every device
+  *          of the fleet runs the scheduling code of the bootloader after a common
+  *          power on, the requests reaching the server are counted per minute
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+
+/* Typedefs ------------------------------------------------------------------*/
+/*Scheduling state of one device, swapped in and out of xBootloaderVariables*/
+typedef struct
+{
+	bootloaderTimer_t askTimer, startupTimer;
+	uint32_t          deviceHash, randomState;
+	uint8_t           rolloutBucket;
+	bool              triggerUpdateAtStart;
+	uint32_t          reservedMinute;																														/*minute a Retry-After holds for the device, 0 without one*/
+	uint64_t          wake;																																	/*ms of the next check of the timers*/
+} fleetDevice_t;
+
+typedef struct
+{
+	const char *name;
+	bool        fixedPeriod;																															/*schedule before the phase offset and the jitter*/
+	uint32_t    capacityPerMinute;																												/*server answers a Retry-After above it, 0 never does*/
+	uint32_t    rolloutPercent;
+} scenario_t;
+
+typedef struct
+{
+	uint32_t peak, peakMinute, peakServed, served, deferred, inRollout;
+} result_t;
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t simNow;
+static fleetDevice_t *fleet;
+static uint32_t *heap, heapCount;
+static uint32_t *perMinute, *servedPerMinute;/*requests arriving and requests served or held for a Retry-After*/
+static uint32_t deviceCount = 10000, horizonMinutes = 48 * 60;
+
+static uint32_t ulSimTick(void)
+{
+	return simNow;
+}
+
+/**
+* @brief  This function keeps the devices ordered by their next wake up time
+*/
+static void vHeapSift(uint32_t i)
+{
+	for (;;)
+	{
+		uint32_t smallest = i, left = 2 * i + 1, right = left + 1, swap;
+		
+		if (left < heapCount && fleet[heap[left]].wake < fleet[heap[smallest]].wake)
+		{
+			smallest = left;
+		}
+		
+		if (right < heapCount && fleet[heap[right]].wake < fleet[heap[smallest]].wake)
+		{
+			smallest = right;
+		}
+		
+		if (smallest == i)
+		{
+			return;
+		}
+		
+		swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		
+		i = smallest;
+	}
+}
+
+static void vDeviceLoad(fleetDevice_t *device)
+{
+	xBootloaderVariables.timers[ASK_FOR_UPDATE_TIMER] = device->askTimer;
+	xBootloaderVariables.timers[STARTUP_CHECK_TIMER]  = device->startupTimer;
+	xBootloaderVariables.deviceHash                   = device->deviceHash;
+	xBootloaderVariables.randomState                  = device->randomState;
+	xBootloaderVariables.rolloutBucket                = device->rolloutBucket;
+	xBootloaderVariables.triggerUpdateAtStartWifi     = device->triggerUpdateAtStart;
+}
+
+/**
+* @brief  This function stores the state of the device and finds when its next check is due
+*/
+static void vDeviceStore(fleetDevice_t *device)
+{
+	bool pending = xBootloaderVariables.triggerUpdateAtStartWifi;
+	bootloaderTimer_t *timer = &xBootloaderVariables.timers[pending ? STARTUP_CHECK_TIMER : ASK_FOR_UPDATE_TIMER];
+	uint32_t elapsed = simNow - timer->start;
+	
+	device->askTimer             = xBootloaderVariables.timers[ASK_FOR_UPDATE_TIMER];
+	device->startupTimer         = xBootloaderVariables.timers[STARTUP_CHECK_TIMER];
+	device->randomState          = xBootloaderVariables.randomState;
+	device->triggerUpdateAtStart = pending;
+	device->wake                 = simNow + ((elapsed >= timer->duration) ? 1 : timer->duration - elapsed);
+}
+
+/**
+* @brief  This function answers a checkFirmware request as the server would
+* @retval true if the request was served, false if it was told to come back later
+* @note   Above the capacity of the current minute the request is given a Retry-After pointing to the first minute
+*					with capacity left, that minute is held for it, so deferred requests fill the following minutes one by one
+*					instead of coming back together.
+*/
+static bool bServerAnswer(const scenario_t *scenario, fleetDevice_t *device, uint32_t minute, char response[], result_t *result)
+{
+	uint32_t later;
+	
+	if (device->reservedMinute == minute && minute != 0)/*comes back into the minute held for it*/
+	{
+		device->reservedMinute = 0;
+	}
+	else if (scenario->capacityPerMinute == 0 || servedPerMinute[minute] < scenario->capacityPerMinute)
+	{
+		servedPerMinute[minute]++;
+	}
+	else
+	{
+		for (later = minute + 1; later < horizonMinutes && servedPerMinute[later] >= scenario->capacityPerMinute; later++);
+		
+		if (later < horizonMinutes)
+		{
+			servedPerMinute[later]++;
+		}
+		
+		device->reservedMinute = later;
+		
+		sprintf(response, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: %u\r\n\r\n", later * 60 - simNow / 1000);
+		
+		bBootloaderApplySchedulingHints(response);
+		
+		result->deferred++;
+		
+		return false;
+	}
+	
+	sprintf(response, "HTTP/1.1 200 OK\r\n\r\n{\"data\":{\"file\":\"rx-1.2.3bin\",\"rollout\":\"%u\"}}", scenario->rolloutPercent);
+	
+	if (bBootloaderApplySchedulingHints(response))
+	{
+		result->inRollout++;
+	}
+	
+	result->served++;
+	
+	return true;
+}
+
+/**
+* @brief  This function runs the fleet from a common power on over the horizon
+*/
+static result_t xRunScenario(const scenario_t *scenario)
+{
+	result_t result = {0};
+	char response[256];
+	
+	memset(perMinute, 0, horizonMinutes * sizeof(uint32_t));
+	memset(servedPerMinute, 0, horizonMinutes * sizeof(uint32_t));
+	
+	simNow = 0;
+	
+	for (uint32_t i = 0; i < deviceCount; i++)
+	{
+		xHostDevice.uid[0] = 0x00470031U + i / 4096;/*wafer coordinates, lot and wafer number of an STM32 UID*/
+		xHostDevice.uid[1] = 0x3436510BU;
+		xHostDevice.uid[2] = 0x30383935U + i % 4096 * 0x00010003U;
+		
+		vBootloadervariablesInit();
+		
+		xBootloaderVariables.triggerUpdateAtStartWifi = true;/*the application asks once its link is up*/
+		
+		fleet[i].deviceHash     = xBootloaderVariables.deviceHash;
+		fleet[i].rolloutBucket  = xBootloaderVariables.rolloutBucket;
+		fleet[i].reservedMinute = 0;
+		
+		vDeviceStore(&fleet[i]);
+		
+		if (scenario->fixedPeriod)/*checked at power on, then every PERIODIC_FW_UPDATE_TIME*/
+		{
+			fleet[i].wake = 0;
+		}
+		
+		heap[i] = i;
+	}
+	
+	heapCount = deviceCount;
+	
+	for (int32_t i = (int32_t)heapCount / 2; i >= 0; i--)
+	{
+		vHeapSift((uint32_t)i);
+	}
+	
+	while (fleet[heap[0]].wake < (uint64_t)horizonMinutes * 60000)
+	{
+		fleetDevice_t *device = &fleet[heap[0]];
+		uint32_t minute;
+		
+		simNow = (uint32_t)device->wake;
+		minute = simNow / 60000;
+		
+		if (scenario->fixedPeriod)
+		{
+			perMinute[minute]++;
+			servedPerMinute[minute]++;
+			
+			result.served++;
+			
+			device->wake += PERIODIC_FW_UPDATE_TIME;
+			
+			vHeapSift(0);
+			
+			continue;
+		}
+		
+		vDeviceLoad(device);
+		
+		if (bBootloaderUpdateCheckDue(&xBootloaderVariables.triggerUpdateAtStartWifi))
+		{
+			perMinute[minute]++;
+			
+			bServerAnswer(scenario, device, minute, response, &result);
+		}
+		
+		vDeviceStore(device);
+		
+		vHeapSift(0);
+	}
+	
+	for (uint32_t minute = 0; minute < horizonMinutes; minute++)
+	{
+		if (perMinute[minute] > result.peak)
+		{
+			result.peak       = perMinute[minute];
+			result.peakMinute = minute;
+		}
+		
+		if (servedPerMinute[minute] > result.peakServed)
+		{
+			result.peakServed = servedPerMinute[minute];
+		}
+	}
+	
+	return result;
+}
+
+/**
+* @brief  This function draws the requests per minute of the first hours as rows of ten minutes
+*/
+static void vPlotFirstHours(uint32_t hours)
+{
+	uint32_t scale = 1;
+	
+	for (uint32_t minute = 0; minute < hours * 60; minute++)
+	{
+		while (perMinute[minute] / scale > 60)
+		{
+			scale *= 2;
+		}
+	}
+	
+	printf("  requests per 10 minutes, '#' = %u requests per minute\n", scale);
+	
+	for (uint32_t row = 0; row < hours * 6; row++)
+	{
+		uint32_t peak = 0;
+		
+		for (uint32_t minute = row * 10; minute < row * 10 + 10; minute++)
+		{
+			peak = (perMinute[minute] > peak) ? perMinute[minute] : peak;
+		}
+		
+		printf("  %02u:%02u %6u |", row / 6, row % 6 * 10, peak);
+		
+		for (uint32_t i = 0; i < peak / scale; i++)
+		{
+			putchar('#');
+		}
+		
+		putchar('\n');
+	}
+}
+
+/**
+* @brief  schedule_sim [devices] [hours] [server capacity per minute]
+*/
+int main(int argc, char *argv[])
+{
+	uint32_t capacity;
+	result_t results[4];
+	bool passed;
+	
+	deviceCount    = (argc > 1) ? strtoul(argv[1], NULL, 0) : deviceCount;
+	horizonMinutes = (argc > 2) ? strtoul(argv[2], NULL, 0) * 60 : horizonMinutes;
+	capacity       = (argc > 3) ? strtoul(argv[3], NULL, 0) : deviceCount / 100;
+	
+	const scenario_t scenarios[4] =
+	{
+		{"fixed 16 h period, checked at power on", true, 0, 100},
+		{"UID phase offset and jitter", false, 0, 100},
+		{"offset, jitter and Retry-After", false, capacity, 100},
+		{"offset, jitter, Retry-After, rollout 25%", false, capacity, 25},
+	};
+	
+	xHostPort.tick = ulSimTick;
+	xHostDevice.flash = pucHostFlashCreate();
+	
+	fleet     = calloc(deviceCount, sizeof(fleetDevice_t));
+	heap      = calloc(deviceCount, sizeof(uint32_t));
+	perMinute       = calloc(horizonMinutes, sizeof(uint32_t));
+	servedPerMinute = calloc(horizonMinutes, sizeof(uint32_t));
+	
+	printf("%u devices powered on together, %u h simulated, server capacity %u requests per minute\n", deviceCount, horizonMinutes / 60, capacity);
+	
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		results[i] = xRunScenario(&scenarios[i]);
+		
+		printf("\n%s:\n  peak %u requests per minute at %02u:%02u, peak %u served per minute, %u checks served, %u deferred", scenarios[i].name, results[i].peak, results[i].peakMinute / 60, results[i].peakMinute % 60, results[i].peakServed, results[i].served, results[i].deferred);
+		
+		if (!scenarios[i].fixedPeriod)
+		{
+			printf(", %u checks inside the rollout", results[i].inRollout);
+		}
+		
+		printf("\n");
+		
+		if (i < 3)
+		{
+			vPlotFirstHours(1);
+		}
+	}
+	
+	passed = results[1].peak * 10 < results[0].peak && results[2].peakServed <= capacity && results[3].inRollout < results[3].served / 3;
+	
+	printf("\n%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+/**
+  ******************************************************************************
+  * @file    seed_site.c
+  * @brief   WAN traffic of a site updating from a LAN seed: the Wi-Fi devices
+  *          of a site run 1.0.0, the server offers 1.2.3 with a manifest to the
+  *          first one and holds the others back until it seeds, they then
+  *          download it from that device over the LAN by HTTP Range. The bytes
+  *          the server sent are compared with a site where every device
+  *          downloads the image by TFTP.
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <time.h>
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	bool      updated;																															/*1.2.3 started*/
+	simTime_t updatedTime;
+	bool      fromSeed;																															/*image taken from the LAN seed*/
+} seedRecord_t;
+
+/* Private define ------------------------------------------------------------*/
+#define SEED_STARTUP_SPREAD_MS															60000																				/*start-up checks of the site spread over a minute*/
+#define SEED_SITE_LIMIT_US																	(4ULL * 3600 * 1000000)
+
+/* Private variables ---------------------------------------------------------*/
+static fwServer_t server;
+static uint32_t   updated;
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+* @brief  This function builds an image: the vector table of the application slot, random code after it
+*/
+static void vMakeImage(uint8_t image[], uint32_t length, uint32_t seed)
+{
+	uint32_t *words = (uint32_t *)image;
+	
+	for (uint32_t i = 0; i < length / 4; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		words[i] = seed;
+	}
+	
+	words[0] = 0x20004000U;
+	words[1] = APPLICATION_ADDRESS + 0x201;
+}
+
+/**
+* @brief  This function programs an approved image in the application slot as the factory does, trailer of the legacy layout
+*/
+static void vProgramFactoryImage(const uint8_t image[], uint32_t length, const char version[])
+{
+	uint32_t word;
+	
+	vHostFlashWrite(APPLICATION_ADDRESS, image, length);
+	
+	word = length;
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_LENGTH_OFFSET, &word, 4);
+	
+	word = ulFwServerCRC32(image, length, 0);
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET, &word, 4);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		word = (uint8_t)version[i];
+		vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24 + 4 * i, &word, 4);
+	}
+	
+	word = 1;
+	vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4, &word, 4);
+}
+
+/**
+* @brief  This function takes the firmware ready callback of the bootloader, the image is applied at once
+*/
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	seedRecord_t *record = pxSimCurrent()->user;
+	
+	(void)version;
+	
+	record->fromSeed = (xBootloaderVariables.seedIP[0] != 0);
+	
+	vBootloaderApplyNow();
+}
+
+/**
+* @brief  This function is the application of a device of the site: the start-up check spread over a minute, the update
+*					task run by both images. The first device running 1.2.3 is given as the seed of the site, as the server
+*					would learn it from its next check.
+*/
+static void vSiteApplication(simDevice_t *device)
+{
+	seedRecord_t *record = device->user;
+	
+	vSimApplicationStart(device);
+	
+	xBootloaderVariables.timers[STARTUP_CHECK_TIMER].duration = xBootloaderVariables.deviceHash % SEED_STARTUP_SPREAD_MS;
+	
+	if (!record->updated && memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), server.image, server.imageLength) == 0)
+	{
+		record->updated     = true;
+		record->updatedTime = device->clock;
+		
+		updated++;
+		
+		if (server.seeding && server.seedIP[0] == 0)
+		{
+			vSimLanIP(device->index, server.seedIP);
+		}
+	}
+	
+	for (;;)
+	{
+		vBootloaderUpdateTask();
+		
+		vSimIdle();
+	}
+}
+
+/**
+* @brief  This function updates the devices of one site
+* @retval bytes the server sent, 0 if a device was not updated
+*/
+static uint64_t ullSite(const simModemConfig_t *config, const uint8_t image[], const uint8_t factory[], uint32_t imageLength, uint32_t devices, uint32_t site, bool seeding)
+{
+	seedRecord_t *records = calloc(devices, sizeof(seedRecord_t));
+	uint32_t fromSeed = 0;
+	simTime_t last = 0;
+	double start = dSeconds();
+	uint64_t bytes;
+	
+	vSimInit(site + 1);
+	
+	bFwServerInit(&server, image, imageLength, "1.2.3", "10.0.0.2");
+	bFwServerManifest(&server);
+	
+	server.seeding = seeding;
+	pxSimServer    = &server;
+	updated        = 0;
+	
+	for (uint32_t i = 0; i < devices; i++)
+	{
+		simDevice_t *device = pxSimDeviceCreate(site * devices + i);																	/*UIDs and LAN addresses of its own*/
+		
+		pxSimModemAttach(device, config);
+		
+		device->user        = &records[i];
+		device->application = vSiteApplication;
+		
+		vProgramFactoryImage(factory, imageLength, "1.0.0");
+	}
+	
+	while (updated < devices && xSimNow() < SEED_SITE_LIMIT_US)
+	{
+		vSimRun(xSimNow() + 1000000);
+	}
+	
+	for (uint32_t i = 0; i < devices; i++)
+	{
+		fromSeed += records[i].fromSeed;
+		last      = (records[i].updatedTime > last) ? records[i].updatedTime : last;
+	}
+	
+	bytes = server.bytesSent;
+	
+	printf("site %u seeding %-3s %u of %u devices updated, %u from the seed, the last at %.0f s: %u offers, %u held, %u TFTP blocks, %llu WAN bytes, %.2f images, %.2f s wall time\n",
+				 site, seeding ? "on" : "off", updated, devices, fromSeed, (double)last / 1e6, server.offers, server.held, server.blocks, (unsigned long long)bytes, (double)bytes / imageLength, dSeconds() - start);
+	
+	vFwServerFree(&server);
+	
+	pxSimServer = NULL;
+	
+	free(records);
+	
+	return (updated == devices) ? bytes : 0;
+}
+
+/**
+* @brief  seed_site [-n devices per site] [-s sites] [-k image KB] [-m seed|off|both] [-r most images of WAN traffic with seeding]
+*					Fails if a device is not updated, or a seeded site takes more WAN bytes than the given number of images.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t wifi = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}};
+	uint32_t devices = 8, sites = 2, imageLength = 32 * 1024;
+	const char *mode = "both";
+	double limit = 1.5;
+	uint64_t off = 0, on = 0;
+	uint8_t *image, *factory;
+	bool passed = true;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "n:s:k:m:r:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': devices = strtoul(optarg, NULL, 0); break;
+			case 's': sites = strtoul(optarg, NULL, 0); break;
+			case 'k': imageLength = strtoul(optarg, NULL, 0) * 1024; break;
+			case 'm': mode = optarg; break;
+			case 'r': limit = strtod(optarg, NULL); break;
+			default:  return 2;
+		}
+	}
+	
+	WIFI_UART.Init.BaudRate = wifi.baud;																							/*UART init of the application, every device starts with it*/
+	
+	image   = malloc(imageLength);
+	factory = malloc(imageLength);
+	
+	vMakeImage(image, imageLength, 123);
+	vMakeImage(factory, imageLength, 100);
+	
+	for (uint32_t site = 0; site < sites; site++)
+	{
+		uint64_t bytes;
+		
+		if (strcmp(mode, "seed") != 0)
+		{
+			bytes   = ullSite(&wifi, image, factory, imageLength, devices, site, false);
+			off    += bytes;
+			passed &= (bytes != 0);
+		}
+		
+		if (strcmp(mode, "off") != 0)
+		{
+			bytes   = ullSite(&wifi, image, factory, imageLength, devices, site, true);
+			on     += bytes;
+			passed &= (bytes != 0 && bytes <= limit * imageLength);
+		}
+	}
+	
+	printf("WAN bytes per site of %u devices and a %u KB image: %.0f without seeding, %.0f with it, %.2f and %.2f images\n", devices, imageLength / 1024, (double)off / sites, (double)on / sites, (double)off / sites / imageLength, (double)on / sites / imageLength);
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	free(image);
+	free(factory);
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,714 @@
+/**
+  ******************************************************************************
+  * @file    server_load.c
+  * @brief   Contract and load of fw_serverd serving an image file: the
+  *          checkFirmware answer, HTTP Range, the read request of the
+  *          bootloader and the CRC32 trailer it reads, the blksize, windowsize
+  *          and tsize options, then thousands of concurrent TFTP sessions from
+  *          one epoll loop with every block checked against the image
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "API_BOOTLOADER.h"
+#include "fw_server.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define LOAD_VERSION																	"1.2.3"
+#define LOAD_TIMEOUT																	1.0																					/*s before a client sends its read request or acknowledge again*/
+#define LOAD_TRIES																		10
+#define LOAD_RAMP																		64																					/*sessions started per turn of the loop, a burst of read requests is not dropped*/
+#define LOAD_EVENTS																		256
+
+/* Typedefs ------------------------------------------------------------------*/
+/*One TFTP read of the client*/
+typedef struct
+{
+	int                 fd;
+	bool                negotiated;																											/*read request with blksize, windowsize and tsize*/
+	bool                answered, oack, done, failed;
+	struct sockaddr_in  peer;																												/*session port of the server once it answered*/
+	uint32_t            blockSize, windowSize, tsize;
+	uint32_t            received, bytes, sinceAck;																							/*blocks in order, file bytes, blocks since the last acknowledge*/
+	bool                gapAcked;																											/*a block out of order was answered since the last one in order*/
+	uint8_t             sent[96];																											/*read request or last acknowledge, sent again on a timeout*/
+	uint32_t            sentLength;
+	uint8_t             last[FW_SERVER_TFTP_MAX_BLOCK_SIZE + 4];																			/*last DATA, kept for the trailer check*/
+	uint32_t            lastLength;
+	double              deadline;
+	uint32_t            tries;
+} loadSession_t;
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t *file;																														/*image and the big endian CRC32 of the bootloader, what every session must receive*/
+static uint32_t fileLength, imageLength;
+static struct sockaddr_in tftpAddress;
+static int epollFd;
+static uint32_t requestedBlockSize = 1428, requestedWindow = 16;																			/*options of a negotiated session, a 1500 byte MTU per block*/
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+* @brief  This function starts fw_serverd on the image file and waits for its "ready"
+*/
+static pid_t xServerStart(const char path[], const char imagePath[], uint16_t httpPort, uint16_t tftpPort, FILE **output)
+{
+	char http[8], tftp[8], line[64];
+	int pipeFd[2];
+	pid_t pid;
+	
+	sprintf(http, "%u", httpPort);
+	sprintf(tftp, "%u", tftpPort);
+	
+	if (pipe(pipeFd) != 0 || (pid = fork()) < 0)
+	{
+		return -1;
+	}
+	
+	if (pid == 0)
+	{
+		dup2(pipeFd[1], STDOUT_FILENO);
+		close(pipeFd[0]);
+		
+		execl(path, path, "-p", http, "-t", tftp, "-f", imagePath, "-v", LOAD_VERSION, (char *)NULL);
+		
+		perror(path);
+		
+		_exit(127);
+	}
+	
+	close(pipeFd[1]);
+	
+	*output = fdopen(pipeFd[0], "r");
+	
+	if (fgets(line, sizeof(line), *output) == NULL || strcmp(line, "ready\n") != 0)
+	{
+		waitpid(pid, NULL, 0);
+		
+		return -1;
+	}
+	
+	return pid;
+}
+
+/**
+* @brief  This function sends one HTTP request on a new connection and reads its response
+* @retval bytes of the response, header and body, 0 if none came
+*/
+static uint32_t ulHttpGet(uint16_t port, const char request[], char response[], uint32_t size)
+{
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	struct timeval timeout = {2, 0};
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	uint32_t length = 0, bodyLength = 0;
+	const char *body = NULL;
+	ssize_t received;
+	
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || send(fd, request, strlen(request), 0) != (ssize_t)strlen(request))
+	{
+		close(fd);
+		
+		return 0;
+	}
+	
+	while (length < size - 1 && (body == NULL || length < (uint32_t)(body - response) + bodyLength) && (received = recv(fd, &response[length], size - 1 - length, 0)) > 0)
+	{
+		length          += (uint32_t)received;
+		response[length] = 0;
+		
+		if (body == NULL && (body = strstr(response, "\r\n\r\n")) != NULL)
+		{
+			const char *contentLength = strstr(response, "Content-Length: ");
+			
+			body      += 4;
+			bodyLength = (contentLength != NULL) ? strtoul(&contentLength[strlen("Content-Length: ")], NULL, 10) : 0;
+		}
+	}
+	
+	close(fd);
+	
+	return length;
+}
+
+/**
+* @brief  This function checks the HTTP side: checkFirmware offers the image to an older version with the JSON the
+*					bootloader waits for, nothing to its own version, and the Range downloads answer 206, 416 and 404
+*/
+static bool bHttpContract(uint16_t httpPort, uint16_t tftpPort)
+{
+	static char response[65536];
+	char request[256], offer[256];
+	const char *body;
+	uint32_t length, first = 100, last = 4195;
+	bool passed = true;
+	
+	sprintf(offer, "{\"data\":{\"ip\":\"127.0.0.1\",\"port\":\"%u\",\"file\":\"rx-%sbin\"}}", tftpPort, LOAD_VERSION);
+	
+	length = ulHttpGet(httpPort, "GET /api/Installer/checkFirmware?version=1.0.0 HTTP/1.1\r\nHost: server\r\n\r\n", response, sizeof(response));
+	body   = strstr(response, "\r\n\r\n");
+	
+	if (length == 0 || strncmp(response, "HTTP/1.1 200", 12) != 0 || body == NULL || strcmp(&body[4], offer) != 0)
+	{
+		printf("checkFirmware of 1.0.0: expected %s\n", offer);
+		passed = false;
+	}
+	
+	length = ulHttpGet(httpPort, "GET /api/Installer/checkFirmware?version=" LOAD_VERSION " HTTP/1.1\r\nHost: server\r\n\r\n", response, sizeof(response));
+	body   = strstr(response, "\r\n\r\n");
+	
+	if (length == 0 || body == NULL || strcmp(&body[4], "{\"data\":{}}") != 0)
+	{
+		printf("checkFirmware of %s: expected {\"data\":{}}\n", LOAD_VERSION);
+		passed = false;
+	}
+	
+	sprintf(request, "GET /api/Installer/firmware/rx-%sbin HTTP/1.1\r\nRange: bytes=%u-%u\r\n\r\n", LOAD_VERSION, first, last);
+	
+	length = ulHttpGet(httpPort, request, response, sizeof(response));
+	body   = strstr(response, "\r\n\r\n");
+	
+	if (length == 0 || strncmp(response, "HTTP/1.1 206", 12) != 0 || body == NULL || length - (uint32_t)(body + 4 - response) != last - first + 1 || memcmp(&body[4], &file[first], last - first + 1) != 0)
+	{
+		printf("Range bytes=%u-%u: expected 206 and those bytes of the image\n", first, last);
+		passed = false;
+	}
+	
+	sprintf(request, "GET /api/Installer/firmware/rx-%sbin HTTP/1.1\r\nRange: bytes=0-%u\r\n\r\n", LOAD_VERSION, imageLength);
+	
+	if (ulHttpGet(httpPort, request, response, sizeof(response)) == 0 || strncmp(response, "HTTP/1.1 416", 12) != 0)
+	{
+		printf("Range past the image: expected 416\n");
+		passed = false;
+	}
+	
+	if (ulHttpGet(httpPort, "GET /api/Installer/firmware/rx-9.9.9bin HTTP/1.1\r\nRange: bytes=0-15\r\n\r\n", response, sizeof(response)) == 0 || strncmp(response, "HTTP/1.1 404", 12) != 0)
+	{
+		printf("Range of another file: expected 404\n");
+		passed = false;
+	}
+	
+	printf("HTTP: checkFirmware offer and no offer, Range 206, 416 and 404 %s\n", passed ? "as expected" : "FAILED");
+	
+	return passed;
+}
+
+/**
+* @brief  This function sends the read request or the last acknowledge of a session and arms its timeout
+*/
+static void vLoadSend(loadSession_t *session)
+{
+	if (session->answered)
+	{
+		send(session->fd, session->sent, session->sentLength, 0);
+	}
+	else
+	{
+		sendto(session->fd, session->sent, session->sentLength, 0, (struct sockaddr *)&tftpAddress, sizeof(tftpAddress));
+	}
+	
+	session->deadline = dSeconds() + LOAD_TIMEOUT;
+}
+
+static void vLoadAck(loadSession_t *session, uint32_t block)
+{
+	session->sent[0]    = 0;
+	session->sent[1]    = 4;
+	session->sent[2]    = (uint8_t)(block >> 8);
+	session->sent[3]    = (uint8_t)block;
+	session->sentLength = 4;
+	session->tries      = 0;
+	
+	vLoadSend(session);
+}
+
+/**
+* @brief  This function starts a session: the read request of the bootloader, or the same with the options
+*/
+static bool bLoadStart(loadSession_t *session, bool negotiated)
+{
+	char fileName[32];
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = session};
+	
+	memset(session, 0, sizeof(loadSession_t));
+	
+	if ((session->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+	{
+		return false;
+	}
+	
+	sprintf(fileName, "rx-%sbin", LOAD_VERSION);
+	
+	vPrepareTFTPReadRequest((char *)session->sent, fileName, &session->sentLength);
+	
+	if (negotiated)
+	{
+		session->sentLength += (uint32_t)sprintf((char *)&session->sent[session->sentLength], "blksize%c%u%cwindowsize%c%u%ctsize%c0", 0, requestedBlockSize, 0, 0, requestedWindow, 0, 0) + 1;
+	}
+	
+	session->negotiated = negotiated;
+	session->blockSize  = FW_SERVER_TFTP_BLOCK_SIZE;
+	session->windowSize = 1;
+	
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, session->fd, &event);
+	
+	vLoadSend(session);
+	
+	return true;
+}
+
+static void vLoadEnd(loadSession_t *session, bool failed)
+{
+	session->done   = true;
+	session->failed = failed;
+	
+	close(session->fd);
+}
+
+/**
+* @brief  This function reads the options of an OACK
+*/
+static void vLoadOack(loadSession_t *session, const uint8_t packet[], uint32_t length)
+{
+	uint32_t index = 2;
+	
+	while (index < length)
+	{
+		const char *name = (const char *)&packet[index];
+		uint32_t nameLength = (uint32_t)strnlen(name, length - index), value;
+		
+		if (index + nameLength + 1 >= length)
+		{
+			break;
+		}
+		
+		value  = strtoul((const char *)&packet[index + nameLength + 1], NULL, 10);
+		index += nameLength + (uint32_t)strnlen((const char *)&packet[index + nameLength + 1], length - index - nameLength - 1) + 2;
+		
+		if (strcmp(name, "blksize") == 0)
+		{
+			session->blockSize = value;
+		}
+		else if (strcmp(name, "windowsize") == 0)
+		{
+			session->windowSize = value;
+		}
+		else if (strcmp(name, "tsize") == 0)
+		{
+			session->tsize = value;
+		}
+	}
+}
+
+/**
+* @brief  This function takes a datagram of the server: an OACK is acknowledged with block 0, a DATA in order is checked
+*					against the file and acknowledged at the end of its window, one out of order acknowledges the last in order
+*/
+static void vLoadPacket(loadSession_t *session, const uint8_t packet[], uint32_t length, const struct sockaddr_in *from)
+{
+	uint32_t opcode = ((uint32_t)packet[0] << 8) | packet[1], block = ((uint32_t)packet[2] << 8) | packet[3], offset, data;
+	
+	if (length < 4)
+	{
+		return;
+	}
+	
+	if (!session->answered)
+	{
+		session->peer     = *from;
+		session->answered = true;
+		
+		connect(session->fd, (const struct sockaddr *)from, sizeof(*from));
+	}
+	else if (from->sin_port != session->peer.sin_port)/*a second session of a read request sent again*/
+	{
+		return;
+	}
+	
+	if (opcode == 5)
+	{
+		printf("session answered by ERROR %u: %s\n", block, (const char *)&packet[4]);
+		
+		vLoadEnd(session, true);
+		
+		return;
+	}
+	
+	if (opcode == 6 && session->received == 0)
+	{
+		session->oack = true;
+		
+		vLoadOack(session, packet, length);
+		vLoadAck(session, 0);
+		
+		return;
+	}
+	
+	if (opcode != 3)
+	{
+		return;
+	}
+	
+	if (block != ((session->received + 1) & 0xFFFF))
+	{
+		if (!session->gapAcked)
+		{
+			session->gapAcked = true;
+			session->sinceAck = 0;
+			
+			vLoadAck(session, session->received & 0xFFFF);
+		}
+		
+		return;
+	}
+	
+	offset = session->received * session->blockSize;
+	data   = length - 4;
+	
+	if (offset + data > fileLength || data > session->blockSize || memcmp(&packet[4], &file[offset], data) != 0)
+	{
+		printf("block %u of %u bytes at %u is not the file\n", session->received + 1, data, offset);
+		
+		vLoadEnd(session, true);
+		
+		return;
+	}
+	
+	memcpy(session->last, packet, length);
+	
+	session->lastLength = length;
+	session->received++;
+	session->bytes     += data;
+	session->gapAcked   = false;
+	
+	if (data < session->blockSize)
+	{
+		vLoadAck(session, block);
+		vLoadEnd(session, session->bytes != fileLength);
+	}
+	else if (++session->sinceAck >= session->windowSize)
+	{
+		session->sinceAck = 0;
+		
+		vLoadAck(session, block);
+	}
+}
+
+/**
+* @brief  This function runs sessions at once from one epoll loop, every second one negotiated
+* @retval sessions that received the whole file
+*/
+static uint32_t ulLoadRun(loadSession_t sessions[], uint32_t count, uint32_t limit, uint32_t *mostInFlight, double *seconds)
+{
+	struct epoll_event events[LOAD_EVENTS];
+	uint8_t packet[FW_SERVER_TFTP_MAX_BLOCK_SIZE + 4];
+	uint32_t started = 0, ended = 0, inFlight = 0, complete = 0;
+	double start = dSeconds(), lastScan = start;
+	
+	*mostInFlight = 0;
+	
+	while (ended < count && dSeconds() - start < limit)
+	{
+		int ready;
+		
+		for (uint32_t i = 0; i < LOAD_RAMP && started < count; i++, started++)
+		{
+			if (!bLoadStart(&sessions[started], started % 2 == 1))
+			{
+				sessions[started].done   = true;
+				sessions[started].failed = true;
+				ended++;
+				continue;
+			}
+			
+			inFlight++;
+		}
+		
+		*mostInFlight = (inFlight > *mostInFlight) ? inFlight : *mostInFlight;
+		
+		ready = epoll_wait(epollFd, events, LOAD_EVENTS, 10);
+		
+		for (int i = 0; i < ready; i++)
+		{
+			loadSession_t *session = events[i].data.ptr;
+			struct sockaddr_in from;
+			socklen_t fromLength = sizeof(from);
+			ssize_t received;
+			
+			while (!session->done && (received = recvfrom(session->fd, packet, sizeof(packet), 0, (struct sockaddr *)&from, &fromLength)) > 0)
+			{
+				vLoadPacket(session, packet, (uint32_t)received, &from);
+				
+				fromLength = sizeof(from);
+			}
+			
+			if (session->done)
+			{
+				ended++;
+				inFlight--;
+				complete += !session->failed;
+			}
+		}
+		
+		if (dSeconds() - lastScan >= 0.1)
+		{
+			lastScan = dSeconds();
+			
+			for (uint32_t i = 0; i < started; i++)
+			{
+				if (sessions[i].done || sessions[i].deadline > lastScan)
+				{
+					continue;
+				}
+				
+				if (++sessions[i].tries >= LOAD_TRIES)
+				{
+					printf("session %u timed out after %u blocks\n", i, sessions[i].received);
+					
+					vLoadEnd(&sessions[i], true);
+					
+					ended++;
+					inFlight--;
+					continue;
+				}
+				
+				vLoadSend(&sessions[i]);
+			}
+		}
+	}
+	
+	for (uint32_t i = 0; i < started; i++)
+	{
+		if (!sessions[i].done)
+		{
+			vLoadEnd(&sessions[i], true);
+		}
+	}
+	
+	*seconds = dSeconds() - start;
+	
+	return complete;
+}
+
+/**
+* @brief  This function checks the TFTP side on one plain and one negotiated session: the plain one is the read request
+*					of the bootloader answered block by block, its last DATA holds the trailer vExtractCRCFromTheLastTFTPPackage
+*					reads, the negotiated one is answered by an OACK granting the options, and an unknown file by an ERROR
+*/
+static bool bTftpContract(void)
+{
+	static loadSession_t sessions[2];
+	const loadSession_t *plain = &sessions[0], *negotiated = &sessions[1];
+	uint8_t request[] = "\0\1rx-9.9.9bin\0octet", answer[FW_SERVER_TFTP_PACKET_SIZE];
+	struct timeval timeout = {2, 0};
+	uint32_t mostInFlight, crc = 0, crcIndex = 0;
+	double seconds;
+	bool passed = true;
+	int fd;
+	
+	if (ulLoadRun(sessions, 2, 10, &mostInFlight, &seconds) != 2)
+	{
+		printf("the contract sessions didn't both receive the file\n");
+		passed = false;
+	}
+	
+	if (plain->oack || plain->blockSize != FW_SERVER_TFTP_BLOCK_SIZE || plain->received != fileLength / FW_SERVER_TFTP_BLOCK_SIZE + 1)
+	{
+		printf("the read request of the bootloader: expected DATA 1 at once and %u blocks of %u bytes\n", fileLength / FW_SERVER_TFTP_BLOCK_SIZE + 1, FW_SERVER_TFTP_BLOCK_SIZE);
+		passed = false;
+	}
+	
+	if (plain->lastLength >= 8)
+	{
+		vExtractCRCFromTheLastTFTPPackage(&crc, (char *)plain->last, plain->lastLength, &crcIndex);
+		
+		if (crc != ulCRC32Aligned((const uint32_t *)file, imageLength, 0))
+		{
+			printf("vExtractCRCFromTheLastTFTPPackage read %08X from the last block, the CRC32 of the image is %08X\n", crc, ulCRC32Aligned((const uint32_t *)file, imageLength, 0));
+			passed = false;
+		}
+	}
+	
+	if (!negotiated->oack || negotiated->blockSize != requestedBlockSize || negotiated->windowSize != requestedWindow || negotiated->tsize != fileLength)
+	{
+		printf("OACK: blksize %u windowsize %u tsize %u, expected %u %u %u\n", negotiated->blockSize, negotiated->windowSize, negotiated->tsize, requestedBlockSize, requestedWindow, fileLength);
+		passed = false;
+	}
+	
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	
+	sendto(fd, request, sizeof(request), 0, (struct sockaddr *)&tftpAddress, sizeof(tftpAddress));
+	
+	if (recv(fd, answer, sizeof(answer), 0) < 4 || answer[1] != 5 || answer[3] != 1)
+	{
+		printf("read request of another file: expected ERROR 1\n");
+		passed = false;
+	}
+	
+	close(fd);
+	
+	printf("TFTP: read request of the bootloader, trailer %08X, OACK blksize %u windowsize %u tsize %u, ERROR of an unknown file %s\n", crc, negotiated->blockSize, negotiated->windowSize, negotiated->tsize, passed ? "as expected" : "FAILED");
+	
+	return passed;
+}
+
+/**
+* @brief  server_load [-n sessions] [-k image KB] [-b blksize] [-w windowsize] [-d longest run s] [-S fw_serverd path]
+*					The image file is served by fw_serverd, the contract is checked, then the sessions run at once, half of
+*					them the read request of the bootloader, half of them with the options.
+*/
+int main(int argc, char *argv[])
+{
+	uint32_t sessionCount = 2000, imageKB = 64, limit = 60, seed = 7, complete = 0, mostInFlight = 0, mostSessions = 0, negotiated = 0;
+	uint16_t httpPort = (uint16_t)(20000 + getpid() % 20000);
+	char serverPath[4096], imagePath[] = "/tmp/server_load_XXXXXX", line[256];
+	unsigned long long served = 0;
+	loadSession_t *sessions;
+	struct rlimit files;
+	struct rusage usage;
+	FILE *serverOutput;
+	double seconds = 0, cpu;
+	bool passed;
+	pid_t server;
+	int option, fd;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	snprintf(serverPath, sizeof(serverPath), "%s/fw_serverd", dirname(strdup(argv[0])));
+	
+	while ((option = getopt(argc, argv, "n:k:b:w:d:S:")) != -1)
+	{
+		uint32_t value = strtoul(optarg, NULL, 0);
+		
+		switch (option)
+		{
+			case 'n': sessionCount = (value > 0) ? value : 1; break;
+			case 'k': imageKB = (value > 0) ? value : 1; break;
+			case 'b': requestedBlockSize = (value >= FW_SERVER_TFTP_BLOCK_SIZE && value <= FW_SERVER_TFTP_MAX_BLOCK_SIZE) ? value : requestedBlockSize; break;
+			case 'w': requestedWindow = (value >= 1 && value <= FW_SERVER_TFTP_MAX_WINDOW) ? value : requestedWindow; break;
+			case 'd': limit = value; break;
+			case 'S': snprintf(serverPath, sizeof(serverPath), "%s", optarg); break;
+			default:  return 2;
+		}
+	}
+	
+	if (getrlimit(RLIMIT_NOFILE, &files) == 0)/*a socket per session*/
+	{
+		files.rlim_cur = files.rlim_max;
+		
+		setrlimit(RLIMIT_NOFILE, &files);
+		
+		if (files.rlim_cur < sessionCount + 64)
+		{
+			sessionCount = (uint32_t)files.rlim_cur - 64;
+			
+			printf("open files limited to %u, %u sessions\n", (uint32_t)files.rlim_cur, sessionCount);
+		}
+	}
+	
+	imageLength = imageKB * 1024;
+	fileLength  = imageLength + 4;
+	file        = malloc(fileLength);
+	
+	for (uint32_t i = 0; i < imageLength / 4; i++)
+	{
+		seed = seed * 1664525U + 1013904223U;
+		
+		memcpy(&file[4 * i], &seed, 4);
+	}
+	
+	seed = ulCRC32Aligned((const uint32_t *)file, imageLength, 0);
+	
+	file[imageLength]     = (uint8_t)(seed >> 24);
+	file[imageLength + 1] = (uint8_t)(seed >> 16);
+	file[imageLength + 2] = (uint8_t)(seed >> 8);
+	file[imageLength + 3] = (uint8_t)seed;
+	
+	if ((fd = mkstemp(imagePath)) < 0 || write(fd, file, imageLength) != (ssize_t)imageLength)
+	{
+		perror(imagePath);
+		
+		return 1;
+	}
+	
+	close(fd);
+	
+	if ((server = xServerStart(serverPath, imagePath, httpPort, httpPort + 1, &serverOutput)) < 0)
+	{
+		printf("%s didn't start\n", serverPath);
+		
+		unlink(imagePath);
+		
+		return 1;
+	}
+	
+	tftpAddress.sin_family      = AF_INET;
+	tftpAddress.sin_port        = htons(httpPort + 1);
+	tftpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	epollFd  = epoll_create1(EPOLL_CLOEXEC);
+	sessions = calloc(sessionCount, sizeof(loadSession_t));
+	
+	passed = bHttpContract(httpPort, httpPort + 1);
+	passed = bTftpContract() && passed;
+	
+	if (passed)
+	{
+		complete = ulLoadRun(sessions, sessionCount, limit, &mostInFlight, &seconds);
+	}
+	
+	kill(server, SIGTERM);
+	
+	if (fgets(line, sizeof(line), serverOutput) != NULL)
+	{
+		const char *counters = strstr(line, "negotiated ");
+		
+		if (counters != NULL)
+		{
+			sscanf(counters, "negotiated %u most sessions %u bytes %llu", &negotiated, &mostSessions, &served);
+		}
+	}
+	
+	wait4(server, NULL, 0, &usage);
+	
+	unlink(imagePath);
+	
+	cpu = (double)usage.ru_utime.tv_sec + (double)usage.ru_stime.tv_sec + (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	
+	if (seconds > 0)
+	{
+		printf("%u sessions of a %u KB image, %u at once, blksize %u windowsize %u for every second one: %u complete in %.1f s, %.0f sessions/s\n", sessionCount, imageKB, mostInFlight, requestedBlockSize, requestedWindow, complete, seconds, complete / seconds);
+		printf("server: %u sessions open at most, %u negotiated, %.1f MB/s served, %.3f s CPU, %.1f%% of a core\n", mostSessions, negotiated, (double)served / seconds / 1e6, cpu, cpu / seconds * 100);
+	}
+	
+	passed = passed && complete == sessionCount;
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	free(sessions);
+	free(file);
+	
+	return passed ? 0 : 1;
+}
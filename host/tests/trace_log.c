@@ -0,0 +1,246 @@
+/**
+  ******************************************************************************
+  * @file    trace_log.c
+  * @brief   Binary trace of an end to end update: a TFTP_BOOTLOADER_TRACE
+  *          device is updated over the emulated ESP8266 or UG95, its trace
+  *          ring is drained to a file while it runs and trace_decode prints
+  *          the records, which must hold every block and resolve every literal
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include "sim.h"
+#include <dlfcn.h>
+#include <libgen.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define TRACE_DRAIN_US																	100000																				/*virtual time between drains, far less than TRACE_RING_SIZE records*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint32_t imageLength = 32 * 1024;
+static FILE *records;
+static uint32_t drained;
+static bool installed;
+
+/**
+* @brief  This function is the trace hook, the records of vBootloaderTraceDrain go to the records file
+*/
+static void vTraceWrite(const void *data, uint32_t length)
+{
+	fwrite(data, 1, length, records);
+	
+	drained += length / sizeof(traceRecord_t);
+}
+
+/**
+* @brief  This function builds an image: the vector table of the application slot, random code after it
+*/
+static void vMakeImage(uint8_t image[], uint32_t length, uint32_t seed)
+{
+	uint32_t *words = (uint32_t *)image;
+	
+	for (uint32_t i = 0; i < length / 4; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		words[i] = seed;
+	}
+	
+	words[0] = 0x20004000U;
+	words[1] = APPLICATION_ADDRESS + 0x201;
+}
+
+/**
+* @brief  This function programs an approved image in the application slot as the factory does, trailer of the legacy layout
+*/
+static void vProgramFactoryImage(const uint8_t image[], uint32_t length, const char version[])
+{
+	uint32_t word;
+	
+	vHostFlashWrite(APPLICATION_ADDRESS, image, length);
+	
+	word = length;
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_LENGTH_OFFSET, &word, 4);
+	
+	word = ulFwServerCRC32(image, length, 0);
+	vHostFlashWrite(APPLICATION_ADDRESS + IMAGE_CRC_OFFSET, &word, 4);
+	
+	for (uint32_t i = 0; i < 5; i++)
+	{
+		word = (uint8_t)version[i];
+		vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 24 + 4 * i, &word, 4);
+	}
+	
+	word = 1;
+	vHostFlashWrite(APPLICATION_ADDRESS + MAX_APPICATION_SIZE - 4, &word, 4);
+}
+
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	(void)version;
+	
+	vBootloaderApplyNow();
+}
+
+/**
+* @brief  This function is the application of the device: 1.0.0 checks for updates, the new image stops the device
+*/
+static void vDeviceApplication(simDevice_t *device)
+{
+	if (memcmp((const void *)BOOTLOADER_FLASH_POINTER(APPLICATION_ADDRESS), pxSimServer->image, pxSimServer->imageLength) != 0)
+	{
+		vSimBootloaderApplication(device);
+	}
+	
+	installed = true;
+}
+
+/**
+* @brief  This function updates one device over one modem with the trace drained to the records file
+* @retval records written by the device, drained or not
+*/
+static uint32_t ulUpdate(const simModemConfig_t *config)
+{
+	static fwServer_t server;
+	uint8_t *image = malloc(imageLength), *factory = malloc(imageLength);
+	simDevice_t *device;
+	uint32_t written;
+	
+	vMakeImage(image, imageLength, 123);
+	vMakeImage(factory, imageLength, 100);
+	
+	vSimInit(1);
+	
+	bFwServerInit(&server, image, imageLength, "1.2.3", "10.0.0.2");
+	
+	pxSimServer = &server;
+	
+	device = pxSimDeviceCreate(0);
+	
+	pxSimModemAttach(device, config);
+	
+	device->application = vDeviceApplication;
+	
+	vProgramFactoryImage(factory, imageLength, "1.0.0");
+	
+	while (!device->halted && xSimNow() < 3600ULL * 1000000)
+	{
+		vSimRun(xSimNow() + TRACE_DRAIN_US);
+		
+		vSimLoad(device);
+		vBootloaderTraceDrain();
+	}
+	
+	written = xTraceLog.head;
+	
+	vFwServerFree(&server);
+	
+	free(image);
+	free(factory);
+	
+	return written;
+}
+
+/**
+* @brief  trace_log [-t wifi|gsm] [-k image KB] [-D trace_decode path]
+*					Fails if records were overwritten before a drain, a block is missing from the decoded trace or a literal of
+*					the build is not resolved.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t wifi = {SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}};
+	simModemConfig_t gsm  = {SIM_MODEM_UG95, 115200, 5000, {150000, 50000, 0}};
+	char decoderPath[4096], recordsPath[] = "/tmp/trace_log_XXXXXX", command[8192], line[256];
+	uint32_t written, blocks = 0, wrong = 0, received = 0, timeouts = 0, decoded = 0, unresolved = 1, correct = 0;
+	const char *transport = "wifi";
+	Dl_info library;
+	FILE *decoder;
+	bool passed;
+	int option, fd;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	snprintf(decoderPath, sizeof(decoderPath), "%s/trace_decode", dirname(strdup(argv[0])));
+	
+	while ((option = getopt(argc, argv, "t:k:D:")) != -1)
+	{
+		switch (option)
+		{
+			case 't': transport = optarg; break;
+			case 'k': imageLength = strtoul(optarg, NULL, 0) * 1024; break;
+			case 'D': snprintf(decoderPath, sizeof(decoderPath), "%s", optarg); break;
+			default:  return 2;
+		}
+	}
+	
+	if ((fd = mkstemp(recordsPath)) < 0 || (records = fdopen(fd, "wb")) == NULL)
+	{
+		perror(recordsPath);
+		
+		return 1;
+	}
+	
+	WIFI_UART.Init.BaudRate = wifi.baud;
+	GSM_UART.Init.BaudRate  = gsm.baud;
+	xHostPort.trace         = vTraceWrite;																							/*before vSimInit, every device starts with it*/
+	
+	written = ulUpdate((strcmp(transport, "gsm") == 0) ? &gsm : &wifi);
+	
+	fclose(records);
+	
+	if (dladdr(&xTraceLog, &library) == 0)/*the literals of the build are read from its shared library*/
+	{
+		printf("the bootloader build is not found\n");
+		printf("FAIL\n");
+		
+		unlink(recordsPath);
+		
+		return 1;
+	}
+	
+	snprintf(command, sizeof(command), "%s -e %s -b 0x%X %s", decoderPath, library.dli_fname, (uint32_t)(uintptr_t)library.dli_fbase, recordsPath);
+	
+	if ((decoder = popen(command, "r")) == NULL)
+	{
+		perror(decoderPath);
+		
+		unlink(recordsPath);
+		
+		return 1;
+	}
+	
+	while (fgets(line, sizeof(line), decoder) != NULL)
+	{
+		uint32_t block;
+		
+		if (sscanf(line, "%*f ms BLOCK_CORRECT block %u", &block) == 1)
+		{
+			correct += (block == correct + 1);
+			blocks++;
+		}
+		
+		wrong    += (strstr(line, " BLOCK_WRONG ") != NULL);
+		received += (strstr(line, " RESPONSE_RECEIVED ") != NULL);
+		timeouts += (strstr(line, " RESPONSE_TIMEOUT ") != NULL);
+		
+		if (received == 1 && strstr(line, " RESPONSE_RECEIVED ") != NULL)
+		{
+			printf("first response: %s", line);
+		}
+		
+		sscanf(line, "%u records, %u literals not resolved", &decoded, &unresolved);
+	}
+	
+	pclose(decoder);
+	unlink(recordsPath);
+	
+	printf("%s update of a %u KB image, %s: %u records written, %u drained, %u decoded\n", transport, imageLength / 1024, installed ? "installed" : "NOT INSTALLED", written, drained, decoded);
+	printf("blocks %u correct in order of %u expected, %u wrong, responses %u received, %u timed out, %u literals not resolved\n", correct, (imageLength + 4) / 512 + 1, wrong, received, timeouts, unresolved);
+	
+	passed = installed && written == drained && decoded == drained && blocks == correct && correct == (imageLength + 4) / 512 + 1 && received > 0 && unresolved == 0;
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,378 @@
+/**
+  ******************************************************************************
+  * @file    uart_replay.c
+  * @brief   Record and replay of the modem UART streams: a simulated update is
+  *          captured at the drain of the receive rings, a fresh device then
+  *          runs the capture alone through the parsers and the TFTP state
+  *          machine, at the original timing or as fast as the device answers,
+  *          and must end with the same flash byte for byte
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim.h"
+#include <time.h>
+#include <unistd.h>
+
+/* Typedefs ------------------------------------------------------------------*/
+typedef struct
+{
+	const uint8_t *capture;
+	uint32_t       length, offset;
+	uint32_t       start;																																/*replayStart of lBootloaderReplayCapture*/
+	bool           fast, truncated;
+	simDevice_t   *device;
+	simModem_t    *modem;
+	uint32_t       record;																															/*next record to feed*/
+	uint32_t       fedTick;																															/*recorded tick of the last record fed*/
+	simTime_t      fedTime;
+} replay_t;
+
+/* Private define ------------------------------------------------------------*/
+#define REPLAY_RETRY_US																			1000																				/*next try while the rings are full or the device didn't ask yet*/
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t    *capture;
+static uint32_t    captureLength, captureSize;
+static uint64_t   *sentBefore;																													/*bytes the device had sent to its modem before each record*/
+static uint32_t    records;
+static simModem_t *recordingModem;
+static simTime_t   readyTime;
+
+static double dSeconds(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+/**
+* @brief  This function is the capture hook, UART_CAPTURE_WRITE of the recording device: a uartCaptureHeader_t, then
+*					its bytes. What the device had sent by then is kept beside the capture for the fast replay.
+*/
+static void vCaptureWrite(const void *data, uint32_t length)
+{
+	static uint32_t calls;
+	
+	if (recordingModem == NULL)
+	{
+		return;
+	}
+	
+	if (calls++ % 2 == 0)
+	{
+		sentBefore = realloc(sentBefore, (records + 1) * sizeof(uint64_t));
+		
+		sentBefore[records++] = recordingModem->bytesIn;
+	}
+	
+	if (captureLength + length > captureSize)
+	{
+		captureSize = (captureSize + length) * 2;
+		capture     = realloc(capture, captureSize);
+	}
+	
+	memcpy(&capture[captureLength], data, length);
+	
+	captureLength += length;
+}
+
+/**
+* @brief  This function ends a run once the image is downloaded and approved, the flash is compared in that state
+*/
+void vBootloaderOnFirmwareReady(const char version[])
+{
+	(void)version;
+	
+	readyTime = pxSimCurrent()->clock;
+	
+	vSimHalt();
+}
+
+/**
+* @brief  This function stands for the modem of the replay: the bytes of the device go nowhere
+*/
+static void vDiscard(simModem_t *modem, const uint8_t data[], uint32_t length)
+{
+	(void)modem;
+	(void)data;
+	(void)length;
+}
+
+/**
+* @brief  This function feeds the capture as the receive interrupt would, so the bootloader takes it in its blocking
+*					waits too. The original timing feeds the records at their ticks. The fast replay feeds a record once the
+*					device sent its modem what it had sent before that record was received, at the latest after the recorded
+*					gap, so the latency of the network is left out but no answer comes before its request.
+*/
+static void vReplayFeed(void *payload)
+{
+	replay_t *replay = *(replay_t **)payload;
+	uint32_t length = replay->length - replay->offset;
+	simTime_t next = xSimNow() + REPLAY_RETRY_US;
+	uartCaptureHeader_t header;
+	int32_t consumed;
+	
+	memcpy(&header, &replay->capture[replay->offset], sizeof(header));
+	
+	if (replay->fast)
+	{
+		if (replay->modem->bytesIn < sentBefore[replay->record] && xSimNow() < replay->fedTime + (simTime_t)(header.tick - replay->fedTick) * 1000)
+		{
+			*(replay_t **)pvSimAt(next, replay->device, vReplayFeed, sizeof(replay_t *)) = replay;
+			
+			return;
+		}
+		
+		length = sizeof(header) + header.length;
+	}
+	
+	if ((consumed = lBootloaderReplayCapture(&replay->capture[replay->offset], length, &replay->start)) < 0)
+	{
+		replay->truncated = true;
+		
+		return;
+	}
+	
+	if (consumed > 0)
+	{
+		for (uint32_t fed = 0; fed < (uint32_t)consumed; replay->record++)
+		{
+			memcpy(&header, &replay->capture[replay->offset + fed], sizeof(header));
+			
+			fed += sizeof(header) + header.length;
+		}
+		
+		replay->offset  += (uint32_t)consumed;
+		replay->fedTick  = header.tick;
+		replay->fedTime  = xSimNow();
+		
+		vSimWake(replay->device);
+	}
+	
+	if (replay->offset == replay->length)
+	{
+		return;
+	}
+	
+	memcpy(&header, &replay->capture[replay->offset], sizeof(header));
+	
+	if (!replay->fast && (int32_t)(header.tick + replay->start - HAL_GetTick()) > 0)
+	{
+		next = replay->device->bootTime + (simTime_t)(header.tick + replay->start) * 1000;
+	}
+	else if (replay->fast && consumed > 0)
+	{
+		next = xSimNow();
+	}
+	
+	*(replay_t **)pvSimAt(next, replay->device, vReplayFeed, sizeof(replay_t *)) = replay;
+}
+
+/**
+* @brief  This function runs an update of one device over one modem and captures what its rings received
+* @retval flash of the device once the image was ready, NULL if it never was
+*/
+static uint8_t *pucRecord(const simModemConfig_t *config, uint32_t imageLength, simTime_t *duration)
+{
+	static fwServer_t server;
+	uint32_t *image = malloc(imageLength), seed = 123;
+	uint8_t *flash = NULL;
+	simDevice_t *device;
+	
+	for (uint32_t i = 0; i < imageLength / 4; i++)
+	{
+		seed     = seed * 1664525U + 1013904223U;
+		image[i] = seed;
+	}
+	
+	image[0] = 0x20004000U;
+	image[1] = APPLICATION_ADDRESS + 0x201;
+	
+	vSimInit(1);
+	
+	bFwServerInit(&server, (const uint8_t *)image, imageLength, "1.2.3", "10.0.0.2");
+	
+	pxSimServer   = &server;
+	captureLength = 0;
+	records       = 0;
+	readyTime     = 0;
+	
+	device         = pxSimDeviceCreate(0);
+	recordingModem = pxSimModemAttach(device, config);
+	
+	while (!device->halted && xSimNow() < 3600ULL * 1000000)
+	{
+		vSimRun(xSimNow() + 1000000);
+	}
+	
+	recordingModem = NULL;
+	
+	if (readyTime != 0 && memcmp(&device->flash[STORAGE_ADDRESS - HOST_FLASH_BASE], image, imageLength) == 0)
+	{
+		flash = malloc(HOST_FLASH_SIZE);
+		
+		memcpy(flash, device->flash, HOST_FLASH_SIZE);
+	}
+	
+	*duration = readyTime;
+	
+	vFwServerFree(&server);
+	
+	pxSimServer = NULL;
+	
+	free(image);
+	
+	return flash;
+}
+
+/**
+* @brief  This function replays a capture into a fresh device with the modem of the recording cut off
+* @retval true if the flash of the device ends as expected, byte for byte
+*/
+static bool bReplay(const simModemConfig_t *config, const uint8_t expected[], bool fast, const char name[], simTime_t original)
+{
+	replay_t replay = {capture, captureLength, 0, fast ? BOOTLOADER_NO_DEADLINE : 0, fast, false, NULL, NULL, 0, 0, 0};
+	uartCaptureHeader_t first;
+	uint32_t differing = 0, firstDifference = 0;
+	simDevice_t *device;
+	simModem_t *modem;
+	double start, wall;
+	
+	vSimInit(1);
+	
+	readyTime = 0;
+	
+	device = pxSimDeviceCreate(0);
+	modem  = pxSimModemAttach(device, config);
+	
+	modem->receive = vDiscard;
+	replay.device  = device;
+	replay.modem   = modem;
+	
+	memcpy(&first, capture, sizeof(first));
+	
+	replay.fedTick = first.tick;
+	replay.fedTime = device->bootTime + (simTime_t)first.tick * 1000;
+	
+	*(replay_t **)pvSimAt(device->bootTime + (simTime_t)first.tick * 1000, device, vReplayFeed, sizeof(replay_t *)) = &replay;/*the session starts at its recorded tick, the device asks first*/
+	
+	start = dSeconds();
+	
+	while (!device->halted && !replay.truncated && xSimNow() < 3600ULL * 1000000)
+	{
+		vSimRun(xSimNow() + 1000000);
+	}
+	
+	wall = dSeconds() - start;
+	
+	for (uint32_t i = HOST_FLASH_SIZE; i-- > 0;)
+	{
+		if (device->flash[i] != expected[i])
+		{
+			differing++;
+			firstDifference = i;
+		}
+	}
+	
+	printf("%s %-8s %u capture bytes in %.3f s, %.2f MB/s, image ready at %.1f s, %.1f s recorded: ", name, fast ? "fast" : "original", captureLength, wall, captureLength / wall / 1e6, (double)readyTime / 1e6, (double)original / 1e6);
+	
+	if (replay.truncated || readyTime == 0)
+	{
+		printf("%s\n", replay.truncated ? "truncated capture" : "image never ready");
+	}
+	else if (differing != 0)
+	{
+		printf("%u flash bytes differ from 0x%08X\n", differing, HOST_FLASH_BASE + firstDifference);
+	}
+	else
+	{
+		printf("flash identical\n");
+	}
+	
+	return !replay.truncated && readyTime != 0 && differing == 0;
+}
+
+/**
+* @brief  uart_replay [-t wifi|gsm|both] [-k image KB] [-m original|fast|both] [-w capture file]
+*					Every transport is recorded once and replayed in the modes asked for, -w keeps the last capture.
+*/
+int main(int argc, char *argv[])
+{
+	simModemConfig_t configs[2] = {{SIM_MODEM_ESP8266, 115200, 2000, {30000, 10000, 0}}, {SIM_MODEM_UG95, 115200, 5000, {150000, 50000, 0}}};
+	const char *names[2] = {"wifi", "gsm "}, *transport = "both", *mode = "both", *output = NULL;
+	uint32_t imageLength = 32 * 1024;
+	bool passed = true;
+	int option;
+	
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	
+	while ((option = getopt(argc, argv, "t:k:m:w:")) != -1)
+	{
+		switch (option)
+		{
+			case 't': transport = optarg; break;
+			case 'k': imageLength = strtoul(optarg, NULL, 0) * 1024; break;
+			case 'm': mode = optarg; break;
+			case 'w': output = optarg; break;
+			default:  return 2;
+		}
+	}
+	
+	WIFI_UART.Init.BaudRate = 115200;
+	GSM_UART.Init.BaudRate  = 115200;
+	xHostPort.capture       = vCaptureWrite;																					/*before the first vSimInit, every device starts with it*/
+	
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		simTime_t original;
+		uint8_t *flash;
+		
+		if (strcmp(transport, "both") != 0 && strncmp(transport, names[i], strlen(transport)) != 0)
+		{
+			continue;
+		}
+		
+		if ((flash = pucRecord(&configs[i], imageLength, &original)) == NULL)
+		{
+			printf("%s recording didn't download the image\n", names[i]);
+			
+			passed = false;
+			
+			continue;
+		}
+		
+		if (output != NULL)
+		{
+			FILE *file = fopen(output, "wb");
+			
+			if (file == NULL || fwrite(capture, 1, captureLength, file) != captureLength)
+			{
+				perror(output);
+			}
+			
+			if (file != NULL)
+			{
+				fclose(file);
+			}
+		}
+		
+		if (strcmp(mode, "fast") != 0)
+		{
+			passed &= bReplay(&configs[i], flash, false, names[i], original);
+		}
+		
+		if (strcmp(mode, "original") != 0)
+		{
+			passed &= bReplay(&configs[i], flash, true, names[i], original);
+		}
+		
+		free(flash);
+	}
+	
+	printf("%s\n", passed ? "PASS" : "FAIL");
+	
+	return passed ? 0 : 1;
+}
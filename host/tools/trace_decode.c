@@ -0,0 +1,190 @@
+/**
+  ******************************************************************************
+  * @file    trace_decode.c
+  * @brief   Decoder of the binary trace of a TFTP_BOOTLOADER_TRACE build: the
+  *          traceRecord_t records vBootloaderTraceDrain writes are printed one
+  *          per line with their time, event and arguments, the expected
+  *          response literals logged by address are read from the ELF file
+  ******************************************************************************
+  */
+
+/* Includes ------------------------------------------------------------------*/
+#include "API_BOOTLOADER.h"
+#include <elf.h>
+#include <unistd.h>
+
+/* Private variables ---------------------------------------------------------*/
+static const char *eventNames[] = {"", "BLOCK_CORRECT", "BLOCK_WRONG", "RESPONSE_RECEIVED", "RESPONSE_TIMEOUT"};
+static uint8_t *elf;
+static long elfLength;
+
+/**
+* @brief  This function reads the whole ELF file of the build
+*/
+static bool bLoadElf(const char path[])
+{
+	FILE *file = fopen(path, "rb");
+	
+	if (file == NULL || fseek(file, 0, SEEK_END) != 0 || (elfLength = ftell(file)) < (long)sizeof(Elf32_Ehdr))
+	{
+		perror(path);
+		
+		return false;
+	}
+	
+	rewind(file);
+	
+	elf = malloc((size_t)elfLength);
+	
+	if (fread(elf, 1, (size_t)elfLength, file) != (size_t)elfLength || memcmp(elf, ELFMAG, SELFMAG) != 0)
+	{
+		fprintf(stderr, "%s is not an ELF file\n", path);
+		fclose(file);
+		
+		return false;
+	}
+	
+	fclose(file);
+	
+	return true;
+}
+
+/**
+* @brief  This function finds the bytes of an address in the sections loaded from the ELF file, 32 or 64 bit
+* @retval string at the address, NULL if no section holds it
+*/
+static const char *pcElfString(uint32_t address)
+{
+	bool wide = (elf[EI_CLASS] == ELFCLASS64);
+	uint64_t sections = wide ? ((Elf64_Ehdr *)elf)->e_shoff : ((Elf32_Ehdr *)elf)->e_shoff;
+	uint32_t count = wide ? ((Elf64_Ehdr *)elf)->e_shnum : ((Elf32_Ehdr *)elf)->e_shnum;
+	uint32_t size = wide ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
+	
+	for (uint32_t i = 0; i < count && sections + (uint64_t)(i + 1) * size <= (uint64_t)elfLength; i++)
+	{
+		const uint8_t *header = &elf[sections + (uint64_t)i * size];
+		uint64_t flags = wide ? ((Elf64_Shdr *)header)->sh_flags : ((Elf32_Shdr *)header)->sh_flags;
+		uint64_t start = wide ? ((Elf64_Shdr *)header)->sh_addr : ((Elf32_Shdr *)header)->sh_addr;
+		uint64_t length = wide ? ((Elf64_Shdr *)header)->sh_size : ((Elf32_Shdr *)header)->sh_size;
+		uint64_t offset = wide ? ((Elf64_Shdr *)header)->sh_offset : ((Elf32_Shdr *)header)->sh_offset;
+		uint32_t type = wide ? ((Elf64_Shdr *)header)->sh_type : ((Elf32_Shdr *)header)->sh_type;
+		
+		if ((flags & SHF_ALLOC) && type != SHT_NOBITS && address >= start && address < start + length && offset + length <= (uint64_t)elfLength)
+		{
+			return (const char *)&elf[offset + (address - start)];
+		}
+	}
+	
+	return NULL;
+}
+
+/**
+* @brief  This function prints a response literal with its control characters escaped
+*/
+static void vPrintLiteral(const char literal[])
+{
+	putchar('"');
+	
+	for (uint32_t i = 0; literal[i] != 0 && i < 64; i++)
+	{
+		switch (literal[i])
+		{
+			case '\r': printf("\\r"); break;
+			case '\n': printf("\\n"); break;
+			case '"':  printf("\\\""); break;
+			default:   putchar((literal[i] >= ' ' && literal[i] < 0x7F) ? literal[i] : '.'); break;
+		}
+	}
+	
+	putchar('"');
+}
+
+/**
+* @brief  trace_decode [-e ELF file of the build] [-b load base] [-t timestamp ticks per us] [records file]
+*					Reads the records from the file, stdin without one. The literals are read from the ELF file at their address
+*					less the load base: 0 for the target image, the base of a shared library of the host build. Ticks per us
+*					are SystemCoreClock in MHz on the target, HOST_TIMESTAMP_PER_US by default.
+*/
+int main(int argc, char *argv[])
+{
+	uint32_t base = 0, ticksPerUs = HOST_TIMESTAMP_PER_US, last = 0, records = 0, unresolved = 0;
+	uint64_t ticks = 0;
+	traceRecord_t record;
+	FILE *input = stdin;
+	int option;
+	
+	while ((option = getopt(argc, argv, "e:b:t:")) != -1)
+	{
+		switch (option)
+		{
+			case 'e': if (!bLoadElf(optarg)) return 2; break;
+			case 'b': base = (uint32_t)strtoull(optarg, NULL, 0); break;
+			case 't': ticksPerUs = (strtoul(optarg, NULL, 0) > 0) ? strtoul(optarg, NULL, 0) : 1; break;
+			default:  return 2;
+		}
+	}
+	
+	if (optind < argc && (input = fopen(argv[optind], "rb")) == NULL)
+	{
+		perror(argv[optind]);
+		
+		return 2;
+	}
+	
+	while (fread(&record, sizeof(record), 1, input) == 1)
+	{
+		ticks += (records == 0) ? 0 : (uint32_t)(record.timestamp - last);/*the 32 bit timestamp wraps*/
+		last   = record.timestamp;
+		
+		records++;
+		
+		printf("%12.3f ms  ", (double)ticks / ticksPerUs / 1000.0);
+		
+		if (record.event < sizeof(eventNames) / sizeof(eventNames[0]) && record.event != 0)
+		{
+			printf("%-17s", eventNames[record.event]);
+		}
+		else
+		{
+			printf("EVENT %-11u", record.event);
+		}
+		
+		switch (record.event)
+		{
+			case TRACE_BLOCK_CORRECT:
+			case TRACE_BLOCK_WRONG:
+				printf(" block %u\n", record.arg);
+				break;
+			
+			case TRACE_RESPONSE_RECEIVED:
+			case TRACE_RESPONSE_TIMEOUT:
+			{
+				const char *literal = (elf != NULL) ? pcElfString(record.arg - base) : NULL;
+				
+				putchar(' ');
+				
+				if (literal != NULL)
+				{
+					vPrintLiteral(literal);
+				}
+				else
+				{
+					printf("0x%08X", record.arg);
+					
+					unresolved++;
+				}
+				
+				printf(" after %u ms\n", record.arg16);
+				break;
+			}
+			
+			default:
+				printf(" %u %u\n", record.arg16, record.arg);
+				break;
+		}
+	}
+	
+	printf("%u records, %u literals not resolved\n", records, unresolved);
+	
+	return 0;
+}